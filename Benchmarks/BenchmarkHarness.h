@@ -0,0 +1,249 @@
+﻿/*
+ * 基准测试公共代码
+ *
+ * 结果同时输出为表格和 JSON Lines（每行一个结果），
+ * 传入上一次的结果文件作为基线时，变慢超过容差的项目会使进程返回非零值。
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace PhotoBench
+{
+	/// <summary>
+	/// 命令行参数
+	/// </summary>
+	struct Options
+	{
+		// 结果文件（JSON Lines）
+		std::string json_path;
+		// 基线结果文件
+		std::string baseline_path;
+		// 允许的变慢比例
+		double tolerance{ .10 };
+		// 只运行名称包含该字符串的项目
+		std::string filter;
+		// 最大线程数，从 1 开始按 2 的倍数递增
+		size_t max_threads{ std::max<size_t>(std::thread::hardware_concurrency(), 1) };
+		// 每个项目最少运行的时间
+		double min_seconds{ .25 };
+		// 跳过超过该像素数（百万）的尺寸
+		double max_mpix{ 100 };
+		// 其余参数，由具体的基准测试解释
+		std::map<std::string, std::string> extra;
+	};
+
+	/// <summary>
+	/// 单个结果。name 在同一个基准程序中唯一，用于和基线对比
+	/// </summary>
+	struct Result
+	{
+		std::string name;
+		double median_ms{ 0 };
+		std::vector<std::pair<std::string, double>> metrics;
+	};
+
+	inline Options ParseOptions(int argc, char** argv)
+	{
+		Options options;
+
+		for (auto i = 1; i < argc; i++)
+		{
+			const std::string argument = argv[i];
+			const auto value = [&]() -> std::string
+			{
+				if (i + 1 >= argc)
+				{
+					std::cerr << "missing value for " << argument << "\n";
+					std::exit(2);
+				}
+				return argv[++i];
+			};
+
+			if (argument == "--json") options.json_path = value();
+			else if (argument == "--baseline") options.baseline_path = value();
+			else if (argument == "--tolerance") options.tolerance = std::stod(value());
+			else if (argument == "--filter") options.filter = value();
+			else if (argument == "--threads") options.max_threads = std::max<size_t>(std::stoul(value()), 1);
+			else if (argument == "--min-time") options.min_seconds = std::stod(value());
+			else if (argument == "--max-mpix") options.max_mpix = std::stod(value());
+			else if (argument.rfind("--", 0) == 0) options.extra[argument.substr(2)] = value();
+			else
+			{
+				std::cerr << "unknown argument " << argument << "\n";
+				std::exit(2);
+			}
+		}
+
+		return options;
+	}
+
+	/// <summary>
+	/// 1, 2, 4, ... 直到最大线程数（包含最大值本身）
+	/// </summary>
+	inline std::vector<size_t> ThreadCounts(Options const& options)
+	{
+		std::vector<size_t> counts;
+
+		for (size_t n = 1; n < options.max_threads; n *= 2)
+		{
+			counts.push_back(n);
+		}
+
+		counts.push_back(options.max_threads);
+		return counts;
+	}
+
+	/// <summary>
+	/// 反复运行直到累计时间超过 min_seconds 且至少 3 次，返回中位数（毫秒）
+	/// </summary>
+	inline double MeasureMedianMs(Options const& options, std::function<void()> const& body)
+	{
+		using clock = std::chrono::steady_clock;
+
+		// 预热一次
+		body();
+
+		std::vector<double> samples;
+		const auto deadline = clock::now() + std::chrono::duration<double>(options.min_seconds);
+
+		while (samples.size() < 3 || clock::now() < deadline)
+		{
+			const auto start = clock::now();
+			body();
+			samples.push_back(std::chrono::duration<double, std::milli>(clock::now() - start).count());
+		}
+
+		std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+		return samples[samples.size() / 2];
+	}
+
+	/// <summary>
+	/// 收集结果，输出表格、JSON Lines，并和基线对比
+	/// </summary>
+	class Reporter
+	{
+	public:
+		explicit Reporter(Options const& options) :
+			options_(options)
+		{
+		}
+
+		bool Selected(std::string const& name) const
+		{
+			return options_.filter.empty() || name.find(options_.filter) != std::string::npos;
+		}
+
+		void Add(Result result)
+		{
+			std::printf("%-64s %12.3f ms", result.name.c_str(), result.median_ms);
+
+			for (auto&& [key, value] : result.metrics)
+			{
+				std::printf("  %s=%.3f", key.c_str(), value);
+			}
+
+			std::printf("\n");
+			std::fflush(stdout);
+
+			results_.push_back(std::move(result));
+		}
+
+		/// <summary>
+		/// 写出结果文件并和基线对比
+		/// </summary>
+		/// <returns>进程返回值</returns>
+		int Finish() const
+		{
+			if (!options_.json_path.empty())
+			{
+				std::ofstream output(options_.json_path);
+
+				for (auto&& result : results_)
+				{
+					output << "{\"name\":\"" << result.name << "\",\"median_ms\":" << result.median_ms;
+
+					for (auto&& [key, value] : result.metrics)
+					{
+						output << ",\"" << key << "\":" << value;
+					}
+
+					output << "}\n";
+				}
+			}
+
+			return options_.baseline_path.empty() ? 0 : compare_with_baseline();
+		}
+
+	private:
+		int compare_with_baseline() const
+		{
+			std::ifstream input(options_.baseline_path);
+
+			if (!input)
+			{
+				std::cerr << "cannot open baseline " << options_.baseline_path << "\n";
+				return 2;
+			}
+
+			// 只需要 name 和 median_ms 两个字段
+			std::map<std::string, double> baseline;
+			std::string line;
+
+			while (std::getline(input, line))
+			{
+				const auto name_start = line.find("\"name\":\"");
+				const auto time_start = line.find("\"median_ms\":");
+
+				if (name_start == std::string::npos || time_start == std::string::npos)
+				{
+					continue;
+				}
+
+				const auto name_begin = name_start + 8;
+				const auto name = line.substr(name_begin, line.find('"', name_begin) - name_begin);
+				baseline[name] = std::strtod(line.c_str() + time_start + 12, nullptr);
+			}
+
+			auto regressions = 0;
+
+			for (auto&& result : results_)
+			{
+				const auto found = baseline.find(result.name);
+
+				if (found == baseline.end() || found->second <= 0)
+				{
+					continue;
+				}
+
+				const auto ratio = result.median_ms / found->second;
+
+				if (ratio > 1 + options_.tolerance)
+				{
+					std::printf("REGRESSION %-53s %8.3f ms -> %8.3f ms (%+.1f%%)\n",
+						result.name.c_str(), found->second, result.median_ms, (ratio - 1) * 100);
+					regressions++;
+				}
+			}
+
+			std::printf("%d regression(s) against %s\n", regressions, options_.baseline_path.c_str());
+			return regressions == 0 ? 0 : 1;
+		}
+
+		Options const& options_;
+		std::vector<Result> results_;
+	};
+}
@@ -0,0 +1,749 @@
+﻿/*
+ * 效果内核和效果链的基准测试
+ *
+ * 覆盖 DetailPage::PrepareSelectedEffects 能加入的每个效果，以及 CreateEffectsGraph 连接出的完整效果链，
+ * 尺寸从效果预览（188x88）到 1 亿像素，线程数从 1 到 --threads。
+ * chain/ 使用融合内核（相邻的逐像素效果一次遍历），generic/ 是同一效果链逐个效果遍历，
+ * fused_speedup 是 generic 和 chain 的耗时之比，passes 是遍历整幅图片的次数。
+ * 效果图缓存：
+ *   graph-cache/toggle    在六组效果之间来回切换 600 次并渲染预览尺寸，编译结果来自缓存，
+ *                         hit_rate 是缓存命中率，compile_us_per_toggle 是平均每次切换花在编译上的时间
+ *   graph-cache/uncached  同上，每次切换都重新编译
+ * 效果链化简：
+ *   optimizer/<组合>/defaults  1080p 上参数为默认值的效果链，removed 是化简去掉的效果数，
+ *                             speedup 是化简前后的耗时之比；全部去掉时只复制一次
+ * 融合内核：
+ *   fused/equality  两三个逐像素标签的各种组合，融合内核与逐个效果遍历的结果之差，max_difference 应当为 0
+ * 效果预览：
+ *   preview/separate  从 300x200 的略缩图分别渲染六个 188x88 的效果预览和 232x64 的按钮预览，每个预览各自缩小
+ *   preview/batched   同上，使用 PreviewRenderer：每个尺寸缩小一次，六个预览一次遍历
+ * 缓冲池：
+ *   pool/steady-state  1080p 上反复渲染包含模糊的完整效果链（相当于拖动滑块），
+ *                      allocations_per_frame 是预热之后每帧的堆申请次数，应当为 0
+ *   pool/borrow、heap/borrow  借出 12 MP 的像素缓冲区并逐页写入一个字节再归还，
+ *                      heap 每次直接向系统申请，包括缺页的开销；--arena-mb 指定时 pool 使用保留区域
+ *
+ * 用法：EffectBenchmarks [--json out.jsonl] [--baseline old.jsonl] [--tolerance 0.1]
+ *                         [--filter 名称] [--threads N] [--min-time 秒] [--max-mpix 百万像素] [--arena-mb N]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "BenchmarkHarness.h"
+#include "../PhotoEditor/Core/BufferPool.h"
+#include "../PhotoEditor/Core/EffectChain.h"
+#include "../PhotoEditor/Core/Effects.h"
+#include "../PhotoEditor/Core/PreviewRenderer.h"
+
+using namespace PhotoCore;
+
+namespace
+{
+	// 进程中所有 operator new 的次数，用于检查稳定状态下没有堆申请
+	std::atomic<uint64_t> heap_allocations{ 0 };
+
+	void* counted_allocate(size_t bytes, size_t alignment)
+	{
+		heap_allocations.fetch_add(1, std::memory_order_relaxed);
+		bytes = std::max<size_t>(bytes, 1);
+
+#ifdef _WIN32
+		auto* block = _aligned_malloc(bytes, alignment);
+#else
+		void* block = nullptr;
+
+		if (posix_memalign(&block, std::max(alignment, sizeof(void*)), bytes) != 0)
+		{
+			block = nullptr;
+		}
+#endif
+
+		if (!block)
+		{
+			throw std::bad_alloc();
+		}
+
+		return block;
+	}
+
+	void counted_free(void* block) noexcept
+	{
+#ifdef _WIN32
+		_aligned_free(block);
+#else
+		std::free(block);
+#endif
+	}
+}
+
+void* operator new(size_t bytes)
+{
+	return counted_allocate(bytes, alignof(std::max_align_t));
+}
+
+void* operator new(size_t bytes, std::align_val_t alignment)
+{
+	return counted_allocate(bytes, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* block) noexcept
+{
+	counted_free(block);
+}
+
+void operator delete(void* block, size_t) noexcept
+{
+	counted_free(block);
+}
+
+void operator delete(void* block, std::align_val_t) noexcept
+{
+	counted_free(block);
+}
+
+void operator delete(void* block, size_t, std::align_val_t) noexcept
+{
+	counted_free(block);
+}
+
+namespace
+{
+	struct ImageSize
+	{
+		char const* label;
+		uint32_t width;
+		uint32_t height;
+	};
+
+	// 效果预览、按钮预览、屏幕、常见相机和 1 亿像素
+	constexpr ImageSize image_sizes[]{
+		{ "preview", 188, 88 },
+		{ "button", 232, 64 },
+		{ "1080p", 1920, 1080 },
+		{ "12mp", 4000, 3000 },
+		{ "48mp", 8000, 6000 },
+		{ "100mp", 11552, 8672 },
+	};
+
+	/// <summary>
+	/// 不透明的伪随机渐变，避免全零输入被特殊优化
+	/// </summary>
+	void fill_test_image(ImageView const& image)
+	{
+		uint32_t state = 0x12345678;
+
+		for (uint32_t y = 0; y < image.height; y++)
+		{
+			auto row = image.Row(y);
+
+			for (uint32_t x = 0; x < image.width; x++, row += BytesPerPixel)
+			{
+				state = state * 1664525u + 1013904223u;
+				row[0] = static_cast<uint8_t>((x * 255 / image.width + (state >> 28)) & 0xff);
+				row[1] = static_cast<uint8_t>((y * 255 / image.height + (state >> 24)) & 0xff);
+				row[2] = static_cast<uint8_t>(((x + y) + (state >> 20)) & 0xff);
+				row[3] = 255;
+			}
+		}
+	}
+
+	struct NamedChain
+	{
+		std::string name;
+		EffectChain chain;
+		// 逐个效果遍历，不使用融合内核
+		bool unfused{ false };
+	};
+
+	/// <summary>
+	/// 单个效果，参数与 PrepareSelectedEffects 中按钮预览使用的值相同
+	/// </summary>
+	std::vector<NamedChain> single_effects()
+	{
+		const std::vector<Effect> effects{
+			SepiaEffect{ 1.f },
+			InvertEffect{},
+			GrayscaleEffect{},
+			GaussianBlurEffect{ 2.5f },
+			TemperatureAndTintEffect{ .25f, -.25f },
+			SaturationEffect{ .5f },
+			ContrastEffect{ .25f },
+			ExposureEffect{ -.25f },
+			CompositeEffect{},
+		};
+
+		std::vector<NamedChain> chains;
+
+		for (auto&& effect : effects)
+		{
+			chains.push_back({ std::string("effect/") + EffectName(effect), { effect } });
+		}
+
+		return chains;
+	}
+
+	/// <summary>
+	/// 常见的效果组合，按预览网格中的标签展开
+	/// </summary>
+	std::vector<NamedChain> effect_chains()
+	{
+		EffectParameters parameters{};
+		parameters.exposure = -.25f;
+		parameters.temperature = .25f;
+		parameters.tint = -.25f;
+		parameters.contrast = .25f;
+		parameters.saturation = .5f;
+		parameters.blur_amount = 2.5f;
+		parameters.intensity = 1.f;
+
+		return {
+			{ "chain/light", BuildEffectChain({ EffectTag::Light }, parameters) },
+			{ "chain/light+color", BuildEffectChain({ EffectTag::Light, EffectTag::Color }, parameters) },
+			{ "chain/sepia+grayscale+invert", BuildEffectChain({ EffectTag::Sepia, EffectTag::Grayscale, EffectTag::Invert }, parameters) },
+			{ "chain/all", BuildEffectChain({ EffectTag::Sepia, EffectTag::Invert, EffectTag::Grayscale, EffectTag::Blur, EffectTag::Color, EffectTag::Light }, parameters) },
+		};
+	}
+
+	size_t chain_length(std::vector<EffectTag> const& tags)
+	{
+		return BuildEffectChain(tags, EffectParameters{}).size();
+	}
+
+	/// <summary>
+	/// 构建效果链本身的开销
+	/// </summary>
+	void benchmark_chain_construction(PhotoBench::Options const& options, PhotoBench::Reporter& reporter)
+	{
+		const std::string name = "build/all-tags";
+
+		if (!reporter.Selected(name))
+		{
+			return;
+		}
+
+		const std::vector<EffectTag> tags{ EffectTag::Sepia, EffectTag::Invert, EffectTag::Grayscale, EffectTag::Blur, EffectTag::Color, EffectTag::Light };
+		constexpr auto repetitions = 10000;
+		size_t sink = 0;
+
+		const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+		{
+			for (auto i = 0; i < repetitions; i++)
+			{
+				sink += BuildEffectChain(tags, EffectParameters{}).size();
+			}
+		});
+
+		// 输出累加结果，防止构建被优化掉
+		reporter.Add({ name, median_ms, { { "ns_per_build", median_ms * 1e6 / repetitions }, { "effects", static_cast<double>(sink > 0 ? chain_length(tags) : 0) } } });
+	}
+
+	/// <summary>
+	/// 效果图缓存：在几组效果之间来回切换，每次切换都改变参数
+	/// </summary>
+	void benchmark_graph_cache(PhotoBench::Options const& options, PhotoBench::Reporter& reporter)
+	{
+		const std::vector<std::vector<EffectTag>> selections{
+			{ EffectTag::Light },
+			{ EffectTag::Light, EffectTag::Color },
+			{ EffectTag::Sepia },
+			{ EffectTag::Sepia, EffectTag::Blur },
+			{ EffectTag::Color, EffectTag::Light, EffectTag::Invert },
+			{ EffectTag::Grayscale },
+		};
+
+		constexpr uint32_t width = 188;
+		constexpr uint32_t height = 88;
+		constexpr size_t toggles = 600;
+
+		PixelBuffer source(width, height);
+		PixelBuffer destination(width, height);
+		fill_test_image(source.View());
+		ThreadPool pool(1);
+
+		const auto chain_at = [&](size_t toggle)
+		{
+			EffectParameters parameters{};
+			parameters.exposure = static_cast<float>(toggle % 7) / 7 - .5f;
+			parameters.saturation = static_cast<float>(toggle % 5) / 5;
+			parameters.blur_amount = 2.5f;
+			return BuildEffectChain(selections[toggle % selections.size()], parameters);
+		};
+
+		for (auto cached : { false, true })
+		{
+			const std::string name = cached ? "graph-cache/toggle" : "graph-cache/uncached";
+
+			if (!reporter.Selected(name))
+			{
+				continue;
+			}
+
+			EffectGraphCache<CompiledEffectChain> cache;
+			// 不使用缓存时自己计时，包括预热在内的所有切换
+			double compile_ms = 0;
+			uint64_t switches = 0;
+
+			const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				for (size_t toggle = 0; toggle < toggles; toggle++)
+				{
+					const auto chain = chain_at(toggle);
+
+					if (cached)
+					{
+						RenderEffectChain(cache.GetOrCompile(SignatureOf(chain), [&] { return CompileEffectChain(chain); }), chain, source.View(), destination.View(), pool);
+					}
+					else
+					{
+						const auto start = std::chrono::steady_clock::now();
+						const auto compiled = CompileEffectChain(chain);
+						compile_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+						switches++;
+						RenderEffectChain(compiled, chain, source.View(), destination.View(), pool);
+					}
+				}
+			});
+
+			const auto& stats = cache.Stats();
+
+			if (cached)
+			{
+				compile_ms = stats.compile_ms;
+				switches = stats.hits + stats.misses;
+			}
+
+			reporter.Add({ name, median_ms, {
+				{ "us_per_toggle", median_ms * 1000 / toggles },
+				{ "hit_rate", stats.HitRate() },
+				{ "compile_us_per_toggle", switches == 0 ? 0 : compile_ms * 1000 / switches },
+			} });
+		}
+	}
+
+	/// <summary>
+	/// 效果链化简：参数恢复默认值后，选中的效果大多不再起作用
+	/// </summary>
+	void benchmark_chain_optimizer(PhotoBench::Options const& options, PhotoBench::Reporter& reporter)
+	{
+		const std::vector<std::pair<std::string, std::vector<EffectTag>>> selections{
+			{ "light+color", { EffectTag::Light, EffectTag::Color } },
+			{ "grayscale+color", { EffectTag::Grayscale, EffectTag::Color } },
+			{ "all", { EffectTag::Sepia, EffectTag::Invert, EffectTag::Grayscale, EffectTag::Blur, EffectTag::Color, EffectTag::Light } },
+		};
+
+		PixelBuffer source(1920, 1080);
+		PixelBuffer destination(1920, 1080);
+		fill_test_image(source.View());
+		ThreadPool pool(1);
+
+		for (auto&& [selection, tags] : selections)
+		{
+			const auto name = "optimizer/" + selection + "/defaults";
+
+			if (!reporter.Selected(name))
+			{
+				continue;
+			}
+
+			// 颜色的饱和度不是默认值时，灰度之后的饱和度仍然可以去掉
+			EffectParameters parameters{};
+			parameters.saturation = selection == "grayscale+color" ? .5f : 1.f;
+
+			const auto chain = BuildEffectChain(tags, parameters);
+			size_t removed = 0;
+			const auto optimized = OptimizeEffectChain(chain, removed);
+			const auto compiled = CompileEffectChain(chain);
+			const auto compiled_optimized = CompileEffectChain(optimized);
+
+			const auto original_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				RenderEffectChain(compiled, chain, source.View(), destination.View(), pool);
+			});
+
+			const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				RenderEffectChain(compiled_optimized, optimized, source.View(), destination.View(), pool);
+			});
+
+			reporter.Add({ name, median_ms, {
+				{ "removed", static_cast<double>(removed) },
+				{ "passes", BytesMovedPerPixel(optimized) / (2.0 * BytesPerPixel) },
+				{ "speedup", original_ms / median_ms },
+			} });
+		}
+	}
+
+	/// <summary>
+	/// 融合内核与逐个效果遍历的结果之差：任意两三个逐像素标签的组合，参数取较大的值，
+	/// 另外加上同一个效果连续出现的效果链。不透明和半透明的图片各检查一次
+	/// </summary>
+	void benchmark_fused_equality(PhotoBench::Options const& options, PhotoBench::Reporter& reporter)
+	{
+		const std::string name = "fused/equality";
+
+		if (!reporter.Selected(name))
+		{
+			return;
+		}
+
+		const std::vector<EffectTag> tags{ EffectTag::Light, EffectTag::Color, EffectTag::Sepia, EffectTag::Grayscale, EffectTag::Invert };
+		std::vector<EffectParameters> parameter_sets(2);
+		parameter_sets[0].contrast = .4f;
+		parameter_sets[0].exposure = -.7f;
+		parameter_sets[0].temperature = .8f;
+		parameter_sets[0].tint = -.6f;
+		parameter_sets[0].saturation = 1.8f;
+		parameter_sets[0].intensity = 1.f;
+		parameter_sets[1].contrast = -.5f;
+		parameter_sets[1].exposure = 1.f;
+		parameter_sets[1].temperature = -.5f;
+		parameter_sets[1].tint = .7f;
+		parameter_sets[1].saturation = 0.f;
+		parameter_sets[1].intensity = .6f;
+
+		std::vector<EffectChain> chains{
+			{ SepiaEffect{ 1.f }, SepiaEffect{ 1.f } },
+			{ ExposureEffect{ 1.5f }, ContrastEffect{ .8f }, ExposureEffect{ -1.5f } },
+		};
+
+		for (auto&& parameters : parameter_sets)
+		{
+			for (auto first : tags)
+			{
+				for (auto second : tags)
+				{
+					if (second == first)
+					{
+						continue;
+					}
+
+					chains.push_back(BuildEffectChain({ first, second }, parameters));
+
+					for (auto third : tags)
+					{
+						if (third != first && third != second)
+						{
+							chains.push_back(BuildEffectChain({ first, second, third }, parameters));
+						}
+					}
+				}
+			}
+		}
+
+		// 半透明的图片颜色按 alpha 预乘
+		PixelBuffer opaque(300, 200);
+		PixelBuffer translucent(300, 200);
+		fill_test_image(opaque.View());
+		CopyPixels(opaque.View(), translucent.View());
+
+		for (uint32_t y = 0; y < translucent.Height(); y++)
+		{
+			auto row = translucent.View().Row(y);
+
+			for (uint32_t x = 0; x < translucent.Width(); x++, row += BytesPerPixel)
+			{
+				const auto alpha = static_cast<uint8_t>((x * 7 + y * 3) & 0xff);
+
+				for (auto channel = 0; channel < 3; channel++)
+				{
+					row[channel] = static_cast<uint8_t>(row[channel] * alpha / 255);
+				}
+
+				row[3] = alpha;
+			}
+		}
+
+		PixelBuffer fused(300, 200);
+		PixelBuffer unfused(300, 200);
+		ThreadPool pool(1);
+		int max_difference = 0;
+
+		const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+		{
+			for (auto source : { opaque.View(), translucent.View() })
+			{
+				for (auto&& chain : chains)
+				{
+					RenderEffectChain(chain, source, fused.View(), pool);
+					RenderEffectChainUnfused(chain, source, unfused.View(), pool);
+
+					for (uint32_t y = 0; y < source.height; y++)
+					{
+						const auto a = fused.View().Row(y);
+						const auto b = unfused.View().Row(y);
+
+						for (uint32_t x = 0; x < source.width * BytesPerPixel; x++)
+						{
+							max_difference = std::max(max_difference, std::abs(a[x] - b[x]));
+						}
+					}
+				}
+			}
+		});
+
+		reporter.Add({ name, median_ms, {
+			{ "chains", static_cast<double>(chains.size()) },
+			{ "max_difference", static_cast<double>(max_difference) },
+		} });
+	}
+
+	/// <summary>
+	/// 打开照片时的六个效果预览和应用按钮上的预览
+	/// </summary>
+	void benchmark_previews(PhotoBench::Options const& options, PhotoBench::Reporter& reporter)
+	{
+		const std::vector<EffectTag> tags{ EffectTag::Color, EffectTag::Light, EffectTag::Blur, EffectTag::Sepia, EffectTag::Grayscale, EffectTag::Invert };
+
+		// 与 ImageLoader 的略缩图尺寸相同
+		PixelBuffer thumbnail(300, 200);
+		fill_test_image(thumbnail.View());
+		ThreadPool pool(1);
+
+		std::vector<PixelBuffer> tiles;
+		std::vector<ImageView> views;
+		std::vector<Effect> effects;
+
+		for (auto tag : tags)
+		{
+			views.push_back(tiles.emplace_back(PreviewTileWidth, PreviewTileHeight).View());
+			effects.push_back(PreviewTileEffect(tag));
+		}
+
+		PixelBuffer button(ButtonPreviewWidth, ButtonPreviewHeight);
+		const auto chain = BuildEffectChain({ EffectTag::Light, EffectTag::Color }, EffectParameters{});
+		const auto compiled = CompileEffectChain(chain);
+
+		if (reporter.Selected("preview/separate"))
+		{
+			// 每个预览各自缩小略缩图、各自遍历
+			const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				for (size_t i = 0; i < tags.size(); i++)
+				{
+					PixelBuffer base(PreviewTileWidth, PreviewTileHeight, BufferPool::Shared());
+					ResampleToFill(thumbnail.View(), base.View());
+					ApplyEffect(effects[i], base.View(), views[i], pool);
+				}
+
+				PixelBuffer base(ButtonPreviewWidth, ButtonPreviewHeight, BufferPool::Shared());
+				ResampleToFill(thumbnail.View(), base.View());
+				RenderEffectChain(compiled, chain, base.View(), button.View(), pool);
+			});
+
+			reporter.Add({ "preview/separate", median_ms, { { "resamples", static_cast<double>(tags.size() + 1) } } });
+		}
+
+		if (reporter.Selected("preview/batched"))
+		{
+			size_t resamples = 0;
+
+			const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				PreviewRenderer renderer(thumbnail.View());
+				renderer.RenderTiles(effects.data(), views.data(), views.size(), pool);
+				renderer.RenderChain(compiled, chain, button.View(), pool);
+				resamples = renderer.ResampleCount();
+			});
+
+			reporter.Add({ "preview/batched", median_ms, { { "resamples", static_cast<double>(resamples) } } });
+		}
+	}
+
+	/// <summary>
+	/// 缓冲池：交互编辑的稳定状态和单次借出的开销
+	/// </summary>
+	void benchmark_buffer_pool(PhotoBench::Options const& options, PhotoBench::Reporter& reporter)
+	{
+		if (reporter.Selected("pool/steady-state"))
+		{
+			EffectParameters parameters{};
+			parameters.blur_amount = 2.5f;
+			parameters.exposure = -.25f;
+			const auto chain = BuildEffectChain({ EffectTag::Blur, EffectTag::Light }, parameters);
+			// 拖动滑块只改变参数，编译结果来自效果图缓存
+			const auto compiled = CompileEffectChain(chain);
+
+			PixelBuffer source(1920, 1080);
+			PixelBuffer destination(1920, 1080);
+			fill_test_image(source.View());
+			ThreadPool pool(options.max_threads);
+
+			const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				RenderEffectChain(compiled, chain, source.View(), destination.View(), pool);
+			});
+
+			// 测量循环本身会申请内存，另外渲染若干帧计数
+			constexpr uint64_t frames = 20;
+			const auto before = heap_allocations.load();
+
+			for (uint64_t frame = 0; frame < frames; frame++)
+			{
+				RenderEffectChain(compiled, chain, source.View(), destination.View(), pool);
+			}
+
+			const auto allocations = heap_allocations.load() - before;
+			const auto stats = BufferPool::Shared().Stats();
+
+			reporter.Add({ "pool/steady-state", median_ms, {
+				{ "allocations_per_frame", static_cast<double>(allocations) / frames },
+				{ "reserved_mb", stats.reserved_bytes / 1048576.0 },
+				{ "high_water_mb", stats.high_water_bytes / 1048576.0 },
+				{ "in_use_mb", stats.in_use_bytes / 1048576.0 },
+			} });
+		}
+
+		constexpr uint32_t width = 4000;
+		constexpr uint32_t height = 3000;
+		constexpr size_t page_bytes = 4096;
+
+		// 逐页写入，让系统真正提交内存
+		const auto touch = [](ImageView const& view)
+		{
+			const auto bytes = view.stride * view.height;
+
+			for (size_t offset = 0; offset < bytes; offset += page_bytes)
+			{
+				view.pixels[offset] = static_cast<uint8_t>(offset);
+			}
+		};
+
+		if (reporter.Selected("pool/borrow"))
+		{
+			BufferPoolOptions pool_options;
+			pool_options.arena_bytes = std::stoul(options.extra.count("arena-mb") ? options.extra.at("arena-mb") : "0") << 20;
+			BufferPool buffers(pool_options);
+
+			const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				PixelBuffer buffer(width, height, buffers);
+				touch(buffer.View());
+			});
+
+			const auto stats = buffers.Stats();
+
+			reporter.Add({ "pool/borrow", median_ms, {
+				{ "system_allocations", static_cast<double>(stats.system_allocations) },
+				{ "reuses", static_cast<double>(stats.reuses) },
+				{ "arena_mb", stats.arena_bytes / 1048576.0 },
+				{ "huge_pages", stats.huge_pages ? 1.0 : 0.0 },
+			} });
+		}
+
+		if (reporter.Selected("heap/borrow"))
+		{
+			const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				PixelBuffer buffer(width, height);
+				touch(buffer.View());
+			});
+
+			reporter.Add({ "heap/borrow", median_ms, {} });
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const auto options = PhotoBench::ParseOptions(argc, argv);
+	PhotoBench::Reporter reporter(options);
+
+	benchmark_chain_construction(options, reporter);
+	benchmark_graph_cache(options, reporter);
+	benchmark_previews(options, reporter);
+	benchmark_chain_optimizer(options, reporter);
+	benchmark_fused_equality(options, reporter);
+	benchmark_buffer_pool(options, reporter);
+
+	auto chains = single_effects();
+	for (auto&& chain : effect_chains())
+	{
+		chains.push_back({ "generic" + chain.name.substr(chain.name.find('/')), chain.chain, true });
+		chains.push_back(std::move(chain));
+	}
+
+	for (auto&& size : image_sizes)
+	{
+		const auto mpix = static_cast<double>(size.width) * size.height / 1e6;
+
+		if (mpix > options.max_mpix)
+		{
+			continue;
+		}
+
+		PixelBuffer source(size.width, size.height);
+		PixelBuffer destination(size.width, size.height);
+		fill_test_image(source.View());
+
+		// 单线程耗时，用于计算加速比；逐个效果遍历的耗时，用于计算融合的加速比
+		std::map<std::string, double> single_thread_ms;
+		std::map<std::string, double> unfused_ms;
+
+		for (auto threads : PhotoBench::ThreadCounts(options))
+		{
+			ThreadPool pool(threads);
+
+			for (auto&& [chain_name, chain, unfused] : chains)
+			{
+				const auto key = chain_name + "/" + std::to_string(size.width) + "x" + std::to_string(size.height);
+				const auto name = key + "/t" + std::to_string(threads);
+
+				if (!reporter.Selected(name))
+				{
+					continue;
+				}
+
+				const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+				{
+					if (unfused)
+					{
+						RenderEffectChainUnfused(chain, source.View(), destination.View(), pool);
+					}
+					else
+					{
+						RenderEffectChain(chain, source.View(), destination.View(), pool);
+					}
+				});
+
+				if (threads == 1)
+				{
+					single_thread_ms[key] = median_ms;
+				}
+
+				if (unfused)
+				{
+					unfused_ms[name] = median_ms;
+				}
+
+				const auto bytes_per_pixel = unfused ? UnfusedBytesMovedPerPixel(chain) : BytesMovedPerPixel(chain);
+				const auto found = single_thread_ms.find(key);
+				std::vector<std::pair<std::string, double>> metrics{
+					{ "mpix_per_s", mpix / (median_ms / 1000) },
+					{ "bytes_per_pixel", bytes_per_pixel },
+					{ "gb_per_s", mpix * 1e6 * bytes_per_pixel / (median_ms / 1000) / 1e9 },
+					{ "speedup", found == single_thread_ms.end() ? 0 : found->second / median_ms },
+					{ "passes", bytes_per_pixel / (2.0 * BytesPerPixel) },
+				};
+
+				// generic 在 chain 之前测量
+				if (const auto generic = unfused_ms.find("generic" + name.substr(name.find('/'))); !unfused && generic != unfused_ms.end())
+				{
+					metrics.emplace_back("fused_speedup", generic->second / median_ms);
+				}
+
+				reporter.Add({ name, median_ms, std::move(metrics) });
+			}
+		}
+	}
+
+	return reporter.Finish();
+}
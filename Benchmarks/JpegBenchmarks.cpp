@@ -0,0 +1,568 @@
+﻿/*
+ * JPEG 缩小解码的基准测试
+ *
+ * 用 EncodeJpeg 生成基线和渐进式的测试图片，测量在 DCT 域缩小到 1/1、1/2、1/4、1/8 时的解码速度：
+ *   jpeg/decode/<基线|渐进式>/<尺寸>/1:<比例>
+ *   jpeg/decode/successive/<尺寸>/1:<比例>  同一图片按 libjpeg 的渐进式脚本加上逐次逼近编码后缩小解码，
+ *                 exact 表示与只用频谱选择的渐进式图片解码结果完全相同（量化系数相同），
+ *                 exact_libjpeg 是用 libjpeg 解码两张图片的同样比较
+ *   jpeg/encode/<基线|渐进式>/<尺寸>
+ *   jpeg/encode/parallel/<尺寸>  基线图片在线程池上编码，每行 MCU 一个重启间隔
+ *   jpeg/thumbnail/<embedded|scaled>/<尺寸>  加载 300x200 的略缩图：使用 EXIF 内嵌的略缩图，或者没有内嵌略缩图时缩小解码
+ *   jpeg/rotate/<reencode|lossless>/<尺寸>  带 EXIF 的基线图片顺时针旋转 90 度：解码、旋转像素再编码，或者在 DCT 域无损旋转
+ *   jpeg/rotate/passthrough/<尺寸>  没有编辑时直接复制文件内容
+ *   jpeg/export/<separate|batched|largest>/<尺寸>  导出编辑后的原尺寸、长边 2048 和 400 三个文件：
+ *                 每个文件各自渲染、缩小、编码，或者用 RenderExports 渲染一次、级联缩小、同时编码；
+ *                 largest 只导出原尺寸一个文件，vs_largest 是 batched 与它的耗时之比
+ * mpix_per_s 按原图像素数计算，memory_bytes 是解码时分配的系数、采样平面和输出像素的字节数，
+ * bytes_read 是加载略缩图时从文件读取的字节数。generation_error 是旋转四次回到原方向后与原图解码的最大通道差，
+ * exif_consistent 表示 EXIF 与旋转后的像素一致：方向为 1，内嵌略缩图与主图片的横竖相同。speedup 是单线程基线编码与并行编码的耗时之比，
+ * exact 表示并行编码的图片解码后与单线程编码的图片完全相同。exact_libjpeg 是用 libjpeg 解码的同样比较，
+ * 还要求 libjpeg 没有警告（例如重启标记错位），只在构建时找到 libjpeg 才输出。
+ *
+ * 用法：JpegBenchmarks [公共参数] [--quality N] [--save 目录]
+ * 指定 --save 时把生成的测试图片写到该目录下，便于用其他解码器对比。
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "BenchmarkHarness.h"
+#include "../PhotoEditor/Core/ExportJob.h"
+#include "../PhotoEditor/Core/JpegDecoder.h"
+#include "../PhotoEditor/Core/JpegEncoder.h"
+#include "../PhotoEditor/Core/JpegThumbnail.h"
+#include "../PhotoEditor/Core/JpegTransform.h"
+#include "../PhotoEditor/Core/PreviewRenderer.h"
+
+#ifdef PHOTOEDITOR_LIBJPEG
+#include <csetjmp>
+#include <jpeglib.h>
+#endif
+
+using namespace PhotoCore;
+
+namespace
+{
+	struct ImageSize
+	{
+		char const* label;
+		uint32_t width;
+		uint32_t height;
+	};
+
+	// 屏幕、常见相机和高像素相机
+	constexpr ImageSize image_sizes[]{
+		{ "1080p", 1920, 1080 },
+		{ "12mp", 4000, 3000 },
+		{ "24mp", 6000, 4000 },
+		{ "48mp", 8000, 6000 },
+	};
+
+	constexpr uint32_t scales[]{ 1, 2, 4, 8 };
+
+	// 主页面网格项的大小
+	constexpr uint32_t thumbnail_width = 300;
+	constexpr uint32_t thumbnail_height = 200;
+
+	std::string extra(PhotoBench::Options const& options, std::string const& key, std::string const& fallback)
+	{
+		const auto found = options.extra.find(key);
+		return found == options.extra.end() ? fallback : found->second;
+	}
+
+	/// <summary>
+	/// 在 SOI 之后插入带内嵌略缩图的 EXIF 段，略缩图是原图的 1/8，与相机的做法相近
+	/// </summary>
+	std::vector<uint8_t> with_exif_thumbnail(std::vector<uint8_t> const& jpeg)
+	{
+		const auto preview = DecodeJpeg(jpeg.data(), jpeg.size(), 8);
+		JpegEncodeOptions options;
+		options.quality = 75;
+
+		const auto segment = BuildExifSegment(1, EncodeJpeg(preview.View(), options));
+
+		std::vector<uint8_t> result(jpeg.size() + segment.size());
+		auto output = std::copy(jpeg.begin(), jpeg.begin() + 2, result.begin());
+		output = std::copy(segment.begin(), segment.end(), output);
+		std::copy(jpeg.begin() + 2, jpeg.end(), output);
+		return result;
+	}
+
+	ReadAtFunction read_from(std::vector<uint8_t> const& file)
+	{
+		return [&file](uint64_t offset, uint8_t* buffer, size_t size)
+		{
+			if (offset >= file.size())
+			{
+				return size_t{ 0 };
+			}
+
+			const auto count = std::min<size_t>(size, static_cast<size_t>(file.size() - offset));
+			std::memcpy(buffer, file.data() + offset, count);
+			return count;
+		};
+	}
+
+	/// <summary>
+	/// EXIF 是否与主图片一致：方向为 1（像素已经是正向），有内嵌略缩图时略缩图与主图片的横竖相同
+	/// </summary>
+	bool exif_consistent(std::vector<uint8_t> const& file)
+	{
+		ExifInfo info;
+
+		if (!ReadJpegExif(read_from(file), info) || info.orientation != 1)
+		{
+			return false;
+		}
+
+		if (info.thumbnail_size == 0)
+		{
+			return true;
+		}
+
+		const auto image = DecodeJpeg(file.data(), file.size(), 8);
+		const auto thumbnail = DecodeJpeg(file.data() + info.thumbnail_offset, info.thumbnail_size);
+		return (image.Width() >= image.Height()) == (thumbnail.Width() >= thumbnail.Height());
+	}
+
+	/// <summary>
+	/// 两张图片的最大通道差，尺寸不同时返回 255
+	/// </summary>
+	int max_error(ImageView const& a, ImageView const& b)
+	{
+		if (a.width != b.width || a.height != b.height)
+		{
+			return 255;
+		}
+
+		auto error = 0;
+
+		for (uint32_t y = 0; y < a.height; y++)
+		{
+			for (size_t i = 0; i < a.width * BytesPerPixel; i++)
+			{
+				error = std::max(error, std::abs(a.Row(y)[i] - b.Row(y)[i]));
+			}
+		}
+
+		return error;
+	}
+
+#ifdef PHOTOEDITOR_LIBJPEG
+	/// <summary>
+	/// libjpeg 出错时跳回 decode_with_libjpeg，不退出进程
+	/// </summary>
+	struct libjpeg_error
+	{
+		jpeg_error_mgr manager;
+		std::jmp_buf jump;
+	};
+
+	/// <summary>
+	/// 用 libjpeg 解码为 RGB，作为与核心解码器无关的对照
+	/// </summary>
+	/// <returns>是否解码成功并且没有警告</returns>
+	bool decode_with_libjpeg(std::vector<uint8_t> const& file, std::vector<uint8_t>& pixels)
+	{
+		jpeg_decompress_struct decompress{};
+		libjpeg_error error{};
+		decompress.err = jpeg_std_error(&error.manager);
+		error.manager.error_exit = [](j_common_ptr common)
+		{
+			std::longjmp(reinterpret_cast<libjpeg_error*>(common->err)->jump, 1);
+		};
+
+		if (setjmp(error.jump) != 0)
+		{
+			jpeg_destroy_decompress(&decompress);
+			return false;
+		}
+
+		jpeg_create_decompress(&decompress);
+		jpeg_mem_src(&decompress, const_cast<unsigned char*>(file.data()), static_cast<unsigned long>(file.size()));
+		jpeg_read_header(&decompress, TRUE);
+		decompress.out_color_space = JCS_RGB;
+		jpeg_start_decompress(&decompress);
+
+		const auto row_bytes = static_cast<size_t>(decompress.output_width) * decompress.output_components;
+		pixels.resize(row_bytes * decompress.output_height);
+
+		while (decompress.output_scanline < decompress.output_height)
+		{
+			auto row = pixels.data() + row_bytes * decompress.output_scanline;
+			jpeg_read_scanlines(&decompress, &row, 1);
+		}
+
+		jpeg_finish_decompress(&decompress);
+		jpeg_destroy_decompress(&decompress);
+		return error.manager.num_warnings == 0;
+	}
+
+	/// <summary>
+	/// 两个文件用 libjpeg 解码的结果是否完全相同
+	/// </summary>
+	bool same_with_libjpeg(std::vector<uint8_t> const& a, std::vector<uint8_t> const& b)
+	{
+		std::vector<uint8_t> pixels_a;
+		std::vector<uint8_t> pixels_b;
+		return decode_with_libjpeg(a, pixels_a) && decode_with_libjpeg(b, pixels_b) && pixels_a == pixels_b;
+	}
+#endif
+
+	/// <summary>
+	/// 接近照片的内容：平滑的渐变和色块，加上少量噪声，压缩率与相机照片相近
+	/// </summary>
+	void fill_test_image(ImageView const& image)
+	{
+		uint32_t state = 0x12345678;
+
+		for (uint32_t y = 0; y < image.height; y++)
+		{
+			auto row = image.Row(y);
+			const auto fy = static_cast<float>(y) / image.height;
+
+			for (uint32_t x = 0; x < image.width; x++, row += BytesPerPixel)
+			{
+				const auto fx = static_cast<float>(x) / image.width;
+				state = state * 1664525u + 1013904223u;
+				const auto noise = static_cast<int>(state >> 29) - 4;
+
+				const auto wave = std::sin(fx * 23.f + std::cos(fy * 17.f) * 3.f) * 40.f;
+				const auto b = 90.f + 120.f * fy + wave;
+				const auto g = 60.f + 100.f * fx - wave * .5f;
+				const auto r = 180.f - 80.f * fx * fy + wave * .75f;
+
+				row[0] = static_cast<uint8_t>(std::clamp(static_cast<int>(b) + noise, 0, 255));
+				row[1] = static_cast<uint8_t>(std::clamp(static_cast<int>(g) + noise, 0, 255));
+				row[2] = static_cast<uint8_t>(std::clamp(static_cast<int>(r) + noise, 0, 255));
+				row[3] = 255;
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const auto options = PhotoBench::ParseOptions(argc, argv);
+	PhotoBench::Reporter reporter(options);
+
+	const auto quality = std::stoi(extra(options, "quality", "90"));
+	const auto save = extra(options, "save", "");
+
+	ThreadPool pool(options.max_threads);
+
+	// 导出：原尺寸、网页版和略缩图，效果为亮度和颜色
+	std::vector<ExportTarget> export_targets(3);
+	export_targets[0].options.quality = quality;
+	export_targets[1].max_long_edge = 2048;
+	export_targets[1].options.quality = 85;
+	export_targets[2].max_long_edge = 400;
+	export_targets[2].options.quality = 80;
+
+	EffectParameters export_parameters;
+	export_parameters.exposure = .3f;
+	export_parameters.contrast = .2f;
+	export_parameters.temperature = .1f;
+	export_parameters.saturation = 1.2f;
+	const auto export_chain = BuildEffectChain({ EffectTag::Light, EffectTag::Color }, export_parameters);
+
+	for (auto&& size : image_sizes)
+	{
+		const auto mpix = static_cast<double>(size.width) * size.height / 1e6;
+
+		if (mpix > options.max_mpix)
+		{
+			continue;
+		}
+
+		PixelBuffer source(size.width, size.height);
+		fill_test_image(source.View());
+
+		double largest_ms = 0;
+
+		for (auto method : { "largest", "separate", "batched" })
+		{
+			const auto name = std::string("jpeg/export/") + method + "/" + size.label;
+
+			if (!reporter.Selected(name))
+			{
+				continue;
+			}
+
+			ExportStats stats;
+			size_t bytes = 0;
+			const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				bytes = 0;
+
+				if (std::string(method) == "separate")
+				{
+					// 每个文件都从原图开始：渲染、缩小、编码
+					for (auto&& target : export_targets)
+					{
+						PixelBuffer rendered(size.width, size.height, BufferPool::Shared());
+						RenderEffectChain(export_chain, source.View(), rendered.View(), pool);
+
+						uint32_t width = 0;
+						uint32_t height = 0;
+						FitLongEdge(size.width, size.height, target.max_long_edge, width, height);
+
+						PixelBuffer resized(width, height, BufferPool::Shared());
+						ResampleToFill(rendered.View(), resized.View(), pool);
+						bytes += EncodeJpeg(resized.View(), target.options).size();
+					}
+				}
+				else
+				{
+					const auto outputs = RenderExports(source.View(), export_chain, std::string(method) == "largest" ? std::vector<ExportTarget>{ export_targets[0] } : export_targets, pool, BufferPool::Shared(), &stats);
+
+					for (auto&& output : outputs)
+					{
+						bytes += output.bytes.size();
+					}
+				}
+			});
+
+			if (std::string(method) == "largest")
+			{
+				largest_ms = median_ms;
+			}
+
+			PhotoBench::Result result{ name, median_ms, {
+				{ "mpix_per_s", mpix / (median_ms / 1000) },
+				{ "bytes", static_cast<double>(bytes) },
+			} };
+
+			if (std::string(method) == "batched")
+			{
+				result.metrics.push_back({ "resampled_mpix", stats.resampled_pixels / 1e6 });
+				result.metrics.push_back({ "encode_ms", stats.encode_ms });
+
+				if (largest_ms > 0)
+				{
+					result.metrics.push_back({ "vs_largest", median_ms / largest_ms });
+				}
+			}
+
+			reporter.Add(result);
+		}
+
+		for (auto progressive : { false, true })
+		{
+			const std::string mode = progressive ? "progressive" : "baseline";
+			const auto prefix = mode + "/" + size.label;
+
+			JpegEncodeOptions encode_options;
+			encode_options.quality = quality;
+			encode_options.progressive = progressive;
+
+			const auto encoded = EncodeJpeg(source.View(), encode_options);
+
+			if (!save.empty())
+			{
+				std::filesystem::create_directories(std::filesystem::u8path(save));
+				std::ofstream(std::filesystem::u8path(save) / (mode + "-" + size.label + ".jpg"), std::ios::binary)
+					.write(reinterpret_cast<char const*>(encoded.data()), static_cast<std::streamsize>(encoded.size()));
+			}
+
+			double encode_ms = 0;
+
+			if (reporter.Selected("jpeg/encode/" + prefix))
+			{
+				encode_ms = PhotoBench::MeasureMedianMs(options, [&]
+				{
+					EncodeJpeg(source.View(), encode_options);
+				});
+
+				reporter.Add({ "jpeg/encode/" + prefix, encode_ms, {
+					{ "mpix_per_s", mpix / (encode_ms / 1000) },
+					{ "bytes", static_cast<double>(encoded.size()) },
+				} });
+			}
+
+			if (!progressive && reporter.Selected(std::string("jpeg/encode/parallel/") + size.label))
+			{
+				std::vector<uint8_t> parallel_encoded;
+				const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+				{
+					parallel_encoded = EncodeJpeg(source.View(), encode_options, pool);
+				});
+
+				// 重启间隔只改变熵编码的分段，系数相同，解码结果应当完全相同
+				const auto serial = DecodeJpeg(encoded.data(), encoded.size(), 1);
+				const auto parallel = DecodeJpeg(parallel_encoded.data(), parallel_encoded.size(), 1);
+
+				PhotoBench::Result result{ std::string("jpeg/encode/parallel/") + size.label, median_ms, {
+					{ "mpix_per_s", mpix / (median_ms / 1000) },
+					{ "bytes", static_cast<double>(parallel_encoded.size()) },
+					{ "exact", max_error(serial.View(), parallel.View()) == 0 ? 1.0 : 0.0 },
+				} };
+
+#ifdef PHOTOEDITOR_LIBJPEG
+				result.metrics.push_back({ "exact_libjpeg", same_with_libjpeg(encoded, parallel_encoded) ? 1.0 : 0.0 });
+#endif
+
+				if (encode_ms > 0)
+				{
+					result.metrics.push_back({ "speedup", encode_ms / median_ms });
+				}
+
+				reporter.Add(result);
+			}
+
+			// 略缩图只对基线图片测一次，内嵌略缩图与原图的编码方式无关
+			for (auto embedded : { true, false })
+			{
+				const auto name = std::string("jpeg/thumbnail/") + (embedded ? "embedded/" : "scaled/") + size.label;
+
+				if (progressive || !reporter.Selected(name))
+				{
+					continue;
+				}
+
+				const auto file = embedded ? with_exif_thumbnail(encoded) : encoded;
+				JpegThumbnailStats stats;
+				const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+				{
+					LoadJpegThumbnail(read_from(file), file.size(), thumbnail_width, thumbnail_height, &stats);
+				});
+
+				reporter.Add({ name, median_ms, {
+					{ "bytes_read", static_cast<double>(stats.bytes_read) },
+					{ "file_bytes", static_cast<double>(file.size()) },
+				} });
+			}
+
+			// 旋转也只测基线图片，渐进式图片的无损旋转输出为基线格式
+			for (auto method : { "reencode", "lossless", "passthrough" })
+			{
+				const auto name = std::string("jpeg/rotate/") + method + "/" + size.label;
+
+				if (progressive || !reporter.Selected(name))
+				{
+					continue;
+				}
+
+				const auto file = with_exif_thumbnail(encoded);
+				const auto exif_size = 2 + (static_cast<size_t>(file[4]) << 8 | file[5]);
+				const auto passthrough = std::string(method) == "passthrough";
+
+				JpegTransformOptions transform;
+				transform.transform = passthrough ? JpegTransform::None : JpegTransform::Rotate90;
+
+				const auto rotate = [&](std::vector<uint8_t> const& input)
+				{
+					if (std::string(method) != "reencode")
+					{
+						return TransformJpeg(input.data(), input.size(), transform);
+					}
+
+					// 与无损旋转一样裁掉下边不完整的 MCU，两者的尺寸相同
+					const auto mcu = encode_options.subsampling == JpegSubsampling::Yuv420 ? 16u : 8u;
+					const auto pixels = DecodeJpeg(input.data(), input.size());
+					const auto rotated = ApplyExifOrientation(pixels.View().Crop(0, 0, pixels.Width(), pixels.Height() / mcu * mcu), 6);
+					const auto body = EncodeJpeg(rotated.View(), encode_options);
+
+					// SOI 之后保留原来的 EXIF 段，略缩图仍是旋转前的方向
+					std::vector<uint8_t> output(file.begin(), file.begin() + 2 + exif_size);
+					output.insert(output.end(), body.begin() + 2, body.end());
+					return output;
+				};
+
+				std::vector<uint8_t> output;
+				const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+				{
+					output = rotate(file);
+				});
+
+				// 旋转四次回到原来的方向，与原图比较得到代际损失
+				auto generation = output;
+
+				for (auto i = 1; i < 4; i++)
+				{
+					generation = rotate(generation);
+				}
+
+				const auto original = DecodeJpeg(file.data(), file.size());
+				const auto result = DecodeJpeg(generation.data(), generation.size());
+
+				reporter.Add({ name, median_ms, {
+					{ "mpix_per_s", mpix / (median_ms / 1000) },
+					{ "bytes", static_cast<double>(output.size()) },
+					{ "generation_error", static_cast<double>(max_error(result.View(), original.View().Crop(0, 0, result.Width(), result.Height()))) },
+					{ "exif_consistent", exif_consistent(output) ? 1.0 : 0.0 },
+				} });
+			}
+
+			// 逐次逼近的细化扫描依赖跳过的频带的非零历史，只对渐进式图片检查
+			auto successive_options = encode_options;
+			successive_options.successive_approximation = true;
+			const auto successive = progressive ? EncodeJpeg(source.View(), successive_options) : std::vector<uint8_t>{};
+
+			for (auto scale : scales)
+			{
+				const auto successive_name = std::string("jpeg/decode/successive/") + size.label + "/1:" + std::to_string(scale);
+
+				if (progressive && reporter.Selected(successive_name))
+				{
+					JpegDecodeStats stats;
+					const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+					{
+						stats = {};
+						DecodeJpeg(successive.data(), successive.size(), scale, &stats);
+					});
+
+					const auto expected = DecodeJpeg(encoded.data(), encoded.size(), scale);
+					const auto decoded = DecodeJpeg(successive.data(), successive.size(), scale);
+
+					PhotoBench::Result result{ successive_name, median_ms, {
+						{ "mpix_per_s", mpix / (median_ms / 1000) },
+						{ "scans_skipped", static_cast<double>(stats.scans_skipped) },
+						{ "exact", max_error(expected.View(), decoded.View()) == 0 ? 1.0 : 0.0 },
+					} };
+
+#ifdef PHOTOEDITOR_LIBJPEG
+					// libjpeg 只能完整解码，只在 1:1 时比较
+					if (scale == 1)
+					{
+						result.metrics.push_back({ "exact_libjpeg", same_with_libjpeg(encoded, successive) ? 1.0 : 0.0 });
+					}
+#endif
+
+					reporter.Add(result);
+				}
+
+				const auto name = "jpeg/decode/" + prefix + "/1:" + std::to_string(scale);
+
+				if (!reporter.Selected(name))
+				{
+					continue;
+				}
+
+				JpegDecodeStats stats;
+				size_t output_bytes = 0;
+				const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+				{
+					stats = {};
+					output_bytes = DecodeJpeg(encoded.data(), encoded.size(), scale, &stats).SizeInBytes();
+				});
+
+				reporter.Add({ name, median_ms, {
+					{ "mpix_per_s", mpix / (median_ms / 1000) },
+					{ "scans_skipped", static_cast<double>(stats.scans_skipped) },
+					{ "memory_bytes", static_cast<double>(stats.coefficient_bytes + stats.plane_bytes + output_bytes) },
+				} });
+			}
+		}
+	}
+
+	return reporter.Finish();
+}
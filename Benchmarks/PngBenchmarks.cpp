@@ -0,0 +1,159 @@
+﻿/*
+ * PNG 编码的基准测试
+ *
+ * 测量单线程和并行编码的速度和文件大小：
+ *   png/encode/<single|parallel>/<尺寸>/level<N>
+ * single 把整个图片压缩为一个连续的流，是文件大小的基准；parallel 按段并行压缩。
+ * mpix_per_s 按原图像素数计算，bytes 是文件大小，vs_single 是并行编码的文件与单线程的大小之比，
+ * speedup 是单线程与并行编码的耗时之比。
+ *
+ * 用法：PngBenchmarks [公共参数] [--level N] [--save 目录]
+ * 不指定 --level 时测量 1、6、9 三个级别。指定 --save 时把并行编码的图片写到该目录下，便于用其他解码器检查。
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "BenchmarkHarness.h"
+#include "../PhotoEditor/Core/PngEncoder.h"
+
+using namespace PhotoCore;
+
+namespace
+{
+	struct ImageSize
+	{
+		char const* label;
+		uint32_t width;
+		uint32_t height;
+	};
+
+	// 屏幕、常见相机和高像素相机
+	constexpr ImageSize image_sizes[]{
+		{ "1080p", 1920, 1080 },
+		{ "12mp", 4000, 3000 },
+		{ "24mp", 6000, 4000 },
+		{ "48mp", 8000, 6000 },
+	};
+
+	std::string extra(PhotoBench::Options const& options, std::string const& key, std::string const& fallback)
+	{
+		const auto found = options.extra.find(key);
+		return found == options.extra.end() ? fallback : found->second;
+	}
+
+	/// <summary>
+	/// 接近编辑后照片的内容：平滑的渐变和色块，加上少量噪声
+	/// </summary>
+	void fill_test_image(ImageView const& image)
+	{
+		uint32_t state = 0x12345678;
+
+		for (uint32_t y = 0; y < image.height; y++)
+		{
+			auto row = image.Row(y);
+			const auto fy = static_cast<float>(y) / image.height;
+
+			for (uint32_t x = 0; x < image.width; x++, row += BytesPerPixel)
+			{
+				const auto fx = static_cast<float>(x) / image.width;
+				state = state * 1664525u + 1013904223u;
+				const auto noise = static_cast<int>(state >> 30) - 2;
+
+				const auto wave = std::sin(fx * 23.f + std::cos(fy * 17.f) * 3.f) * 40.f;
+				const auto b = 90.f + 120.f * fy + wave;
+				const auto g = 60.f + 100.f * fx - wave * .5f;
+				const auto r = 180.f - 80.f * fx * fy + wave * .75f;
+
+				row[0] = static_cast<uint8_t>(std::clamp(static_cast<int>(b) + noise, 0, 255));
+				row[1] = static_cast<uint8_t>(std::clamp(static_cast<int>(g) + noise, 0, 255));
+				row[2] = static_cast<uint8_t>(std::clamp(static_cast<int>(r) + noise, 0, 255));
+				row[3] = 255;
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const auto options = PhotoBench::ParseOptions(argc, argv);
+	PhotoBench::Reporter reporter(options);
+
+	const auto level = extra(options, "level", "");
+	const auto save = extra(options, "save", "");
+	const auto levels = level.empty() ? std::vector<int>{ 1, 6, 9 } : std::vector<int>{ std::stoi(level) };
+
+	ThreadPool pool(options.max_threads);
+
+	for (auto&& size : image_sizes)
+	{
+		const auto mpix = static_cast<double>(size.width) * size.height / 1e6;
+
+		if (mpix > options.max_mpix)
+		{
+			continue;
+		}
+
+		PixelBuffer source(size.width, size.height);
+		fill_test_image(source.View());
+
+		for (auto level_value : levels)
+		{
+			const auto suffix = std::string(size.label) + "/level" + std::to_string(level_value);
+
+			PngEncodeOptions encode_options;
+			encode_options.level = level_value;
+
+			double single_ms = 0;
+			size_t single_bytes = 0;
+
+			for (auto parallel : { false, true })
+			{
+				const auto name = std::string("png/encode/") + (parallel ? "parallel/" : "single/") + suffix;
+
+				if (!reporter.Selected(name))
+				{
+					continue;
+				}
+
+				std::vector<uint8_t> encoded;
+				const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+				{
+					encoded = parallel ? EncodePng(source.View(), encode_options, pool) : EncodePng(source.View(), encode_options);
+				});
+
+				PhotoBench::Result result{ name, median_ms, {
+					{ "mpix_per_s", mpix / (median_ms / 1000) },
+					{ "bytes", static_cast<double>(encoded.size()) },
+				} };
+
+				if (!parallel)
+				{
+					single_ms = median_ms;
+					single_bytes = encoded.size();
+				}
+				else if (single_bytes != 0)
+				{
+					result.metrics.push_back({ "vs_single", static_cast<double>(encoded.size()) / single_bytes });
+					result.metrics.push_back({ "speedup", single_ms / median_ms });
+				}
+
+				if (parallel && !save.empty())
+				{
+					std::filesystem::create_directories(std::filesystem::u8path(save));
+					std::ofstream(std::filesystem::u8path(save) / (std::string(size.label) + "-level" + std::to_string(level_value) + ".png"), std::ios::binary)
+						.write(reinterpret_cast<char const*>(encoded.data()), static_cast<std::streamsize>(encoded.size()));
+				}
+
+				reporter.Add(result);
+			}
+		}
+	}
+
+	return reporter.Finish();
+}
@@ -0,0 +1,785 @@
+﻿/*
+ * 图库扫描的基准测试
+ *
+ * 在合成图库上测量 MainPage::get_items_async 的各个阶段随图库大小的变化：
+ *   scan/enumerate     深度查询所有图片文件
+ *   scan/catalog       为查询到的每个文件读取属性、创建照片信息
+ *   scan/first-screen  从开始扫描到第一屏的照片都已加入
+ *   scan/full          完整扫描
+ *   scan/headers       用文件头识别代替读取属性的完整扫描，按批并行读取
+ *   scan/headers-cached  同上，负缓存中已经有上一次扫描发现的无效文件
+ *   scan/records       把扫描结果加入列式的照片目录
+ *   catalog/index      按扫描时合并通知的批次增量建立全部排序索引
+ *   catalog/sort       按标题排序（直接取已有的索引）
+ *   catalog/filter     横向、不小于 2 MP 的照片按日期排序
+ *   catalog/trigram    建立文件名和标题的三元组索引
+ *   catalog/search     逐字输入 --query（默认 dsc_0001）时每次按键的搜索，报告平均和最慢的一次
+ *   walk/serial-wide、walk/parallel-wide    宽图库（只有一层、每个目录约 2000 个文件）的深度查询，
+ *   walk/serial-deep、walk/parallel-deep    深图库（每个目录约 20 个文件、最深 64 层）的深度查询；
+ *                      serial 是 EnumerateImageFiles，parallel 是 DirectoryWalker（--walk-threads 个线程），
+ *                      每次列出目录等待 --list-latency-us（默认 100），first_batch_ms 是交出第一批文件的时间
+ *   metadata/retitle   通过延迟写入队列给 1000 张照片逐字输入标题，每次写入耗时 --write-latency-us（默认 1000），
+ *                      从第一次修改到全部写完的时间；writes 和 batches 是实际的写入次数和批数，direct_writes 是每次修改都写入时的次数
+ *   startup/snapshot-write  写出 --first-screen 张照片（300×200 略缩图）的启动快照
+ *   startup/snapshot-open   读入启动快照、解析并复制出全部照片信息和略缩图，即启动时显示第一屏之前的工作，
+ *                      可以和 scan/first-screen 比较
+ *   startup/placeholder  扫描时的占位预览：识别 --first-screen 张带 EXIF 内嵌略缩图的 JPEG，从内嵌略缩图计算占位预览，
+ *                      再各画成网格项出现时显示的 16×12 位图；bytes_read_per_photo 是每张照片读取的字节数
+ *   layout/resize      --layout-items 张（默认 200000）照片的图库网格改变宽度，全部重新断行
+ *   layout/append      在末尾追加一批照片（扫描时每次合并通知的数量）再删除，只重新断行末尾的几行
+ *   layout/insert      在中间插入一张照片再删除，relayout_rows 是两次修改重新断行的行数
+ * scaling 是相邻两个图库大小之间耗时增长的幂次，1 表示线性；bytes_per_file 是识别文件头平均读取的字节数；
+ * bytes_per_photo 是照片目录中每张照片占用的内存，info_bytes_per_photo 是同样内容用 PhotoInfo 保存时的占用。
+ *
+ * 用法：ScanBenchmarks [公共参数] [--max-files N] [--first-screen N] [--latency-us N] [--disk 目录] [--query 文本] [--write-latency-us N]
+ *                    [--list-latency-us N] [--walk-threads N] [--layout-items N]
+ * 指定 --disk 时把合成图库写到该目录下（已存在时直接使用），通过 DiskLibrary 读取；
+ * 重复运行时文件都在系统缓存中，测的是热缓存的情况。
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BenchmarkHarness.h"
+#include "../PhotoEditor/Core/CatalogIndex.h"
+#include "../PhotoEditor/Core/DirectoryWalker.h"
+#include "../PhotoEditor/Core/DiskLibrary.h"
+#include "../PhotoEditor/Core/JpegDecoder.h"
+#include "../PhotoEditor/Core/JpegEncoder.h"
+#include "../PhotoEditor/Core/JpegThumbnail.h"
+#include "../PhotoEditor/Core/JustifiedLayout.h"
+#include "../PhotoEditor/Core/LibraryScanner.h"
+#include "../PhotoEditor/Core/PhotoCatalog.h"
+#include "../PhotoEditor/Core/Placeholder.h"
+#include "../PhotoEditor/Core/StartupSnapshot.h"
+#include "../PhotoEditor/Core/SyntheticLibrary.h"
+#include "../PhotoEditor/Core/ThreadPool.h"
+#include "../PhotoEditor/Core/TrigramIndex.h"
+#include "../PhotoEditor/Core/WriteBehindQueue.h"
+
+using namespace PhotoCore;
+
+namespace
+{
+	constexpr size_t library_sizes[]{ 1000, 10000, 100000, 1000000 };
+
+	// 增量建立索引时每批加入的照片数，相当于扫描时每次合并通知的数量
+	constexpr size_t index_batch_size = 8192;
+
+	// 重新命名标题的照片数和每个标题的长度（每输入一个字符修改一次）
+	constexpr size_t retitle_photos = 1000;
+	constexpr size_t retitle_length = 12;
+
+	// 启动快照中略缩图的大小，和 ImageLoader 相同
+	constexpr uint32_t snapshot_thumbnail_width = 300;
+	constexpr uint32_t snapshot_thumbnail_height = 200;
+
+	std::string extra(PhotoBench::Options const& options, std::string const& key, std::string const& fallback)
+	{
+		const auto found = options.extra.find(key);
+		return found == options.extra.end() ? fallback : found->second;
+	}
+
+	/// <summary>
+	/// 在内存中或者磁盘上准备图库
+	/// </summary>
+	std::unique_ptr<LibraryProvider> prepare_library(PhotoBench::Options const& options, SyntheticLibraryOptions const& library_options)
+	{
+		auto synthetic = std::make_unique<SyntheticLibrary>(library_options);
+
+		std::printf("# library %zu files, %zu folders, depth %u, %zu local images\n",
+			library_options.file_count, synthetic->FolderCount(), synthetic->Depth(), synthetic->LocalImageCount());
+
+		const auto disk = extra(options, "disk", "");
+
+		if (disk.empty())
+		{
+			return synthetic;
+		}
+
+		const auto root = std::filesystem::u8path(disk) / ("library-" + std::to_string(library_options.file_count));
+		const auto marker = root / ".complete";
+
+		if (!std::filesystem::exists(marker))
+		{
+			const auto start = std::chrono::steady_clock::now();
+			std::filesystem::remove_all(root);
+			synthetic->WriteTo(root);
+			std::ofstream{ marker };
+
+			std::printf("# wrote %s in %.1f s\n", root.u8string().c_str(),
+				std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+		}
+
+		return std::make_unique<DiskLibrary>(root);
+	}
+
+	/// <summary>
+	/// 以文件数为单位的结果
+	/// </summary>
+	PhotoBench::Result per_file_result(std::string const& name, double median_ms, size_t files, double scaling)
+	{
+		return { name, median_ms, {
+			{ "files", static_cast<double>(files) },
+			{ "files_per_s", files / (median_ms / 1000) },
+			{ "us_per_file", median_ms * 1000 / std::max<size_t>(files, 1) },
+			{ "scaling", scaling },
+		} };
+	}
+
+	/// <summary>
+	/// 字符串占用的堆内存，短字符串在对象内部
+	/// </summary>
+	size_t heap_bytes(std::string const& value)
+	{
+		return value.capacity() > std::string().capacity() ? value.capacity() + 1 : 0;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const auto options = PhotoBench::ParseOptions(argc, argv);
+	PhotoBench::Reporter reporter(options);
+
+	const auto max_files = std::stoul(extra(options, "max-files", "1000000"));
+	const auto first_screen = std::stoul(extra(options, "first-screen", "30"));
+	const auto latency = std::chrono::microseconds(std::stol(extra(options, "latency-us", "0")));
+	const auto query = extra(options, "query", "dsc_0001");
+	const auto list_latency = std::chrono::microseconds(std::stol(extra(options, "list-latency-us", "100")));
+	const auto walk_threads = std::stoul(extra(options, "walk-threads", std::to_string(DefaultWalkThreadCount())));
+	const auto write_latency = std::chrono::microseconds(std::stol(extra(options, "write-latency-us", "1000")));
+	const auto layout_items = std::stoul(extra(options, "layout-items", "200000"));
+
+	// 上一个图库大小的耗时，用于计算 scaling
+	std::map<std::string, std::pair<size_t, double>> previous;
+
+	const auto report = [&](std::string const& stage, size_t library_size, double median_ms, size_t files, double bytes_per_file = -1,
+		std::vector<std::pair<std::string, double>> const& metrics = {})
+	{
+		auto scaling = 0.0;
+		const auto found = previous.find(stage);
+
+		if (found != previous.end() && found->second.second > 0)
+		{
+			scaling = std::log(median_ms / found->second.second) / std::log(static_cast<double>(library_size) / found->second.first);
+		}
+
+		previous[stage] = { library_size, median_ms };
+		auto result = per_file_result(stage + "/" + std::to_string(library_size), median_ms, files, scaling);
+
+		if (bytes_per_file >= 0)
+		{
+			result.metrics.emplace_back("bytes_per_file", bytes_per_file);
+		}
+
+		result.metrics.insert(result.metrics.end(), metrics.begin(), metrics.end());
+
+		reporter.Add(std::move(result));
+	};
+
+	for (auto library_size : library_sizes)
+	{
+		if (library_size > max_files)
+		{
+			continue;
+		}
+
+		SyntheticLibraryOptions library_options;
+		library_options.file_count = library_size;
+		library_options.property_latency = latency;
+
+		const auto selected = [&](char const* stage)
+		{
+			return reporter.Selected(std::string(stage) + "/" + std::to_string(library_size));
+		};
+
+		if (!selected("scan/enumerate") && !selected("scan/catalog") && !selected("scan/first-screen") && !selected("scan/full")
+			&& !selected("scan/headers") && !selected("scan/headers-cached") && !selected("scan/records")
+			&& !selected("catalog/index") && !selected("catalog/sort") && !selected("catalog/filter")
+			&& !selected("catalog/trigram") && !selected("catalog/search"))
+		{
+			continue;
+		}
+
+		const auto library = prepare_library(options, library_options);
+		const auto files = EnumerateImageFiles(*library);
+
+		if (selected("scan/enumerate"))
+		{
+			const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				EnumerateImageFiles(*library);
+			});
+
+			report("scan/enumerate", library_size, median_ms, files.size());
+		}
+
+		if (selected("scan/catalog"))
+		{
+			const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				std::vector<PhotoInfo> catalog;
+				catalog.reserve(files.size());
+
+				for (auto&& file : files)
+				{
+					try
+					{
+						catalog.push_back(LoadPhotoInfo(*library, file));
+					}
+					catch (std::exception const&)
+					{
+					}
+				}
+			});
+
+			report("scan/catalog", library_size, median_ms, files.size());
+		}
+
+		if (selected("scan/first-screen"))
+		{
+			const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				size_t count = 0;
+				ScanLibrary(*library, [&](PhotoInfo const&)
+				{
+					return ++count < first_screen;
+				});
+			});
+
+			report("scan/first-screen", library_size, median_ms, files.size());
+		}
+
+		if (selected("scan/full"))
+		{
+			ScanResult result;
+			const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				result = ScanLibrary(*library);
+			});
+
+			std::printf("# %zu photos, %zu unsupported, %zu failed\n", result.photos.size(), result.unsupported_files, result.failed_files);
+			report("scan/full", library_size, median_ms, files.size());
+		}
+
+		for (auto cached : { false, true })
+		{
+			const auto stage = cached ? "scan/headers-cached" : "scan/headers";
+
+			if (!selected(stage))
+			{
+				continue;
+			}
+
+			// 与应用相同，读取文件头使用单独的 I/O 线程池
+			ThreadPool io_pool(DefaultWalkThreadCount());
+			NegativeCache warm_cache;
+			HeaderScanOptions scan_options;
+			scan_options.pool = &io_pool;
+
+			if (cached)
+			{
+				scan_options.negative_cache = &warm_cache;
+				ScanLibraryHeaders(*library, scan_options);
+			}
+
+			ScanResult result;
+			const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				// 没有缓存时每次都从空的负缓存开始
+				NegativeCache cold_cache;
+				scan_options.negative_cache = cached ? &warm_cache : &cold_cache;
+				result = ScanLibraryHeaders(*library, scan_options);
+			});
+
+			std::printf("# %zu photos, %zu unsupported, %zu failed, %zu cached invalid\n",
+				result.photos.size(), result.unsupported_files, result.failed_files, result.cached_invalid_files);
+			report(stage, library_size, median_ms, files.size(), static_cast<double>(result.bytes_read) / std::max<size_t>(files.size(), 1));
+		}
+
+		if (!selected("scan/records") && !selected("catalog/index") && !selected("catalog/sort") && !selected("catalog/filter")
+			&& !selected("catalog/trigram") && !selected("catalog/search"))
+		{
+			continue;
+		}
+
+		HeaderScanOptions scan_options;
+		scan_options.pool = &ThreadPool::Shared();
+		const auto scanned = ScanLibraryHeaders(*library, scan_options);
+
+		if (selected("scan/records"))
+		{
+
+			size_t catalog_bytes = 0;
+			const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				PhotoCatalog catalog;
+
+				for (auto&& photo : scanned.photos)
+				{
+					catalog.Add(photo);
+				}
+
+				catalog_bytes = catalog.MemoryBytes();
+			});
+
+			size_t info_bytes = 0;
+
+			for (auto&& photo : scanned.photos)
+			{
+				info_bytes += sizeof(PhotoInfo) + heap_bytes(photo.path) + heap_bytes(photo.name) + heap_bytes(photo.type) + heap_bytes(photo.title);
+			}
+
+			const auto photos = std::max<size_t>(scanned.photos.size(), 1);
+			auto result = per_file_result("scan/records/" + std::to_string(library_size), median_ms, scanned.photos.size(), 0);
+			result.metrics.emplace_back("bytes_per_photo", static_cast<double>(catalog_bytes) / photos);
+			result.metrics.emplace_back("info_bytes_per_photo", static_cast<double>(info_bytes) / photos);
+			reporter.Add(std::move(result));
+		}
+
+		PhotoCatalog catalog;
+		CatalogIndex index(catalog);
+
+		if (selected("catalog/index"))
+		{
+			const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				PhotoCatalog batch_catalog;
+				CatalogIndex batch_index(batch_catalog);
+
+				for (size_t begin = 0; begin < scanned.photos.size(); begin += index_batch_size)
+				{
+					const auto end = std::min(begin + index_batch_size, scanned.photos.size());
+
+					for (auto i = begin; i < end; i++)
+					{
+						batch_catalog.Add(scanned.photos[i]);
+					}
+
+					batch_index.Update();
+				}
+			});
+
+			report("catalog/index", library_size, median_ms, scanned.photos.size());
+		}
+
+		for (auto&& photo : scanned.photos)
+		{
+			catalog.Add(photo);
+		}
+
+		index.Update();
+
+		if (selected("catalog/sort"))
+		{
+			size_t count = 0;
+			const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				count = index.Query({}, SortKey::Title).size();
+			});
+
+			report("catalog/sort", library_size, median_ms, count);
+		}
+
+		if (selected("catalog/filter"))
+		{
+			PhotoFilter filter;
+			filter.shape = PhotoShape::Landscape;
+			filter.min_pixels = 2'000'000;
+
+			size_t count = 0;
+			const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				count = index.Query(filter, SortKey::Date, true).size();
+			});
+
+			std::printf("# %zu of %zu photos match\n", count, catalog.Size());
+			report("catalog/filter", library_size, median_ms, catalog.Size());
+		}
+
+		if (selected("catalog/trigram"))
+		{
+			size_t memory_bytes = 0;
+			const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				TrigramIndex trigrams(catalog);
+				trigrams.Update();
+				memory_bytes = trigrams.MemoryBytes();
+			});
+
+			auto result = per_file_result("catalog/trigram/" + std::to_string(library_size), median_ms, catalog.Size(), 0);
+			result.metrics.emplace_back("bytes_per_photo", static_cast<double>(memory_bytes) / std::max<size_t>(catalog.Size(), 1));
+			reporter.Add(std::move(result));
+		}
+
+		if (selected("catalog/search"))
+		{
+			TrigramIndex trigrams(catalog);
+			trigrams.Update();
+
+			// 每输入一个字符搜索一次
+			auto total_ms = 0.0;
+			auto slowest_ms = 0.0;
+			size_t matches = 0;
+
+			for (size_t length = 1; length <= query.size(); length++)
+			{
+				const auto prefix = query.substr(0, length);
+				const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+				{
+					matches = trigrams.Search(prefix).size();
+				});
+
+				total_ms += median_ms;
+				slowest_ms = std::max(slowest_ms, median_ms);
+			}
+
+			const auto keystrokes = std::max<size_t>(query.size(), 1);
+			reporter.Add({ "catalog/search/" + std::to_string(library_size), total_ms / keystrokes, {
+				{ "photos", static_cast<double>(catalog.Size()) },
+				{ "keystrokes", static_cast<double>(keystrokes) },
+				{ "slowest_ms", slowest_ms },
+				{ "matches", static_cast<double>(matches) },
+			} });
+		}
+	}
+
+	for (auto library_size : library_sizes)
+	{
+		if (library_size > max_files)
+		{
+			continue;
+		}
+
+		for (auto deep : { false, true })
+		{
+			const std::string shape = deep ? "deep" : "wide";
+			const auto serial_stage = "walk/serial-" + shape;
+			const auto parallel_stage = "walk/parallel-" + shape;
+			const auto suffix = "/" + std::to_string(library_size);
+
+			if (!reporter.Selected(serial_stage + suffix) && !reporter.Selected(parallel_stage + suffix))
+			{
+				continue;
+			}
+
+			SyntheticLibraryOptions library_options;
+			library_options.file_count = library_size;
+			library_options.files_per_folder = deep ? 20 : 2000;
+			library_options.max_depth = deep ? 64 : 1;
+			library_options.list_latency = list_latency;
+
+			SyntheticLibrary library(library_options);
+			std::printf("# %s library %zu files, %zu folders, depth %u\n", shape.c_str(), library_size, library.FolderCount(), library.Depth());
+
+			if (reporter.Selected(serial_stage + suffix))
+			{
+				size_t count = 0;
+				const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+				{
+					count = EnumerateImageFiles(library).size();
+				});
+
+				report(serial_stage, library_size, median_ms, count);
+			}
+
+			if (reporter.Selected(parallel_stage + suffix))
+			{
+				WalkOptions walk_options;
+				walk_options.thread_count = walk_threads;
+
+				size_t count = 0;
+				std::vector<double> first_batch_ms;
+				WalkStats stats;
+
+				const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+				{
+					const auto start = std::chrono::steady_clock::now();
+					DirectoryWalker walker(library, {}, walk_options);
+					std::vector<ScannedFile> batch;
+					count = 0;
+
+					while (walker.Next(batch))
+					{
+						if (count == 0)
+						{
+							first_batch_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+						}
+
+						count += batch.size();
+					}
+
+					stats = walker.Stats();
+				});
+
+				std::sort(first_batch_ms.begin(), first_batch_ms.end());
+				report(parallel_stage, library_size, median_ms, count, -1, {
+					{ "first_batch_ms", first_batch_ms[first_batch_ms.size() / 2] },
+					{ "threads", static_cast<double>(walk_threads) },
+					{ "steals", static_cast<double>(stats.steals) },
+					{ "batches", static_cast<double>(stats.batches) },
+				});
+			}
+		}
+	}
+
+	if (reporter.Selected("startup/snapshot-write") || reporter.Selected("startup/snapshot-open"))
+	{
+		std::vector<PixelBuffer> thumbnails;
+		std::vector<SnapshotPhoto> photos(first_screen);
+
+		for (size_t i = 0; i < first_screen; i++)
+		{
+			auto& info = photos[i].info;
+			info.path = "C:\\Users\\user\\Pictures\\Camera Roll\\IMG_" + std::to_string(i) + ".jpg";
+			info.name = "IMG_" + std::to_string(i);
+			info.type = "JPEG 图像";
+			info.format = ImageFormat::Jpeg;
+			info.width = 4000;
+			info.height = 3000;
+			info.size_bytes = 4'000'000;
+
+			thumbnails.emplace_back(snapshot_thumbnail_width, snapshot_thumbnail_height);
+		}
+
+		for (size_t i = 0; i < first_screen; i++)
+		{
+			photos[i].thumbnail = thumbnails[i].View();
+		}
+
+		const auto path = std::filesystem::temp_directory_path() / "photoeditor-startup-snapshot.bin";
+
+		const auto write_ms = PhotoBench::MeasureMedianMs(options, [&]
+		{
+			std::ofstream output(path, std::ios::binary | std::ios::trunc);
+			WriteStartupSnapshot(output, photos);
+		});
+
+		const auto bytes = static_cast<double>(std::filesystem::file_size(path));
+
+		if (reporter.Selected("startup/snapshot-write"))
+		{
+			reporter.Add({ "startup/snapshot-write", write_ms, {
+				{ "photos", static_cast<double>(first_screen) },
+				{ "bytes", bytes },
+			} });
+		}
+
+		if (reporter.Selected("startup/snapshot-open"))
+		{
+			// 应用中映射文件；这里读入内存，包含了读取的开销
+			const auto open_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				std::ifstream input(path, std::ios::binary);
+				const std::vector<char> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+				const StartupSnapshot snapshot(reinterpret_cast<uint8_t const*>(data.data()), data.size());
+
+				std::vector<PhotoInfo> infos;
+				std::vector<PixelBuffer> primed;
+
+				for (size_t i = 0; i < snapshot.Size(); i++)
+				{
+					infos.push_back(snapshot.Info(i));
+
+					const auto thumbnail = snapshot.Thumbnail(i);
+					primed.emplace_back(thumbnail.width, thumbnail.height);
+					CopyPixels(thumbnail, primed.back().View());
+				}
+			});
+
+			reporter.Add({ "startup/snapshot-open", open_ms, {
+				{ "photos", static_cast<double>(first_screen) },
+				{ "bytes", bytes },
+				{ "us_per_photo", open_ms * 1000 / std::max<size_t>(first_screen, 1) },
+			} });
+		}
+
+		std::filesystem::remove(path);
+	}
+
+	if (reporter.Selected("startup/placeholder"))
+	{
+		// 与相机的文件相同，SOI 之后是带内嵌略缩图（原图的 1/2）的 EXIF 段
+		std::vector<std::vector<uint8_t>> files;
+
+		for (size_t i = 0; i < first_screen; i++)
+		{
+			PixelBuffer pixels(snapshot_thumbnail_width, snapshot_thumbnail_height);
+			auto&& view = pixels.View();
+
+			for (uint32_t y = 0; y < view.height; y++)
+			{
+				for (uint32_t x = 0; x < view.width * BytesPerPixel; x++)
+				{
+					view.Row(y)[x] = static_cast<uint8_t>(x * 7 + y * 3 + i);
+				}
+			}
+
+			const auto jpeg = EncodeJpeg(view);
+			const auto preview = DecodeJpeg(jpeg.data(), jpeg.size(), 2);
+			const auto segment = BuildExifSegment(1, EncodeJpeg(preview.View()));
+
+			auto&& file = files.emplace_back(jpeg.begin(), jpeg.begin() + 2);
+			file.insert(file.end(), segment.begin(), segment.end());
+			file.insert(file.end(), jpeg.begin() + 2, jpeg.end());
+		}
+
+		PixelBuffer rendered(16, 12);
+		uint64_t bytes_read = 0;
+		size_t computed = 0;
+
+		const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+		{
+			bytes_read = 0;
+			computed = 0;
+
+			for (auto&& file : files)
+			{
+				const ReadAtFunction read = [&file](uint64_t offset, uint8_t* buffer, size_t size)
+				{
+					const auto count = offset >= file.size() ? size_t{ 0 } : std::min<size_t>(size, static_cast<size_t>(file.size() - offset));
+					std::copy_n(file.data() + offset, count, buffer);
+					return count;
+				};
+
+				const auto sniffed = SniffImage(read);
+				bytes_read += sniffed.bytes_read;
+
+				if (const auto placeholder = LoadEmbeddedPlaceholder(read, sniffed, &bytes_read))
+				{
+					RenderPlaceholder(*placeholder, rendered.View());
+					computed++;
+				}
+			}
+		});
+
+		reporter.Add({ "startup/placeholder", median_ms, {
+			{ "photos", static_cast<double>(computed) },
+			{ "us_per_photo", median_ms * 1000 / std::max<size_t>(first_screen, 1) },
+			{ "bytes_read_per_photo", static_cast<double>(bytes_read) / std::max<size_t>(first_screen, 1) },
+			{ "bytes_per_photo", static_cast<double>(sizeof(Placeholder)) },
+		} });
+	}
+
+	if (reporter.Selected("layout/resize") || reporter.Selected("layout/append") || reporter.Selected("layout/insert"))
+	{
+		// 横向、纵向和方形照片按伪随机的顺序混合。周期性的顺序会让每行的照片数固定，插入之后断点永远不会重合
+		constexpr uint32_t shapes[][2]{ { 6000, 4000 }, { 4000, 6000 }, { 4032, 3024 }, { 3000, 3000 }, { 1920, 1080 } };
+		std::vector<float> aspects(layout_items);
+
+		for (size_t i = 0; i < aspects.size(); i++)
+		{
+			auto&& shape = shapes[(static_cast<uint32_t>(i) * 2654435761u >> 16) % std::size(shapes)];
+			aspects[i] = JustifiedLayout::AspectRatio(shape[0], shape[1]);
+		}
+
+		JustifiedLayout layout;
+		layout.SetWidth(1280);
+		layout.Assign(aspects);
+
+		if (reporter.Selected("layout/resize"))
+		{
+			auto narrow = false;
+			const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				narrow = !narrow;
+				layout.SetWidth(narrow ? 1270.0f : 1280.0f);
+			});
+
+			reporter.Add({ "layout/resize", median_ms, {
+				{ "items", static_cast<double>(layout.Size()) },
+				{ "rows", static_cast<double>(layout.RowCount()) },
+				{ "ns_per_item", median_ms * 1e6 / std::max<size_t>(layout.Size(), 1) },
+			} });
+
+			layout.SetWidth(1280);
+		}
+
+		if (reporter.Selected("layout/append"))
+		{
+			const std::vector<float> batch(aspects.begin(), aspects.begin() + std::min<size_t>(index_batch_size, aspects.size()));
+			size_t relayout_rows = 0;
+
+			const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				const auto size = layout.Size();
+				layout.Splice(size, 0, batch.data(), batch.size());
+				relayout_rows = layout.LastRelayoutRows();
+				layout.Splice(size, batch.size(), nullptr, 0);
+			});
+
+			reporter.Add({ "layout/append", median_ms, {
+				{ "items", static_cast<double>(batch.size()) },
+				{ "relayout_rows", static_cast<double>(relayout_rows) },
+			} });
+		}
+
+		if (reporter.Selected("layout/insert"))
+		{
+			const auto aspect = JustifiedLayout::AspectRatio(4000, 6000);
+			size_t relayout_rows = 0;
+
+			const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+			{
+				const auto middle = layout.Size() / 2;
+				layout.Splice(middle, 0, &aspect, 1);
+				relayout_rows = layout.LastRelayoutRows();
+				layout.Splice(middle, 1, nullptr, 0);
+				relayout_rows += layout.LastRelayoutRows();
+			});
+
+			reporter.Add({ "layout/insert", median_ms, {
+				{ "items", static_cast<double>(layout.Size()) },
+				{ "relayout_rows", static_cast<double>(relayout_rows) },
+			} });
+		}
+	}
+
+	if (reporter.Selected("metadata/retitle"))
+	{
+		WriteBehindCounters counters{};
+
+		const auto median_ms = PhotoBench::MeasureMedianMs(options, [&]
+		{
+			WriteBehindQueue<std::string, std::string> queue(
+				[&](std::string const&, std::string const&) { std::this_thread::sleep_for(write_latency); },
+				nullptr,
+				std::chrono::milliseconds(20));
+
+			// 逐张照片逐字输入，和界面上编辑标题时的修改顺序相同
+			for (size_t photo = 0; photo < retitle_photos; photo++)
+			{
+				const auto path = "photos/IMG_" + std::to_string(photo) + ".jpg";
+				std::string title;
+
+				for (size_t i = 0; i < retitle_length; i++)
+				{
+					title += static_cast<char>('a' + (photo + i) % 26);
+					queue.Submit(path, title);
+				}
+			}
+
+			queue.Flush();
+			counters = queue.Counters();
+		});
+
+		reporter.Add({ "metadata/retitle", median_ms, {
+			{ "photos", static_cast<double>(retitle_photos) },
+			{ "direct_writes", static_cast<double>(counters.submitted) },
+			{ "writes", static_cast<double>(counters.written) },
+			{ "batches", static_cast<double>(counters.batches) },
+			{ "max_batch", static_cast<double>(counters.max_batch) },
+		} });
+	}
+
+	return reporter.Finish();
+}
@@ -2,11 +2,17 @@
 
 #include "App.h"
 #include "MainPage.h"
+#include "MetadataWriter.h"
+#include "Core/Trace.h"
+#include <sstream>
 
 using namespace winrt;
 using namespace Windows::ApplicationModel;
 using namespace Windows::ApplicationModel::Activation;
 using namespace Windows::Foundation;
+using namespace Windows::Storage;
+using namespace Windows::System;
+using namespace Windows::UI::Core;
 using namespace Windows::UI::Xaml;
 using namespace Windows::UI::Xaml::Controls;
 using namespace Windows::UI::Xaml::Navigation;
@@ -20,7 +26,8 @@ App::App()
 {
     InitializeComponent();
 
-
+    Suspending({ this, &App::OnSuspending });
+    Resuming({ this, &App::OnResuming });
 }
 
 /// <summary>
@@ -50,6 +57,31 @@ void App::OnLaunched(LaunchActivatedEventArgs const &e)
         // 导航失败时候委托执行方法 OnNavigationFailed
         rootFrame.NavigationFailed({this, &App::OnNavigationFailed});
 
+        // 图片属性写入失败时，在这一批写完后回到界面线程报告
+        MetadataWriter::Current().OnFailures([this, dispatcher = Window::Current().Dispatcher()]
+        {
+            dispatcher.RunAsync(CoreDispatcherPriority::Normal, [this] { ShowMetadataFailures(); });
+        });
+
+#ifdef PHOTOEDITOR_TRACE
+        // 启用追踪，按 Ctrl+Shift+T 导出
+        PhotoCore::Trace::Enable(true);
+        PE_TRACE_THREAD_NAME("UI");
+
+        Window::Current().CoreWindow().KeyDown([this](CoreWindow const& sender, KeyEventArgs const& args)
+        {
+            const auto is_down = [&sender](VirtualKey key)
+            {
+                return (sender.GetKeyState(key) & CoreVirtualKeyStates::Down) == CoreVirtualKeyStates::Down;
+            };
+
+            if (args.VirtualKey() == VirtualKey::T && is_down(VirtualKey::Control) && is_down(VirtualKey::Shift))
+            {
+                SaveTraceAsync();
+            }
+        });
+#endif
+
 
         if (e.PrelaunchActivated() == false)
         {
@@ -89,6 +121,82 @@ void App::OnNavigationFailed(IInspectable const &, NavigationFailedEventArgs con
     throw hresult_error(E_FAIL, hstring(L"加载页面失败") + e.SourcePageType().Name);
 }
 
+/// <summary>
+/// 挂起之前写完所有排队的图片属性修改，挂起之后应用可能被终止
+/// </summary>
+/// <param name="e">挂起信息</param>
+fire_and_forget App::OnSuspending(IInspectable const &, SuspendingEventArgs const &e)
+{
+    const auto deferral = e.SuspendingOperation().GetDeferral();
+
+    co_await MetadataWriter::Current().FlushAsync();
+    deferral.Complete();
+}
+
+/// <summary>
+/// 恢复时报告挂起期间写入失败的图片属性
+/// </summary>
+void App::OnResuming(IInspectable const &, IInspectable const &)
+{
+    ShowMetadataFailures();
+}
+
+/// <summary>
+/// 取出写入失败的图片属性并显示，显示期间又有失败时关闭后接着显示
+/// </summary>
+fire_and_forget App::ShowMetadataFailures()
+{
+    if (showing_metadata_failures_)
+    {
+        co_return;
+    }
+
+    const auto strong = get_strong();
+    showing_metadata_failures_ = true;
+
+    for (auto failures = MetadataWriter::Current().TakeFailures(); !failures.empty(); failures = MetadataWriter::Current().TakeFailures())
+    {
+        std::wstring content = L"以下图片的属性没有保存：";
+
+        for (auto&& failure : failures)
+        {
+            content += L"\n" + std::wstring(failure.path) + L"：" + std::wstring(failure.message);
+        }
+
+        const ContentDialog failures_dialog{};
+        failures_dialog.Title(box_value(L"无法保存图片属性"));
+        failures_dialog.Content(box_value(content));
+        failures_dialog.CloseButtonText(L"确定");
+
+        try
+        {
+            co_await failures_dialog.ShowAsync();
+        }
+        catch (hresult_error const&)
+        {
+            // 同一时间只能显示一个对话框，页面的对话框正在显示时放弃这一次
+            break;
+        }
+    }
+
+    showing_metadata_failures_ = false;
+}
+
+#ifdef PHOTOEDITOR_TRACE
+/// <summary>
+/// 把所有线程的追踪事件写入 LocalFolder\trace.json，可用 Perfetto 或 chrome://tracing 打开
+/// </summary>
+/// <returns></returns>
+IAsyncAction App::SaveTraceAsync()
+{
+    std::ostringstream json;
+    PhotoCore::Trace::WriteChromeJson(json);
+
+    const auto file = co_await ApplicationData::Current().LocalFolder().CreateFileAsync(L"trace.json", CreationCollisionOption::ReplaceExisting);
+    co_await FileIO::WriteTextAsync(file, to_hstring(json.str()));
+}
+#endif
+
 /*
  * 根据 MIT 协议，本项目参考了 Microsoft 的部分代码
  */
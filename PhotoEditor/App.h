@@ -9,5 +9,20 @@ namespace winrt::PhotoEditor::implementation
 
         void OnLaunched(Windows::ApplicationModel::Activation::LaunchActivatedEventArgs const&);
         void OnNavigationFailed(IInspectable const&, Windows::UI::Xaml::Navigation::NavigationFailedEventArgs const&);
+        fire_and_forget OnSuspending(IInspectable const&, Windows::ApplicationModel::SuspendingEventArgs const&);
+        void OnResuming(IInspectable const&, IInspectable const&);
+
+    private:
+        // 显示写入失败的图片属性
+        fire_and_forget ShowMetadataFailures();
+
+        // 正在显示失败对话框，期间新的失败在关闭后接着显示
+        bool showing_metadata_failures_{ false };
+
+#ifdef PHOTOEDITOR_TRACE
+    public:
+        // 导出追踪文件到应用数据目录
+        Windows::Foundation::IAsyncAction SaveTraceAsync();
+#endif
     };
 }
\ No newline at end of file
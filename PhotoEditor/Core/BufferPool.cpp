@@ -0,0 +1,465 @@
+﻿/*
+ * 像素缓冲池代码
+ */
+
+#include "BufferPool.h"
+#include "Trace.h"
+
+#include <new>
+#include <unordered_map>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace PhotoCore
+{
+	namespace
+	{
+		// 最小一级的块是 2^min_power 字节
+		constexpr size_t min_power = 12;
+		static_assert(size_t{ 1 } << min_power == BufferPool::MinBlockBytes);
+
+		// 保留区域按大页的大小取整
+		constexpr size_t huge_page_bytes = size_t{ 2 } << 20;
+
+		/// <summary>
+		/// bytes 所在的级别。(2^p, 2^(p+1)] 分为 4 级，每级相差 2^(p-2)
+		/// </summary>
+		size_t size_class_of(size_t bytes) noexcept
+		{
+			if (bytes <= BufferPool::MinBlockBytes)
+			{
+				return 0;
+			}
+
+			size_t power = 0;
+
+			for (auto value = bytes - 1; value > 1; value >>= 1)
+			{
+				power++;
+			}
+
+			const auto base = size_t{ 1 } << power;
+			const auto step = base >> 2;
+			return (power - min_power) * 4 + (bytes - base + step - 1) / step;
+		}
+
+		size_t class_bytes(size_t size_class) noexcept
+		{
+			if (size_class == 0)
+			{
+				return BufferPool::MinBlockBytes;
+			}
+
+			const auto base = size_t{ 1 } << (min_power + (size_class - 1) / 4);
+			return base + ((size_class - 1) % 4 + 1) * (base >> 2);
+		}
+
+		void* system_allocate(size_t bytes)
+		{
+			return ::operator new(bytes, std::align_val_t{ BufferAlignment });
+		}
+
+		void system_free(void* block) noexcept
+		{
+			::operator delete(block, std::align_val_t{ BufferAlignment });
+		}
+
+		/// <summary>
+		/// 保留一段连续内存，先尝试大页。Windows 上大页需要“锁定内存页”权限，没有时使用普通页；
+		/// 其他系统上使用透明大页，由内核在后台合并
+		/// </summary>
+		/// <param name="bytes">请求的大小</param>
+		/// <param name="reserved">实际大小，失败时为 0</param>
+		/// <param name="huge">是否使用了大页</param>
+		/// <returns>区域起点，失败时为空</returns>
+		uint8_t* reserve_arena(size_t bytes, size_t& reserved, bool& huge) noexcept
+		{
+			reserved = (bytes + huge_page_bytes - 1) / huge_page_bytes * huge_page_bytes;
+			huge = false;
+
+#ifdef _WIN32
+			auto* arena = VirtualAllocFromApp(nullptr, reserved, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+
+			if (arena)
+			{
+				huge = true;
+			}
+			else
+			{
+				arena = VirtualAllocFromApp(nullptr, reserved, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+			}
+#else
+			auto* arena = mmap(nullptr, reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+			if (arena == MAP_FAILED)
+			{
+				arena = nullptr;
+			}
+#ifdef MADV_HUGEPAGE
+			else
+			{
+				huge = madvise(arena, reserved, MADV_HUGEPAGE) == 0;
+			}
+#endif
+#endif
+
+			if (!arena)
+			{
+				reserved = 0;
+			}
+
+			return static_cast<uint8_t*>(arena);
+		}
+
+		void release_arena(uint8_t* arena, size_t bytes) noexcept
+		{
+#ifdef _WIN32
+			(void)bytes;
+			VirtualFree(arena, 0, MEM_RELEASE);
+#else
+			munmap(arena, bytes);
+#endif
+		}
+
+		/// <summary>
+		/// 存活的缓冲池，线程退出时按 ID 找到缓存的块所属的池。ID 不重复使用
+		/// </summary>
+		struct Registry
+		{
+			std::mutex mutex;
+			std::unordered_map<uint64_t, BufferPool*> pools;
+			uint64_t next_id{ 1 };
+		};
+
+		Registry& registry()
+		{
+			// 有意不释放，其它线程退出时仍可能访问
+			static auto* instance = new Registry();
+			return *instance;
+		}
+
+		uint64_t register_pool(BufferPool* pool)
+		{
+			auto& reg = registry();
+			std::lock_guard<std::mutex> lock(reg.mutex);
+			const auto id = reg.next_id++;
+			reg.pools.emplace(id, pool);
+			return id;
+		}
+
+		// 线程缓存的容量，事先预留，放入块时不会重新分配
+		constexpr size_t thread_cache_capacity = 64;
+	}
+
+	/// <summary>
+	/// 线程自己的空闲块。只有本线程访问，不加锁；线程退出时交给仍然存活的池
+	/// </summary>
+	struct BufferPool::thread_cache
+	{
+		struct entry
+		{
+			uint64_t pool;
+			size_t size_class;
+			void* block;
+			bool arena;
+		};
+
+		std::vector<entry> entries;
+
+		thread_cache()
+		{
+			entries.reserve(thread_cache_capacity);
+		}
+
+		~thread_cache()
+		{
+			auto& reg = registry();
+			std::lock_guard<std::mutex> lock(reg.mutex);
+
+			for (auto&& cached : entries)
+			{
+				if (const auto found = reg.pools.find(cached.pool); found != reg.pools.end())
+				{
+					found->second->return_block(cached.block, cached.size_class);
+				}
+				else if (!cached.arena)
+				{
+					// 池已经销毁，保留区域也已经释放
+					system_free(cached.block);
+				}
+			}
+		}
+
+		static thread_cache& current()
+		{
+			thread_local thread_cache cache;
+			return cache;
+		}
+	};
+
+	BufferPool::BufferPool(BufferPoolOptions options) :
+		id_(register_pool(this)),
+		options_(options)
+	{
+		if (options_.arena_bytes > 0)
+		{
+			arena_ = reserve_arena(options_.arena_bytes, arena_bytes_, huge_pages_);
+			reserved_bytes_ += arena_bytes_;
+		}
+	}
+
+	BufferPool::~BufferPool()
+	{
+		{
+			auto& reg = registry();
+			std::lock_guard<std::mutex> lock(reg.mutex);
+			reg.pools.erase(id_);
+		}
+
+		// 其他线程缓存的块在线程退出时释放
+		Trim();
+
+		if (arena_)
+		{
+			release_arena(arena_, arena_bytes_);
+		}
+	}
+
+	void* BufferPool::Allocate(size_t bytes)
+	{
+		if (bytes == 0)
+		{
+			return nullptr;
+		}
+
+		// 超大的块不缓存
+		if (bytes > MaxPooledBytes)
+		{
+			auto* block = system_allocate(bytes);
+			reserved_bytes_ += bytes;
+			system_allocations_++;
+			update_high_water(in_use_bytes_ += bytes);
+			return block;
+		}
+
+		const auto size_class = size_class_of(bytes);
+		const auto block_bytes = class_bytes(size_class);
+		void* block = nullptr;
+
+		auto& entries = thread_cache::current().entries;
+
+		for (auto it = entries.rbegin(); it != entries.rend(); ++it)
+		{
+			if (it->pool == id_ && it->size_class == size_class)
+			{
+				block = it->block;
+				entries.erase(std::next(it).base());
+				reuses_++;
+				break;
+			}
+		}
+
+		if (!block)
+		{
+			block = take_block(size_class, block_bytes);
+		}
+
+		update_high_water(in_use_bytes_ += block_bytes);
+		return block;
+	}
+
+	void BufferPool::Release(void* block, size_t bytes) noexcept
+	{
+		if (!block)
+		{
+			return;
+		}
+
+		if (bytes > MaxPooledBytes)
+		{
+			system_free(block);
+			reserved_bytes_ -= bytes;
+			in_use_bytes_ -= bytes;
+			return;
+		}
+
+		const auto size_class = size_class_of(bytes);
+		const auto block_bytes = class_bytes(size_class);
+		in_use_bytes_ -= block_bytes;
+
+		if (block_bytes > options_.thread_cache_max_bytes)
+		{
+			return_block(block, size_class);
+			return;
+		}
+
+		auto& entries = thread_cache::current().entries;
+		size_t cached = 0;
+
+		for (auto&& entry : entries)
+		{
+			cached += entry.pool == id_ && entry.size_class == size_class;
+		}
+
+		if (cached < options_.thread_cache_blocks && entries.size() < entries.capacity())
+		{
+			entries.push_back({ id_, size_class, block, in_arena(block) });
+			return;
+		}
+
+		return_block(block, size_class);
+	}
+
+	void BufferPool::Trim() noexcept
+	{
+		PE_TRACE_SCOPE("BufferPool::Trim");
+
+		auto& entries = thread_cache::current().entries;
+
+		for (auto it = entries.begin(); it != entries.end();)
+		{
+			if (it->pool == id_)
+			{
+				if (it->arena)
+				{
+					return_block(it->block, it->size_class);
+				}
+				else
+				{
+					free_block(it->block, class_bytes(it->size_class));
+				}
+
+				it = entries.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		for (size_t size_class = 0; size_class < class_count; size_class++)
+		{
+			auto&& blocks = free_[size_class];
+			size_t kept = 0;
+
+			for (auto* block : blocks)
+			{
+				if (in_arena(block))
+				{
+					blocks[kept++] = block;
+				}
+				else
+				{
+					free_block(block, class_bytes(size_class));
+				}
+			}
+
+			blocks.resize(kept);
+		}
+
+		PE_TRACE_COUNTER("BufferPool.ReservedBytes", reserved_bytes_.load());
+	}
+
+	BufferPoolStats BufferPool::Stats() const noexcept
+	{
+		BufferPoolStats stats;
+		stats.reserved_bytes = reserved_bytes_.load();
+		stats.in_use_bytes = in_use_bytes_.load();
+		stats.high_water_bytes = high_water_bytes_.load();
+		stats.arena_bytes = arena_bytes_;
+		stats.huge_pages = huge_pages_;
+		stats.system_allocations = system_allocations_.load();
+		stats.reuses = reuses_.load();
+		return stats;
+	}
+
+	size_t BufferPool::BlockBytes(size_t bytes) noexcept
+	{
+		return bytes > MaxPooledBytes ? bytes : class_bytes(size_class_of(bytes));
+	}
+
+	BufferPool& BufferPool::Shared()
+	{
+		// 有意不释放，其它线程退出时仍可能归还缓存的块
+		static auto* instance = new BufferPool();
+		return *instance;
+	}
+
+	void BufferPool::return_block(void* block, size_t size_class) noexcept
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		try
+		{
+			free_[size_class].push_back(block);
+		}
+		catch (std::bad_alloc const&)
+		{
+			// 链表无法增长时直接释放，保留区域中的块留在区域里
+			if (!in_arena(block))
+			{
+				free_block(block, class_bytes(size_class));
+			}
+		}
+	}
+
+	void* BufferPool::take_block(size_t size_class, size_t block_bytes)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			auto&& blocks = free_[size_class];
+
+			if (!blocks.empty())
+			{
+				auto* block = blocks.back();
+				blocks.pop_back();
+				reuses_++;
+				return block;
+			}
+
+			if (arena_ && arena_bytes_ - arena_used_ >= block_bytes)
+			{
+				auto* block = arena_ + arena_used_;
+				arena_used_ += block_bytes;
+				return block;
+			}
+		}
+
+		PE_TRACE_SCOPE("BufferPool::system_allocate");
+
+		auto* block = system_allocate(block_bytes);
+		system_allocations_++;
+		reserved_bytes_ += block_bytes;
+		PE_TRACE_COUNTER("BufferPool.ReservedBytes", reserved_bytes_.load());
+		return block;
+	}
+
+	void BufferPool::free_block(void* block, size_t block_bytes) noexcept
+	{
+		system_free(block);
+		reserved_bytes_ -= block_bytes;
+	}
+
+	bool BufferPool::in_arena(void const* block) const noexcept
+	{
+		auto const* address = static_cast<uint8_t const*>(block);
+		return arena_ && address >= arena_ && address < arena_ + arena_bytes_;
+	}
+
+	void BufferPool::update_high_water(size_t in_use) noexcept
+	{
+		auto high_water = high_water_bytes_.load(std::memory_order_relaxed);
+
+		while (in_use > high_water && !high_water_bytes_.compare_exchange_weak(high_water, in_use, std::memory_order_relaxed))
+		{
+		}
+	}
+}
@@ -0,0 +1,228 @@
+﻿/*
+ * 像素缓冲池（与平台无关）
+ *
+ * 效果链的中间结果在每次拖动滑块、每次导出时都要申请和释放整幅图片大小的内存。
+ * 缓冲池按大小分级缓存释放的块：小块先放在线程自己的空闲链表里（不加锁），
+ * 放满之后再交给池共享的空闲链表；整幅图片大小的块直接放入共享链表，任何线程都能再用，Trim 也能还给系统；申请时依次查找线程缓存、共享链表、预留的大页区域，最后才向系统申请。
+ * 交互编辑时图片尺寸不变，第一帧之后不再向系统申请内存。所有块都对齐到缓存行。
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace PhotoCore
+{
+	// 块的对齐，与像素行的对齐相同
+	constexpr size_t BufferAlignment = 64;
+
+	/// <summary>
+	/// 缓冲池参数
+	/// </summary>
+	struct BufferPoolOptions
+	{
+		// 预先保留的连续区域大小，尽量使用大页以减少 TLB 缺失；0 表示不保留，全部向系统堆申请
+		size_t arena_bytes{ 0 };
+		// 每个线程每一级缓存的块数
+		size_t thread_cache_blocks{ 2 };
+		// 线程缓存的最大块，更大的块放入共享链表。
+		// 系统线程池的线程缓存的大块无法被其他线程使用，挂起时的 Trim 也只清理当前线程的缓存
+		size_t thread_cache_max_bytes{ size_t{ 1 } << 20 };
+	};
+
+	/// <summary>
+	/// 缓冲池的统计
+	/// </summary>
+	struct BufferPoolStats
+	{
+		// 池持有的内存：向系统申请的块和保留的区域
+		size_t reserved_bytes{ 0 };
+		// 借出未还的块，按级别大小计算
+		size_t in_use_bytes{ 0 };
+		// in_use_bytes 的最大值
+		size_t high_water_bytes{ 0 };
+		// 保留区域的大小和是否使用了大页
+		size_t arena_bytes{ 0 };
+		bool huge_pages{ false };
+		// 向系统申请的次数和从空闲链表取得的次数
+		uint64_t system_allocations{ 0 };
+		uint64_t reuses{ 0 };
+	};
+
+	/// <summary>
+	/// 按大小分级的缓冲池。大小按 2 的幂分段，每段再分为 4 级，浪费不超过 25%；
+	/// 最小一级 4 KB，超过 1 GB 的块不缓存。线程安全，池销毁之前借出的块都要归还
+	/// </summary>
+	class BufferPool
+	{
+	public:
+		static constexpr size_t MinBlockBytes = 4096;
+		static constexpr size_t MaxPooledBytes = size_t{ 1 } << 30;
+
+		explicit BufferPool(BufferPoolOptions options = {});
+
+		BufferPool(BufferPool const&) = delete;
+		BufferPool& operator=(BufferPool const&) = delete;
+
+		~BufferPool();
+
+		/// <summary>
+		/// 借出至少 bytes 字节、对齐到 BufferAlignment 的块，内容未初始化
+		/// </summary>
+		/// <param name="bytes">字节数</param>
+		/// <returns>块，bytes 为 0 时为空</returns>
+		[[nodiscard]] void* Allocate(size_t bytes);
+
+		/// <summary>
+		/// 归还 Allocate 借出的块
+		/// </summary>
+		/// <param name="block">块</param>
+		/// <param name="bytes">借出时的字节数</param>
+		void Release(void* block, size_t bytes) noexcept;
+
+		/// <summary>
+		/// 把共享链表和当前线程缓存中的空闲块还给系统，保留区域中的块留在池中
+		/// </summary>
+		void Trim() noexcept;
+
+		[[nodiscard]] BufferPoolStats Stats() const noexcept;
+
+		/// <summary>
+		/// bytes 字节所在级别的块大小
+		/// </summary>
+		static size_t BlockBytes(size_t bytes) noexcept;
+
+		/// <summary>
+		/// 进程共享的缓冲池，不保留区域
+		/// </summary>
+		/// <returns>缓冲池</returns>
+		static BufferPool& Shared();
+
+	private:
+		static constexpr size_t class_count = 73;
+
+		// 线程自己的空闲链表，定义在 BufferPool.cpp
+		struct thread_cache;
+
+		/// <summary>
+		/// 把块放入共享链表，加锁
+		/// </summary>
+		void return_block(void* block, size_t size_class) noexcept;
+
+		void* take_block(size_t size_class, size_t block_bytes);
+		void free_block(void* block, size_t block_bytes) noexcept;
+		bool in_arena(void const* block) const noexcept;
+		void update_high_water(size_t in_use) noexcept;
+
+		const uint64_t id_;
+		const BufferPoolOptions options_;
+
+		mutable std::mutex mutex_;
+		std::array<std::vector<void*>, class_count> free_;
+
+		// 保留区域，按顺序切出块，切出的块之后和其他块一样在空闲链表中循环
+		uint8_t* arena_{ nullptr };
+		size_t arena_bytes_{ 0 };
+		size_t arena_used_{ 0 };
+		bool huge_pages_{ false };
+
+		std::atomic<size_t> reserved_bytes_{ 0 };
+		std::atomic<size_t> in_use_bytes_{ 0 };
+		std::atomic<size_t> high_water_bytes_{ 0 };
+		std::atomic<uint64_t> system_allocations_{ 0 };
+		std::atomic<uint64_t> reuses_{ 0 };
+	};
+
+	/// <summary>
+	/// 从缓冲池借出的数组，析构时归还。元素不初始化，只用于可以按字节复制的类型
+	/// </summary>
+	template <class T>
+	class PooledArray
+	{
+		static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>, "PooledArray 的元素不构造也不析构");
+
+	public:
+		PooledArray() = default;
+
+		explicit PooledArray(size_t size, BufferPool& pool = BufferPool::Shared()) :
+			pool_(&pool),
+			data_(static_cast<T*>(pool.Allocate(size * sizeof(T)))),
+			size_(size)
+		{
+		}
+
+		PooledArray(PooledArray&& other) noexcept :
+			pool_(std::exchange(other.pool_, nullptr)),
+			data_(std::exchange(other.data_, nullptr)),
+			size_(std::exchange(other.size_, 0))
+		{
+		}
+
+		PooledArray& operator=(PooledArray&& other) noexcept
+		{
+			if (this != &other)
+			{
+				release();
+				pool_ = std::exchange(other.pool_, nullptr);
+				data_ = std::exchange(other.data_, nullptr);
+				size_ = std::exchange(other.size_, 0);
+			}
+
+			return *this;
+		}
+
+		PooledArray(PooledArray const&) = delete;
+		PooledArray& operator=(PooledArray const&) = delete;
+
+		~PooledArray()
+		{
+			release();
+		}
+
+		[[nodiscard]] T* Data() const noexcept
+		{
+			return data_;
+		}
+
+		[[nodiscard]] size_t Size() const noexcept
+		{
+			return size_;
+		}
+
+		T& operator[](size_t index) const noexcept
+		{
+			return data_[index];
+		}
+
+		T* begin() const noexcept
+		{
+			return data_;
+		}
+
+		T* end() const noexcept
+		{
+			return data_ + size_;
+		}
+
+	private:
+		void release() noexcept
+		{
+			if (data_)
+			{
+				pool_->Release(data_, size_ * sizeof(T));
+				data_ = nullptr;
+			}
+		}
+
+		BufferPool* pool_{ nullptr };
+		T* data_{ nullptr };
+		size_t size_{ 0 };
+	};
+}
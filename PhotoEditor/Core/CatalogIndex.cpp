@@ -0,0 +1,452 @@
+﻿/*
+ * 照片目录的排序索引和筛选代码
+ */
+
+#include "CatalogIndex.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		constexpr size_t key_index(SortKey key) noexcept
+		{
+			return static_cast<size_t>(key);
+		}
+
+		constexpr bool is_numeric(SortKey key) noexcept
+		{
+			return key == SortKey::Width || key == SortKey::Height || key == SortKey::Megapixels || key == SortKey::Date;
+		}
+
+		char fold_case(char c) noexcept
+		{
+			return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+		}
+
+		/// <summary>
+		/// 忽略 ASCII 大小写的比较，其他字符按字节比较
+		/// </summary>
+		int compare_folded(std::string_view left, std::string_view right) noexcept
+		{
+			const auto length = std::min(left.size(), right.size());
+
+			for (size_t i = 0; i < length; i++)
+			{
+				const auto a = static_cast<unsigned char>(fold_case(left[i]));
+				const auto b = static_cast<unsigned char>(fold_case(right[i]));
+
+				if (a != b)
+				{
+					return a < b ? -1 : 1;
+				}
+			}
+
+			return left.size() == right.size() ? 0 : left.size() < right.size() ? -1 : 1;
+		}
+
+		/// <summary>
+		/// 忽略大小写的前 8 个字节，按大端排列，大小关系与 compare_folded 一致
+		/// </summary>
+		uint64_t folded_prefix(std::string_view value) noexcept
+		{
+			uint64_t prefix = 0;
+
+			for (size_t i = 0; i < 8; i++)
+			{
+				prefix = prefix << 8 | (i < value.size() ? static_cast<unsigned char>(fold_case(value[i])) : 0u);
+			}
+
+			return prefix;
+		}
+
+		/// <summary>
+		/// 按键比较，键相同时按 ID
+		/// </summary>
+		template <class KeyOf>
+		auto by_key(KeyOf key_of) noexcept
+		{
+			return [key_of](PhotoId left, PhotoId right)
+			{
+				const auto a = key_of(left);
+				const auto b = key_of(right);
+				return a != b ? a < b : left < right;
+			};
+		}
+
+		/// <summary>
+		/// 排序 [first_new, end) 中新加入的 ID，再和前面已经排好的部分归并到 scratch 中交换回来。
+		/// 不用 std::inplace_merge：缓冲区不够时它会退化为递归的旋转
+		/// </summary>
+		template <class Compare>
+		void merge_new(std::vector<PhotoId>& index, size_t first_new, std::vector<PhotoId>& scratch, Compare compare)
+		{
+			const auto middle = index.begin() + static_cast<std::ptrdiff_t>(first_new);
+			std::sort(middle, index.end(), compare);
+
+			if (first_new == 0)
+			{
+				return;
+			}
+
+			scratch.resize(index.size());
+			std::merge(index.begin(), middle, middle, index.end(), scratch.begin(), compare);
+			index.swap(scratch);
+		}
+
+		bool is_unconstrained(PhotoFilter const& filter) noexcept
+		{
+			const PhotoFilter none;
+
+			return filter.min_width == none.min_width && filter.max_width == none.max_width
+				&& filter.min_height == none.min_height && filter.max_height == none.max_height
+				&& filter.min_pixels == none.min_pixels && filter.max_pixels == none.max_pixels
+				&& filter.min_time == none.min_time && filter.max_time == none.max_time
+				&& filter.formats == 0 && filter.shape == PhotoShape::Any && !filter.valid_only && !filter.ids;
+		}
+	}
+
+	void CatalogIndex::Update()
+	{
+		const auto end = catalog_.Size();
+
+		if (end == indexed_)
+		{
+			return;
+		}
+
+		PE_TRACE_SCOPE("CatalogIndex::Update");
+
+		for (auto id = indexed_; id < end; id++)
+		{
+			title_prefixes_.push_back(folded_prefix(catalog_.DisplayTitle(static_cast<PhotoId>(id))));
+		}
+
+		const auto first_new = indexed_;
+
+		for (size_t key = 0; key < key_count; key++)
+		{
+			if (key == key_index(SortKey::Added))
+			{
+				continue;
+			}
+
+			for (auto id = indexed_; id < end; id++)
+			{
+				sorted_[key].push_back(static_cast<PhotoId>(id));
+			}
+		}
+
+		// 每个键用单独的比较函数，直接读取列数据
+		auto const* const widths = catalog_.Widths().data();
+		auto const* const heights = catalog_.Heights().data();
+		auto const* const times = catalog_.ModifiedTimes().data();
+
+		merge_new(sorted_[key_index(SortKey::Width)], first_new, scratch_, by_key([widths](PhotoId id)
+		{
+			return widths[id];
+		}));
+
+		merge_new(sorted_[key_index(SortKey::Height)], first_new, scratch_, by_key([heights](PhotoId id)
+		{
+			return heights[id];
+		}));
+
+		merge_new(sorted_[key_index(SortKey::Megapixels)], first_new, scratch_, by_key([widths, heights](PhotoId id)
+		{
+			return static_cast<uint64_t>(widths[id]) * heights[id];
+		}));
+
+		merge_new(sorted_[key_index(SortKey::Date)], first_new, scratch_, by_key([times](PhotoId id)
+		{
+			return times[id];
+		}));
+
+		merge_new(sorted_[key_index(SortKey::Type)], first_new, scratch_, [this](PhotoId left, PhotoId right)
+		{
+			return less(SortKey::Type, left, right);
+		});
+
+		merge_new(sorted_[key_index(SortKey::Title)], first_new, scratch_, [this](PhotoId left, PhotoId right)
+		{
+			return less(SortKey::Title, left, right);
+		});
+		indexed_ = end;
+	}
+
+	void CatalogIndex::TitleChanged(PhotoId id)
+	{
+		if (id >= indexed_)
+		{
+			return;
+		}
+
+		title_prefixes_[id] = folded_prefix(catalog_.DisplayTitle(id));
+
+		auto& index = sorted_[key_index(SortKey::Title)];
+		const auto found = std::find(index.begin(), index.end(), id);
+
+		if (found != index.end())
+		{
+			index.erase(found);
+		}
+
+		const auto position = std::upper_bound(index.begin(), index.end(), id, [this](PhotoId left, PhotoId right)
+		{
+			return less(SortKey::Title, left, right);
+		});
+
+		index.insert(position, id);
+	}
+
+	std::vector<PhotoId> const& CatalogIndex::Sorted(SortKey key) const
+	{
+		if (key == SortKey::Added)
+		{
+			throw std::invalid_argument("加入顺序没有索引");
+		}
+
+		return sorted_[key_index(key)];
+	}
+
+	std::pair<size_t, size_t> CatalogIndex::Range(SortKey key, int64_t low, int64_t high) const
+	{
+		if (!is_numeric(key))
+		{
+			throw std::invalid_argument("只有数值键可以按范围查询");
+		}
+
+		auto const& index = sorted_[key_index(key)];
+
+		const auto first = std::partition_point(index.begin(), index.end(), [&](PhotoId id)
+		{
+			return numeric_key(key, id) < low;
+		});
+
+		const auto last = std::partition_point(first, index.end(), [&](PhotoId id)
+		{
+			return numeric_key(key, id) <= high;
+		});
+
+		return { static_cast<size_t>(first - index.begin()), static_cast<size_t>(last - index.begin()) };
+	}
+
+	std::vector<PhotoId> CatalogIndex::Query(PhotoFilter const& filter, SortKey key, bool descending) const
+	{
+		PE_TRACE_SCOPE("CatalogIndex::Query");
+
+		std::vector<PhotoId> result;
+
+		if (is_unconstrained(filter))
+		{
+			if (key == SortKey::Added)
+			{
+				result.resize(indexed_);
+
+				for (size_t id = 0; id < indexed_; id++)
+				{
+					result[id] = static_cast<PhotoId>(id);
+				}
+			}
+			else
+			{
+				result = sorted_[key_index(key)];
+			}
+		}
+		else
+		{
+			const auto mask = Match(filter);
+			result.resize(indexed_);
+			size_t count = 0;
+
+			// 无分支地收集：总是写入，满足条件时才前进，避免难以预测的分支
+			if (key == SortKey::Added)
+			{
+				for (size_t id = 0; id < indexed_; id++)
+				{
+					result[count] = static_cast<PhotoId>(id);
+					count += mask[id];
+				}
+			}
+			else
+			{
+				for (auto id : sorted_[key_index(key)])
+				{
+					result[count] = id;
+					count += mask[id];
+				}
+			}
+
+			result.resize(count);
+		}
+
+		if (descending)
+		{
+			std::reverse(result.begin(), result.end());
+		}
+
+		return result;
+	}
+
+	std::vector<uint8_t> CatalogIndex::Match(PhotoFilter const& filter) const
+	{
+		PE_TRACE_SCOPE("CatalogIndex::Match");
+
+		const auto count = indexed_;
+		std::vector<uint8_t> mask(count, 1);
+		auto* const out = mask.data();
+
+		auto const* const widths = catalog_.Widths().data();
+		auto const* const heights = catalog_.Heights().data();
+		const PhotoFilter none;
+
+		// 每个条件单独扫描一遍相关的列，循环中没有分支，编译器可以向量化；没有限制的条件跳过
+		if (filter.min_width != none.min_width || filter.max_width != none.max_width)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				out[i] &= static_cast<uint8_t>((widths[i] >= filter.min_width) & (widths[i] <= filter.max_width));
+			}
+		}
+
+		if (filter.min_height != none.min_height || filter.max_height != none.max_height)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				out[i] &= static_cast<uint8_t>((heights[i] >= filter.min_height) & (heights[i] <= filter.max_height));
+			}
+		}
+
+		if (filter.min_pixels != none.min_pixels || filter.max_pixels != none.max_pixels)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				const auto pixels = static_cast<uint64_t>(widths[i]) * heights[i];
+				out[i] &= static_cast<uint8_t>((pixels >= filter.min_pixels) & (pixels <= filter.max_pixels));
+			}
+		}
+
+		if (filter.min_time != none.min_time || filter.max_time != none.max_time)
+		{
+			auto const* const times = catalog_.ModifiedTimes().data();
+
+			for (size_t i = 0; i < count; i++)
+			{
+				out[i] &= static_cast<uint8_t>((times[i] >= filter.min_time) & (times[i] <= filter.max_time));
+			}
+		}
+
+		if (filter.formats != 0)
+		{
+			auto const* const formats = catalog_.Formats().data();
+
+			for (size_t i = 0; i < count; i++)
+			{
+				out[i] &= static_cast<uint8_t>((filter.formats >> static_cast<uint8_t>(formats[i])) & 1);
+			}
+		}
+
+		switch (filter.shape)
+		{
+		case PhotoShape::Landscape:
+			for (size_t i = 0; i < count; i++)
+			{
+				out[i] &= static_cast<uint8_t>(widths[i] > heights[i]);
+			}
+			break;
+
+		case PhotoShape::Portrait:
+			for (size_t i = 0; i < count; i++)
+			{
+				out[i] &= static_cast<uint8_t>(heights[i] > widths[i]);
+			}
+			break;
+
+		case PhotoShape::Square:
+			for (size_t i = 0; i < count; i++)
+			{
+				out[i] &= static_cast<uint8_t>(heights[i] == widths[i]);
+			}
+			break;
+
+		case PhotoShape::Any:
+			break;
+		}
+
+		if (filter.valid_only)
+		{
+			auto const* const flags = catalog_.Flags().data();
+
+			for (size_t i = 0; i < count; i++)
+			{
+				out[i] &= static_cast<uint8_t>(flags[i] & PhotoCatalog::flag_valid);
+			}
+		}
+
+		if (filter.ids)
+		{
+			std::vector<uint8_t> selected(count, 0);
+
+			for (auto id : *filter.ids)
+			{
+				if (id < count)
+				{
+					selected[id] = 1;
+				}
+			}
+
+			for (size_t i = 0; i < count; i++)
+			{
+				out[i] &= selected[i];
+			}
+		}
+
+		return mask;
+	}
+
+	int64_t CatalogIndex::numeric_key(SortKey key, PhotoId id) const noexcept
+	{
+		switch (key)
+		{
+		case SortKey::Width:
+			return catalog_.Width(id);
+		case SortKey::Height:
+			return catalog_.Height(id);
+		case SortKey::Megapixels:
+			return static_cast<int64_t>(static_cast<uint64_t>(catalog_.Width(id)) * catalog_.Height(id));
+		case SortKey::Date:
+			return catalog_.ModifiedTime(id);
+		default:
+			return id;
+		}
+	}
+
+	bool CatalogIndex::less(SortKey key, PhotoId left, PhotoId right) const noexcept
+	{
+		int order;
+
+		if (key == SortKey::Type)
+		{
+			// 类型字符串经过去重，ID 相同就不需要比较字符串
+			order = catalog_.TypeId(left) == catalog_.TypeId(right) ? 0 : catalog_.Type(left).compare(catalog_.Type(right));
+		}
+		else if (key == SortKey::Title)
+		{
+			// 多数标题在前 8 个字节就能比较出来
+			const auto a = title_prefixes_[left];
+			const auto b = title_prefixes_[right];
+			order = a != b ? (a < b ? -1 : 1) : compare_folded(catalog_.DisplayTitle(left), catalog_.DisplayTitle(right));
+		}
+		else
+		{
+			const auto a = numeric_key(key, left);
+			const auto b = numeric_key(key, right);
+			order = a < b ? -1 : a > b ? 1 : 0;
+		}
+
+		return order != 0 ? order < 0 : left < right;
+	}
+}
@@ -0,0 +1,149 @@
+﻿/*
+ * 照片目录的排序索引和筛选（与平台无关）
+ *
+ * 每个排序键维护一个按键排好序的照片 ID 数组，扫描加入照片时只排序新加入的部分再归并，
+ * 排序查询直接返回已有的数组。筛选按列顺序扫描，先对整列计算是否满足条件，
+ * 再按排序索引的顺序收集满足条件的 ID。结果可以直接作为网格的显示顺序。
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "PhotoCatalog.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 排序键
+	/// </summary>
+	enum class SortKey : uint8_t
+	{
+		// 加入目录的顺序，也就是扫描的顺序
+		Added,
+		Width,
+		Height,
+		// 像素数
+		Megapixels,
+		Type,
+		// 文件日期
+		Date,
+		// 标题，没有标题时为名称
+		Title
+	};
+
+	/// <summary>
+	/// 方向筛选
+	/// </summary>
+	enum class PhotoShape : uint8_t
+	{
+		Any,
+		// 宽大于高
+		Landscape,
+		// 高大于宽
+		Portrait,
+		Square
+	};
+
+	/// <summary>
+	/// 筛选条件，默认不筛选。范围都包括两端
+	/// </summary>
+	struct PhotoFilter
+	{
+		uint32_t min_width{ 0 };
+		uint32_t max_width{ std::numeric_limits<uint32_t>::max() };
+		uint32_t min_height{ 0 };
+		uint32_t max_height{ std::numeric_limits<uint32_t>::max() };
+		uint64_t min_pixels{ 0 };
+		uint64_t max_pixels{ std::numeric_limits<uint64_t>::max() };
+		int64_t min_time{ std::numeric_limits<int64_t>::min() };
+		int64_t max_time{ std::numeric_limits<int64_t>::max() };
+		// 允许的格式，第 i 位对应 ImageFormat 的值 i，为 0 时不限
+		uint8_t formats{ 0 };
+		PhotoShape shape{ PhotoShape::Any };
+		// 只保留有效的图片
+		bool valid_only{ false };
+		// 只保留这些照片，例如搜索的结果；为空指针时不限
+		std::vector<PhotoId> const* ids{ nullptr };
+	};
+
+	/// <summary>
+	/// 照片目录的排序索引。只能和目录在同一个线程上使用
+	/// </summary>
+	class CatalogIndex
+	{
+	public:
+		explicit CatalogIndex(PhotoCatalog const& catalog) noexcept :
+			catalog_(catalog)
+		{
+		}
+
+		/// <summary>
+		/// 把目录中新加入的照片加入索引
+		/// </summary>
+		void Update();
+
+		/// <summary>
+		/// 照片的标题改变之后调用，重新确定它在标题索引中的位置
+		/// </summary>
+		/// <param name="id">照片 ID</param>
+		void TitleChanged(PhotoId id);
+
+		/// <summary>
+		/// 已经加入索引的照片数
+		/// </summary>
+		[[nodiscard]] size_t Size() const noexcept
+		{
+			return indexed_;
+		}
+
+		/// <summary>
+		/// 按键升序排好的照片 ID，键相同时按 ID。Added 没有索引，抛出 std::invalid_argument
+		/// </summary>
+		[[nodiscard]] std::vector<PhotoId> const& Sorted(SortKey key) const;
+
+		/// <summary>
+		/// 数值键在 [low, high] 范围内的照片在 Sorted(key) 中的位置 [first, last)。
+		/// Type、Title 和 Added 抛出 std::invalid_argument
+		/// </summary>
+		[[nodiscard]] std::pair<size_t, size_t> Range(SortKey key, int64_t low, int64_t high) const;
+
+		/// <summary>
+		/// 筛选并排序
+		/// </summary>
+		/// <param name="filter">筛选条件</param>
+		/// <param name="key">排序键</param>
+		/// <param name="descending">是否降序</param>
+		/// <returns>照片 ID</returns>
+		[[nodiscard]] std::vector<PhotoId> Query(PhotoFilter const& filter, SortKey key, bool descending = false) const;
+
+		/// <summary>
+		/// 按列计算每张照片是否满足条件
+		/// </summary>
+		/// <param name="filter">筛选条件</param>
+		/// <returns>每张已索引的照片一项，满足时为 1</returns>
+		[[nodiscard]] std::vector<uint8_t> Match(PhotoFilter const& filter) const;
+
+	private:
+		static constexpr size_t key_count = 7;
+
+		PhotoCatalog const& catalog_;
+		size_t indexed_{ 0 };
+
+		// 每个排序键一个索引，Added 不使用
+		std::array<std::vector<PhotoId>, key_count> sorted_;
+
+		// 每张照片标题忽略大小写的前 8 个字节，比较标题时先比较这一项
+		std::vector<uint64_t> title_prefixes_;
+
+		// 归并用的缓冲区，和索引交换使用
+		std::vector<PhotoId> scratch_;
+
+		[[nodiscard]] int64_t numeric_key(SortKey key, PhotoId id) const noexcept;
+		[[nodiscard]] bool less(SortKey key, PhotoId left, PhotoId right) const noexcept;
+	};
+}
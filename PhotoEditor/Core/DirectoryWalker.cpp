@@ -0,0 +1,276 @@
+﻿/*
+ * 并行目录遍历代码
+ */
+
+#include "DirectoryWalker.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <exception>
+
+namespace PhotoCore
+{
+	DirectoryWalker::DirectoryWalker(LibraryProvider const& provider, std::string const& folder, WalkOptions options) :
+		provider_(provider),
+		options_(std::move(options))
+	{
+		const auto thread_count = std::max<size_t>(options_.thread_count, 1);
+
+		for (size_t i = 0; i < thread_count; i++)
+		{
+			queues_.push_back(std::make_unique<folder_queue>());
+		}
+
+		queues_[0]->folders.push_back(folder);
+		outstanding_ = 1;
+		queued_ = 1;
+		running_workers_ = thread_count;
+
+		workers_.reserve(thread_count);
+
+		for (size_t i = 0; i < thread_count; i++)
+		{
+			workers_.emplace_back([this, i] { worker_loop(i); });
+		}
+	}
+
+	DirectoryWalker::~DirectoryWalker()
+	{
+		Cancel();
+
+		for (auto&& worker : workers_)
+		{
+			worker.join();
+		}
+	}
+
+	bool DirectoryWalker::Next(std::vector<ScannedFile>& files)
+	{
+		std::unique_lock<std::mutex> lock(output_mutex_);
+		output_ready_.wait(lock, [this] { return !output_.empty() || running_workers_ == 0; });
+
+		if (output_.empty())
+		{
+			return false;
+		}
+
+		files = std::move(output_.front());
+		output_.pop_front();
+		output_size_--;
+		return true;
+	}
+
+	void DirectoryWalker::Cancel()
+	{
+		stopping_ = true;
+
+		{
+			std::lock_guard<std::mutex> lock(idle_mutex_);
+		}
+
+		idle_.notify_all();
+
+		// 已经交出但还没有取走的批次不再需要
+		std::lock_guard<std::mutex> lock(output_mutex_);
+		output_.clear();
+		output_size_ = 0;
+	}
+
+	WalkStats DirectoryWalker::Stats() const
+	{
+		WalkStats stats;
+		stats.folders = folders_;
+		stats.files = files_;
+		stats.steals = steals_;
+		stats.failed_folders = failed_folders_;
+		stats.batches = batches_;
+		return stats;
+	}
+
+	void DirectoryWalker::worker_loop(size_t index)
+	{
+		PE_TRACE_THREAD_NAME("DirectoryWalker worker");
+
+		std::vector<ScannedFile> batch;
+		std::string folder;
+
+		while (!stopping_)
+		{
+			if (pop_local(index, folder) || steal(index, folder))
+			{
+				list_folder(index, folder, batch);
+				continue;
+			}
+
+			// 没有可做的目录，先交出手上的文件，再等其它线程发现新目录
+			deliver(batch);
+
+			std::unique_lock<std::mutex> lock(idle_mutex_);
+			idle_.wait(lock, [this] { return stopping_ || queued_ > 0 || outstanding_ == 0; });
+
+			if (outstanding_ == 0)
+			{
+				break;
+			}
+		}
+
+		deliver(batch);
+
+		std::lock_guard<std::mutex> lock(output_mutex_);
+
+		if (--running_workers_ == 0)
+		{
+			output_ready_.notify_all();
+		}
+	}
+
+	bool DirectoryWalker::pop_local(size_t index, std::string& folder)
+	{
+		auto& queue = *queues_[index];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		if (queue.folders.empty())
+		{
+			return false;
+		}
+
+		folder = std::move(queue.folders.back());
+		queue.folders.pop_back();
+		queued_--;
+		return true;
+	}
+
+	bool DirectoryWalker::steal(size_t index, std::string& folder)
+	{
+		if (queued_ == 0)
+		{
+			return false;
+		}
+
+		for (size_t offset = 1; offset < queues_.size(); offset++)
+		{
+			auto& queue = *queues_[(index + offset) % queues_.size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+
+			if (!queue.folders.empty())
+			{
+				folder = std::move(queue.folders.front());
+				queue.folders.pop_front();
+				queued_--;
+				steals_++;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void DirectoryWalker::list_folder(size_t index, std::string const& folder, std::vector<ScannedFile>& batch)
+	{
+		PE_TRACE_SCOPE("DirectoryWalker::list_folder");
+
+		std::vector<FileEntry> entries;
+
+		try
+		{
+			entries = provider_.ListFolder(folder);
+		}
+		catch (std::exception const&)
+		{
+			// 打不开的目录跳过，不影响其它目录
+			failed_folders_++;
+		}
+
+		size_t subfolders = 0;
+
+		{
+			auto& queue = *queues_[index];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+
+			for (auto&& entry : entries)
+			{
+				if (entry.is_folder)
+				{
+					queue.folders.push_back(JoinPath(folder, entry.name));
+					subfolders++;
+				}
+			}
+
+			// 先计入子目录再完成当前目录，outstanding_ 不会在中途变成 0
+			outstanding_ += subfolders;
+			queued_ += subfolders;
+		}
+
+		for (auto&& entry : entries)
+		{
+			if (!entry.is_folder && (options_.filter ? options_.filter(entry.name) : IsImageFileName(entry.name)))
+			{
+				batch.push_back({ JoinPath(folder, entry.name), entry.size_bytes, entry.modified_time });
+
+				// 很大的目录也分成几批交出
+				if (batch.size() >= options_.batch_size)
+				{
+					deliver(batch);
+				}
+			}
+		}
+
+		folders_++;
+		const auto finished = --outstanding_ == 0;
+
+		// 有新目录时叫醒空闲的线程来窃取；全部完成时让它们退出
+		if (subfolders > 1 || finished)
+		{
+			{
+				std::lock_guard<std::mutex> lock(idle_mutex_);
+			}
+
+			finished ? idle_.notify_all() : idle_.notify_one();
+		}
+
+		// 调用方在等待时不凑满一批，尽快显示第一屏
+		if (!batch.empty() && output_size_ == 0)
+		{
+			deliver(batch);
+		}
+	}
+
+	void DirectoryWalker::deliver(std::vector<ScannedFile>& batch)
+	{
+		if (batch.empty() || stopping_)
+		{
+			batch.clear();
+			return;
+		}
+
+		files_ += batch.size();
+		batches_++;
+
+		{
+			std::lock_guard<std::mutex> lock(output_mutex_);
+			output_.push_back(std::move(batch));
+			output_size_++;
+		}
+
+		batch = {};
+		batch.reserve(options_.batch_size);
+		output_ready_.notify_one();
+	}
+
+	std::vector<ScannedFile> WalkImageFiles(LibraryProvider const& provider, std::string const& folder, WalkOptions const& options)
+	{
+		PE_TRACE_SCOPE("WalkImageFiles");
+
+		std::vector<ScannedFile> files;
+		std::vector<ScannedFile> batch;
+		DirectoryWalker walker(provider, folder, options);
+
+		while (walker.Next(batch))
+		{
+			files.insert(files.end(), std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()));
+		}
+
+		PE_TRACE_COUNTER("WalkImageFiles.Files", files.size());
+		return files;
+	}
+}
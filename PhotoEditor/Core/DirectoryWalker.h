@@ -0,0 +1,151 @@
+﻿/*
+ * 并行目录遍历（与平台无关）
+ *
+ * EnumerateImageFiles 在一个线程上逐个列出目录，全部列完才返回；深层的图库要等很久才能显示第一张。
+ * 这里每个工作线程有自己的目录队列，新发现的子目录放进自己的队列，从队尾取（深度优先，局部性好）；
+ * 自己的队列空了就从其它线程的队头窃取（较浅的目录，包含的子树大）。
+ * 遍历时就按后缀名过滤，找到的文件按批交给调用方，调用方可以在遍历的同时读取文件头。
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LibraryScanner.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 默认的遍历线程数。列出目录主要是等待 I/O，线程数是核心数的两倍，至少 4 个
+	/// </summary>
+	inline size_t DefaultWalkThreadCount()
+	{
+		return std::clamp<size_t>(std::thread::hardware_concurrency() * 2, 4, 16);
+	}
+
+	/// <summary>
+	/// 遍历参数
+	/// </summary>
+	struct WalkOptions
+	{
+		// 工作线程数
+		size_t thread_count{ DefaultWalkThreadCount() };
+		// 每批最多的文件数。调用方在等待时，不满一批也立即交出
+		size_t batch_size{ 256 };
+		// 是否保留文件，为空时只保留 .jpg、.png 和 .gif
+		std::function<bool(std::string const& name)> filter;
+	};
+
+	/// <summary>
+	/// 遍历统计
+	/// </summary>
+	struct WalkStats
+	{
+		size_t folders{ 0 };
+		size_t files{ 0 };
+		// 从其它线程的队列窃取的目录数
+		size_t steals{ 0 };
+		// 列出失败（例如没有权限）、被跳过的目录数
+		size_t failed_folders{ 0 };
+		size_t batches{ 0 };
+	};
+
+	/// <summary>
+	/// 后台并行遍历一个目录树。构造时开始遍历，调用方用 Next 逐批取得文件；
+	/// 文件的顺序不确定。Next 只能在一个线程上调用。析构时停止遍历并等待工作线程退出
+	/// </summary>
+	class DirectoryWalker
+	{
+	public:
+		DirectoryWalker(LibraryProvider const& provider, std::string const& folder = {}, WalkOptions options = {});
+
+		DirectoryWalker(DirectoryWalker const&) = delete;
+		DirectoryWalker& operator=(DirectoryWalker const&) = delete;
+
+		~DirectoryWalker();
+
+		/// <summary>
+		/// 等待下一批文件
+		/// </summary>
+		/// <param name="files">输出的文件，原有内容被替换</param>
+		/// <returns>遍历结束、没有更多文件时为 false</returns>
+		bool Next(std::vector<ScannedFile>& files);
+
+		/// <summary>
+		/// 停止遍历，之后 Next 返回 false
+		/// </summary>
+		void Cancel();
+
+		/// <summary>
+		/// 统计，遍历结束之后是最终结果
+		/// </summary>
+		/// <returns>统计快照</returns>
+		[[nodiscard]] WalkStats Stats() const;
+
+	private:
+		/// <summary>
+		/// 一个工作线程的目录队列
+		/// </summary>
+		struct folder_queue
+		{
+			std::mutex mutex;
+			std::deque<std::string> folders;
+		};
+
+		void worker_loop(size_t index);
+		bool pop_local(size_t index, std::string& folder);
+		bool steal(size_t index, std::string& folder);
+		void list_folder(size_t index, std::string const& folder, std::vector<ScannedFile>& batch);
+		void deliver(std::vector<ScannedFile>& batch);
+
+		LibraryProvider const& provider_;
+		const WalkOptions options_;
+
+		std::vector<std::unique_ptr<folder_queue>> queues_;
+
+		// 已经放入队列、还没有列完的目录数，为 0 时遍历结束
+		std::atomic<size_t> outstanding_{ 0 };
+		// 还在队列中等待的目录数，空闲的线程据此决定是否醒来
+		std::atomic<size_t> queued_{ 0 };
+		std::atomic<bool> stopping_{ false };
+		std::mutex idle_mutex_;
+		std::condition_variable idle_;
+
+		// 交给调用方的批次
+		mutable std::mutex output_mutex_;
+		std::condition_variable output_ready_;
+		std::deque<std::vector<ScannedFile>> output_;
+		std::atomic<size_t> output_size_{ 0 };
+		size_t running_workers_{ 0 };
+
+		// 统计
+		std::atomic<size_t> folders_{ 0 };
+		std::atomic<size_t> files_{ 0 };
+		std::atomic<size_t> steals_{ 0 };
+		std::atomic<size_t> failed_folders_{ 0 };
+		std::atomic<size_t> batches_{ 0 };
+
+		// 必须最后声明，保证工作线程启动时其它成员已构造
+		std::vector<std::thread> workers_;
+	};
+
+	/// <summary>
+	/// 并行遍历目录下的所有图片文件，结果和 EnumerateImageFiles 相同，顺序不确定
+	/// </summary>
+	/// <param name="provider">图库</param>
+	/// <param name="folder">起始目录</param>
+	/// <param name="options">遍历参数</param>
+	/// <returns>图片文件</returns>
+	std::vector<ScannedFile> WalkImageFiles(LibraryProvider const& provider, std::string const& folder = {}, WalkOptions const& options = {});
+}
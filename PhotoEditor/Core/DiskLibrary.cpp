@@ -0,0 +1,63 @@
+﻿/*
+ * 磁盘图库代码
+ */
+
+#include "DiskLibrary.h"
+
+#include <chrono>
+#include <fstream>
+#include <stdexcept>
+
+namespace PhotoCore
+{
+	DiskLibrary::DiskLibrary(std::filesystem::path root) :
+		root_(std::move(root))
+	{
+	}
+
+	std::vector<FileEntry> DiskLibrary::ListFolder(std::string const& folder) const
+	{
+		std::vector<FileEntry> entries;
+		std::error_code error;
+
+		for (std::filesystem::directory_iterator it(full_path(folder), error), end; !error && it != end; it.increment(error))
+		{
+			FileEntry entry;
+			entry.name = it->path().filename().u8string();
+			entry.is_folder = it->is_directory(error);
+
+			if (!entry.is_folder)
+			{
+				entry.size_bytes = it->file_size(error);
+			}
+
+			// 纪元与具体的时钟有关，只用于比较先后
+			const auto modified = it->last_write_time(error);
+			entry.modified_time = std::chrono::duration_cast<std::chrono::seconds>(modified.time_since_epoch()).count();
+
+			entries.push_back(std::move(entry));
+			error.clear();
+		}
+
+		return entries;
+	}
+
+	size_t DiskLibrary::ReadBytes(std::string const& path, uint64_t offset, uint8_t* buffer, size_t size) const
+	{
+		std::ifstream file(full_path(path), std::ios::binary);
+
+		if (!file)
+		{
+			throw std::runtime_error("cannot open " + path);
+		}
+
+		file.seekg(static_cast<std::streamoff>(offset));
+		file.read(reinterpret_cast<char*>(buffer), static_cast<std::streamsize>(size));
+		return static_cast<size_t>(file.gcount());
+	}
+
+	std::filesystem::path DiskLibrary::full_path(std::string const& path) const
+	{
+		return path.empty() ? root_ : root_ / std::filesystem::u8path(path);
+	}
+}
@@ -0,0 +1,34 @@
+﻿/*
+ * 磁盘目录上的图库提供者（与平台无关）
+ */
+
+#pragma once
+
+#include <filesystem>
+
+#include "LibraryProvider.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 以磁盘上的一个目录作为图库根目录，使用 std::filesystem 访问
+	/// </summary>
+	class DiskLibrary final : public LibraryProvider
+	{
+	public:
+		explicit DiskLibrary(std::filesystem::path root);
+
+		std::vector<FileEntry> ListFolder(std::string const& folder) const override;
+		size_t ReadBytes(std::string const& path, uint64_t offset, uint8_t* buffer, size_t size) const override;
+
+		[[nodiscard]] std::filesystem::path const& Root() const noexcept
+		{
+			return root_;
+		}
+
+	private:
+		std::filesystem::path full_path(std::string const& path) const;
+
+		std::filesystem::path root_;
+	};
+}
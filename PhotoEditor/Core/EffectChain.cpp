@@ -0,0 +1,268 @@
+﻿/*
+ * CPU 效果链代码
+ */
+
+#include "EffectChain.h"
+
+#include <stdexcept>
+#include <type_traits>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		/// <summary>
+		/// 当前参数下不改变图片的效果
+		/// </summary>
+		bool is_identity(Effect const& effect) noexcept
+		{
+			return std::visit([](auto&& e)
+			{
+				using T = std::decay_t<decltype(e)>;
+
+				if constexpr (std::is_same_v<T, ContrastEffect>) return e.contrast == 0;
+				else if constexpr (std::is_same_v<T, ExposureEffect>) return e.exposure == 0;
+				else if constexpr (std::is_same_v<T, TemperatureAndTintEffect>) return e.temperature == 0 && e.tint == 0;
+				else if constexpr (std::is_same_v<T, GaussianBlurEffect>) return e.blur_amount <= 0;
+				else if constexpr (std::is_same_v<T, SaturationEffect>) return e.saturation == 1;
+				else if constexpr (std::is_same_v<T, SepiaEffect>) return e.intensity <= 0;
+				else if constexpr (std::is_same_v<T, CompositeEffect>) return true;
+				else return false;
+			}, effect);
+		}
+
+		/// <summary>
+		/// 把 next 接到化简后的效果链末尾，能与末尾的效果合并时合并
+		/// </summary>
+		void append_folded(EffectChain& chain, Effect next)
+		{
+			while (!is_identity(next))
+			{
+				if (chain.empty())
+				{
+					chain.push_back(next);
+					return;
+				}
+
+				auto& last = chain.back();
+
+				if (std::holds_alternative<InvertEffect>(last) && std::holds_alternative<InvertEffect>(next))
+				{
+					// 两次反色抵消
+					chain.pop_back();
+					return;
+				}
+
+				if (std::holds_alternative<GrayscaleEffect>(last) && (std::holds_alternative<GrayscaleEffect>(next) || std::holds_alternative<SaturationEffect>(next)))
+				{
+					// 灰度图片没有色度，饱和度和再一次灰度都不起作用
+					return;
+				}
+
+				if (std::holds_alternative<SaturationEffect>(last) && std::holds_alternative<GrayscaleEffect>(next))
+				{
+					// 饱和度不改变亮度，之后的灰度结果相同；去掉饱和度后再和新的末尾比较
+					chain.pop_back();
+					continue;
+				}
+
+				if (std::holds_alternative<ExposureEffect>(last) && std::holds_alternative<ExposureEffect>(next))
+				{
+					next = ExposureEffect{ std::get<ExposureEffect>(last).exposure + std::get<ExposureEffect>(next).exposure };
+					chain.pop_back();
+					continue;
+				}
+
+				if (std::holds_alternative<SaturationEffect>(last) && std::holds_alternative<SaturationEffect>(next))
+				{
+					next = SaturationEffect{ std::get<SaturationEffect>(last).saturation * std::get<SaturationEffect>(next).saturation };
+					chain.pop_back();
+					continue;
+				}
+
+				chain.push_back(next);
+				return;
+			}
+		}
+	}
+
+	EffectChain BuildEffectChain(std::vector<EffectTag> const& tags, EffectParameters const& parameters)
+	{
+		EffectChain chain;
+		chain.reserve(tags.size() * 2 + 1);
+
+		for (auto tag : tags)
+		{
+			switch (tag)
+			{
+			case EffectTag::Sepia:
+				chain.emplace_back(SepiaEffect{ parameters.intensity });
+				break;
+			case EffectTag::Invert:
+				chain.emplace_back(InvertEffect{});
+				break;
+			case EffectTag::Grayscale:
+				chain.emplace_back(GrayscaleEffect{});
+				break;
+			case EffectTag::Blur:
+				chain.emplace_back(GaussianBlurEffect{ parameters.blur_amount });
+				break;
+			case EffectTag::Color:
+				chain.emplace_back(TemperatureAndTintEffect{ parameters.temperature, parameters.tint });
+				chain.emplace_back(SaturationEffect{ parameters.saturation });
+				break;
+			case EffectTag::Light:
+				chain.emplace_back(ContrastEffect{ parameters.contrast });
+				chain.emplace_back(ExposureEffect{ parameters.exposure });
+				break;
+			}
+		}
+
+		chain.emplace_back(CompositeEffect{});
+		return chain;
+	}
+
+	EffectChain OptimizeEffectChain(EffectChain const& chain, size_t& removed)
+	{
+		EffectChain optimized;
+		optimized.reserve(chain.size());
+
+		for (auto&& effect : chain)
+		{
+			append_folded(optimized, effect);
+		}
+
+		removed = chain.size() - optimized.size();
+		return optimized;
+	}
+
+	EffectGraphSignature SignatureOf(EffectChain const& chain)
+	{
+		EffectGraphSignature signature;
+
+		for (auto&& effect : chain)
+		{
+			signature.AddEffect(EffectName(effect));
+		}
+
+		return signature;
+	}
+
+	CompiledEffectChain CompileEffectChain(EffectChain const& chain)
+	{
+		CompiledEffectChain compiled;
+		compiled.effect_count = chain.size();
+
+		for (size_t i = 0; i < chain.size();)
+		{
+			// 只有一个输入的合成效果就是上一个效果的输出
+			if (std::holds_alternative<CompositeEffect>(chain[i]))
+			{
+				i++;
+				continue;
+			}
+
+			size_t length = 0;
+			const auto kernel = FindFusedKernel(chain.data() + i, chain.size() - i, length);
+			length = kernel ? length : 1;
+
+			compiled.passes.push_back({ kernel, static_cast<uint32_t>(i), static_cast<uint32_t>(length) });
+			i += length;
+		}
+
+		return compiled;
+	}
+
+	void RenderEffectChain(CompiledEffectChain const& compiled, EffectChain const& chain, ImageView const& source, ImageView const& destination, ThreadPool& pool)
+	{
+		if (compiled.effect_count != chain.size())
+		{
+			throw std::invalid_argument("效果链与编译结果不一致");
+		}
+
+		// 第一遍从源读取，之后都在目标上原地处理
+		auto input = source;
+
+		for (auto&& pass : compiled.passes)
+		{
+			if (pass.kernel)
+			{
+				pass.kernel(chain.data() + pass.first, input, destination, pool);
+			}
+			else
+			{
+				ApplyEffect(chain[pass.first], input, destination, pool);
+			}
+
+			input = destination;
+		}
+
+		CopyPixels(input, destination);
+	}
+
+	void RenderEffectChain(EffectChain const& chain, ImageView const& source, ImageView const& destination, ThreadPool& pool)
+	{
+		RenderEffectChain(CompileEffectChain(chain), chain, source, destination, pool);
+	}
+
+	void RenderEffectChainUnfused(EffectChain const& chain, ImageView const& source, ImageView const& destination, ThreadPool& pool)
+	{
+		auto input = source;
+
+		for (auto&& effect : chain)
+		{
+			if (std::holds_alternative<CompositeEffect>(effect))
+			{
+				continue;
+			}
+
+			ApplyEffect(effect, input, destination, pool);
+			input = destination;
+		}
+
+		CopyPixels(input, destination);
+	}
+
+	double BytesMovedPerPixel(EffectChain const& chain) noexcept
+	{
+		double bytes = 0;
+
+		for (size_t i = 0; i < chain.size();)
+		{
+			size_t length = 0;
+
+			if (std::holds_alternative<CompositeEffect>(chain[i]))
+			{
+				i++;
+			}
+			else if (FindFusedKernel(chain.data() + i, chain.size() - i, length))
+			{
+				bytes += 2.0 * BytesPerPixel;
+				i += length;
+			}
+			else
+			{
+				bytes += BytesMovedPerPixel(chain[i]);
+				i++;
+			}
+		}
+
+		// 空链只复制一次
+		return bytes == 0 ? 2.0 * BytesPerPixel : bytes;
+	}
+
+	double UnfusedBytesMovedPerPixel(EffectChain const& chain) noexcept
+	{
+		double bytes = 0;
+
+		for (auto&& effect : chain)
+		{
+			if (!std::holds_alternative<CompositeEffect>(effect))
+			{
+				bytes += BytesMovedPerPixel(effect);
+			}
+		}
+
+		return bytes == 0 ? 2.0 * BytesPerPixel : bytes;
+	}
+}
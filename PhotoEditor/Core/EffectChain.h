@@ -0,0 +1,117 @@
+﻿/*
+ * CPU 效果链（与平台无关）
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "EffectGraphCache.h"
+#include "Effects.h"
+#include "FusedKernels.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 效果预览网格中的标签，与 DetailPage.xaml 中 Tag 的取值对应
+	/// </summary>
+	enum class EffectTag : uint8_t
+	{
+		Sepia,
+		Invert,
+		Grayscale,
+		Blur,
+		Color,
+		Light
+	};
+
+	/// <summary>
+	/// 照片的效果参数，默认值与 Photo 一致
+	/// </summary>
+	struct EffectParameters
+	{
+		float exposure{ 0 };
+		float temperature{ 0 };
+		float tint{ 0 };
+		float contrast{ 0 };
+		float saturation{ 1 };
+		float blur_amount{ 0 };
+		float intensity{ .5f };
+	};
+
+	using EffectChain = std::vector<Effect>;
+
+	/// <summary>
+	/// 按 DetailPage::PrepareSelectedEffects 的规则把选中的标签展开为效果链，末尾是合成效果
+	/// </summary>
+	/// <param name="tags">按选择顺序排列的标签</param>
+	/// <param name="parameters">效果参数</param>
+	/// <returns>效果链</returns>
+	EffectChain BuildEffectChain(std::vector<EffectTag> const& tags, EffectParameters const& parameters);
+
+	/// <summary>
+	/// 按当前参数化简效果链：去掉不改变图片的效果（曝光 0、对比度 0、饱和度 1、模糊 0、色温色调 0、泛黄强度 0）
+	/// 和只有一个输入的合成效果，合并相邻的冗余效果（两次反色抵消、灰度前后的饱和度、连续的曝光或饱和度）。
+	/// 全部去掉时渲染退化为一次复制。合并按浮点计算，与 RenderEffectChain 的融合内核一致
+	/// </summary>
+	/// <param name="chain">效果链</param>
+	/// <param name="removed">输出去掉的效果数</param>
+	/// <returns>化简后的效果链，没有合成效果，效果的相对顺序不变</returns>
+	EffectChain OptimizeEffectChain(EffectChain const& chain, size_t& removed);
+
+	/// <summary>
+	/// 编译后的效果链：每一遍处理哪几个效果、使用哪个融合内核。只取决于效果的类型和顺序，
+	/// 参数在渲染时从效果链读取，所以类型相同的效果链可以共用
+	/// </summary>
+	struct CompiledEffectChain
+	{
+		struct pass
+		{
+			// 为空时逐个效果调用 ApplyEffect
+			FusedKernel kernel;
+			uint32_t first;
+			uint32_t length;
+		};
+
+		std::vector<pass> passes;
+		// 编译时效果链的长度，渲染时检查
+		size_t effect_count{ 0 };
+	};
+
+	/// <summary>
+	/// 效果链的签名，与 DetailPage 为同一组效果生成的签名相同（CPU 效果链没有可动画的属性）
+	/// </summary>
+	EffectGraphSignature SignatureOf(EffectChain const& chain);
+
+	/// <summary>
+	/// 为效果链挑选融合内核
+	/// </summary>
+	CompiledEffectChain CompileEffectChain(EffectChain const& chain);
+
+	/// <summary>
+	/// 按编译结果渲染 chain，chain 的效果类型必须与编译时相同，否则抛出 std::invalid_argument
+	/// </summary>
+	void RenderEffectChain(CompiledEffectChain const& compiled, EffectChain const& chain, ImageView const& source, ImageView const& destination, ThreadPool& pool);
+
+	/// <summary>
+	/// 按 DetailPage::CreateEffectsGraph 连接的顺序渲染。相邻的逐像素效果有融合内核时一次遍历完成，
+	/// 中间结果保持浮点精度；其余效果逐个遍历整幅图片。每次调用都重新编译，反复渲染同一组效果时使用上面的重载
+	/// </summary>
+	void RenderEffectChain(EffectChain const& chain, ImageView const& source, ImageView const& destination, ThreadPool& pool);
+
+	/// <summary>
+	/// 不融合，每个效果遍历一次整幅图片，每个效果之后截断为 8 位。用于和融合内核对比
+	/// </summary>
+	void RenderEffectChainUnfused(EffectChain const& chain, ImageView const& source, ImageView const& destination, ThreadPool& pool);
+
+	/// <summary>
+	/// RenderEffectChain 每个像素在内存中读写的字节数
+	/// </summary>
+	double BytesMovedPerPixel(EffectChain const& chain) noexcept;
+
+	/// <summary>
+	/// RenderEffectChainUnfused 每个像素在内存中读写的字节数
+	/// </summary>
+	double UnfusedBytesMovedPerPixel(EffectChain const& chain) noexcept;
+}
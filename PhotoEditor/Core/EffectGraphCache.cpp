@@ -0,0 +1,58 @@
+﻿/*
+ * 编译后的效果图缓存代码
+ */
+
+#include "EffectGraphCache.h"
+
+#include <algorithm>
+
+namespace PhotoCore
+{
+	void EffectGraphSignature::AddEffect(std::string_view type)
+	{
+		if (const auto dot = type.rfind('.'); dot != std::string_view::npos)
+		{
+			type.remove_prefix(dot + 1);
+		}
+
+		effects_.emplace_back(type);
+	}
+
+	void EffectGraphSignature::AddAnimatableProperty(std::string_view name)
+	{
+		properties_.emplace_back(name);
+	}
+
+	std::string EffectGraphSignature::Key() const
+	{
+		auto properties = properties_;
+		std::sort(properties.begin(), properties.end());
+		properties.erase(std::unique(properties.begin(), properties.end()), properties.end());
+
+		std::string key;
+
+		for (size_t i = 0; i < effects_.size(); i++)
+		{
+			if (i > 0)
+			{
+				key += '>';
+			}
+
+			key += effects_[i];
+		}
+
+		key += '|';
+
+		for (size_t i = 0; i < properties.size(); i++)
+		{
+			if (i > 0)
+			{
+				key += ',';
+			}
+
+			key += properties[i];
+		}
+
+		return key;
+	}
+}
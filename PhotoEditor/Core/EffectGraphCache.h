@@ -0,0 +1,178 @@
+﻿/*
+ * 编译后的效果图缓存（与平台无关）
+ *
+ * 改变选中的效果时，DetailPage 要重新连接 Win2D 效果图并调用 CreateEffectFactory 编译，
+ * CPU 效果链也要重新挑选融合内核。编译结果只取决于效果的类型、顺序和可动画的属性，与参数的取值无关，
+ * 所以按这些内容的规范形式缓存：切换回用过的效果组合时直接取出编译结果，只更新参数。
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 效果图的签名：按连接顺序排列的效果类型，以及可动画的属性。
+	/// 属性与顺序无关，生成键时排序去重；效果类型使用与 Win2D 类名相同的短名称
+	/// </summary>
+	class EffectGraphSignature
+	{
+	public:
+		/// <summary>
+		/// 追加一个效果。可以传入完整的运行时类名，只保留最后一个点之后的部分
+		/// </summary>
+		void AddEffect(std::string_view type);
+
+		/// <summary>
+		/// 添加一个可动画的属性，例如 "ExposureEffect.Exposure"
+		/// </summary>
+		void AddAnimatableProperty(std::string_view name);
+
+		/// <summary>
+		/// 规范形式，例如 "ContrastEffect>ExposureEffect>CompositeEffect|ContrastEffect.Contrast,ExposureEffect.Exposure"
+		/// </summary>
+		[[nodiscard]] std::string Key() const;
+
+		[[nodiscard]] size_t EffectCount() const noexcept
+		{
+			return effects_.size();
+		}
+
+	private:
+		std::vector<std::string> effects_;
+		std::vector<std::string> properties_;
+	};
+
+	/// <summary>
+	/// 效果图缓存的统计
+	/// </summary>
+	struct EffectGraphCacheStats
+	{
+		uint64_t hits{ 0 };
+		uint64_t misses{ 0 };
+		uint64_t evictions{ 0 };
+		// 缓存的编译结果数
+		size_t entries{ 0 };
+		// 所有编译的总耗时和最近一次编译的耗时
+		double compile_ms{ 0 };
+		double last_compile_ms{ 0 };
+
+		[[nodiscard]] double HitRate() const noexcept
+		{
+			const auto lookups = hits + misses;
+			return lookups == 0 ? 0 : static_cast<double>(hits) / lookups;
+		}
+	};
+
+	/// <summary>
+	/// 按签名缓存编译结果，超过容量时淘汰最久未使用的一项。
+	/// Graph 是编译结果的类型，例如 CompositionEffectFactory 或 CompiledEffectChain。不是线程安全的
+	/// </summary>
+	template <class Graph>
+	class EffectGraphCache
+	{
+	public:
+		// 预览网格只有六个标签，常用的组合不多
+		static constexpr size_t DefaultCapacity = 16;
+
+		explicit EffectGraphCache(size_t capacity = DefaultCapacity) :
+			capacity_(capacity == 0 ? 1 : capacity)
+		{
+		}
+
+		/// <summary>
+		/// 取得签名对应的编译结果，没有时调用 compile() 编译并缓存
+		/// </summary>
+		/// <param name="signature">签名</param>
+		/// <param name="compile">编译函数，返回 Graph。抛出异常时不缓存</param>
+		/// <returns>编译结果，下一次调用 GetOrCompile 或 Clear 之前有效</returns>
+		template <class Compile>
+		Graph const& GetOrCompile(EffectGraphSignature const& signature, Compile&& compile)
+		{
+			return GetOrCompile(signature.Key(), std::forward<Compile>(compile));
+		}
+
+		/// <summary>
+		/// 同上，key 是 EffectGraphSignature::Key() 的结果，签名不变时可以保存下来重复使用
+		/// </summary>
+		template <class Compile>
+		Graph const& GetOrCompile(std::string const& key, Compile&& compile)
+		{
+			const auto tick = ++clock_;
+
+			if (const auto found = entries_.find(key); found != entries_.end())
+			{
+				stats_.hits++;
+				found->second.last_used = tick;
+				return found->second.graph;
+			}
+
+			const auto start = std::chrono::steady_clock::now();
+			Graph graph = compile();
+			const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+			stats_.misses++;
+			stats_.compile_ms += elapsed;
+			stats_.last_compile_ms = elapsed;
+
+			if (entries_.size() >= capacity_)
+			{
+				evict_oldest();
+			}
+
+			auto&& entry = entries_.emplace(key, cached_graph{ std::move(graph), tick }).first->second;
+			stats_.entries = entries_.size();
+			return entry.graph;
+		}
+
+		void Clear() noexcept
+		{
+			entries_.clear();
+			stats_.entries = 0;
+		}
+
+		[[nodiscard]] EffectGraphCacheStats const& Stats() const noexcept
+		{
+			return stats_;
+		}
+
+	private:
+		struct cached_graph
+		{
+			Graph graph;
+			uint64_t last_used;
+		};
+
+		void evict_oldest()
+		{
+			auto oldest = entries_.begin();
+
+			for (auto it = entries_.begin(); it != entries_.end(); ++it)
+			{
+				if (it->second.last_used < oldest->second.last_used)
+				{
+					oldest = it;
+				}
+			}
+
+			if (oldest != entries_.end())
+			{
+				entries_.erase(oldest);
+				stats_.evictions++;
+			}
+		}
+
+		const size_t capacity_;
+		std::unordered_map<std::string, cached_graph> entries_;
+		uint64_t clock_{ 0 };
+		EffectGraphCacheStats stats_;
+	};
+}
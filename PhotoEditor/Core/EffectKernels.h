@@ -0,0 +1,319 @@
+﻿/*
+ * 逐像素效果内核（与平台无关）
+ *
+ * 每个内核只处理一个像素，多个内核可以在一次遍历中依次调用。
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+
+#include "Effects.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 预乘像素，取值范围 [0, 255]
+	/// </summary>
+	struct Pixel
+	{
+		float b;
+		float g;
+		float r;
+		float a;
+	};
+
+	// Rec.709 亮度系数，与 Direct2D 灰度、饱和度效果一致
+	constexpr float LuminanceR = 0.2126f;
+	constexpr float LuminanceG = 0.7152f;
+	constexpr float LuminanceB = 0.0722f;
+
+	inline float Luminance(Pixel const& p) noexcept
+	{
+		return p.r * LuminanceR + p.g * LuminanceG + p.b * LuminanceB;
+	}
+
+	/// <summary>
+	/// 对比度：以半透明灰为中心缩放
+	/// </summary>
+	struct ContrastKernel
+	{
+		float scale;
+		float offset;
+
+		explicit ContrastKernel(ContrastEffect const& effect) noexcept :
+			scale(1 + effect.contrast),
+			offset(.5f * -effect.contrast)
+		{
+		}
+
+		void operator()(Pixel& p) const noexcept
+		{
+			const auto shift = p.a * offset;
+			p.r = p.r * scale + shift;
+			p.g = p.g * scale + shift;
+			p.b = p.b * scale + shift;
+		}
+	};
+
+	/// <summary>
+	/// 曝光度：乘以 2 的 exposure 次方
+	/// </summary>
+	struct ExposureKernel
+	{
+		float gain;
+
+		explicit ExposureKernel(ExposureEffect const& effect) noexcept :
+			gain(std::exp2(effect.exposure))
+		{
+		}
+
+		void operator()(Pixel& p) const noexcept
+		{
+			p.r *= gain;
+			p.g *= gain;
+			p.b *= gain;
+		}
+	};
+
+	/// <summary>
+	/// 色温和色调：色温正值偏暖（加红减蓝），色调正值偏洋红（减绿）
+	/// </summary>
+	struct TemperatureAndTintKernel
+	{
+		float r_gain;
+		float g_gain;
+		float b_gain;
+
+		explicit TemperatureAndTintKernel(TemperatureAndTintEffect const& effect) noexcept :
+			r_gain(1 + .3f * effect.temperature),
+			g_gain(1 - .3f * effect.tint),
+			b_gain(1 - .3f * effect.temperature)
+		{
+		}
+
+		void operator()(Pixel& p) const noexcept
+		{
+			p.r *= r_gain;
+			p.g *= g_gain;
+			p.b *= b_gain;
+		}
+	};
+
+	/// <summary>
+	/// 饱和度：在亮度和原色之间插值
+	/// </summary>
+	struct SaturationKernel
+	{
+		float saturation;
+
+		explicit SaturationKernel(SaturationEffect const& effect) noexcept :
+			saturation(effect.saturation)
+		{
+		}
+
+		void operator()(Pixel& p) const noexcept
+		{
+			const auto luminance = Luminance(p);
+			p.r = luminance + (p.r - luminance) * saturation;
+			p.g = luminance + (p.g - luminance) * saturation;
+			p.b = luminance + (p.b - luminance) * saturation;
+		}
+	};
+
+	/// <summary>
+	/// 泛黄：在原色和泛黄矩阵之间插值，预先合并为一个矩阵
+	/// </summary>
+	struct SepiaKernel
+	{
+		float m[3][3];
+
+		explicit SepiaKernel(SepiaEffect const& effect) noexcept
+		{
+			constexpr float sepia[3][3]{
+				{ .393f, .769f, .189f },
+				{ .349f, .686f, .168f },
+				{ .272f, .534f, .131f } };
+
+			const auto intensity = std::clamp(effect.intensity, 0.f, 1.f);
+
+			for (auto row = 0; row < 3; row++)
+			{
+				for (auto column = 0; column < 3; column++)
+				{
+					const auto identity = row == column ? 1.f : 0.f;
+					m[row][column] = identity + (sepia[row][column] - identity) * intensity;
+				}
+			}
+		}
+
+		void operator()(Pixel& p) const noexcept
+		{
+			const auto r = p.r;
+			const auto g = p.g;
+			const auto b = p.b;
+			p.r = m[0][0] * r + m[0][1] * g + m[0][2] * b;
+			p.g = m[1][0] * r + m[1][1] * g + m[1][2] * b;
+			p.b = m[2][0] * r + m[2][1] * g + m[2][2] * b;
+		}
+	};
+
+	struct GrayscaleKernel
+	{
+		explicit GrayscaleKernel(GrayscaleEffect const&) noexcept
+		{
+		}
+
+		void operator()(Pixel& p) const noexcept
+		{
+			const auto luminance = Luminance(p);
+			p.r = luminance;
+			p.g = luminance;
+			p.b = luminance;
+		}
+	};
+
+	/// <summary>
+	/// 反色，预乘下用 alpha 减去颜色
+	/// </summary>
+	struct InvertKernel
+	{
+		explicit InvertKernel(InvertEffect const&) noexcept
+		{
+		}
+
+		void operator()(Pixel& p) const noexcept
+		{
+			p.r = p.a - p.r;
+			p.g = p.a - p.g;
+			p.b = p.a - p.b;
+		}
+	};
+
+	/// <summary>
+	/// 逐像素效果对应的内核，其他效果（模糊、合成）没有 type
+	/// </summary>
+	template <class T>
+	struct PointKernelFor
+	{
+	};
+
+	template <>
+	struct PointKernelFor<ContrastEffect>
+	{
+		using type = ContrastKernel;
+	};
+
+	template <>
+	struct PointKernelFor<ExposureEffect>
+	{
+		using type = ExposureKernel;
+	};
+
+	template <>
+	struct PointKernelFor<TemperatureAndTintEffect>
+	{
+		using type = TemperatureAndTintKernel;
+	};
+
+	template <>
+	struct PointKernelFor<SaturationEffect>
+	{
+		using type = SaturationKernel;
+	};
+
+	template <>
+	struct PointKernelFor<SepiaEffect>
+	{
+		using type = SepiaKernel;
+	};
+
+	template <>
+	struct PointKernelFor<GrayscaleEffect>
+	{
+		using type = GrayscaleKernel;
+	};
+
+	template <>
+	struct PointKernelFor<InvertEffect>
+	{
+		using type = InvertKernel;
+	};
+
+	template <class T, class = void>
+	constexpr bool IsPointEffect = false;
+
+	template <class T>
+	constexpr bool IsPointEffect<T, std::void_t<typename PointKernelFor<T>::type>> = true;
+
+	inline Pixel LoadPixel(uint8_t const* source) noexcept
+	{
+		return { float(source[0]), float(source[1]), float(source[2]), float(source[3]) };
+	}
+
+	/// <summary>
+	/// 写回像素，颜色截断到 [0, alpha] 保持预乘有效
+	/// </summary>
+	inline void StorePixel(Pixel const& p, uint8_t* destination) noexcept
+	{
+		const auto store = [a = p.a](float value)
+		{
+			return static_cast<uint8_t>(std::min(std::max(value, 0.f), a) + .5f);
+		};
+
+		destination[0] = store(p.b);
+		destination[1] = store(p.g);
+		destination[2] = store(p.r);
+		destination[3] = static_cast<uint8_t>(p.a + .5f);
+	}
+
+	/// <summary>
+	/// 把颜色截断到 [0, alpha] 并取整，与 StorePixel 写回再读出的值相同
+	/// </summary>
+	inline void QuantizePixel(Pixel& p) noexcept
+	{
+		const auto quantize = [a = p.a](float value)
+		{
+			return static_cast<float>(static_cast<int>(std::min(std::max(value, 0.f), a) + .5f));
+		};
+
+		p.b = quantize(p.b);
+		p.g = quantize(p.g);
+		p.r = quantize(p.r);
+	}
+
+	/// <summary>
+	/// 对一个像素依次执行若干个内核，相邻内核之间截断取整，结果与逐个效果遍历相同
+	/// </summary>
+	template <class First, class... Rest>
+	void ApplyPointKernels(Pixel& p, First const& first, Rest const&... rest) noexcept
+	{
+		first(p);
+		((QuantizePixel(p), rest(p)), ...);
+	}
+
+	/// <summary>
+	/// 一次遍历依次执行若干个逐像素内核，中间结果不落地
+	/// </summary>
+	template <class... Kernels>
+	void RunPointKernels(ImageView const& source, ImageView const& destination, ThreadPool& pool, Kernels const&... kernels)
+	{
+		pool.ParallelFor(source.height, [&](size_t begin, size_t end)
+		{
+			for (auto y = begin; y < end; y++)
+			{
+				auto input = source.Row(y);
+				auto output = destination.Row(y);
+
+				for (uint32_t x = 0; x < source.width; x++, input += BytesPerPixel, output += BytesPerPixel)
+				{
+					auto p = LoadPixel(input);
+					ApplyPointKernels(p, kernels...);
+					StorePixel(p, output);
+				}
+			}
+		}, RowsPerChunk(source.width));
+	}
+}
@@ -0,0 +1,190 @@
+﻿/*
+ * CPU 图片效果代码
+ */
+
+#include "Effects.h"
+#include "EffectKernels.h"
+
+#include <cmath>
+#include <type_traits>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		template <class>
+		constexpr bool always_false = false;
+
+		/// <summary>
+		/// 16 位定点的一维高斯权重，总和正好为 65536。从缓冲池借出，拖动滑块时不申请堆内存
+		/// </summary>
+		PooledArray<uint32_t> gaussian_weights(float sigma)
+		{
+			const auto radius = static_cast<int>(std::ceil(sigma * 3));
+			const auto exact = [sigma](int i) { return std::exp(-(i * i) / (2.0 * sigma * sigma)); };
+			double sum = 0;
+
+			for (auto i = -radius; i <= radius; i++)
+			{
+				sum += exact(i);
+			}
+
+			PooledArray<uint32_t> weights(static_cast<size_t>(radius) * 2 + 1);
+			uint32_t total = 0;
+
+			for (auto i = -radius; i <= radius; i++)
+			{
+				weights[i + radius] = static_cast<uint32_t>(exact(i) / sum * 65536.0);
+				total += weights[i + radius];
+			}
+
+			// 舍入误差补到中心
+			weights[radius] += 65536 - total;
+			return weights;
+		}
+
+		/// <summary>
+		/// 可分离高斯模糊。Hard 边缘：图片外的像素视为透明
+		/// </summary>
+		void gaussian_blur(ImageView const& source, ImageView const& destination, float sigma, ThreadPool& pool)
+		{
+			if (sigma <= 0)
+			{
+				CopyPixels(source, destination);
+				return;
+			}
+
+			const auto weights = gaussian_weights(sigma);
+			const auto radius = static_cast<int>(weights.Size() / 2);
+			const auto width = static_cast<int>(source.width);
+			const auto height = static_cast<int>(source.height);
+
+			PixelBuffer horizontal_buffer(source.width, source.height, BufferPool::Shared());
+			const auto horizontal = horizontal_buffer.View();
+
+			// 水平方向
+			pool.ParallelFor(source.height, [&](size_t begin, size_t end)
+			{
+				for (auto y = begin; y < end; y++)
+				{
+					const auto input = source.Row(y);
+					auto output = horizontal.Row(y);
+
+					for (auto x = 0; x < width; x++, output += BytesPerPixel)
+					{
+						const auto first = std::max(x - radius, 0);
+						const auto last = std::min(x + radius, width - 1);
+						uint32_t sum[4]{};
+
+						for (auto k = first; k <= last; k++)
+						{
+							const auto weight = weights[k - x + radius];
+							const auto pixel = input + k * BytesPerPixel;
+							sum[0] += weight * pixel[0];
+							sum[1] += weight * pixel[1];
+							sum[2] += weight * pixel[2];
+							sum[3] += weight * pixel[3];
+						}
+
+						for (auto c = 0; c < 4; c++)
+						{
+							output[c] = static_cast<uint8_t>((sum[c] + 32768) >> 16);
+						}
+					}
+				}
+			}, RowsPerChunk(source.width));
+
+			// 垂直方向：每个输出行累加相邻若干行，内层循环连续访问内存
+			const auto row_bytes = source.width * BytesPerPixel;
+
+			pool.ParallelFor(source.height, [&](size_t begin, size_t end)
+			{
+				PooledArray<uint32_t> sum(row_bytes);
+
+				for (auto y = static_cast<int>(begin); y < static_cast<int>(end); y++)
+				{
+					std::fill(sum.begin(), sum.end(), 0u);
+
+					const auto first = std::max(y - radius, 0);
+					const auto last = std::min(y + radius, height - 1);
+
+					for (auto k = first; k <= last; k++)
+					{
+						const auto weight = weights[k - y + radius];
+						const auto input = horizontal.Row(k);
+
+						for (size_t i = 0; i < row_bytes; i++)
+						{
+							sum[i] += weight * input[i];
+						}
+					}
+
+					auto output = destination.Row(y);
+
+					for (size_t i = 0; i < row_bytes; i++)
+					{
+						output[i] = static_cast<uint8_t>((sum[i] + 32768) >> 16);
+					}
+				}
+			}, RowsPerChunk(source.width));
+		}
+	}
+
+	char const* EffectName(Effect const& effect) noexcept
+	{
+		return std::visit([](auto&& e) -> char const*
+		{
+			using T = std::decay_t<decltype(e)>;
+
+			if constexpr (std::is_same_v<T, ContrastEffect>) return "ContrastEffect";
+			else if constexpr (std::is_same_v<T, ExposureEffect>) return "ExposureEffect";
+			else if constexpr (std::is_same_v<T, TemperatureAndTintEffect>) return "TemperatureAndTintEffect";
+			else if constexpr (std::is_same_v<T, GaussianBlurEffect>) return "GaussianBlurEffect";
+			else if constexpr (std::is_same_v<T, SaturationEffect>) return "SaturationEffect";
+			else if constexpr (std::is_same_v<T, SepiaEffect>) return "SepiaEffect";
+			else if constexpr (std::is_same_v<T, GrayscaleEffect>) return "GrayscaleEffect";
+			else if constexpr (std::is_same_v<T, InvertEffect>) return "InvertEffect";
+			else if constexpr (std::is_same_v<T, CompositeEffect>) return "CompositeEffect";
+			else static_assert(always_false<T>, "未处理的效果类型");
+		}, effect);
+	}
+
+	void ApplyEffect(Effect const& effect, ImageView const& source, ImageView const& destination, ThreadPool& pool)
+	{
+		std::visit([&](auto&& e)
+		{
+			using T = std::decay_t<decltype(e)>;
+
+			if constexpr (std::is_same_v<T, ContrastEffect>) RunPointKernels(source, destination, pool, ContrastKernel{ e });
+			else if constexpr (std::is_same_v<T, ExposureEffect>) RunPointKernels(source, destination, pool, ExposureKernel{ e });
+			else if constexpr (std::is_same_v<T, TemperatureAndTintEffect>) RunPointKernels(source, destination, pool, TemperatureAndTintKernel{ e });
+			else if constexpr (std::is_same_v<T, GaussianBlurEffect>) gaussian_blur(source, destination, e.blur_amount, pool);
+			else if constexpr (std::is_same_v<T, SaturationEffect>) RunPointKernels(source, destination, pool, SaturationKernel{ e });
+			else if constexpr (std::is_same_v<T, SepiaEffect>) RunPointKernels(source, destination, pool, SepiaKernel{ e });
+			else if constexpr (std::is_same_v<T, GrayscaleEffect>) RunPointKernels(source, destination, pool, GrayscaleKernel{ e });
+			else if constexpr (std::is_same_v<T, InvertEffect>) RunPointKernels(source, destination, pool, InvertKernel{ e });
+			else if constexpr (std::is_same_v<T, CompositeEffect>) CopyPixels(source, destination);
+			else static_assert(always_false<T>, "未处理的效果类型");
+		}, effect);
+	}
+
+	double BytesMovedPerPixel(Effect const& effect) noexcept
+	{
+		constexpr auto pass = 2.0 * BytesPerPixel;
+
+		return std::visit([&](auto&& e)
+		{
+			using T = std::decay_t<decltype(e)>;
+
+			if constexpr (std::is_same_v<T, GaussianBlurEffect>)
+			{
+				// 水平、垂直各一遍
+				return e.blur_amount > 0 ? 2 * pass : pass;
+			}
+			else
+			{
+				return pass;
+			}
+		}, effect);
+	}
+}
@@ -0,0 +1,116 @@
+﻿/*
+ * CPU 图片效果（与平台无关）
+ *
+ * 与 DetailPage 使用的 Win2D 效果一一对应，参数名称和默认值相同，
+ * 用于导出、预览和基准测试等不经过 Composition 的路径。
+ */
+
+#pragma once
+
+#include <variant>
+#include <vector>
+
+#include "PixelBuffer.h"
+#include "ThreadPool.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 对比度，范围 [-1, 1]
+	/// </summary>
+	struct ContrastEffect
+	{
+		float contrast{ 0 };
+	};
+
+	/// <summary>
+	/// 曝光度，单位为档，范围 [-2, 2]
+	/// </summary>
+	struct ExposureEffect
+	{
+		float exposure{ 0 };
+	};
+
+	/// <summary>
+	/// 色温和色调，范围 [-1, 1]
+	/// </summary>
+	struct TemperatureAndTintEffect
+	{
+		float temperature{ 0 };
+		float tint{ 0 };
+	};
+
+	/// <summary>
+	/// 高斯模糊，模糊强度为标准差（像素），边缘模式为 Hard
+	/// </summary>
+	struct GaussianBlurEffect
+	{
+		float blur_amount{ 3 };
+	};
+
+	/// <summary>
+	/// 饱和度，0 为灰度，1 为原图
+	/// </summary>
+	struct SaturationEffect
+	{
+		float saturation{ .5f };
+	};
+
+	/// <summary>
+	/// 泛黄，强度范围 [0, 1]
+	/// </summary>
+	struct SepiaEffect
+	{
+		float intensity{ .5f };
+	};
+
+	struct GrayscaleEffect
+	{
+	};
+
+	struct InvertEffect
+	{
+	};
+
+	/// <summary>
+	/// 效果链的终点，只有一个输入时直接输出
+	/// </summary>
+	struct CompositeEffect
+	{
+	};
+
+	// 与 DetailPage::effects_list_ 的类型顺序一致
+	using Effect = std::variant<ContrastEffect,
+		ExposureEffect,
+		TemperatureAndTintEffect,
+		GaussianBlurEffect,
+		SaturationEffect,
+		SepiaEffect,
+		GrayscaleEffect,
+		InvertEffect,
+		CompositeEffect>;
+
+	/// <summary>
+	/// 效果名称，与 Win2D 效果类名一致
+	/// </summary>
+	char const* EffectName(Effect const& effect) noexcept;
+
+	/// <summary>
+	/// 单个效果处理整幅图片。源和目标尺寸必须相同，可以是同一块内存
+	/// </summary>
+	void ApplyEffect(Effect const& effect, ImageView const& source, ImageView const& destination, ThreadPool& pool);
+
+	/// <summary>
+	/// 效果每个像素在内存中读写的字节数（按整幅图片遍历的次数计算）
+	/// </summary>
+	double BytesMovedPerPixel(Effect const& effect) noexcept;
+
+	/// <summary>
+	/// 点运算每块处理的行数，使每块大约 64K 像素
+	/// </summary>
+	inline size_t RowsPerChunk(uint32_t width) noexcept
+	{
+		constexpr size_t pixels_per_chunk = 1 << 16;
+		return width == 0 ? 1 : (pixels_per_chunk + width - 1) / width;
+	}
+}
@@ -0,0 +1,563 @@
+﻿/*
+ * EXIF 代码
+ */
+
+#include "Exif.h"
+#include "JpegCommon.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		// 第一次读取的字节数，多数文件的 APP1 起始位置都在这个范围内
+		constexpr size_t initial_read = 4 * 1024;
+
+		// 最多查看的标记段数，避免损坏的文件导致大量小读取
+		constexpr int max_segments = 64;
+
+		constexpr uint16_t tag_orientation = 0x0112;
+		constexpr uint16_t tag_compression = 0x0103;
+		constexpr uint16_t tag_thumbnail_offset = 0x0201;
+		constexpr uint16_t tag_thumbnail_length = 0x0202;
+		constexpr uint16_t tag_exif_ifd = 0x8769;
+		constexpr uint16_t tag_pixel_x_dimension = 0xa002;
+		constexpr uint16_t tag_pixel_y_dimension = 0xa003;
+
+		constexpr uint16_t type_short = 3;
+		constexpr uint16_t type_long = 4;
+
+		uint32_t read_be16(uint8_t const* p) noexcept
+		{
+			return static_cast<uint32_t>(p[0]) << 8 | p[1];
+		}
+
+		/// <summary>
+		/// 按 TIFF 头指定的字节序读取
+		/// </summary>
+		class tiff_reader
+		{
+		public:
+			tiff_reader(uint8_t const* data, size_t size, bool little_endian) noexcept :
+				data_(data),
+				size_(size),
+				little_endian_(little_endian)
+			{
+			}
+
+			uint32_t U16(size_t offset) const noexcept
+			{
+				const auto p = data_ + offset;
+				return little_endian_ ? static_cast<uint32_t>(p[1]) << 8 | p[0] : static_cast<uint32_t>(p[0]) << 8 | p[1];
+			}
+
+			uint32_t U32(size_t offset) const noexcept
+			{
+				return little_endian_ ? U16(offset + 2) << 16 | U16(offset) : U16(offset) << 16 | U16(offset + 2);
+			}
+
+			/// <summary>
+			/// 遍历一个 IFD 的所有项
+			/// </summary>
+			/// <returns>下一个 IFD 的位置，0 表示没有或者 IFD 无效</returns>
+			template <typename Visitor>
+			uint32_t VisitIfd(uint32_t offset, Visitor&& visit) const noexcept
+			{
+				if (offset < 8 || static_cast<size_t>(offset) + 2 > size_)
+				{
+					return 0;
+				}
+
+				const auto count = U16(offset);
+				const auto end = static_cast<size_t>(offset) + 2 + count * 12;
+
+				if (end + 4 > size_)
+				{
+					return 0;
+				}
+
+				for (uint32_t i = 0; i < count; i++)
+				{
+					const auto entry = offset + 2 + i * 12;
+					const auto type = static_cast<uint16_t>(U16(entry + 2));
+
+					// 只关心单个 SHORT 或者 LONG，值在项内
+					if (U32(entry + 4) != 1 || (type != type_short && type != type_long))
+					{
+						continue;
+					}
+
+					visit(static_cast<uint16_t>(U16(entry)), type == type_short ? U16(entry + 8) : U32(entry + 8));
+				}
+
+				const auto next = U32(end);
+				return next > offset ? next : 0;
+			}
+
+		private:
+			uint8_t const* data_;
+			size_t size_;
+			bool little_endian_;
+		};
+
+		/// <summary>
+		/// 原地修改 TIFF 数据，字节序与 TIFF 头相同
+		/// </summary>
+		class tiff_editor
+		{
+		public:
+			explicit tiff_editor(std::vector<uint8_t>& tiff) noexcept :
+				tiff_(tiff),
+				little_endian_(tiff[0] == 'I')
+			{
+			}
+
+			[[nodiscard]] tiff_reader Reader() const noexcept
+			{
+				return { tiff_.data(), tiff_.size(), little_endian_ };
+			}
+
+			void Put16(size_t offset, uint32_t value) noexcept
+			{
+				const auto p = tiff_.data() + offset;
+				p[little_endian_ ? 0 : 1] = static_cast<uint8_t>(value);
+				p[little_endian_ ? 1 : 0] = static_cast<uint8_t>(value >> 8);
+			}
+
+			void Put32(size_t offset, uint32_t value) noexcept
+			{
+				Put16(offset + (little_endian_ ? 0 : 2), value & 0xffff);
+				Put16(offset + (little_endian_ ? 2 : 0), value >> 16);
+			}
+
+			/// <summary>
+			/// 遍历一个 IFD 的所有项，visit 得到项的位置、标签、类型和个数
+			/// </summary>
+			/// <returns>存放下一个 IFD 位置的偏移，IFD 无效时为 0</returns>
+			template <typename Visitor>
+			size_t VisitEntries(uint32_t offset, Visitor&& visit) const
+			{
+				const auto reader = Reader();
+
+				if (offset < 8 || static_cast<size_t>(offset) + 2 > tiff_.size())
+				{
+					return 0;
+				}
+
+				const auto count = reader.U16(offset);
+				const auto end = static_cast<size_t>(offset) + 2 + count * 12;
+
+				if (end + 4 > tiff_.size())
+				{
+					return 0;
+				}
+
+				for (uint32_t i = 0; i < count; i++)
+				{
+					const auto entry = static_cast<size_t>(offset) + 2 + i * 12;
+					visit(entry, static_cast<uint16_t>(reader.U16(entry)), static_cast<uint16_t>(reader.U16(entry + 2)), reader.U32(entry + 4));
+				}
+
+				return end;
+			}
+
+		private:
+			std::vector<uint8_t>& tiff_;
+			bool little_endian_;
+		};
+
+		void put_le16(std::vector<uint8_t>& bytes, uint32_t value)
+		{
+			bytes.push_back(static_cast<uint8_t>(value));
+			bytes.push_back(static_cast<uint8_t>(value >> 8));
+		}
+
+		void put_le32(std::vector<uint8_t>& bytes, uint32_t value)
+		{
+			put_le16(bytes, value & 0xffff);
+			put_le16(bytes, value >> 16);
+		}
+
+		void put_ifd_entry(std::vector<uint8_t>& bytes, uint16_t tag, uint16_t type, uint32_t value)
+		{
+			put_le16(bytes, tag);
+			put_le16(bytes, type);
+			put_le32(bytes, 1);
+
+			if (type == type_short)
+			{
+				put_le16(bytes, value);
+				put_le16(bytes, 0);
+			}
+			else
+			{
+				put_le32(bytes, value);
+			}
+		}
+	}
+
+	bool ReadJpegExif(ReadAtFunction const& read, ExifInfo& info, uint64_t* bytes_read)
+	{
+		PE_TRACE_SCOPE("ReadJpegExif");
+
+		info = {};
+
+		// 已读取的一段文件内容
+		std::vector<uint8_t> buffer(initial_read);
+		uint64_t buffer_start = 0;
+		uint64_t total = 0;
+
+		const auto fill = [&](uint64_t offset, size_t size)
+		{
+			buffer.resize(std::max(size, initial_read));
+			const auto count = read(offset, buffer.data(), buffer.size());
+			buffer.resize(count);
+			buffer_start = offset;
+			total += count;
+		};
+
+		// 确保 [offset, offset + size) 在缓冲区中
+		const auto ensure = [&](uint64_t offset, size_t size)
+		{
+			if (offset < buffer_start || offset + size > buffer_start + buffer.size())
+			{
+				fill(offset, size);
+			}
+
+			return offset + size <= buffer_start + buffer.size();
+		};
+
+		const auto at = [&](uint64_t offset)
+		{
+			return buffer.data() + (offset - buffer_start);
+		};
+
+		const auto finish = [&](bool found)
+		{
+			if (bytes_read)
+			{
+				*bytes_read = total;
+			}
+
+			return found;
+		};
+
+		fill(0, initial_read);
+
+		if (buffer.size() < 4 || buffer[0] != 0xff || buffer[1] != Jpeg::SOI)
+		{
+			return finish(false);
+		}
+
+		uint64_t position = 2;
+
+		for (auto segment = 0; segment < max_segments; segment++)
+		{
+			if (!ensure(position, 4) || *at(position) != 0xff)
+			{
+				return finish(false);
+			}
+
+			const auto marker = at(position)[1];
+
+			// 填充字节
+			if (marker == 0xff)
+			{
+				position++;
+				continue;
+			}
+
+			// EXIF 总是在帧头之前
+			if (marker == Jpeg::SOS || marker == Jpeg::EOI || (marker >= 0xc0 && marker <= 0xcf && marker != Jpeg::DHT && marker != 0xc8 && marker != 0xcc))
+			{
+				return finish(false);
+			}
+
+			const auto length = read_be16(at(position) + 2);
+
+			if (length < 2)
+			{
+				return finish(false);
+			}
+
+			if (marker == Jpeg::APP1 && length >= 8 + 8)
+			{
+				// 读取整个段
+				const auto payload = position + 4;
+				const size_t payload_size = length - 2;
+
+				if (ensure(payload, payload_size) && std::memcmp(at(payload), "Exif\0\0", 6) == 0)
+				{
+					return finish(ParseExifTiff(at(payload) + 6, payload_size - 6, payload + 6, info));
+				}
+			}
+
+			position += 2 + length;
+		}
+
+		return finish(false);
+	}
+
+	bool ParseExifTiff(uint8_t const* tiff, size_t size, uint64_t tiff_offset, ExifInfo& info) noexcept
+	{
+		info = {};
+
+		if (size < 8 || !((tiff[0] == 'I' && tiff[1] == 'I') || (tiff[0] == 'M' && tiff[1] == 'M')))
+		{
+			return false;
+		}
+
+		const tiff_reader reader(tiff, size, tiff[0] == 'I');
+
+		if (reader.U16(2) != 42)
+		{
+			return false;
+		}
+
+		// IFD0：主图片，只需要方向
+		const auto ifd1 = reader.VisitIfd(reader.U32(4), [&](uint16_t tag, uint32_t value)
+		{
+			if (tag == tag_orientation && value >= 1 && value <= 8)
+			{
+				info.orientation = static_cast<uint16_t>(value);
+			}
+		});
+
+		// IFD1：略缩图
+		uint32_t compression = 6;
+		uint32_t thumbnail_offset = 0;
+		uint32_t thumbnail_length = 0;
+
+		reader.VisitIfd(ifd1, [&](uint16_t tag, uint32_t value)
+		{
+			switch (tag)
+			{
+			case tag_compression:
+				compression = value;
+				break;
+			case tag_thumbnail_offset:
+				thumbnail_offset = value;
+				break;
+			case tag_thumbnail_length:
+				thumbnail_length = value;
+				break;
+			}
+		});
+
+		// 只接受段内完整的 JPEG 略缩图（不支持未压缩的 TIFF 略缩图）
+		if (compression == 6
+			&& thumbnail_offset >= 8
+			&& thumbnail_length >= 4
+			&& static_cast<size_t>(thumbnail_offset) + thumbnail_length <= size
+			&& tiff[thumbnail_offset] == 0xff
+			&& tiff[thumbnail_offset + 1] == Jpeg::SOI)
+		{
+			info.thumbnail_offset = tiff_offset + thumbnail_offset;
+			info.thumbnail_size = thumbnail_length;
+		}
+
+		return true;
+	}
+
+	std::vector<uint8_t> BuildExifSegment(uint16_t orientation, std::vector<uint8_t> const& thumbnail, size_t min_size)
+	{
+		// 小端 TIFF：头、IFD0（方向）、IFD1（略缩图），之后是略缩图数据
+		std::vector<uint8_t> tiff{ 'I', 'I', 0x2a, 0x00 };
+		put_le32(tiff, 8);
+
+		constexpr uint32_t ifd0_size = 2 + 12 + 4;
+		constexpr uint32_t ifd1_size = 2 + 3 * 12 + 4;
+
+		put_le16(tiff, 1);
+		put_ifd_entry(tiff, tag_orientation, type_short, orientation);
+		put_le32(tiff, thumbnail.empty() ? 0 : 8 + ifd0_size);
+
+		if (!thumbnail.empty())
+		{
+			put_le16(tiff, 3);
+			put_ifd_entry(tiff, tag_compression, type_short, 6);
+			put_ifd_entry(tiff, tag_thumbnail_offset, type_long, 8 + ifd0_size + ifd1_size);
+			put_ifd_entry(tiff, tag_thumbnail_length, type_long, static_cast<uint32_t>(thumbnail.size()));
+			put_le32(tiff, 0);
+			tiff.insert(tiff.end(), thumbnail.begin(), thumbnail.end());
+		}
+
+		// 标记、长度和 "Exif\0\0"
+		constexpr size_t overhead = 2 + 2 + 6;
+		const auto segment_size = std::max(overhead + tiff.size(), min_size);
+
+		if (segment_size - 2 > 0xffff)
+		{
+			throw std::invalid_argument("EXIF: segment is larger than 64 KB");
+		}
+
+		std::vector<uint8_t> segment(segment_size);
+		const uint8_t header[]{ 0xff, Jpeg::APP1, static_cast<uint8_t>((segment_size - 2) >> 8), static_cast<uint8_t>(segment_size - 2), 'E', 'x', 'i', 'f', 0, 0 };
+		std::memcpy(segment.data(), header, overhead);
+		std::memcpy(segment.data() + overhead, tiff.data(), tiff.size());
+
+		return segment;
+	}
+
+	std::vector<uint8_t> RewriteExifSegment(uint8_t const* segment, size_t size, uint32_t width, uint32_t height, std::vector<uint8_t> const& thumbnail)
+	{
+		// 标记、长度和 "Exif\0\0"
+		constexpr size_t overhead = 2 + 2 + 6;
+
+		if (size < overhead + 8 || segment[0] != 0xff || segment[1] != Jpeg::APP1 || std::memcmp(segment + 4, "Exif\0\0", 6) != 0)
+		{
+			return { segment, segment + size };
+		}
+
+		std::vector<uint8_t> tiff(segment + overhead, segment + size);
+
+		if (!((tiff[0] == 'I' && tiff[1] == 'I') || (tiff[0] == 'M' && tiff[1] == 'M')))
+		{
+			return { segment, segment + size };
+		}
+
+		tiff_editor editor(tiff);
+		const auto reader = editor.Reader();
+
+		if (reader.U16(2) != 42)
+		{
+			return { segment, segment + size };
+		}
+
+		// 只改写值在项内的单个 SHORT 或者 LONG
+		const auto put_value = [&](size_t entry, uint16_t type, uint32_t count, uint32_t value)
+		{
+			if (count == 1 && type == type_short)
+			{
+				editor.Put16(entry + 8, value);
+			}
+			else if (count == 1 && type == type_long)
+			{
+				editor.Put32(entry + 8, value);
+			}
+		};
+
+		// IFD0：方向，EXIF IFD 的位置
+		uint32_t exif_ifd = 0;
+		const auto ifd0_next = editor.VisitEntries(reader.U32(4), [&](size_t entry, uint16_t tag, uint16_t type, uint32_t count)
+		{
+			if (tag == tag_orientation)
+			{
+				put_value(entry, type, count, 1);
+			}
+			else if (tag == tag_exif_ifd && count == 1 && type == type_long)
+			{
+				exif_ifd = reader.U32(entry + 8);
+			}
+		});
+
+		if (ifd0_next == 0)
+		{
+			return { segment, segment + size };
+		}
+
+		// EXIF IFD：主图片的尺寸
+		editor.VisitEntries(exif_ifd, [&](size_t entry, uint16_t tag, uint16_t type, uint32_t count)
+		{
+			if (tag == tag_pixel_x_dimension)
+			{
+				put_value(entry, type, count, width);
+			}
+			else if (tag == tag_pixel_y_dimension)
+			{
+				put_value(entry, type, count, height);
+			}
+		});
+
+		// IFD1：略缩图。原来的略缩图在末尾（之后只有填充）时可以直接换掉，否则只能去掉
+		size_t length_entry = 0;
+		uint32_t thumbnail_offset = 0;
+		uint32_t thumbnail_length = 0;
+
+		editor.VisitEntries(reader.U32(ifd0_next), [&](size_t entry, uint16_t tag, uint16_t type, uint32_t count)
+		{
+			if (tag == tag_thumbnail_offset && count == 1 && type == type_long)
+			{
+				thumbnail_offset = reader.U32(entry + 8);
+			}
+			else if (tag == tag_thumbnail_length && count == 1 && type == type_long)
+			{
+				length_entry = entry;
+				thumbnail_length = reader.U32(entry + 8);
+			}
+		});
+
+		const auto thumbnail_end = static_cast<size_t>(thumbnail_offset) + thumbnail_length;
+		const auto at_end = length_entry != 0 && thumbnail_offset >= 8 && thumbnail_end <= tiff.size()
+			&& std::all_of(tiff.begin() + thumbnail_end, tiff.end(), [](uint8_t value) { return value == 0; });
+
+		// 之后 tiff 会变长或者变短，不能再用 reader
+		if (at_end)
+		{
+			tiff.resize(thumbnail_offset);
+		}
+
+		if (at_end && !thumbnail.empty() && overhead + tiff.size() + thumbnail.size() - 2 <= 0xffff)
+		{
+			editor.Put32(length_entry + 8, static_cast<uint32_t>(thumbnail.size()));
+			tiff.insert(tiff.end(), thumbnail.begin(), thumbnail.end());
+		}
+		else if (editor.Reader().U32(ifd0_next) != 0)
+		{
+			// 断开 IFD1，原来的略缩图不再被引用
+			editor.Put32(ifd0_next, 0);
+		}
+
+		const auto segment_size = overhead + tiff.size();
+		std::vector<uint8_t> result(segment_size);
+		const uint8_t header[]{ 0xff, Jpeg::APP1, static_cast<uint8_t>((segment_size - 2) >> 8), static_cast<uint8_t>(segment_size - 2), 'E', 'x', 'i', 'f', 0, 0 };
+		std::memcpy(result.data(), header, overhead);
+		std::memcpy(result.data() + overhead, tiff.data(), tiff.size());
+
+		return result;
+	}
+
+	PixelBuffer ApplyExifOrientation(ImageView const& image, uint16_t orientation)
+	{
+		PE_TRACE_SCOPE("ApplyExifOrientation");
+
+		const auto swap = SwapsDimensions(orientation);
+		PixelBuffer result(swap ? image.height : image.width, swap ? image.width : image.height);
+		const auto output = result.View();
+
+		const auto last_x = image.width - 1;
+		const auto last_y = image.height - 1;
+
+		for (uint32_t y = 0; y < output.height; y++)
+		{
+			auto destination = reinterpret_cast<uint32_t*>(output.Row(y));
+
+			for (uint32_t x = 0; x < output.width; x++)
+			{
+				// 输出像素对应的原图位置
+				uint32_t source_x;
+				uint32_t source_y;
+
+				switch (orientation)
+				{
+				case 2: source_x = last_x - x; source_y = y; break;
+				case 3: source_x = last_x - x; source_y = last_y - y; break;
+				case 4: source_x = x; source_y = last_y - y; break;
+				case 5: source_x = y; source_y = x; break;
+				case 6: source_x = y; source_y = last_y - x; break;
+				case 7: source_x = last_x - y; source_y = last_y - x; break;
+				case 8: source_x = last_x - y; source_y = x; break;
+				default: source_x = x; source_y = y; break;
+				}
+
+				destination[x] = reinterpret_cast<uint32_t const*>(image.Row(source_y))[source_x];
+			}
+		}
+
+		return result;
+	}
+}
@@ -0,0 +1,92 @@
+﻿/*
+ * JPEG 中的 EXIF（与平台无关）
+ *
+ * 只读取文件开头的标记段，找到 APP1/EXIF 后解析方向和 IFD1 中内嵌的 JPEG 略缩图，
+ * 不读取图片数据。相机照片的 EXIF 段通常只有几 KB 到几十 KB。
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "PixelBuffer.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 从 EXIF 得到的信息
+	/// </summary>
+	struct ExifInfo
+	{
+		// 1 - 8，与 TIFF 的 Orientation 标签相同，没有时为 1
+		uint16_t orientation{ 1 };
+		// 内嵌 JPEG 略缩图在文件中的位置，没有略缩图时 thumbnail_size 为 0
+		uint64_t thumbnail_offset{ 0 };
+		uint32_t thumbnail_size{ 0 };
+	};
+
+	/// <summary>
+	/// 从文件指定位置读取字节，返回实际读取的字节数，到文件末尾时小于 size
+	/// </summary>
+	using ReadAtFunction = std::function<size_t(uint64_t offset, uint8_t* buffer, size_t size)>;
+
+	/// <summary>
+	/// 逐个读取 JPEG 开头的标记段，只完整读取 APP1/EXIF 段。遇到帧头或者扫描时停止
+	/// </summary>
+	/// <param name="read">读取函数</param>
+	/// <param name="info">EXIF 信息</param>
+	/// <param name="bytes_read">可选的输出：读取的字节数</param>
+	/// <returns>是否找到了有效的 EXIF</returns>
+	bool ReadJpegExif(ReadAtFunction const& read, ExifInfo& info, uint64_t* bytes_read = nullptr);
+
+	/// <summary>
+	/// 解析 TIFF 结构（APP1 中 "Exif\0\0" 之后的部分）
+	/// </summary>
+	/// <param name="tiff">TIFF 数据</param>
+	/// <param name="size">字节数</param>
+	/// <param name="tiff_offset">TIFF 数据在文件中的位置，用于计算略缩图的位置</param>
+	/// <param name="info">EXIF 信息</param>
+	/// <returns>是否是有效的 TIFF 结构</returns>
+	bool ParseExifTiff(uint8_t const* tiff, size_t size, uint64_t tiff_offset, ExifInfo& info) noexcept;
+
+	/// <summary>
+	/// 生成包含方向和内嵌略缩图的 APP1/EXIF 段（含标记），总长度不小于 min_size
+	/// </summary>
+	/// <param name="orientation">方向</param>
+	/// <param name="thumbnail">内嵌的 JPEG 略缩图，可以为空</param>
+	/// <param name="min_size">用填充补齐到的最小长度</param>
+	/// <returns>APP1 段</returns>
+	std::vector<uint8_t> BuildExifSegment(uint16_t orientation, std::vector<uint8_t> const& thumbnail, size_t min_size = 0);
+
+	/// <summary>
+	/// 像素已经旋转、翻转或者裁剪为正向之后更新 APP1/EXIF 段：方向改为 1，PixelXDimension 和 PixelYDimension 改为新的尺寸，
+	/// 内嵌略缩图换成 thumbnail。其余标签按原样保留。
+	/// thumbnail 为空、原来的略缩图不在 TIFF 数据的末尾（无法替换）或者替换后超过 64 KB 时去掉略缩图
+	/// </summary>
+	/// <param name="segment">APP1 段（含标记和长度）</param>
+	/// <param name="size">段的字节数</param>
+	/// <param name="width">新的宽度</param>
+	/// <param name="height">新的高度</param>
+	/// <param name="thumbnail">同样变换过的 JPEG 略缩图，可以为空</param>
+	/// <returns>新的 APP1 段；不是有效的 EXIF 段时原样返回</returns>
+	std::vector<uint8_t> RewriteExifSegment(uint8_t const* segment, size_t size, uint32_t width, uint32_t height, std::vector<uint8_t> const& thumbnail);
+
+	/// <summary>
+	/// 方向 5 - 8 需要交换宽高
+	/// </summary>
+	constexpr bool SwapsDimensions(uint16_t orientation) noexcept
+	{
+		return orientation >= 5 && orientation <= 8;
+	}
+
+	/// <summary>
+	/// 按 EXIF 方向旋转、翻转为正向显示的图片
+	/// </summary>
+	/// <param name="image">按存储方向的图片</param>
+	/// <param name="orientation">EXIF 方向</param>
+	/// <returns>正向的图片</returns>
+	PixelBuffer ApplyExifOrientation(ImageView const& image, uint16_t orientation);
+}
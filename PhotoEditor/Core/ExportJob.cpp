@@ -0,0 +1,143 @@
+﻿/*
+ * 多尺寸导出代码
+ */
+
+#include "ExportJob.h"
+#include "PreviewRenderer.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		double elapsed_ms(std::chrono::steady_clock::time_point start) noexcept
+		{
+			return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+	}
+
+	void FitLongEdge(uint32_t width, uint32_t height, uint32_t max_long_edge, uint32_t& fitted_width, uint32_t& fitted_height) noexcept
+	{
+		const auto long_edge = std::max(width, height);
+
+		if (max_long_edge == 0 || long_edge <= max_long_edge)
+		{
+			fitted_width = width;
+			fitted_height = height;
+			return;
+		}
+
+		const auto scale = static_cast<double>(max_long_edge) / long_edge;
+		fitted_width = std::max(1u, static_cast<uint32_t>(width * scale + .5));
+		fitted_height = std::max(1u, static_cast<uint32_t>(height * scale + .5));
+	}
+
+	std::vector<ExportOutput> RenderExports(ImageView const& source, EffectChain const& chain, std::vector<ExportTarget> const& targets, ThreadPool& pool, BufferPool& buffers, ExportStats* stats)
+	{
+		PE_TRACE_SCOPE("RenderExports");
+
+		ExportStats local_stats;
+		std::vector<ExportOutput> outputs(targets.size());
+
+		// 渲染一次效果链，没有效果时直接使用原图
+		auto start = std::chrono::steady_clock::now();
+		PixelBuffer rendered;
+		auto edited = source;
+
+		if (!chain.empty())
+		{
+			PE_TRACE_SCOPE("RenderExports.render");
+
+			rendered = PixelBuffer(source.width, source.height, buffers);
+			RenderEffectChain(CompileEffectChain(chain), chain, source, rendered.View(), pool);
+			edited = rendered.View();
+		}
+
+		local_stats.render_ms = elapsed_ms(start);
+
+		// 从大到小排列，每个尺寸只依赖之前的尺寸
+		std::vector<size_t> order(targets.size());
+		std::iota(order.begin(), order.end(), size_t{ 0 });
+
+		for (size_t i = 0; i < targets.size(); i++)
+		{
+			FitLongEdge(source.width, source.height, targets[i].max_long_edge, outputs[i].width, outputs[i].height);
+		}
+
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+		{
+			return static_cast<uint64_t>(outputs[a].width) * outputs[a].height > static_cast<uint64_t>(outputs[b].width) * outputs[b].height;
+		});
+
+		start = std::chrono::steady_clock::now();
+		std::vector<PixelBuffer> resampled(targets.size());
+		std::vector<ImageView> views(targets.size());
+
+		{
+			PE_TRACE_SCOPE("RenderExports.resample");
+
+			for (size_t n = 0; n < order.size(); n++)
+			{
+				const auto i = order[n];
+				auto&& output = outputs[i];
+
+				if (output.width == source.width && output.height == source.height)
+				{
+					views[i] = edited;
+					continue;
+				}
+
+				// 已有的结果中不小于这个尺寸的最小一张，都没有时用渲染结果
+				auto input = edited;
+
+				for (size_t m = 0; m < n; m++)
+				{
+					auto&& candidate = views[order[m]];
+
+					if (candidate.width >= output.width && candidate.height >= output.height && candidate.PixelCount() < input.PixelCount())
+					{
+						input = candidate;
+					}
+				}
+
+				resampled[i] = PixelBuffer(output.width, output.height, buffers);
+				views[i] = resampled[i].View();
+				ResampleToFill(input, views[i], pool);
+
+				local_stats.resampled_pixels += input.PixelCount();
+				local_stats.resamples++;
+			}
+		}
+
+		local_stats.resample_ms = elapsed_ms(start);
+
+		// 每个输出一个编码器，从最大的开始同时编码
+		start = std::chrono::steady_clock::now();
+
+		{
+			PE_TRACE_SCOPE("RenderExports.encode");
+
+			pool.ParallelFor(order.size(), [&](size_t begin, size_t end)
+			{
+				for (auto n = begin; n < end; n++)
+				{
+					const auto i = order[n];
+					outputs[i].bytes = EncodeJpeg(views[i], targets[i].options);
+				}
+			});
+		}
+
+		local_stats.encode_ms = elapsed_ms(start);
+
+		if (stats)
+		{
+			*stats = local_stats;
+		}
+
+		return outputs;
+	}
+}
@@ -0,0 +1,73 @@
+﻿/*
+ * 多尺寸导出（与平台无关）
+ *
+ * 同一张编辑后的照片要导出原尺寸、网页版和略缩图等多个文件时，原图只渲染一次效果链。
+ * 各个尺寸从大到小依次缩小，每个尺寸从已有的结果中最小的、仍然不小于它的那张缩小
+ * （略缩图从网页版缩小，而不是再读一遍原图），中间结果都从缓冲池借出。
+ * 最后所有输出同时在线程池上编码，总时间接近只导出最大的一个文件。
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "BufferPool.h"
+#include "EffectChain.h"
+#include "JpegEncoder.h"
+#include "PixelBuffer.h"
+#include "ThreadPool.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 一个导出的文件
+	/// </summary>
+	struct ExportTarget
+	{
+		// 长边的最大像素数，0 表示原尺寸。不放大
+		uint32_t max_long_edge{ 0 };
+		JpegEncodeOptions options;
+	};
+
+	/// <summary>
+	/// 导出的结果，与 ExportTarget 一一对应
+	/// </summary>
+	struct ExportOutput
+	{
+		uint32_t width{ 0 };
+		uint32_t height{ 0 };
+		std::vector<uint8_t> bytes;
+	};
+
+	/// <summary>
+	/// 一次导出的统计
+	/// </summary>
+	struct ExportStats
+	{
+		double render_ms{ 0 };
+		double resample_ms{ 0 };
+		double encode_ms{ 0 };
+		// 缩小时读取的源像素数，级联缩小时远小于每个尺寸都读一遍原图
+		uint64_t resampled_pixels{ 0 };
+		// 缩小的次数，与原图尺寸相同的输出直接编码渲染结果
+		uint32_t resamples{ 0 };
+	};
+
+	/// <summary>
+	/// 长边不超过 max_long_edge 时保持宽高比的尺寸，max_long_edge 为 0 或者不小于长边时不变
+	/// </summary>
+	void FitLongEdge(uint32_t width, uint32_t height, uint32_t max_long_edge, uint32_t& fitted_width, uint32_t& fitted_height) noexcept;
+
+	/// <summary>
+	/// 渲染效果链一次，再缩小、编码为每个目标
+	/// </summary>
+	/// <param name="source">原图</param>
+	/// <param name="chain">效果链，为空时直接使用原图</param>
+	/// <param name="targets">导出的文件</param>
+	/// <param name="pool">线程池</param>
+	/// <param name="buffers">中间结果使用的缓冲池</param>
+	/// <param name="stats">可选的统计输出</param>
+	/// <returns>每个目标的 JPEG 文件内容</returns>
+	std::vector<ExportOutput> RenderExports(ImageView const& source, EffectChain const& chain, std::vector<ExportTarget> const& targets, ThreadPool& pool, BufferPool& buffers = BufferPool::Shared(), ExportStats* stats = nullptr);
+}
@@ -0,0 +1,164 @@
+﻿/*
+ * 效果链的融合内核代码
+ */
+
+#include "FusedKernels.h"
+#include "EffectKernels.h"
+
+#include <array>
+#include <cstdint>
+#include <utility>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		// 一个内核最多融合的效果数，两个标签最多展开为 4 个效果
+		constexpr size_t max_fused_effects = 4;
+
+		template <class T>
+		constexpr auto effect_index = static_cast<uint8_t>(Effect(std::in_place_type<T>).index());
+
+		template <class... Effects, size_t... Indices>
+		void run_fused(Effect const* effects, ImageView const& source, ImageView const& destination, ThreadPool& pool, std::index_sequence<Indices...>)
+		{
+			RunPointKernels(source, destination, pool, typename PointKernelFor<Effects>::type{ std::get<Effects>(effects[Indices]) }...);
+		}
+
+		template <class... Effects>
+		void fused_kernel(Effect const* effects, ImageView const& source, ImageView const& destination, ThreadPool& pool)
+		{
+			run_fused<Effects...>(effects, source, destination, pool, std::index_sequence_for<Effects...>{});
+		}
+
+		/// <summary>
+		/// 效果类型的序列
+		/// </summary>
+		template <class... Effects>
+		struct sequence
+		{
+		};
+
+		template <class First, class Second>
+		struct concat;
+
+		template <class... First, class... Second>
+		struct concat<sequence<First...>, sequence<Second...>>
+		{
+			using type = sequence<First..., Second...>;
+		};
+
+		// 标签展开的效果，与 BuildEffectChain 一致
+		using light = sequence<ContrastEffect, ExposureEffect>;
+		using color = sequence<TemperatureAndTintEffect, SaturationEffect>;
+		using sepia = sequence<SepiaEffect>;
+		using grayscale = sequence<GrayscaleEffect>;
+		using invert = sequence<InvertEffect>;
+
+		struct fused_entry
+		{
+			std::array<uint8_t, max_fused_effects> signature;
+			size_t length;
+			FusedKernel kernel;
+		};
+
+		template <class Sequence>
+		struct entry_for;
+
+		template <class... Effects>
+		struct entry_for<sequence<Effects...>>
+		{
+			static_assert(sizeof...(Effects) <= max_fused_effects);
+			static constexpr fused_entry value{ { effect_index<Effects>... }, sizeof...(Effects), &fused_kernel<Effects...> };
+		};
+
+		/// <summary>
+		/// 第一个标签是 First，第二个标签依次是 Seconds 的组合
+		/// </summary>
+		template <class First, class... Seconds>
+		constexpr std::array<fused_entry, sizeof...(Seconds)> pairs_starting_with() noexcept
+		{
+			return { entry_for<typename concat<First, Seconds>::type>::value... };
+		}
+
+		/// <summary>
+		/// 每个逐像素效果单独一项，每个标签一项，再加上任意两个标签按选择顺序的组合
+		/// （同一个标签重复的组合不会出现，一并生成更简单）
+		/// </summary>
+		template <class... Tags>
+		constexpr auto build_table() noexcept
+		{
+			constexpr size_t singles = 7;
+			constexpr size_t tags = sizeof...(Tags);
+			std::array<fused_entry, singles + tags + tags * tags> table{};
+
+			const std::array<fused_entry, singles> single_entries{
+				entry_for<sequence<ContrastEffect>>::value,
+				entry_for<sequence<ExposureEffect>>::value,
+				entry_for<sequence<TemperatureAndTintEffect>>::value,
+				entry_for<sequence<SaturationEffect>>::value,
+				entry_for<sequence<SepiaEffect>>::value,
+				entry_for<sequence<GrayscaleEffect>>::value,
+				entry_for<sequence<InvertEffect>>::value,
+			};
+
+			size_t next = 0;
+
+			for (auto&& entry : single_entries)
+			{
+				table[next++] = entry;
+			}
+
+			for (auto&& entry : { entry_for<Tags>::value... })
+			{
+				table[next++] = entry;
+			}
+
+			for (auto&& row : { pairs_starting_with<Tags, Tags...>()... })
+			{
+				for (auto&& entry : row)
+				{
+					table[next++] = entry;
+				}
+			}
+
+			return table;
+		}
+
+		const auto fused_table = build_table<light, color, sepia, grayscale, invert>();
+	}
+
+	FusedKernel FindFusedKernel(Effect const* effects, size_t count, size_t& length) noexcept
+	{
+		length = 0;
+		FusedKernel found = nullptr;
+
+		for (auto&& entry : fused_table)
+		{
+			if (entry.length > count || entry.length <= length)
+			{
+				continue;
+			}
+
+			auto matches = true;
+
+			for (size_t i = 0; i < entry.length && matches; i++)
+			{
+				matches = effects[i].index() == entry.signature[i];
+			}
+
+			if (matches)
+			{
+				length = entry.length;
+				found = entry.kernel;
+			}
+		}
+
+		return found;
+	}
+
+	size_t FusedKernelCount() noexcept
+	{
+		return fused_table.size();
+	}
+}
@@ -0,0 +1,36 @@
+﻿/*
+ * 效果链的融合内核（与平台无关）
+ *
+ * 预览网格的六个标签（Light、Color、Sepia、Grayscale、Invert、Blur）展开出的逐像素效果，
+ * 单个标签和任意两个标签的组合在编译时展开为专门的内核：一次遍历依次执行这些效果，
+ * 每个像素不经过 std::visit，中间结果也不写回内存。
+ * 运行时按效果类型的序列查表，找不到的效果仍然逐个遍历。
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#include "Effects.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 融合内核，依次对 source 执行 effects 开始的若干个效果，写入 destination
+	/// </summary>
+	using FusedKernel = void (*)(Effect const* effects, ImageView const& source, ImageView const& destination, ThreadPool& pool);
+
+	/// <summary>
+	/// 查找从 effects 开始、能够融合的最长一段效果
+	/// </summary>
+	/// <param name="effects">效果</param>
+	/// <param name="count">效果数</param>
+	/// <param name="length">输出融合的效果数，没有找到时为 0</param>
+	/// <returns>内核，第一个效果不是逐像素效果时为空</returns>
+	FusedKernel FindFusedKernel(Effect const* effects, size_t count, size_t& length) noexcept;
+
+	/// <summary>
+	/// 编译时生成的内核数
+	/// </summary>
+	size_t FusedKernelCount() noexcept;
+}
@@ -0,0 +1,258 @@
+﻿/*
+ * 只读文件头的图片识别代码
+ */
+
+#include "HeaderSniffer.h"
+#include "JpegCommon.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		// 第一次读取的字节数，PNG、GIF 和多数 JPEG 在这个范围内就能得到尺寸
+		constexpr size_t prefix_size = 4 * 1024;
+
+		// 标记段开头需要的字节数：标记、长度和 SOF 中的精度、高度、宽度
+		constexpr size_t segment_head = 9;
+
+		// 最多查看的标记段数
+		constexpr int max_segments = 64;
+
+		uint32_t read_be16(uint8_t const* p) noexcept
+		{
+			return static_cast<uint32_t>(p[0]) << 8 | p[1];
+		}
+
+		bool is_start_of_frame(uint8_t marker) noexcept
+		{
+			return marker >= 0xc0 && marker <= 0xcf && marker != Jpeg::DHT && marker != 0xc8 && marker != 0xcc;
+		}
+
+		/// <summary>
+		/// 逐个标记段查找 SOF。段头在 prefix 之外时只读取段头的几个字节；
+		/// read 为空时只使用 prefix。只有数据本身有错误时结果才是确定的
+		/// </summary>
+		void sniff_jpeg(uint8_t const* prefix, size_t size, ReadAtFunction const* read, SniffResult& result)
+		{
+			uint64_t position = 2;
+			uint8_t head[segment_head];
+
+			for (auto segment = 0; segment < max_segments; segment++)
+			{
+				uint8_t const* p;
+				size_t available;
+
+				if (position + segment_head <= size)
+				{
+					p = prefix + position;
+					available = segment_head;
+				}
+				else if (position < size && !read)
+				{
+					p = prefix + position;
+					available = static_cast<size_t>(size - position);
+				}
+				else if (read)
+				{
+					available = (*read)(position, head, segment_head);
+					result.bytes_read += available;
+					p = head;
+				}
+				else
+				{
+					return;
+				}
+
+				// 读取不完整
+				if (available < 4)
+				{
+					return;
+				}
+
+				if (p[0] != 0xff)
+				{
+					result.definitive = true;
+					return;
+				}
+
+				const auto marker = p[1];
+
+				// 填充字节
+				if (marker == 0xff)
+				{
+					position++;
+					continue;
+				}
+
+				// 没有长度字段的标记
+				if (marker == 0x01 || (marker >= Jpeg::RST0 && marker <= Jpeg::SOI))
+				{
+					position += 2;
+					continue;
+				}
+
+				// 在 SOF 之前就开始扫描或者结束了
+				if (marker == Jpeg::SOS || marker == Jpeg::EOI)
+				{
+					result.definitive = true;
+					return;
+				}
+
+				const auto length = read_be16(p + 2);
+
+				if (length < 2)
+				{
+					result.definitive = true;
+					return;
+				}
+
+				if (is_start_of_frame(marker))
+				{
+					if (available < segment_head)
+					{
+						return;
+					}
+
+					result.header.format = ImageFormat::Jpeg;
+					result.header.height = read_be16(p + 5);
+					result.header.width = read_be16(p + 7);
+					result.valid = length >= 7 && result.header.width != 0 && result.header.height != 0;
+
+					// 高度为 0 表示由 DNL 段给出，这里不支持，但不是错误
+					result.definitive = result.valid || length < 7 || result.header.width == 0;
+					return;
+				}
+
+				// 方向在 IFD0 中，通常就在 EXIF 段的开头，只解析已经读到的部分
+				if (marker == Jpeg::APP1 && length >= 8 && position + 10 <= size && std::memcmp(prefix + position + 4, "Exif\0\0", 6) == 0)
+				{
+					if (result.exif_size == 0)
+					{
+						result.exif_offset = position + 10;
+						result.exif_size = length - 8;
+					}
+
+					const auto tiff_size = std::min<size_t>(length - 8, static_cast<size_t>(size - position - 10));
+					ExifInfo exif;
+
+					if (ParseExifTiff(prefix + position + 10, tiff_size, 0, exif))
+					{
+						result.orientation = exif.orientation;
+					}
+				}
+
+				position += 2 + length;
+			}
+		}
+
+		void sniff(uint8_t const* prefix, size_t size, ReadAtFunction const* read, SniffResult& result)
+		{
+			if (size >= 3 && prefix[0] == 0xff && prefix[1] == Jpeg::SOI && prefix[2] == 0xff)
+			{
+				sniff_jpeg(prefix, size, read, result);
+				return;
+			}
+
+			result.valid = ParseImageHeader(prefix, size, result.header);
+
+			// 签名正确、只是数据不够读出尺寸时（文件被截断或者读取不完整）不确定
+			const auto png = size >= 8 && std::memcmp(prefix, "\x89PNG\r\n\x1a\n", 8) == 0;
+			const auto gif = size >= 6 && (std::memcmp(prefix, "GIF87a", 6) == 0 || std::memcmp(prefix, "GIF89a", 6) == 0);
+			result.definitive = result.valid || (png ? size >= 24 : gif ? size >= 10 : size >= 8);
+		}
+	}
+
+	SniffResult SniffImage(ReadAtFunction const& read)
+	{
+		std::vector<uint8_t> prefix(prefix_size);
+		SniffResult result;
+
+		prefix.resize(read(0, prefix.data(), prefix.size()));
+		result.bytes_read = prefix.size();
+
+		// 文件比第一次读取的还短时，之后不会再有内容
+		sniff(prefix.data(), prefix.size(), prefix.size() < prefix_size ? nullptr : &read, result);
+		return result;
+	}
+
+	SniffResult SniffImage(uint8_t const* data, size_t size)
+	{
+		SniffResult result;
+		sniff(data, size, nullptr, result);
+		return result;
+	}
+
+	bool NegativeCache::Contains(std::string const& path, uint64_t size_bytes, int64_t modified_time) const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		const auto found = entries_.find(path);
+		return found != entries_.end() && found->second.size_bytes == size_bytes && found->second.modified_time == modified_time;
+	}
+
+	void NegativeCache::Add(std::string const& path, uint64_t size_bytes, int64_t modified_time)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		entries_[path] = { size_bytes, modified_time };
+	}
+
+	void NegativeCache::Remove(std::string const& path)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		entries_.erase(path);
+	}
+
+	size_t NegativeCache::Size() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return entries_.size();
+	}
+
+	void NegativeCache::Save(std::ostream& output) const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		for (auto&& [path, entry] : entries_)
+		{
+			output << entry.size_bytes << '\t' << entry.modified_time << '\t' << path << '\n';
+		}
+	}
+
+	void NegativeCache::Load(std::istream& input)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::string line;
+
+		while (std::getline(input, line))
+		{
+			const auto first = line.find('\t');
+			const auto second = first == std::string::npos ? std::string::npos : line.find('\t', first + 1);
+
+			if (second == std::string::npos || second + 1 >= line.size())
+			{
+				continue;
+			}
+
+			char* end = nullptr;
+			const auto size_bytes = std::strtoull(line.c_str(), &end, 10);
+
+			if (end != line.c_str() + first)
+			{
+				continue;
+			}
+
+			const auto modified_time = std::strtoll(line.c_str() + first + 1, &end, 10);
+
+			if (end != line.c_str() + second)
+			{
+				continue;
+			}
+
+			entries_[line.substr(second + 1)] = { size_bytes, modified_time };
+		}
+	}
+}
@@ -0,0 +1,121 @@
+﻿/*
+ * 只读文件头的图片识别（与平台无关）
+ *
+ * 扫描图库时用几次小读取得到格式、尺寸和是否有效，代替逐个文件的 GetImagePropertiesAsync。
+ * JPEG 的帧头在大的 EXIF 段之后时，按段长度跳过，只读取每个标记段开头的几个字节。
+ * 确定不是有效图片的文件记入负缓存，文件没有变化之前不再读取或者解码；
+ * 只是没有读到足够的数据或者这里不支持的文件不算，仍然交给解码器。
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+#include "Exif.h"
+#include "ImageHeader.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 识别结果
+	/// </summary>
+	struct SniffResult
+	{
+		// 存储方向的格式和尺寸
+		ImageHeader header;
+		// JPEG 的 EXIF 方向，EXIF 在读到的范围之外时为 1
+		uint16_t orientation{ 1 };
+		// JPEG 的 EXIF 段中 TIFF 数据（"Exif\0\0" 之后）在文件中的位置和长度，没有时长度为 0。
+		// 内嵌略缩图在这一段里，计算占位预览时只需要再读取这一段
+		uint64_t exif_offset{ 0 };
+		uint32_t exif_size{ 0 };
+		bool valid{ false };
+		// 结果是否确定。无效而且确定时数据本身不是有效的图片（签名不对、标记段损坏），可以记入负缓存；
+		// 查看的标记段数用完、读取不完整、高度由 DNL 段给出等情况只是这里无法识别，解码器仍然可能打开
+		bool definitive{ false };
+		// 从文件读取的字节数
+		uint64_t bytes_read{ 0 };
+
+		/// <summary>
+		/// 转正后的宽度，与解码得到的位图一致
+		/// </summary>
+		[[nodiscard]] uint32_t DisplayWidth() const noexcept
+		{
+			return SwapsDimensions(orientation) ? header.height : header.width;
+		}
+
+		/// <summary>
+		/// 转正后的高度
+		/// </summary>
+		[[nodiscard]] uint32_t DisplayHeight() const noexcept
+		{
+			return SwapsDimensions(orientation) ? header.width : header.height;
+		}
+	};
+
+	/// <summary>
+	/// 读取文件开头识别图片。读取失败时抛出读取函数的异常
+	/// </summary>
+	/// <param name="read">读取函数</param>
+	/// <returns>识别结果</returns>
+	SniffResult SniffImage(ReadAtFunction const& read);
+
+	/// <summary>
+	/// 识别内存中的文件开头，数据不够时视为无效
+	/// </summary>
+	/// <param name="data">文件开头的字节</param>
+	/// <param name="size">字节数</param>
+	/// <returns>识别结果</returns>
+	SniffResult SniffImage(uint8_t const* data, size_t size);
+
+	/// <summary>
+	/// 无效图片的负缓存。以路径为键，记录识别时文件的大小和修改时间，文件变化后自动失效。
+	/// 可以被多个线程同时访问
+	/// </summary>
+	class NegativeCache
+	{
+	public:
+		/// <summary>
+		/// 文件是否已知无效
+		/// </summary>
+		[[nodiscard]] bool Contains(std::string const& path, uint64_t size_bytes, int64_t modified_time) const;
+
+		/// <summary>
+		/// 记录无效的文件
+		/// </summary>
+		void Add(std::string const& path, uint64_t size_bytes, int64_t modified_time);
+
+		/// <summary>
+		/// 文件恢复正常（例如重新解码成功）时移除
+		/// </summary>
+		void Remove(std::string const& path);
+
+		[[nodiscard]] size_t Size() const;
+
+		/// <summary>
+		/// 每行一项：大小、修改时间、路径，以制表符分隔
+		/// </summary>
+		void Save(std::ostream& output) const;
+
+		/// <summary>
+		/// 读取 Save 写出的内容，忽略无法解析的行
+		/// </summary>
+		void Load(std::istream& input);
+
+	private:
+		struct stamp
+		{
+			uint64_t size_bytes;
+			int64_t modified_time;
+		};
+
+		mutable std::mutex mutex_;
+		std::unordered_map<std::string, stamp> entries_;
+	};
+}
@@ -0,0 +1,164 @@
+﻿/*
+ * 图片文件头解析代码
+ */
+
+#include "ImageHeader.h"
+
+#include <cstring>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		uint32_t read_be16(uint8_t const* p) noexcept
+		{
+			return static_cast<uint32_t>(p[0]) << 8 | p[1];
+		}
+
+		uint32_t read_be32(uint8_t const* p) noexcept
+		{
+			return static_cast<uint32_t>(p[0]) << 24 | static_cast<uint32_t>(p[1]) << 16 | static_cast<uint32_t>(p[2]) << 8 | p[3];
+		}
+
+		uint32_t read_le16(uint8_t const* p) noexcept
+		{
+			return static_cast<uint32_t>(p[1]) << 8 | p[0];
+		}
+
+		/// <summary>
+		/// SOF0 - SOF15，不包括 DHT(C4)、JPG(C8) 和 DAC(CC)
+		/// </summary>
+		bool is_start_of_frame(uint8_t marker) noexcept
+		{
+			return marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc;
+		}
+
+		/// <summary>
+		/// 逐个跳过标记段直到 SOF
+		/// </summary>
+		bool parse_jpeg(uint8_t const* data, size_t size, ImageHeader& header) noexcept
+		{
+			size_t position = 2;
+
+			while (position + 4 <= size)
+			{
+				if (data[position] != 0xff)
+				{
+					return false;
+				}
+
+				const auto marker = data[position + 1];
+
+				// 填充字节
+				if (marker == 0xff)
+				{
+					position++;
+					continue;
+				}
+
+				// 没有长度字段的标记
+				if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd8))
+				{
+					position += 2;
+					continue;
+				}
+
+				// 在 SOF 之前就开始扫描或者结束了
+				if (marker == 0xd9 || marker == 0xda)
+				{
+					return false;
+				}
+
+				const auto length = read_be16(data + position + 2);
+
+				if (length < 2)
+				{
+					return false;
+				}
+
+				if (is_start_of_frame(marker))
+				{
+					if (position + 9 > size || length < 7)
+					{
+						return false;
+					}
+
+					header.format = ImageFormat::Jpeg;
+					header.height = read_be16(data + position + 5);
+					header.width = read_be16(data + position + 7);
+
+					// 高度为 0 表示由 DNL 段给出，这里不支持
+					return header.width != 0 && header.height != 0;
+				}
+
+				position += 2 + length;
+			}
+
+			return false;
+		}
+
+		bool parse_png(uint8_t const* data, size_t size, ImageHeader& header) noexcept
+		{
+			// 签名之后第一个块必须是 IHDR
+			if (size < 24 || std::memcmp(data + 12, "IHDR", 4) != 0)
+			{
+				return false;
+			}
+
+			header.format = ImageFormat::Png;
+			header.width = read_be32(data + 16);
+			header.height = read_be32(data + 20);
+			return header.width != 0 && header.height != 0;
+		}
+
+		bool parse_gif(uint8_t const* data, size_t size, ImageHeader& header) noexcept
+		{
+			if (size < 10)
+			{
+				return false;
+			}
+
+			header.format = ImageFormat::Gif;
+			header.width = read_le16(data + 6);
+			header.height = read_le16(data + 8);
+			return header.width != 0 && header.height != 0;
+		}
+	}
+
+	bool ParseImageHeader(uint8_t const* data, size_t size, ImageHeader& header) noexcept
+	{
+		header = {};
+
+		if (size >= 3 && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff)
+		{
+			return parse_jpeg(data, size, header);
+		}
+
+		if (size >= 8 && std::memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0)
+		{
+			return parse_png(data, size, header);
+		}
+
+		if (size >= 6 && (std::memcmp(data, "GIF87a", 6) == 0 || std::memcmp(data, "GIF89a", 6) == 0))
+		{
+			return parse_gif(data, size, header);
+		}
+
+		return false;
+	}
+
+	char const* ImageFormatName(ImageFormat format) noexcept
+	{
+		switch (format)
+		{
+		case ImageFormat::Jpeg:
+			return "JPEG";
+		case ImageFormat::Png:
+			return "PNG";
+		case ImageFormat::Gif:
+			return "GIF";
+		default:
+			return "Unknown";
+		}
+	}
+}
@@ -0,0 +1,46 @@
+﻿/*
+ * 图片文件头解析（与平台无关）
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 支持的图片格式，与 MainPage 扫描时的后缀名过滤一致
+	/// </summary>
+	enum class ImageFormat : uint8_t
+	{
+		Unknown,
+		Jpeg,
+		Png,
+		Gif
+	};
+
+	/// <summary>
+	/// 从文件头得到的图片信息
+	/// </summary>
+	struct ImageHeader
+	{
+		ImageFormat format{ ImageFormat::Unknown };
+		uint32_t width{ 0 };
+		uint32_t height{ 0 };
+	};
+
+	/// <summary>
+	/// 解析文件开头的字节，得到格式和尺寸
+	/// </summary>
+	/// <param name="data">文件开头的字节</param>
+	/// <param name="size">字节数</param>
+	/// <param name="header">解析结果</param>
+	/// <returns>是否识别出格式并读到了尺寸</returns>
+	bool ParseImageHeader(uint8_t const* data, size_t size, ImageHeader& header) noexcept;
+
+	/// <summary>
+	/// 格式名称，用于显示
+	/// </summary>
+	char const* ImageFormatName(ImageFormat format) noexcept;
+}
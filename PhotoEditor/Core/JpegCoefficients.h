@@ -0,0 +1,84 @@
+﻿/*
+ * JPEG 的量化 DCT 系数（与平台无关）
+ *
+ * 解码器熵解码之后、IDCT 之前的数据。无损变换直接在这一层重新排列块，
+ * 编码器再把它熵编码为基线 JPEG，整个过程不做 IDCT、颜色转换和重新量化。
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 一个分量的系数
+	/// </summary>
+	struct JpegComponentCoefficients
+	{
+		uint8_t id{ 0 };
+		// 采样因子
+		uint8_t h{ 1 };
+		uint8_t v{ 1 };
+		// 按 MCU 补齐后的块数
+		uint32_t blocks_w{ 0 };
+		uint32_t blocks_h{ 0 };
+		// 量化表，Z 字形顺序
+		uint16_t quantization[64]{};
+		// 每块 64 个系数，Z 字形顺序，块按行排列
+		std::vector<int16_t> coefficients;
+
+		[[nodiscard]] int16_t* Block(uint32_t bx, uint32_t by) noexcept
+		{
+			return coefficients.data() + (static_cast<size_t>(by) * blocks_w + bx) * 64;
+		}
+
+		[[nodiscard]] int16_t const* Block(uint32_t bx, uint32_t by) const noexcept
+		{
+			return coefficients.data() + (static_cast<size_t>(by) * blocks_w + bx) * 64;
+		}
+	};
+
+	/// <summary>
+	/// 一张图片的系数和需要原样保留的标记段
+	/// </summary>
+	struct JpegCoefficients
+	{
+		uint32_t width{ 0 };
+		uint32_t height{ 0 };
+		// 一个（灰度）或者三个分量。单分量的扫描不交错，采样因子总是 1
+		std::vector<JpegComponentCoefficients> components;
+		// APPn（JFIF、EXIF、XMP、ICC、Adobe 等）和 COM 段，含标记和长度，按文件中的顺序
+		std::vector<uint8_t> metadata;
+
+		/// <summary>
+		/// MCU 的宽度（像素），裁剪的起点必须对齐到 MCU
+		/// </summary>
+		[[nodiscard]] uint32_t McuWidth() const noexcept
+		{
+			uint32_t max_h = 1;
+
+			for (auto&& c : components)
+			{
+				max_h = std::max<uint32_t>(max_h, c.h);
+			}
+
+			return 8 * max_h;
+		}
+
+		[[nodiscard]] uint32_t McuHeight() const noexcept
+		{
+			uint32_t max_v = 1;
+
+			for (auto&& c : components)
+			{
+				max_v = std::max<uint32_t>(max_v, c.v);
+			}
+
+			return 8 * max_v;
+		}
+	};
+}
@@ -0,0 +1,1690 @@
+﻿/*
+ * JPEG 解码代码
+ */
+
+#include "JpegDecoder.h"
+#include "JpegCommon.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		[[noreturn]] void fail(char const* message)
+		{
+			throw std::runtime_error(std::string("JPEG: ") + message);
+		}
+
+		uint32_t read_be16(uint8_t const* p) noexcept
+		{
+			return static_cast<uint32_t>(p[0]) << 8 | p[1];
+		}
+
+		uint8_t clamp_sample(int value) noexcept
+		{
+			return static_cast<uint8_t>(value < 0 ? 0 : value > 255 ? 255 : value);
+		}
+
+		/// <summary>
+		/// 从 position 开始找下一个标记，返回 0xFF 的位置，找不到时返回 size
+		/// </summary>
+		size_t find_marker(uint8_t const* data, size_t size, size_t position) noexcept
+		{
+			while (position + 1 < size)
+			{
+				if (data[position] == 0xff && data[position + 1] != 0x00 && data[position + 1] != 0xff)
+				{
+					return position;
+				}
+
+				position++;
+			}
+
+			return size;
+		}
+
+		constexpr int fast_bits = 9;
+
+		/// <summary>
+		/// 解码用的 Huffman 表
+		/// </summary>
+		struct huffman_table
+		{
+			// 前 fast_bits 位直接查表：(码长 << 8) | 符号，0 表示码长超过 fast_bits
+			uint16_t fast[1 << fast_bits]{};
+			// 每种码长的最大码字，没有该码长时为 -1
+			int32_t max_code[18]{};
+			// 符号序号 = 码字 + offset
+			int32_t offset[17]{};
+			uint8_t symbols[256]{};
+			bool defined{ false };
+		};
+
+		void build_huffman_table(huffman_table& table, uint8_t const (&counts)[16], uint8_t const* symbols, size_t symbol_count)
+		{
+			table = {};
+
+			if (symbol_count > 256)
+			{
+				fail("too many Huffman symbols");
+			}
+
+			std::copy(symbols, symbols + symbol_count, table.symbols);
+
+			int32_t code = 0;
+			int32_t index = 0;
+
+			for (auto length = 1; length <= 16; length++)
+			{
+				table.offset[length] = index - code;
+
+				for (auto i = 0; i < counts[length - 1]; i++, code++, index++)
+				{
+					if (length <= fast_bits)
+					{
+						const auto first = code << (fast_bits - length);
+						const auto entry = static_cast<uint16_t>(length << 8 | table.symbols[index]);
+						std::fill(table.fast + first, table.fast + first + (1 << (fast_bits - length)), entry);
+					}
+				}
+
+				table.max_code[length] = counts[length - 1] != 0 ? code - 1 : -1;
+
+				if (code > (1 << length))
+				{
+					fail("invalid Huffman table");
+				}
+
+				code <<= 1;
+			}
+
+			table.max_code[17] = INT32_MAX;
+			table.defined = true;
+		}
+
+		/// <summary>
+		/// 熵编码数据的位读取器。遇到标记后补 0，停在标记处
+		/// </summary>
+		class bit_reader
+		{
+		public:
+			bit_reader(uint8_t const* data, size_t size, size_t position) noexcept :
+				data_(data),
+				size_(size),
+				position_(position)
+			{
+			}
+
+			size_t Position() const noexcept
+			{
+				return position_;
+			}
+
+			void Reset(size_t position) noexcept
+			{
+				position_ = position;
+				buffer_ = 0;
+				bits_ = 0;
+				marker_ = false;
+			}
+
+			uint32_t Bits(int count)
+			{
+				if (bits_ < count)
+				{
+					fill();
+				}
+
+				const auto value = static_cast<uint32_t>(buffer_ >> (64 - count));
+				consume(count);
+				return value;
+			}
+
+			uint32_t Bit()
+			{
+				return Bits(1);
+			}
+
+			void Skip(int count)
+			{
+				if (bits_ < count)
+				{
+					fill();
+				}
+
+				consume(count);
+			}
+
+			/// <summary>
+			/// 读取 count 位并按 JPEG 的规则扩展符号
+			/// </summary>
+			int32_t ReceiveExtend(int count)
+			{
+				if (count == 0)
+				{
+					return 0;
+				}
+
+				const auto value = static_cast<int32_t>(Bits(count));
+				return value < (1 << (count - 1)) ? value - (1 << count) + 1 : value;
+			}
+
+			uint8_t Decode(huffman_table const& table)
+			{
+				if (bits_ < 16)
+				{
+					fill();
+				}
+
+				const auto entry = table.fast[buffer_ >> (64 - fast_bits)];
+
+				if (entry != 0)
+				{
+					consume(entry >> 8);
+					return static_cast<uint8_t>(entry);
+				}
+
+				for (auto length = fast_bits + 1; length <= 16; length++)
+				{
+					const auto code = static_cast<int32_t>(buffer_ >> (64 - length));
+
+					if (code <= table.max_code[length])
+					{
+						consume(length);
+						return table.symbols[(code + table.offset[length]) & 0xff];
+					}
+				}
+
+				fail("invalid Huffman code");
+			}
+
+		private:
+			void consume(int count) noexcept
+			{
+				buffer_ <<= count;
+				bits_ -= count;
+			}
+
+			void fill() noexcept
+			{
+				while (bits_ <= 56)
+				{
+					uint64_t byte = 0;
+
+					if (!marker_ && position_ < size_)
+					{
+						byte = data_[position_];
+
+						if (byte != 0xff)
+						{
+							position_++;
+						}
+						else if (position_ + 1 < size_ && data_[position_ + 1] == 0x00)
+						{
+							// 填充的 0xFF00
+							position_ += 2;
+						}
+						else
+						{
+							marker_ = true;
+							byte = 0;
+						}
+					}
+
+					buffer_ |= byte << (56 - bits_);
+					bits_ += 8;
+				}
+			}
+
+			uint8_t const* data_;
+			size_t size_;
+			size_t position_;
+			uint64_t buffer_{ 0 };
+			int bits_{ 0 };
+			bool marker_{ false };
+		};
+
+		/// <summary>
+		/// AAN 浮点 IDCT 的量化表缩放系数
+		/// </summary>
+		constexpr float aan_scale[8]{
+			1.0f, 1.387039845f, 1.306562965f, 1.175875602f,
+			1.0f, 0.785694958f, 0.541196100f, 0.275899379f,
+		};
+
+		/// <summary>
+		/// 8x8 的 AAN 浮点 IDCT，quant 已经乘了 aan_scale
+		/// </summary>
+		void idct_8x8(int16_t const* coefficients, float const* quant, uint8_t* output, size_t stride) noexcept
+		{
+			float workspace[64];
+
+			for (auto column = 0; column < 8; column++)
+			{
+				auto in = coefficients + column;
+				auto q = quant + column;
+				auto ws = workspace + column;
+
+				if (in[8] == 0 && in[16] == 0 && in[24] == 0 && in[32] == 0 && in[40] == 0 && in[48] == 0 && in[56] == 0)
+				{
+					const auto dc = in[0] * q[0];
+
+					for (auto row = 0; row < 8; row++)
+					{
+						ws[row * 8] = dc;
+					}
+
+					continue;
+				}
+
+				auto tmp0 = in[0] * q[0];
+				auto tmp1 = in[16] * q[16];
+				auto tmp2 = in[32] * q[32];
+				auto tmp3 = in[48] * q[48];
+
+				auto tmp10 = tmp0 + tmp2;
+				auto tmp11 = tmp0 - tmp2;
+				auto tmp13 = tmp1 + tmp3;
+				auto tmp12 = (tmp1 - tmp3) * 1.414213562f - tmp13;
+
+				tmp0 = tmp10 + tmp13;
+				tmp3 = tmp10 - tmp13;
+				tmp1 = tmp11 + tmp12;
+				tmp2 = tmp11 - tmp12;
+
+				auto tmp4 = in[8] * q[8];
+				auto tmp5 = in[24] * q[24];
+				auto tmp6 = in[40] * q[40];
+				auto tmp7 = in[56] * q[56];
+
+				const auto z13 = tmp6 + tmp5;
+				const auto z10 = tmp6 - tmp5;
+				const auto z11 = tmp4 + tmp7;
+				const auto z12 = tmp4 - tmp7;
+
+				tmp7 = z11 + z13;
+				tmp11 = (z11 - z13) * 1.414213562f;
+
+				const auto z5 = (z10 + z12) * 1.847759065f;
+				tmp10 = 1.082392200f * z12 - z5;
+				tmp12 = -2.613125930f * z10 + z5;
+
+				tmp6 = tmp12 - tmp7;
+				tmp5 = tmp11 - tmp6;
+				tmp4 = tmp10 + tmp5;
+
+				ws[0] = tmp0 + tmp7;
+				ws[56] = tmp0 - tmp7;
+				ws[8] = tmp1 + tmp6;
+				ws[48] = tmp1 - tmp6;
+				ws[16] = tmp2 + tmp5;
+				ws[40] = tmp2 - tmp5;
+				ws[32] = tmp3 + tmp4;
+				ws[24] = tmp3 - tmp4;
+			}
+
+			for (auto row = 0; row < 8; row++)
+			{
+				auto ws = workspace + row * 8;
+				auto out = output + row * stride;
+
+				const auto tmp10 = ws[0] + ws[4];
+				const auto tmp11 = ws[0] - ws[4];
+				const auto tmp13 = ws[2] + ws[6];
+				const auto tmp12 = (ws[2] - ws[6]) * 1.414213562f - tmp13;
+
+				const auto tmp0 = tmp10 + tmp13;
+				const auto tmp3 = tmp10 - tmp13;
+				const auto tmp1 = tmp11 + tmp12;
+				const auto tmp2 = tmp11 - tmp12;
+
+				const auto z13 = ws[5] + ws[3];
+				const auto z10 = ws[5] - ws[3];
+				const auto z11 = ws[1] + ws[7];
+				const auto z12 = ws[1] - ws[7];
+
+				const auto tmp7 = z11 + z13;
+				const auto tmp11b = (z11 - z13) * 1.414213562f;
+
+				const auto z5 = (z10 + z12) * 1.847759065f;
+				const auto tmp10b = 1.082392200f * z12 - z5;
+				const auto tmp12b = -2.613125930f * z10 + z5;
+
+				const auto tmp6 = tmp12b - tmp7;
+				const auto tmp5 = tmp11b - tmp6;
+				const auto tmp4 = tmp10b + tmp5;
+
+				// 除以 8 并加上 128 的电平偏移
+				const auto store = [](float value)
+				{
+					return clamp_sample(static_cast<int>(std::lround(value * .125f)) + 128);
+				};
+
+				out[0] = store(tmp0 + tmp7);
+				out[7] = store(tmp0 - tmp7);
+				out[1] = store(tmp1 + tmp6);
+				out[6] = store(tmp1 - tmp6);
+				out[2] = store(tmp2 + tmp5);
+				out[5] = store(tmp2 - tmp5);
+				out[4] = store(tmp3 + tmp4);
+				out[3] = store(tmp3 - tmp4);
+			}
+		}
+
+		/// <summary>
+		/// 缩小的 IDCT：只用左上角 size x size 个系数，输出 size x size 个采样。
+		/// 每个方向是 (1/2) Σ C(u) F(u) cos((2x+1)uπ/2N)，保持块的平均值不变
+		/// </summary>
+		template <int Size>
+		void idct_reduced(int16_t const* coefficients, uint16_t const* quant, uint8_t* output, size_t stride) noexcept
+		{
+			struct cosine_table
+			{
+				float values[Size][Size];
+
+				cosine_table() noexcept
+				{
+					constexpr auto pi = 3.14159265358979323846;
+
+					for (auto x = 0; x < Size; x++)
+					{
+						for (auto u = 0; u < Size; u++)
+						{
+							const auto c = u == 0 ? 1 / std::sqrt(2.0) : 1.0;
+							// 8 点基函数在 8 / Size 个像素上的平均值，输出相当于把原尺寸的块按像素取平均
+							const auto pixels = 8 / Size;
+							const auto average = u == 0 ? 1.0 : std::sin(u * pixels * pi / 16) / (pixels * std::sin(u * pi / 16));
+							values[x][u] = static_cast<float>(c / 2 * average * std::cos((2 * x + 1) * u * pi / (2 * Size)));
+						}
+					}
+				}
+			};
+
+			static const cosine_table table;
+
+			float dequantized[Size][Size];
+
+			for (auto v = 0; v < Size; v++)
+			{
+				for (auto u = 0; u < Size; u++)
+				{
+					dequantized[v][u] = static_cast<float>(coefficients[v * 8 + u] * quant[v * 8 + u]);
+				}
+			}
+
+			// 先对每行做一维 IDCT
+			float rows[Size][Size];
+
+			for (auto v = 0; v < Size; v++)
+			{
+				for (auto x = 0; x < Size; x++)
+				{
+					float sum = 0;
+
+					for (auto u = 0; u < Size; u++)
+					{
+						sum += table.values[x][u] * dequantized[v][u];
+					}
+
+					rows[v][x] = sum;
+				}
+			}
+
+			for (auto y = 0; y < Size; y++)
+			{
+				for (auto x = 0; x < Size; x++)
+				{
+					float sum = 0;
+
+					for (auto v = 0; v < Size; v++)
+					{
+						sum += table.values[y][v] * rows[v][x];
+					}
+
+					output[y * stride + x] = clamp_sample(static_cast<int>(std::lround(sum)) + 128);
+				}
+			}
+		}
+
+		/// <summary>
+		/// 只有直流系数：块的平均值
+		/// </summary>
+		void idct_1x1(int16_t const* coefficients, uint16_t const* quant, uint8_t* output) noexcept
+		{
+			output[0] = clamp_sample(static_cast<int>(std::lround(coefficients[0] * quant[0] * .125f)) + 128);
+		}
+
+		/// <summary>
+		/// YCbCr 转 RGB 的定点表
+		/// </summary>
+		struct color_tables
+		{
+			int cr_r[256];
+			int cb_b[256];
+			int cr_g[256];
+			int cb_g[256];
+
+			color_tables() noexcept
+			{
+				for (auto i = 0; i < 256; i++)
+				{
+					const auto x = i - 128;
+					cr_r[i] = static_cast<int>(std::lround(1.402 * x));
+					cb_b[i] = static_cast<int>(std::lround(1.772 * x));
+					cr_g[i] = static_cast<int>(std::lround(-0.714136 * 65536 * x));
+					cb_g[i] = static_cast<int>(std::lround(-0.344136 * 65536 * x)) + 32768;
+				}
+			}
+		};
+
+		struct component
+		{
+			uint8_t id{ 0 };
+			uint32_t h{ 1 };
+			uint32_t v{ 1 };
+			uint32_t quant{ 0 };
+			uint32_t dc_table{ 0 };
+			uint32_t ac_table{ 0 };
+			int32_t dc_prediction{ 0 };
+
+			// 按 MCU 补齐后的块数
+			uint32_t blocks_w{ 0 };
+			uint32_t blocks_h{ 0 };
+			// 实际覆盖图片的块数，非交错扫描只处理这些块
+			uint32_t used_blocks_w{ 0 };
+			uint32_t used_blocks_h{ 0 };
+
+			// 缩小解码时每块输出的边长。水平和垂直都有下采样的色度用更大的 IDCT，直接得到输出分辨率的采样
+			uint32_t block_size{ 8 };
+			// 输出需要的 Z 字形系数个数
+			int kept{ 64 };
+
+			// 渐进式：每块保存前 kept 个 Z 字形系数，以及所有交流系数是否非零的位图
+			std::vector<int16_t> coefficients;
+			std::vector<uint64_t> nonzero;
+			// 解码的细化扫描覆盖到的最后一个系数。这之前的系数即使用不到，也需要非零的历史，覆盖它们的扫描不能跳过
+			int refined_end{ 0 };
+
+			// 缩小后的采样平面
+			std::vector<uint8_t> plane;
+			size_t plane_stride{ 0 };
+		};
+
+		class decoder
+		{
+		public:
+			decoder(uint8_t const* data, size_t size, uint32_t scale) :
+				data_(data),
+				size_(size),
+				block_size_(8 / scale),
+				reader_(data, size, 0)
+			{
+				if (scale != 1 && scale != 2 && scale != 4 && scale != 8)
+				{
+					fail("scale must be 1, 2, 4 or 8");
+				}
+			}
+
+			PixelBuffer Decode(JpegDecodeStats& stats)
+			{
+				parse();
+
+				if (progressive_)
+				{
+					PE_TRACE_SCOPE("DecodeJpeg.idct");
+
+					for (auto&& c : components_)
+					{
+						idct_component(c);
+					}
+				}
+
+				auto output = convert_color();
+				stats = stats_;
+				return output;
+			}
+
+			/// <summary>
+			/// 只做熵解码，取出完整的系数和标记段
+			/// </summary>
+			JpegCoefficients ReadCoefficients()
+			{
+				keep_coefficients_ = true;
+				parse();
+
+				JpegCoefficients result;
+				result.width = width_;
+				result.height = height_;
+				result.metadata = std::move(metadata_);
+
+				for (auto&& c : components_)
+				{
+					auto&& out = result.components.emplace_back();
+					out.id = c.id;
+					// 单分量的扫描不交错，文件中的采样因子没有意义
+					out.h = static_cast<uint8_t>(components_.size() == 1 ? 1 : c.h);
+					out.v = static_cast<uint8_t>(components_.size() == 1 ? 1 : c.v);
+					out.blocks_w = c.blocks_w;
+					out.blocks_h = c.blocks_h;
+
+					for (auto k = 0; k < 64; k++)
+					{
+						out.quantization[k] = quant_[c.quant][Jpeg::NaturalOrder[k]];
+					}
+
+					out.coefficients = std::move(c.coefficients);
+				}
+
+				return result;
+			}
+
+		private:
+			/// <summary>
+			/// 读取所有标记段并解码扫描
+			/// </summary>
+			void parse()
+			{
+				if (size_ < 4 || data_[0] != 0xff || data_[1] != Jpeg::SOI)
+				{
+					fail("not a JPEG file");
+				}
+
+				size_t position = 2;
+
+				while (true)
+				{
+					position = find_marker(data_, size_, position);
+
+					if (position >= size_)
+					{
+						// 被截断，输出已经解码的部分
+						break;
+					}
+
+					const auto marker = data_[position + 1];
+					position += 2;
+
+					if (marker == Jpeg::EOI)
+					{
+						break;
+					}
+
+					if (marker == Jpeg::SOI || Jpeg::IsRestartMarker(marker) || marker == 0x01)
+					{
+						continue;
+					}
+
+					if (position + 2 > size_)
+					{
+						break;
+					}
+
+					const auto length = read_be16(data_ + position);
+
+					if (length < 2)
+					{
+						fail("invalid segment length");
+					}
+
+					if (position + length > size_)
+					{
+						if (stats_.scans_decoded == 0)
+						{
+							fail("truncated header");
+						}
+
+						break;
+					}
+
+					const auto segment = data_ + position + 2;
+					const auto segment_size = length - 2;
+
+					if (keep_coefficients_ && ((marker >= Jpeg::APP0 && marker <= Jpeg::APP0 + 15) || marker == Jpeg::COM))
+					{
+						metadata_.insert(metadata_.end(), data_ + position - 2, data_ + position + length);
+					}
+
+					switch (marker)
+					{
+					case Jpeg::SOF0:
+					case Jpeg::SOF1:
+					case Jpeg::SOF2:
+						read_frame(segment, segment_size, marker == Jpeg::SOF2);
+						break;
+					case Jpeg::DHT:
+						read_huffman_tables(segment, segment_size);
+						break;
+					case Jpeg::DQT:
+						read_quantization_tables(segment, segment_size);
+						break;
+					case Jpeg::DRI:
+						if (segment_size < 2)
+						{
+							fail("invalid DRI");
+						}
+						restart_interval_ = read_be16(segment);
+						break;
+					case Jpeg::APP14:
+						read_adobe(segment, segment_size);
+						break;
+					case Jpeg::SOS:
+						position = read_scan(segment, segment_size, position + length);
+						continue;
+					default:
+						if (marker >= 0xc3 && marker <= 0xcf && marker != Jpeg::DHT && marker != 0xc8 && marker != 0xcc)
+						{
+							fail("unsupported coding process");
+						}
+						break;
+					}
+
+					position += length;
+				}
+
+				if (components_.empty())
+				{
+					fail("missing frame header");
+				}
+
+				if (stats_.scans_decoded == 0)
+				{
+					fail("missing scan");
+				}
+			}
+
+			void read_frame(uint8_t const* segment, size_t size, bool progressive)
+			{
+				if (!components_.empty())
+				{
+					fail("multiple frames");
+				}
+
+				if (size < 6)
+				{
+					fail("invalid frame header");
+				}
+
+				if (segment[0] != 8)
+				{
+					fail("only 8-bit precision is supported");
+				}
+
+				height_ = read_be16(segment + 1);
+				width_ = read_be16(segment + 3);
+				const auto count = segment[5];
+
+				if (width_ == 0 || height_ == 0)
+				{
+					fail("missing image size");
+				}
+
+				if (count != 1 && count != 3)
+				{
+					fail("only grayscale and three-component images are supported");
+				}
+
+				if (size < 6 + count * 3u)
+				{
+					fail("invalid frame header");
+				}
+
+				progressive_ = progressive;
+				components_.resize(count);
+
+				for (auto i = 0; i < count; i++)
+				{
+					auto&& c = components_[i];
+					c.id = segment[6 + i * 3];
+					c.h = segment[7 + i * 3] >> 4;
+					c.v = segment[7 + i * 3] & 15;
+					c.quant = segment[8 + i * 3];
+
+					if (c.h < 1 || c.h > 4 || c.v < 1 || c.v > 4 || c.quant > 3)
+					{
+						fail("invalid component");
+					}
+
+					max_h_ = std::max(max_h_, c.h);
+					max_v_ = std::max(max_v_, c.v);
+				}
+
+				mcus_x_ = (width_ + 8 * max_h_ - 1) / (8 * max_h_);
+				mcus_y_ = (height_ + 8 * max_v_ - 1) / (8 * max_v_);
+
+				for (auto&& c : components_)
+				{
+					// 与 libjpeg 相同：采样率是最大采样率的 1/2、1/4 时把 IDCT 放大同样的倍数，色度不需要再放大
+					c.block_size = block_size_;
+
+					while (c.block_size < 8 && max_h_ % (c.h * (c.block_size / block_size_) * 2) == 0 && max_v_ % (c.v * (c.block_size / block_size_) * 2) == 0)
+					{
+						c.block_size *= 2;
+					}
+
+					c.kept = kept_coefficients(c.block_size);
+
+					c.blocks_w = mcus_x_ * c.h;
+					c.blocks_h = mcus_y_ * c.v;
+					c.used_blocks_w = ((width_ * c.h + max_h_ - 1) / max_h_ + 7) / 8;
+					c.used_blocks_h = ((height_ * c.v + max_v_ - 1) / max_v_ + 7) / 8;
+
+					// 只读系数时不需要采样平面，基线图片也像渐进式一样保存系数
+					if (!keep_coefficients_)
+					{
+						c.plane_stride = static_cast<size_t>(c.blocks_w) * c.block_size;
+						c.plane.resize(c.plane_stride * c.blocks_h * c.block_size);
+						stats_.plane_bytes += c.plane.size();
+					}
+
+					if (progressive_ || keep_coefficients_)
+					{
+						const auto blocks = static_cast<size_t>(c.blocks_w) * c.blocks_h;
+						c.coefficients.assign(blocks * c.kept, 0);
+						stats_.coefficient_bytes += c.coefficients.size() * sizeof(int16_t);
+
+						// 只保存部分系数时，还需要知道其余系数是否非零才能处理细化扫描
+						if (c.kept < 64)
+						{
+							c.nonzero.assign(blocks, 0);
+							stats_.coefficient_bytes += c.nonzero.size() * sizeof(uint64_t);
+						}
+					}
+				}
+			}
+
+			void read_huffman_tables(uint8_t const* segment, size_t size)
+			{
+				size_t position = 0;
+
+				while (position < size)
+				{
+					if (position + 17 > size)
+					{
+						fail("invalid Huffman table");
+					}
+
+					const auto type = segment[position] >> 4;
+					const auto index = segment[position] & 15;
+
+					if (type > 1 || index > 3)
+					{
+						fail("invalid Huffman table");
+					}
+
+					uint8_t counts[16];
+					size_t total = 0;
+
+					for (auto i = 0; i < 16; i++)
+					{
+						counts[i] = segment[position + 1 + i];
+						total += counts[i];
+					}
+
+					position += 17;
+
+					if (position + total > size)
+					{
+						fail("invalid Huffman table");
+					}
+
+					build_huffman_table(type == 0 ? dc_tables_[index] : ac_tables_[index], counts, segment + position, total);
+					position += total;
+				}
+			}
+
+			void read_quantization_tables(uint8_t const* segment, size_t size)
+			{
+				size_t position = 0;
+
+				while (position < size)
+				{
+					const auto precision = segment[position] >> 4;
+					const auto index = segment[position] & 15;
+					const size_t entry_size = precision == 0 ? 1 : 2;
+
+					if (index > 3 || precision > 1 || position + 1 + 64 * entry_size > size)
+					{
+						fail("invalid quantization table");
+					}
+
+					position++;
+
+					for (auto k = 0; k < 64; k++)
+					{
+						const auto value = entry_size == 1 ? segment[position + k] : read_be16(segment + position + k * 2);
+						const auto natural = Jpeg::NaturalOrder[k];
+						quant_[index][natural] = static_cast<uint16_t>(value);
+						aan_quant_[index][natural] = value * aan_scale[natural / 8] * aan_scale[natural % 8];
+					}
+
+					position += 64 * entry_size;
+				}
+			}
+
+			void read_adobe(uint8_t const* segment, size_t size)
+			{
+				if (size >= 12 && std::equal(segment, segment + 5, "Adobe"))
+				{
+					adobe_transform_ = segment[11];
+				}
+			}
+
+			/// <summary>
+			/// 读取扫描头并解码（或者跳过）扫描数据
+			/// </summary>
+			/// <returns>扫描数据之后的位置</returns>
+			size_t read_scan(uint8_t const* segment, size_t size, size_t data_start)
+			{
+				if (components_.empty())
+				{
+					fail("scan before frame");
+				}
+
+				if (size < 1 || size < 4 + segment[0] * 2u || segment[0] < 1 || segment[0] > 4)
+				{
+					fail("invalid scan header");
+				}
+
+				const auto count = segment[0];
+				scan_components_.clear();
+
+				for (auto i = 0; i < count; i++)
+				{
+					const auto id = segment[1 + i * 2];
+					const auto found = std::find_if(components_.begin(), components_.end(), [id](component const& c)
+					{
+						return c.id == id;
+					});
+
+					if (found == components_.end())
+					{
+						fail("scan references unknown component");
+					}
+
+					found->dc_table = segment[2 + i * 2] >> 4;
+					found->ac_table = segment[2 + i * 2] & 15;
+
+					if (found->dc_table > 3 || found->ac_table > 3)
+					{
+						fail("invalid table selector");
+					}
+
+					scan_components_.push_back(&*found);
+				}
+
+				const auto tail = segment + 1 + count * 2;
+				spectral_start_ = tail[0];
+				spectral_end_ = tail[1];
+				approximation_high_ = tail[2] >> 4;
+				approximation_low_ = tail[2] & 15;
+
+				if (!progressive_)
+				{
+					spectral_start_ = 0;
+					spectral_end_ = 63;
+					approximation_high_ = 0;
+					approximation_low_ = 0;
+				}
+				else if (spectral_end_ > 63 || spectral_start_ > spectral_end_ || (spectral_start_ == 0 && spectral_end_ != 0) || (spectral_start_ > 0 && count != 1))
+				{
+					fail("invalid progressive scan");
+				}
+
+				if (progressive_ && block_size_ < 8 && !scans_planned_)
+				{
+					plan_skipped_scans(static_cast<size_t>(segment - data_) - 4);
+				}
+
+				// 整个频带都在需要的系数之外，之后的细化扫描也不需要这些系数的历史：不做熵解码，直接跳到下一个标记
+				if (progressive_ && spectral_start_ > 0 && spectral_start_ >= scan_components_[0]->kept && spectral_start_ > scan_components_[0]->refined_end)
+				{
+					stats_.scans_skipped++;
+					return skip_entropy_data(data_start);
+				}
+
+				stats_.scans_decoded++;
+				PE_TRACE_SCOPE("DecodeJpeg.scan");
+
+				for (auto c : scan_components_)
+				{
+					c->dc_prediction = 0;
+
+					const auto needs_dc = spectral_start_ == 0 && approximation_high_ == 0;
+					const auto needs_ac = !progressive_ || spectral_start_ > 0;
+
+					if ((needs_dc && !dc_tables_[c->dc_table].defined) || (needs_ac && !ac_tables_[c->ac_table].defined))
+					{
+						fail("missing Huffman table");
+					}
+				}
+
+				eob_run_ = 0;
+				reader_.Reset(data_start);
+
+				if (scan_components_.size() == 1)
+				{
+					decode_non_interleaved(*scan_components_[0]);
+				}
+				else
+				{
+					decode_interleaved();
+				}
+
+				return skip_entropy_data(reader_.Position());
+			}
+
+			/// <summary>
+			/// 在第一个扫描之前读出所有交流扫描的扫描头，确定每个分量的 refined_end。
+			/// 交流细化扫描要对已经非零的系数读取修正位，所以它的整个频带都需要之前扫描留下的非零位图；
+			/// 而为此解码的细化扫描又需要自己频带的历史，重复直到不再扩大
+			/// </summary>
+			/// <param name="position">第一个 SOS 标记的位置</param>
+			void plan_skipped_scans(size_t position)
+			{
+				scans_planned_ = true;
+
+				struct ac_scan
+				{
+					component* c;
+					int start;
+					int end;
+					bool refinement;
+				};
+
+				std::vector<ac_scan> scans;
+
+				while (true)
+				{
+					position = find_marker(data_, size_, position);
+
+					if (position + 4 > size_)
+					{
+						break;
+					}
+
+					const auto marker = data_[position + 1];
+
+					if (marker == Jpeg::EOI)
+					{
+						break;
+					}
+
+					if (marker == Jpeg::SOI || Jpeg::IsRestartMarker(marker) || marker == 0x01)
+					{
+						position += 2;
+						continue;
+					}
+
+					const auto length = read_be16(data_ + position + 2);
+
+					if (length < 2 || position + 2 + length > size_)
+					{
+						break;
+					}
+
+					const auto segment = data_ + position + 4;
+					position += 2 + length;
+
+					if (marker != Jpeg::SOS)
+					{
+						continue;
+					}
+
+					// 交流扫描只有一个分量，格式错误留给 read_scan 报告
+					if (length == 8 && segment[0] == 1 && segment[3] > 0)
+					{
+						const auto id = segment[1];
+						const auto found = std::find_if(components_.begin(), components_.end(), [id](component const& c)
+						{
+							return c.id == id;
+						});
+
+						if (found != components_.end())
+						{
+							scans.push_back({ &*found, segment[3], segment[4], (segment[5] >> 4) != 0 });
+						}
+					}
+
+					position = skip_entropy_data(position);
+				}
+
+				// 起始于需要的系数之内的细化扫描总是要解码
+				for (auto&& c : components_)
+				{
+					c.refined_end = c.kept - 1;
+				}
+
+				for (auto changed = true; changed;)
+				{
+					changed = false;
+
+					for (auto&& scan : scans)
+					{
+						if (scan.refinement && scan.start <= scan.c->refined_end && scan.end > scan.c->refined_end)
+						{
+							scan.c->refined_end = scan.end;
+							changed = true;
+						}
+					}
+				}
+			}
+
+			/// <summary>
+			/// 跳过熵编码数据和其中的 RST 标记
+			/// </summary>
+			size_t skip_entropy_data(size_t position) const noexcept
+			{
+				while (true)
+				{
+					position = find_marker(data_, size_, position);
+
+					if (position >= size_ || !Jpeg::IsRestartMarker(data_[position + 1]))
+					{
+						return position;
+					}
+
+					position += 2;
+				}
+			}
+
+			void decode_non_interleaved(component& c)
+			{
+				uint32_t mcu = 0;
+				const auto total = c.used_blocks_w * c.used_blocks_h;
+
+				for (uint32_t by = 0; by < c.used_blocks_h; by++)
+				{
+					for (uint32_t bx = 0; bx < c.used_blocks_w; bx++)
+					{
+						decode_block(c, bx, by);
+						handle_restart(++mcu, total);
+					}
+				}
+			}
+
+			void decode_interleaved()
+			{
+				uint32_t mcu = 0;
+				const auto total = mcus_x_ * mcus_y_;
+
+				for (uint32_t my = 0; my < mcus_y_; my++)
+				{
+					for (uint32_t mx = 0; mx < mcus_x_; mx++)
+					{
+						for (auto c : scan_components_)
+						{
+							for (uint32_t y = 0; y < c->v; y++)
+							{
+								for (uint32_t x = 0; x < c->h; x++)
+								{
+									decode_block(*c, mx * c->h + x, my * c->v + y);
+								}
+							}
+						}
+
+						handle_restart(++mcu, total);
+					}
+				}
+			}
+
+			void handle_restart(uint32_t mcu, uint32_t total)
+			{
+				if (restart_interval_ == 0 || mcu % restart_interval_ != 0 || mcu == total)
+				{
+					return;
+				}
+
+				// 跳到 RST 标记之后，重置预测值
+				auto position = find_marker(data_, size_, reader_.Position());
+
+				if (position < size_ && Jpeg::IsRestartMarker(data_[position + 1]))
+				{
+					position += 2;
+				}
+
+				reader_.Reset(position);
+				eob_run_ = 0;
+
+				for (auto c : scan_components_)
+				{
+					c->dc_prediction = 0;
+				}
+			}
+
+			void decode_block(component& c, uint32_t bx, uint32_t by)
+			{
+				if (!progressive_)
+				{
+					decode_sequential_block(c, bx, by);
+					return;
+				}
+
+				const auto block = static_cast<size_t>(by) * c.blocks_w + bx;
+				const auto coefficients = c.coefficients.data() + block * c.kept;
+				const auto nonzero = c.nonzero.empty() ? nullptr : &c.nonzero[block];
+
+				if (spectral_start_ == 0)
+				{
+					if (approximation_high_ == 0)
+					{
+						const auto s = reader_.Decode(dc_tables_[c.dc_table]);
+						c.dc_prediction += reader_.ReceiveExtend(s);
+						coefficients[0] = static_cast<int16_t>(c.dc_prediction * (1 << approximation_low_));
+					}
+					else if (reader_.Bit())
+					{
+						coefficients[0] = static_cast<int16_t>(coefficients[0] | (1 << approximation_low_));
+					}
+				}
+				else if (approximation_high_ == 0)
+				{
+					decode_ac_first(c, coefficients, nonzero);
+				}
+				else
+				{
+					decode_ac_refine(c, coefficients, nonzero);
+				}
+			}
+
+			void decode_sequential_block(component& c, uint32_t bx, uint32_t by)
+			{
+				int16_t block[64]{};
+
+				const auto s = reader_.Decode(dc_tables_[c.dc_table]);
+				c.dc_prediction += reader_.ReceiveExtend(s);
+				block[0] = static_cast<int16_t>(c.dc_prediction);
+
+				auto&& ac = ac_tables_[c.ac_table];
+
+				for (auto k = 1; k < 64;)
+				{
+					const auto rs = reader_.Decode(ac);
+					const auto run = rs >> 4;
+					const auto size = rs & 15;
+
+					if (size == 0)
+					{
+						if (run != 15)
+						{
+							break;
+						}
+
+						k += 16;
+						continue;
+					}
+
+					k += run;
+
+					// 输出用不到的系数只需要跳过
+					if (k < c.kept)
+					{
+						block[Jpeg::NaturalOrder[k]] = static_cast<int16_t>(reader_.ReceiveExtend(size));
+					}
+					else
+					{
+						reader_.Skip(size);
+					}
+
+					k++;
+				}
+
+				if (keep_coefficients_)
+				{
+					auto coefficients = c.coefficients.data() + (static_cast<size_t>(by) * c.blocks_w + bx) * c.kept;
+
+					for (auto k = 0; k < c.kept; k++)
+					{
+						coefficients[k] = block[Jpeg::NaturalOrder[k]];
+					}
+
+					return;
+				}
+
+				idct_block(c, block, bx, by);
+			}
+
+			void decode_ac_first(component& c, int16_t* coefficients, uint64_t* nonzero)
+			{
+				if (eob_run_ > 0)
+				{
+					eob_run_--;
+					return;
+				}
+
+				auto&& ac = ac_tables_[c.ac_table];
+
+				for (auto k = spectral_start_; k <= spectral_end_;)
+				{
+					const auto rs = reader_.Decode(ac);
+					const auto run = rs >> 4;
+					const auto size = rs & 15;
+
+					if (size == 0)
+					{
+						if (run < 15)
+						{
+							eob_run_ = (1u << run) - 1;
+
+							if (run != 0)
+							{
+								eob_run_ += reader_.Bits(run);
+							}
+
+							break;
+						}
+
+						k += 16;
+						continue;
+					}
+
+					k += run;
+
+					if (k > 63)
+					{
+						fail("coefficient index out of range");
+					}
+
+					const auto value = reader_.ReceiveExtend(size) * (1 << approximation_low_);
+
+					if (k < c.kept)
+					{
+						coefficients[k] = static_cast<int16_t>(value);
+					}
+
+					if (nonzero)
+					{
+						*nonzero |= 1ull << k;
+					}
+
+					k++;
+				}
+			}
+
+			/// <summary>
+			/// 交流系数的逐次逼近细化，与 libjpeg 的 decode_mcu_AC_refine 相同
+			/// </summary>
+			void decode_ac_refine(component& c, int16_t* coefficients, uint64_t* nonzero)
+			{
+				const auto positive = 1 << approximation_low_;
+				const auto negative = -1 * positive;
+
+				// 已经非零的系数读一个修正位
+				const auto is_nonzero = [&](int k)
+				{
+					return nonzero ? (*nonzero >> k & 1) != 0 : coefficients[k] != 0;
+				};
+
+				const auto correct = [&](int k)
+				{
+					if (reader_.Bit() && k < c.kept)
+					{
+						auto&& coefficient = coefficients[k];
+
+						if ((coefficient & positive) == 0)
+						{
+							coefficient = static_cast<int16_t>(coefficient + (coefficient >= 0 ? positive : negative));
+						}
+					}
+				};
+
+				auto k = static_cast<int>(spectral_start_);
+				const auto end = static_cast<int>(spectral_end_);
+
+				if (eob_run_ == 0)
+				{
+					auto&& ac = ac_tables_[c.ac_table];
+
+					for (; k <= end; k++)
+					{
+						const auto rs = reader_.Decode(ac);
+						auto run = rs >> 4;
+						const auto size = rs & 15;
+						auto value = 0;
+
+						if (size != 0)
+						{
+							value = reader_.Bit() ? positive : negative;
+						}
+						else if (run != 15)
+						{
+							eob_run_ = 1u << run;
+
+							if (run != 0)
+							{
+								eob_run_ += reader_.Bits(run);
+							}
+
+							break;
+						}
+
+						// 跳过 run 个零系数，途经的非零系数读取修正位
+						while (k <= end)
+						{
+							if (is_nonzero(k))
+							{
+								correct(k);
+							}
+							else if (run-- == 0)
+							{
+								break;
+							}
+
+							k++;
+						}
+
+						if (value != 0 && k <= 63)
+						{
+							if (k < c.kept)
+							{
+								coefficients[k] = static_cast<int16_t>(value);
+							}
+
+							if (nonzero)
+							{
+								*nonzero |= 1ull << k;
+							}
+						}
+					}
+				}
+
+				if (eob_run_ > 0)
+				{
+					for (; k <= end; k++)
+					{
+						if (is_nonzero(k))
+						{
+							correct(k);
+						}
+					}
+
+					eob_run_--;
+				}
+			}
+
+			/// <summary>
+			/// 输出边长为 block_size 的块需要的 Z 字形系数个数
+			/// </summary>
+			static int kept_coefficients(uint32_t block_size)
+			{
+				auto kept = 0;
+
+				for (auto k = 0; k < 64; k++)
+				{
+					const auto position = Jpeg::NaturalOrder[k];
+
+					if (position / 8 < block_size && position % 8 < block_size)
+					{
+						kept = k + 1;
+					}
+				}
+
+				return kept;
+			}
+
+			void idct_block(component& c, int16_t const* natural, uint32_t bx, uint32_t by)
+			{
+				auto output = c.plane.data() + static_cast<size_t>(by) * c.block_size * c.plane_stride + static_cast<size_t>(bx) * c.block_size;
+				const auto quant = quant_[c.quant];
+
+				switch (c.block_size)
+				{
+				case 8:
+					idct_8x8(natural, aan_quant_[c.quant], output, c.plane_stride);
+					break;
+				case 4:
+					idct_reduced<4>(natural, quant, output, c.plane_stride);
+					break;
+				case 2:
+					idct_reduced<2>(natural, quant, output, c.plane_stride);
+					break;
+				default:
+					idct_1x1(natural, quant, output);
+					break;
+				}
+			}
+
+			void idct_component(component& c)
+			{
+				int16_t natural[64];
+
+				for (uint32_t by = 0; by < c.used_blocks_h; by++)
+				{
+					for (uint32_t bx = 0; bx < c.used_blocks_w; bx++)
+					{
+						const auto coefficients = c.coefficients.data() + (static_cast<size_t>(by) * c.blocks_w + bx) * c.kept;
+						std::fill(std::begin(natural), std::end(natural), int16_t{ 0 });
+
+						for (auto k = 0; k < c.kept; k++)
+						{
+							natural[Jpeg::NaturalOrder[k]] = coefficients[k];
+						}
+
+						idct_block(c, natural, bx, by);
+					}
+				}
+			}
+
+			/// <summary>
+			/// 放大色度采样并转换为 BGRA
+			/// </summary>
+			PixelBuffer convert_color() const
+			{
+				PE_TRACE_SCOPE("DecodeJpeg.color");
+
+				const auto scale = 8 / block_size_;
+				const auto output_width = (width_ + scale - 1) / scale;
+				const auto output_height = (height_ + scale - 1) / scale;
+
+				PixelBuffer output(output_width, output_height);
+				const auto view = output.View();
+
+				// 每个分量的横向采样位置
+				std::vector<std::vector<uint32_t>> columns(components_.size());
+
+				for (size_t i = 0; i < components_.size(); i++)
+				{
+					columns[i].resize(output_width);
+
+					for (uint32_t x = 0; x < output_width; x++)
+					{
+						columns[i][x] = x * components_[i].h * (components_[i].block_size / block_size_) / max_h_;
+					}
+				}
+
+				// 分量在输出第 y 行的采样行
+				const auto row_of = [this](component const& c, uint32_t y)
+				{
+					return c.plane.data() + static_cast<size_t>(y * c.v * (c.block_size / block_size_) / max_v_) * c.plane_stride;
+				};
+
+				static const color_tables tables;
+				const auto rgb = components_.size() == 3 && (adobe_transform_ == 0 || (components_[0].id == 'R' && components_[1].id == 'G' && components_[2].id == 'B'));
+
+				for (uint32_t y = 0; y < output_height; y++)
+				{
+					auto out = view.Row(y);
+
+					if (components_.size() == 1)
+					{
+						auto&& gray = components_[0];
+						const auto row = row_of(gray, y);
+
+						for (uint32_t x = 0; x < output_width; x++, out += BytesPerPixel)
+						{
+							const auto value = row[columns[0][x]];
+							out[0] = value;
+							out[1] = value;
+							out[2] = value;
+							out[3] = 255;
+						}
+
+						continue;
+					}
+
+					const auto row0 = row_of(components_[0], y);
+					const auto row1 = row_of(components_[1], y);
+					const auto row2 = row_of(components_[2], y);
+
+					for (uint32_t x = 0; x < output_width; x++, out += BytesPerPixel)
+					{
+						const int c0 = row0[columns[0][x]];
+						const int c1 = row1[columns[1][x]];
+						const int c2 = row2[columns[2][x]];
+
+						if (rgb)
+						{
+							out[0] = static_cast<uint8_t>(c2);
+							out[1] = static_cast<uint8_t>(c1);
+							out[2] = static_cast<uint8_t>(c0);
+						}
+						else
+						{
+							out[0] = clamp_sample(c0 + tables.cb_b[c1]);
+							out[1] = clamp_sample(c0 + ((tables.cb_g[c1] + tables.cr_g[c2]) >> 16));
+							out[2] = clamp_sample(c0 + tables.cr_r[c2]);
+						}
+
+						out[3] = 255;
+					}
+				}
+
+				return output;
+			}
+
+			uint8_t const* data_;
+			size_t size_;
+			// 每个块输出的边长：8、4、2、1
+			uint32_t block_size_;
+			// 只读系数：保存所有块的系数和 APPn、COM 段，不做 IDCT
+			bool keep_coefficients_{ false };
+			std::vector<uint8_t> metadata_;
+
+			uint32_t width_{ 0 };
+			uint32_t height_{ 0 };
+			bool progressive_{ false };
+			int adobe_transform_{ -1 };
+			uint32_t restart_interval_{ 0 };
+			uint32_t max_h_{ 1 };
+			uint32_t max_v_{ 1 };
+			uint32_t mcus_x_{ 0 };
+			uint32_t mcus_y_{ 0 };
+
+			std::vector<component> components_;
+			std::vector<component*> scan_components_;
+
+			uint16_t quant_[4][64]{};
+			float aan_quant_[4][64]{};
+			huffman_table dc_tables_[4];
+			huffman_table ac_tables_[4];
+
+			// 是否已经确定哪些扫描可以跳过
+			bool scans_planned_{ false };
+
+			// 当前扫描
+			int spectral_start_{ 0 };
+			int spectral_end_{ 63 };
+			uint32_t approximation_high_{ 0 };
+			uint32_t approximation_low_{ 0 };
+			uint32_t eob_run_{ 0 };
+			bit_reader reader_;
+
+			JpegDecodeStats stats_{};
+		};
+	}
+
+	bool ReadJpegInfo(uint8_t const* data, size_t size, JpegInfo& info) noexcept
+	{
+		info = {};
+
+		if (size < 4 || data[0] != 0xff || data[1] != Jpeg::SOI)
+		{
+			return false;
+		}
+
+		size_t position = 2;
+
+		while (true)
+		{
+			position = find_marker(data, size, position);
+
+			if (position + 4 > size)
+			{
+				return false;
+			}
+
+			const auto marker = data[position + 1];
+
+			if (marker == Jpeg::SOS || marker == Jpeg::EOI)
+			{
+				return false;
+			}
+
+			if (Jpeg::IsRestartMarker(marker) || marker == Jpeg::SOI)
+			{
+				position += 2;
+				continue;
+			}
+
+			const auto length = read_be16(data + position + 2);
+
+			if (marker == Jpeg::SOF0 || marker == Jpeg::SOF1 || marker == Jpeg::SOF2)
+			{
+				if (position + 10 > size || length < 8)
+				{
+					return false;
+				}
+
+				info.height = read_be16(data + position + 5);
+				info.width = read_be16(data + position + 7);
+				info.components = data[position + 9];
+				info.progressive = marker == Jpeg::SOF2;
+
+				return data[position + 4] == 8 && info.width != 0 && info.height != 0 && (info.components == 1 || info.components == 3);
+			}
+
+			position += 2 + length;
+		}
+	}
+
+	uint32_t ChooseJpegScale(uint32_t width, uint32_t height, uint32_t min_width, uint32_t min_height) noexcept
+	{
+		for (uint32_t scale = 8; scale > 1; scale /= 2)
+		{
+			if ((width + scale - 1) / scale >= min_width && (height + scale - 1) / scale >= min_height)
+			{
+				return scale;
+			}
+		}
+
+		return 1;
+	}
+
+	PixelBuffer DecodeJpeg(uint8_t const* data, size_t size, uint32_t scale_denominator, JpegDecodeStats* stats)
+	{
+		PE_TRACE_SCOPE("DecodeJpeg");
+
+		JpegDecodeStats local_stats;
+		auto output = decoder(data, size, scale_denominator).Decode(local_stats);
+
+		if (stats)
+		{
+			*stats = local_stats;
+		}
+
+		return output;
+	}
+
+	JpegCoefficients ReadJpegCoefficients(uint8_t const* data, size_t size)
+	{
+		PE_TRACE_SCOPE("ReadJpegCoefficients");
+		return decoder(data, size, 1).ReadCoefficients();
+	}
+}
@@ -0,0 +1,82 @@
+﻿/*
+ * JPEG 解码（与平台无关）
+ *
+ * 支持基线、扩展和渐进式 Huffman 编码的 8 位灰度和 YCbCr 图片。
+ * 可以在 DCT 域直接缩小到 1/2、1/4、1/8：只对每个 8x8 块左上角的低频系数做缩小的 IDCT，
+ * 不需要先得到全尺寸的像素。与 libjpeg 相同，下采样的色度用相应更大的 IDCT，直接得到输出分辨率的采样。
+ * 渐进式图片只保存需要的系数，完全用不到、之后的细化扫描也不依赖的扫描直接跳过。
+ * 也可以只做熵解码，读出量化 DCT 系数用于无损变换。
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "JpegCoefficients.h"
+#include "PixelBuffer.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 从帧头得到的信息
+	/// </summary>
+	struct JpegInfo
+	{
+		uint32_t width{ 0 };
+		uint32_t height{ 0 };
+		uint8_t components{ 0 };
+		bool progressive{ false };
+	};
+
+	/// <summary>
+	/// 一次解码的统计
+	/// </summary>
+	struct JpegDecodeStats
+	{
+		// 解码了的扫描数
+		uint32_t scans_decoded{ 0 };
+		// 因为系数用不到而跳过的扫描数
+		uint32_t scans_skipped{ 0 };
+		// 渐进式图片保存系数用的字节数
+		size_t coefficient_bytes{ 0 };
+		// 各分量缩小后的采样平面的字节数
+		size_t plane_bytes{ 0 };
+	};
+
+	/// <summary>
+	/// 读取帧头，不解码
+	/// </summary>
+	/// <returns>是否是支持的 JPEG</returns>
+	bool ReadJpegInfo(uint8_t const* data, size_t size, JpegInfo& info) noexcept;
+
+	/// <summary>
+	/// 选择最大的缩小比例（8、4、2、1），使输出仍然不小于要求的尺寸
+	/// </summary>
+	/// <param name="width">原图宽度</param>
+	/// <param name="height">原图高度</param>
+	/// <param name="min_width">输出的最小宽度</param>
+	/// <param name="min_height">输出的最小高度</param>
+	/// <returns>缩小比例的分母</returns>
+	uint32_t ChooseJpegScale(uint32_t width, uint32_t height, uint32_t min_width, uint32_t min_height) noexcept;
+
+	/// <summary>
+	/// 解码为 BGRA8 预乘像素（不透明）。数据损坏或者格式不支持时抛出 std::runtime_error；
+	/// 数据被截断时尽量输出已经解码的部分
+	/// </summary>
+	/// <param name="data">文件内容</param>
+	/// <param name="size">字节数</param>
+	/// <param name="scale_denominator">缩小比例的分母：1、2、4 或 8</param>
+	/// <param name="stats">可选的统计输出</param>
+	/// <returns>宽高为原图除以比例向上取整的图片</returns>
+	PixelBuffer DecodeJpeg(uint8_t const* data, size_t size, uint32_t scale_denominator = 1, JpegDecodeStats* stats = nullptr);
+
+	/// <summary>
+	/// 只做熵解码，读出所有分量的量化 DCT 系数以及 APPn、COM 段，不做 IDCT 和颜色转换。
+	/// 数据损坏或者格式不支持时抛出 std::runtime_error
+	/// </summary>
+	/// <param name="data">文件内容</param>
+	/// <param name="size">字节数</param>
+	/// <returns>系数，渐进式图片也合并为完整的系数</returns>
+	JpegCoefficients ReadJpegCoefficients(uint8_t const* data, size_t size);
+}
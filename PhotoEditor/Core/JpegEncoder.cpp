@@ -0,0 +1,1088 @@
+﻿/*
+ * JPEG 编码代码
+ */
+
+#include "JpegEncoder.h"
+#include "JpegCommon.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		/// <summary>
+		/// 每个符号的码字和码长
+		/// </summary>
+		struct huffman_code
+		{
+			uint16_t code[256]{};
+			uint8_t length[256]{};
+		};
+
+		huffman_code build_huffman_code(Jpeg::HuffmanSpec const& spec) noexcept
+		{
+			huffman_code table;
+			uint32_t code = 0;
+			size_t index = 0;
+
+			for (auto length = 1; length <= 16; length++)
+			{
+				for (auto i = 0; i < spec.counts[length - 1]; i++, index++, code++)
+				{
+					table.code[spec.symbols[index]] = static_cast<uint16_t>(code);
+					table.length[spec.symbols[index]] = static_cast<uint8_t>(length);
+				}
+
+				code <<= 1;
+			}
+
+			return table;
+		}
+
+		/// <summary>
+		/// 写熵编码数据，0xFF 之后补 0x00
+		/// </summary>
+		class bit_writer
+		{
+		public:
+			explicit bit_writer(std::vector<uint8_t>& output) noexcept :
+				output_(output)
+			{
+			}
+
+			void Write(uint32_t bits, int count)
+			{
+				buffer_ = buffer_ << count | (bits & ((1u << count) - 1));
+				count_ += count;
+
+				while (count_ >= 8)
+				{
+					const auto byte = static_cast<uint8_t>(buffer_ >> (count_ - 8));
+					output_.push_back(byte);
+
+					if (byte == 0xff)
+					{
+						output_.push_back(0x00);
+					}
+
+					count_ -= 8;
+				}
+			}
+
+			void Code(huffman_code const& table, uint8_t symbol)
+			{
+				Write(table.code[symbol], table.length[symbol]);
+			}
+
+			/// <summary>
+			/// 用 1 补齐到字节边界
+			/// </summary>
+			void Flush()
+			{
+				if (count_ > 0)
+				{
+					Write(0x7f, 8 - count_);
+				}
+			}
+
+		private:
+			std::vector<uint8_t>& output_;
+			uint64_t buffer_{ 0 };
+			int count_{ 0 };
+		};
+
+		/// <summary>
+		/// 数值的位数（JPEG 的 SSSS）
+		/// </summary>
+		int magnitude_category(int value) noexcept
+		{
+			auto magnitude = value < 0 ? -value : value;
+			auto bits = 0;
+
+			while (magnitude != 0)
+			{
+				bits++;
+				magnitude >>= 1;
+			}
+
+			return bits;
+		}
+
+		/// <summary>
+		/// 负数写成 value - 1 的低位
+		/// </summary>
+		uint32_t magnitude_bits(int value, int category) noexcept
+		{
+			return static_cast<uint32_t>(value < 0 ? value - 1 : value) & ((1u << category) - 1);
+		}
+
+		void encode_dc(bit_writer& writer, huffman_code const& codes, int difference)
+		{
+			const auto category = magnitude_category(difference);
+			writer.Code(codes, static_cast<uint8_t>(category));
+
+			if (category != 0)
+			{
+				writer.Write(magnitude_bits(difference, category), category);
+			}
+		}
+
+		/// <summary>
+		/// 编码 Z 字形 [start, end] 范围内的交流系数，末尾的零用 EOB 表示
+		/// </summary>
+		void encode_ac(bit_writer& writer, huffman_code const& codes, int16_t const* coefficients, int start, int end)
+		{
+			auto run = 0;
+
+			for (auto k = start; k <= end; k++)
+			{
+				const int value = coefficients[k];
+
+				if (value == 0)
+				{
+					run++;
+					continue;
+				}
+
+				while (run > 15)
+				{
+					writer.Code(codes, 0xf0);
+					run -= 16;
+				}
+
+				const auto category = magnitude_category(value);
+				writer.Code(codes, static_cast<uint8_t>(run << 4 | category));
+				writer.Write(magnitude_bits(value, category), category);
+				run = 0;
+			}
+
+			if (run > 0)
+			{
+				writer.Code(codes, 0x00);
+			}
+		}
+
+		/// <summary>
+		/// 逐次逼近的交流细化扫描，与 libjpeg 的 encode_mcu_AC_refine 相同，但不使用 EOB 游程（标准表中没有这些符号）。
+		/// 本次新变为非零的系数编码位置和符号，之前已经非零的系数只输出一个修正位，跟在下一个符号之后
+		/// </summary>
+		void encode_ac_refine(bit_writer& writer, huffman_code const& codes, int16_t const* coefficients, int start, int end, int low)
+		{
+			int magnitudes[64];
+			auto last_new = 0;
+
+			for (auto k = start; k <= end; k++)
+			{
+				const int value = coefficients[k];
+				magnitudes[k] = (value < 0 ? -value : value) >> low;
+
+				if (magnitudes[k] == 1)
+				{
+					last_new = k;
+				}
+			}
+
+			// 等待输出的修正位
+			uint8_t corrections[64];
+			auto pending = 0;
+			auto run = 0;
+
+			const auto flush_corrections = [&]
+			{
+				for (auto i = 0; i < pending; i++)
+				{
+					writer.Write(corrections[i], 1);
+				}
+
+				pending = 0;
+			};
+
+			for (auto k = start; k <= end; k++)
+			{
+				const auto magnitude = magnitudes[k];
+
+				if (magnitude == 0)
+				{
+					run++;
+					continue;
+				}
+
+				while (run > 15 && k <= last_new)
+				{
+					writer.Code(codes, 0xf0);
+					run -= 16;
+					flush_corrections();
+				}
+
+				if (magnitude > 1)
+				{
+					corrections[pending++] = static_cast<uint8_t>(magnitude & 1);
+					continue;
+				}
+
+				writer.Code(codes, static_cast<uint8_t>(run << 4 | 1));
+				writer.Write(coefficients[k] < 0 ? 0 : 1, 1);
+				flush_corrections();
+				run = 0;
+			}
+
+			if (run > 0 || pending > 0)
+			{
+				writer.Code(codes, 0x00);
+				flush_corrections();
+			}
+		}
+
+		void put16(std::vector<uint8_t>& output, uint32_t value)
+		{
+			output.push_back(static_cast<uint8_t>(value >> 8));
+			output.push_back(static_cast<uint8_t>(value));
+		}
+
+		/// <summary>
+		/// 写标准 Huffman 表：0 号用于亮度，1 号用于色度
+		/// </summary>
+		void write_huffman_tables(std::vector<uint8_t>& output)
+		{
+			Jpeg::HuffmanSpec const* specs[]{ &Jpeg::StandardLuminanceDc, &Jpeg::StandardLuminanceAc, &Jpeg::StandardChrominanceDc, &Jpeg::StandardChrominanceAc };
+			const uint8_t classes[]{ 0x00, 0x10, 0x01, 0x11 };
+
+			for (auto i = 0; i < 4; i++)
+			{
+				output.insert(output.end(), { 0xff, Jpeg::DHT });
+				put16(output, 2 + 1 + 16 + specs[i]->symbol_count);
+				output.push_back(classes[i]);
+				output.insert(output.end(), specs[i]->counts, specs[i]->counts + 16);
+				output.insert(output.end(), specs[i]->symbols, specs[i]->symbols + specs[i]->symbol_count);
+			}
+		}
+
+		constexpr float aan_scale[8]{
+			1.0f, 1.387039845f, 1.306562965f, 1.175875602f,
+			1.0f, 0.785694958f, 0.541196100f, 0.275899379f,
+		};
+
+		/// <summary>
+		/// AAN 浮点一维 FDCT，同时变换 8 列：第 k 个输入是 data[k * 8 + i]。
+		/// 8 列互相独立、内存连续，编译器可以向量化
+		/// </summary>
+		void fdct_columns(float* data) noexcept
+		{
+			for (auto i = 0; i < 8; i++)
+			{
+				const auto d = data + i;
+
+				const auto tmp0 = d[0 * 8] + d[7 * 8];
+				const auto tmp7 = d[0 * 8] - d[7 * 8];
+				const auto tmp1 = d[1 * 8] + d[6 * 8];
+				const auto tmp6 = d[1 * 8] - d[6 * 8];
+				const auto tmp2 = d[2 * 8] + d[5 * 8];
+				const auto tmp5 = d[2 * 8] - d[5 * 8];
+				const auto tmp3 = d[3 * 8] + d[4 * 8];
+				const auto tmp4 = d[3 * 8] - d[4 * 8];
+
+				auto tmp10 = tmp0 + tmp3;
+				const auto tmp13 = tmp0 - tmp3;
+				auto tmp11 = tmp1 + tmp2;
+				auto tmp12 = tmp1 - tmp2;
+
+				d[0 * 8] = tmp10 + tmp11;
+				d[4 * 8] = tmp10 - tmp11;
+
+				const auto z1 = (tmp12 + tmp13) * 0.707106781f;
+				d[2 * 8] = tmp13 + z1;
+				d[6 * 8] = tmp13 - z1;
+
+				tmp10 = tmp4 + tmp5;
+				tmp11 = tmp5 + tmp6;
+				tmp12 = tmp6 + tmp7;
+
+				const auto z5 = (tmp10 - tmp12) * 0.382683433f;
+				const auto z2 = 0.541196100f * tmp10 + z5;
+				const auto z4 = 1.306562965f * tmp12 + z5;
+				const auto z3 = tmp11 * 0.707106781f;
+
+				const auto z11 = tmp7 + z3;
+				const auto z13 = tmp7 - z3;
+
+				d[5 * 8] = z13 + z2;
+				d[3 * 8] = z13 - z2;
+				d[1 * 8] = z11 + z4;
+				d[7 * 8] = z11 - z4;
+			}
+		}
+
+		/// <summary>
+		/// 二维 FDCT，输入按列存放（data[x * 8 + y]），输出按行存放（data[v * 8 + u]）。
+		/// 先变换行再变换列，中间转置一次，两遍都是连续的 8 列
+		/// </summary>
+		void fdct_8x8(float* data) noexcept
+		{
+			fdct_columns(data);
+
+			for (auto y = 0; y < 8; y++)
+			{
+				for (auto x = y + 1; x < 8; x++)
+				{
+					std::swap(data[y * 8 + x], data[x * 8 + y]);
+				}
+			}
+
+			fdct_columns(data);
+		}
+
+		struct component
+		{
+			uint8_t id{ 0 };
+			uint32_t h{ 1 };
+			uint32_t v{ 1 };
+			uint32_t table{ 0 };
+			// 按 MCU 补齐的块数
+			uint32_t blocks_w{ 0 };
+			uint32_t blocks_h{ 0 };
+			// 实际覆盖图片的块数
+			uint32_t used_blocks_w{ 0 };
+			uint32_t used_blocks_h{ 0 };
+			// 补齐后的采样平面
+			std::vector<uint8_t> plane;
+			size_t stride{ 0 };
+		};
+
+		class encoder
+		{
+		public:
+			encoder(ImageView const& image, JpegEncodeOptions const& options, ThreadPool* pool) :
+				image_(image),
+				options_(options),
+				pool_(pool)
+			{
+				if (image.Empty() || image.width > 65535 || image.height > 65535)
+				{
+					throw std::invalid_argument("JPEG: image size must be 1 - 65535");
+				}
+
+				const auto quality = std::clamp(options.quality, 1, 100);
+				const auto scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+
+				for (auto i = 0; i < 64; i++)
+				{
+					quant_[0][i] = static_cast<uint16_t>(std::clamp((Jpeg::StandardLuminanceQuantization[i] * scale + 50) / 100, 1, 255));
+					quant_[1][i] = static_cast<uint16_t>(std::clamp((Jpeg::StandardChrominanceQuantization[i] * scale + 50) / 100, 1, 255));
+
+					for (auto t = 0; t < 2; t++)
+					{
+						divisors_[t][i] = 1.0f / (quant_[t][i] * aan_scale[i / 8] * aan_scale[i % 8] * 8);
+					}
+				}
+
+				dc_codes_[0] = build_huffman_code(Jpeg::StandardLuminanceDc);
+				ac_codes_[0] = build_huffman_code(Jpeg::StandardLuminanceAc);
+				dc_codes_[1] = build_huffman_code(Jpeg::StandardChrominanceDc);
+				ac_codes_[1] = build_huffman_code(Jpeg::StandardChrominanceAc);
+
+				const auto chroma_h = options.subsampling == JpegSubsampling::Yuv444 ? 1u : 2u;
+				const auto chroma_v = options.subsampling == JpegSubsampling::Yuv420 ? 2u : 1u;
+
+				max_h_ = chroma_h;
+				max_v_ = chroma_v;
+				mcus_x_ = (image.width + 8 * max_h_ - 1) / (8 * max_h_);
+				mcus_y_ = (image.height + 8 * max_v_ - 1) / (8 * max_v_);
+
+				components_[0].h = max_h_;
+				components_[0].v = max_v_;
+				components_[1].table = 1;
+				components_[2].table = 1;
+
+				for (auto i = 0; i < 3; i++)
+				{
+					auto&& c = components_[i];
+					c.id = static_cast<uint8_t>(i + 1);
+					c.blocks_w = mcus_x_ * c.h;
+					c.blocks_h = mcus_y_ * c.v;
+					c.used_blocks_w = ((image.width * c.h + max_h_ - 1) / max_h_ + 7) / 8;
+					c.used_blocks_h = ((image.height * c.v + max_v_ - 1) / max_v_ + 7) / 8;
+					c.stride = static_cast<size_t>(c.blocks_w) * 8;
+					c.plane.resize(c.stride * c.blocks_h * 8);
+				}
+
+				// 并行编码基线图片时每行 MCU 是一个重启间隔
+				if (pool_ && !options.progressive)
+				{
+					restart_interval_ = mcus_x_;
+				}
+			}
+
+			std::vector<uint8_t> Encode()
+			{
+				convert_color();
+
+				std::vector<uint8_t> output;
+				output.reserve(static_cast<size_t>(image_.width) * image_.height / 4 + 1024);
+
+				write_headers(output);
+
+				if (options_.progressive)
+				{
+					encode_progressive(output);
+				}
+				else
+				{
+					write_scan_header(output, { 0, 1, 2 }, 0, 63);
+
+					if (restart_interval_ != 0)
+					{
+						encode_restart_intervals(output);
+					}
+					else
+					{
+						encode_baseline(output);
+					}
+				}
+
+				output.push_back(0xff);
+				output.push_back(Jpeg::EOI);
+				return output;
+			}
+
+		private:
+			/// <summary>
+			/// 有线程池时把 [0, count) 分块并行执行，否则在当前线程上执行
+			/// </summary>
+			template <class Function>
+			void for_each_range(size_t count, Function const& body) const
+			{
+				if (pool_)
+				{
+					pool_->ParallelFor(count, body);
+				}
+				else
+				{
+					body(size_t{ 0 }, count);
+				}
+			}
+
+			/// <summary>
+			/// 转换为 YCbCr 平面，色度按块平均降采样，边缘复制补齐到整块。
+			/// 按 MCU 行分段，每段的全分辨率色度只在段内使用
+			/// </summary>
+			void convert_color()
+			{
+				PE_TRACE_SCOPE("EncodeJpeg.color");
+
+				for_each_range(mcus_y_, [&](size_t begin, size_t end)
+				{
+					auto&& luma = components_[0];
+					const auto padded_width = luma.blocks_w * 8;
+					const auto band_rows = 8 * max_v_;
+
+					// 一段的全分辨率色度，之后再降采样
+					std::vector<uint8_t> cb(static_cast<size_t>(padded_width) * band_rows);
+					std::vector<uint8_t> cr(cb.size());
+
+					for (auto my = static_cast<uint32_t>(begin); my < end; my++)
+					{
+						for (uint32_t row = 0; row < band_rows; row++)
+						{
+							const auto y = my * band_rows + row;
+							convert_row(image_.Row(std::min(y, image_.height - 1)), luma.plane.data() + y * luma.stride, cb.data() + static_cast<size_t>(row) * padded_width, cr.data() + static_cast<size_t>(row) * padded_width, padded_width);
+						}
+
+						for (auto index = 1; index < 3; index++)
+						{
+							auto&& c = components_[index];
+							downsample(index == 1 ? cb.data() : cr.data(), padded_width, c.plane.data() + static_cast<size_t>(my) * 8 * c.v * c.stride, c.stride, c.blocks_w * 8, 8 * c.v);
+						}
+					}
+				});
+			}
+
+			/// <summary>
+			/// 转换一行，图片宽度之外复制最后一个像素。循环中没有分支，编译器可以向量化
+			/// </summary>
+			void convert_row(uint8_t const* source, uint8_t* y_row, uint8_t* cb_row, uint8_t* cr_row, uint32_t padded_width) const noexcept
+			{
+				const auto width = image_.width;
+
+				for (uint32_t x = 0; x < width; x++)
+				{
+					const auto pixel = source + x * BytesPerPixel;
+					const int b = pixel[0];
+					const int g = pixel[1];
+					const int r = pixel[2];
+
+					// 16 位定点
+					y_row[x] = static_cast<uint8_t>((19595 * r + 38470 * g + 7471 * b + 32768) >> 16);
+					cb_row[x] = static_cast<uint8_t>((-11059 * r - 21709 * g + 32768 * b + (128 << 16) + 32767) >> 16);
+					cr_row[x] = static_cast<uint8_t>((32768 * r - 27439 * g - 5329 * b + (128 << 16) + 32767) >> 16);
+				}
+
+				std::fill(y_row + width, y_row + padded_width, y_row[width - 1]);
+				std::fill(cb_row + width, cb_row + padded_width, cb_row[width - 1]);
+				std::fill(cr_row + width, cr_row + padded_width, cr_row[width - 1]);
+			}
+
+			/// <summary>
+			/// 全分辨率的色度按 max_h_ x max_v_ 的块取平均，每种采样方式一个没有分支的循环
+			/// </summary>
+			void downsample(uint8_t const* full, size_t full_stride, uint8_t* output, size_t stride, uint32_t width, uint32_t rows) const noexcept
+			{
+				for (uint32_t y = 0; y < rows; y++, output += stride)
+				{
+					const auto row0 = full + static_cast<size_t>(y) * max_v_ * full_stride;
+					const auto row1 = row0 + (max_v_ - 1) * full_stride;
+
+					if (max_h_ == 1 && max_v_ == 1)
+					{
+						std::memcpy(output, row0, width);
+					}
+					else if (max_v_ == 1)
+					{
+						for (uint32_t x = 0; x < width; x++)
+						{
+							output[x] = static_cast<uint8_t>((row0[2 * x] + row0[2 * x + 1] + 1) >> 1);
+						}
+					}
+					else
+					{
+						for (uint32_t x = 0; x < width; x++)
+						{
+							output[x] = static_cast<uint8_t>((row0[2 * x] + row0[2 * x + 1] + row1[2 * x] + row1[2 * x + 1] + 2) >> 2);
+						}
+					}
+				}
+			}
+
+			/// <summary>
+			/// FDCT 并量化，输出 Z 字形顺序的系数
+			/// </summary>
+			void transform_block(component const& c, uint32_t bx, uint32_t by, int16_t* coefficients) const noexcept
+			{
+				float block[64];
+				const auto source = c.plane.data() + static_cast<size_t>(by) * 8 * c.stride + bx * 8;
+
+				// 按列存放
+				for (auto y = 0; y < 8; y++)
+				{
+					for (auto x = 0; x < 8; x++)
+					{
+						block[x * 8 + y] = static_cast<float>(source[y * c.stride + x]) - 128;
+					}
+				}
+
+				fdct_8x8(block);
+
+				// 按自然顺序量化，四舍五入（远离 0）与 std::lround 相同，但不调用库函数，可以向量化
+				auto&& divisors = divisors_[c.table];
+				int16_t quantized[64];
+
+				for (auto i = 0; i < 64; i++)
+				{
+					const auto value = block[i] * divisors[i];
+					const auto truncated = static_cast<int>(value);
+					const auto fraction = value - static_cast<float>(truncated);
+					quantized[i] = static_cast<int16_t>(truncated + (fraction >= .5f ? 1 : 0) - (fraction <= -.5f ? 1 : 0));
+				}
+
+				for (auto k = 0; k < 64; k++)
+				{
+					coefficients[k] = quantized[Jpeg::NaturalOrder[k]];
+				}
+			}
+
+			void write_headers(std::vector<uint8_t>& output) const
+			{
+				output.insert(output.end(), { 0xff, Jpeg::SOI });
+
+				// JFIF
+				output.insert(output.end(), { 0xff, Jpeg::APP0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00 });
+
+				// 量化表，Z 字形顺序
+				output.insert(output.end(), { 0xff, Jpeg::DQT });
+				put16(output, 2 + 65 * 2);
+
+				for (uint8_t t = 0; t < 2; t++)
+				{
+					output.push_back(t);
+
+					for (auto k = 0; k < 64; k++)
+					{
+						output.push_back(static_cast<uint8_t>(quant_[t][Jpeg::NaturalOrder[k]]));
+					}
+				}
+
+				// 帧头
+				output.insert(output.end(), { 0xff, options_.progressive ? Jpeg::SOF2 : Jpeg::SOF0 });
+				put16(output, 8 + 3 * 3);
+				output.push_back(8);
+				put16(output, image_.height);
+				put16(output, image_.width);
+				output.push_back(3);
+
+				for (auto&& c : components_)
+				{
+					output.push_back(c.id);
+					output.push_back(static_cast<uint8_t>(c.h << 4 | c.v));
+					output.push_back(static_cast<uint8_t>(c.table));
+				}
+
+				// Huffman 表
+				write_huffman_tables(output);
+
+				if (restart_interval_ != 0)
+				{
+					output.insert(output.end(), { 0xff, Jpeg::DRI });
+					put16(output, 4);
+					put16(output, restart_interval_);
+				}
+			}
+
+			void write_scan_header(std::vector<uint8_t>& output, std::initializer_list<int> indices, uint8_t spectral_start, uint8_t spectral_end, uint8_t high = 0, uint8_t low = 0) const
+			{
+				const auto count = static_cast<uint32_t>(indices.size());
+				const auto length = 6 + count * 2;
+
+				output.insert(output.end(), { 0xff, Jpeg::SOS, static_cast<uint8_t>(length >> 8), static_cast<uint8_t>(length), static_cast<uint8_t>(count) });
+
+				for (auto index : indices)
+				{
+					auto&& c = components_[index];
+					output.push_back(c.id);
+					output.push_back(static_cast<uint8_t>(c.table << 4 | c.table));
+				}
+
+				output.insert(output.end(), { spectral_start, spectral_end, static_cast<uint8_t>(high << 4 | low) });
+			}
+
+			/// <summary>
+			/// 编码一行 MCU
+			/// </summary>
+			void encode_mcu_row(bit_writer& writer, uint32_t my, int* predictions) const
+			{
+				int16_t coefficients[64];
+
+				for (uint32_t mx = 0; mx < mcus_x_; mx++)
+				{
+					for (auto i = 0; i < 3; i++)
+					{
+						auto&& c = components_[i];
+
+						for (uint32_t y = 0; y < c.v; y++)
+						{
+							for (uint32_t x = 0; x < c.h; x++)
+							{
+								transform_block(c, mx * c.h + x, my * c.v + y, coefficients);
+								encode_dc(writer, dc_codes_[c.table], coefficients[0] - predictions[i]);
+								predictions[i] = coefficients[0];
+								encode_ac(writer, ac_codes_[c.table], coefficients, 1, 63);
+							}
+						}
+					}
+				}
+			}
+
+			void encode_baseline(std::vector<uint8_t>& output) const
+			{
+				PE_TRACE_SCOPE("EncodeJpeg.entropy");
+
+				bit_writer writer(output);
+				int predictions[3]{};
+
+				for (uint32_t my = 0; my < mcus_y_; my++)
+				{
+					encode_mcu_row(writer, my, predictions);
+				}
+
+				writer.Flush();
+			}
+
+			/// <summary>
+			/// 每行 MCU 是一个重启间隔：预测值从 0 开始，末尾补齐到字节，互相独立，可以并行编码。
+			/// 编码好的各行按顺序拼接，之间插入 RST0 - RST7
+			/// </summary>
+			void encode_restart_intervals(std::vector<uint8_t>& output) const
+			{
+				PE_TRACE_SCOPE("EncodeJpeg.entropy");
+
+				std::vector<std::vector<uint8_t>> intervals(mcus_y_);
+
+				for_each_range(mcus_y_, [&](size_t begin, size_t end)
+				{
+					for (auto my = begin; my < end; my++)
+					{
+						auto&& interval = intervals[my];
+						interval.reserve(static_cast<size_t>(image_.width) * 8 * max_v_ / 4);
+
+						bit_writer writer(interval);
+						int predictions[3]{};
+						encode_mcu_row(writer, static_cast<uint32_t>(my), predictions);
+						writer.Flush();
+					}
+				});
+
+				size_t bytes = output.size();
+
+				for (auto&& interval : intervals)
+				{
+					bytes += interval.size() + 2;
+				}
+
+				output.reserve(bytes + 2);
+
+				for (size_t my = 0; my < intervals.size(); my++)
+				{
+					if (my > 0)
+					{
+						output.push_back(0xff);
+						output.push_back(static_cast<uint8_t>(Jpeg::RST0 + (my - 1) % 8));
+					}
+
+					output.insert(output.end(), intervals[my].begin(), intervals[my].end());
+				}
+			}
+
+			/// <summary>
+			/// 先变换所有块，再按直流、低频 1-5、高频 6-63 分别写扫描；
+			/// 使用逐次逼近时按 libjpeg 的 jpeg_simple_progression 脚本写扫描
+			/// </summary>
+			void encode_progressive(std::vector<uint8_t>& output) const
+			{
+				PE_TRACE_SCOPE("EncodeJpeg.entropy");
+
+				std::vector<int16_t> coefficients[3];
+
+				for (auto i = 0; i < 3; i++)
+				{
+					auto&& c = components_[i];
+					coefficients[i].resize(static_cast<size_t>(c.blocks_w) * c.blocks_h * 64);
+
+					// 变换可以并行，熵编码仍然是一个连续的扫描
+					for_each_range(c.blocks_h, [&](size_t begin, size_t end)
+					{
+						for (auto by = static_cast<uint32_t>(begin); by < end; by++)
+						{
+							for (uint32_t bx = 0; bx < c.blocks_w; bx++)
+							{
+								transform_block(c, bx, by, coefficients[i].data() + (static_cast<size_t>(by) * c.blocks_w + bx) * 64);
+							}
+						}
+					});
+				}
+
+				if (!options_.successive_approximation)
+				{
+					encode_dc_scan(output, coefficients, 0, 0);
+
+					for (auto&& band : { std::make_pair(1, 5), std::make_pair(6, 63) })
+					{
+						for (auto i = 0; i < 3; i++)
+						{
+							encode_ac_scan(output, coefficients[i], i, band.first, band.second, 0, 0);
+						}
+					}
+
+					return;
+				}
+
+				// 直流先少 1 位；亮度低频、高频和色度先少 2 位和 1 位，之后逐位细化
+				encode_dc_scan(output, coefficients, 0, 1);
+				encode_ac_scan(output, coefficients[0], 0, 1, 5, 0, 2);
+				encode_ac_scan(output, coefficients[2], 2, 1, 63, 0, 1);
+				encode_ac_scan(output, coefficients[1], 1, 1, 63, 0, 1);
+				encode_ac_scan(output, coefficients[0], 0, 6, 63, 0, 2);
+				encode_ac_scan(output, coefficients[0], 0, 1, 63, 2, 1);
+				encode_dc_scan(output, coefficients, 1, 0);
+				encode_ac_scan(output, coefficients[2], 2, 1, 63, 1, 0);
+				encode_ac_scan(output, coefficients[1], 1, 1, 63, 1, 0);
+				encode_ac_scan(output, coefficients[0], 0, 1, 63, 1, 0);
+			}
+
+			/// <summary>
+			/// 交错的直流扫描。首次扫描编码右移 low 位之后的差分，细化扫描每块输出第 low 位
+			/// </summary>
+			void encode_dc_scan(std::vector<uint8_t>& output, std::vector<int16_t> const (&coefficients)[3], int high, int low) const
+			{
+				write_scan_header(output, { 0, 1, 2 }, 0, 0, static_cast<uint8_t>(high), static_cast<uint8_t>(low));
+
+				bit_writer writer(output);
+				int predictions[3]{};
+
+				for (uint32_t my = 0; my < mcus_y_; my++)
+				{
+					for (uint32_t mx = 0; mx < mcus_x_; mx++)
+					{
+						for (auto i = 0; i < 3; i++)
+						{
+							auto&& c = components_[i];
+
+							for (uint32_t y = 0; y < c.v; y++)
+							{
+								for (uint32_t x = 0; x < c.h; x++)
+								{
+									// 算术右移，与解码时左移还原相对应
+									const auto dc = coefficients[i][((static_cast<size_t>(my) * c.v + y) * c.blocks_w + mx * c.h + x) * 64] >> low;
+
+									if (high == 0)
+									{
+										encode_dc(writer, dc_codes_[c.table], dc - predictions[i]);
+										predictions[i] = dc;
+									}
+									else
+									{
+										writer.Write(static_cast<uint32_t>(dc), 1);
+									}
+								}
+							}
+						}
+					}
+				}
+
+				writer.Flush();
+			}
+
+			/// <summary>
+			/// 一个分量的交流扫描，非交错扫描只覆盖实际的块。首次扫描的系数绝对值右移 low 位
+			/// </summary>
+			void encode_ac_scan(std::vector<uint8_t>& output, std::vector<int16_t> const& coefficients, int index, int start, int end, int high, int low) const
+			{
+				auto&& c = components_[index];
+				write_scan_header(output, { index }, static_cast<uint8_t>(start), static_cast<uint8_t>(end), static_cast<uint8_t>(high), static_cast<uint8_t>(low));
+
+				bit_writer writer(output);
+				int16_t shifted[64];
+
+				for (uint32_t by = 0; by < c.used_blocks_h; by++)
+				{
+					for (uint32_t bx = 0; bx < c.used_blocks_w; bx++)
+					{
+						const auto block = coefficients.data() + (static_cast<size_t>(by) * c.blocks_w + bx) * 64;
+
+						if (high != 0)
+						{
+							encode_ac_refine(writer, ac_codes_[c.table], block, start, end, low);
+						}
+						else if (low == 0)
+						{
+							encode_ac(writer, ac_codes_[c.table], block, start, end);
+						}
+						else
+						{
+							for (auto k = start; k <= end; k++)
+							{
+								const auto magnitude = (block[k] < 0 ? -block[k] : block[k]) >> low;
+								shifted[k] = static_cast<int16_t>(block[k] < 0 ? -magnitude : magnitude);
+							}
+
+							encode_ac(writer, ac_codes_[c.table], shifted, start, end);
+						}
+					}
+				}
+
+				writer.Flush();
+			}
+
+			ImageView image_;
+			JpegEncodeOptions options_;
+			ThreadPool* pool_;
+			// 每个重启间隔的 MCU 数，0 表示不使用重启间隔
+			uint32_t restart_interval_{ 0 };
+
+			uint16_t quant_[2][64]{};
+			float divisors_[2][64]{};
+			huffman_code dc_codes_[2];
+			huffman_code ac_codes_[2];
+
+			uint32_t max_h_{ 1 };
+			uint32_t max_v_{ 1 };
+			uint32_t mcus_x_{ 0 };
+			uint32_t mcus_y_{ 0 };
+			component components_[3];
+		};
+	}
+
+	std::vector<uint8_t> EncodeJpeg(ImageView const& image, JpegEncodeOptions const& options)
+	{
+		PE_TRACE_SCOPE("EncodeJpeg");
+		return encoder(image, options, nullptr).Encode();
+	}
+
+	std::vector<uint8_t> EncodeJpeg(ImageView const& image, JpegEncodeOptions const& options, ThreadPool& pool)
+	{
+		PE_TRACE_SCOPE("EncodeJpeg.parallel");
+		return encoder(image, options, &pool).Encode();
+	}
+
+	std::vector<uint8_t> EncodeJpegCoefficients(JpegCoefficients const& image)
+	{
+		PE_TRACE_SCOPE("EncodeJpegCoefficients");
+
+		const auto count = image.components.size();
+
+		if (count != 1 && count != 3)
+		{
+			throw std::invalid_argument("JPEG: only one or three components are supported");
+		}
+
+		if (image.width == 0 || image.height == 0 || image.width > 65535 || image.height > 65535)
+		{
+			throw std::invalid_argument("JPEG: image size must be 1 - 65535");
+		}
+
+		const auto mcu_width = image.McuWidth();
+		const auto mcu_height = image.McuHeight();
+		const auto mcus_x = (image.width + mcu_width - 1) / mcu_width;
+		const auto mcus_y = (image.height + mcu_height - 1) / mcu_height;
+
+		// 单分量的扫描不交错，只编码覆盖图片的块
+		const auto used_blocks_w = (image.width + 7) / 8;
+		const auto used_blocks_h = (image.height + 7) / 8;
+
+		// 内容相同的量化表只写一次
+		uint8_t tables[3]{};
+		std::vector<uint16_t const*> distinct;
+		auto wide = false;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			auto&& c = image.components[i];
+			const auto needed_w = count == 1 ? used_blocks_w : mcus_x * c.h;
+			const auto needed_h = count == 1 ? used_blocks_h : mcus_y * c.v;
+
+			if (c.h < 1 || c.h > 4 || c.v < 1 || c.v > 4 || c.blocks_w < needed_w || c.blocks_h < needed_h || c.coefficients.size() < static_cast<size_t>(c.blocks_w) * c.blocks_h * 64)
+			{
+				throw std::invalid_argument("JPEG: coefficient planes do not cover the image");
+			}
+
+			const auto found = std::find_if(distinct.begin(), distinct.end(), [&](uint16_t const* table)
+			{
+				return std::equal(table, table + 64, c.quantization);
+			});
+
+			tables[i] = static_cast<uint8_t>(found - distinct.begin());
+
+			if (found == distinct.end())
+			{
+				distinct.push_back(c.quantization);
+			}
+
+			wide = wide || *std::max_element(std::begin(c.quantization), std::end(c.quantization)) > 255;
+		}
+
+		std::vector<uint8_t> output;
+		output.reserve(image.metadata.size() + static_cast<size_t>(image.width) * image.height / 4 + 1024);
+
+		output.insert(output.end(), { 0xff, Jpeg::SOI });
+		output.insert(output.end(), image.metadata.begin(), image.metadata.end());
+
+		// 量化表，Z 字形顺序。基线格式只允许 8 位的表
+		output.insert(output.end(), { 0xff, Jpeg::DQT });
+		put16(output, static_cast<uint32_t>(2 + distinct.size() * (1 + 64 * (wide ? 2 : 1))));
+
+		for (size_t t = 0; t < distinct.size(); t++)
+		{
+			output.push_back(static_cast<uint8_t>((wide ? 0x10 : 0x00) | t));
+
+			for (auto k = 0; k < 64; k++)
+			{
+				if (wide)
+				{
+					put16(output, distinct[t][k]);
+				}
+				else
+				{
+					output.push_back(static_cast<uint8_t>(distinct[t][k]));
+				}
+			}
+		}
+
+		// 帧头
+		output.insert(output.end(), { 0xff, wide ? Jpeg::SOF1 : Jpeg::SOF0 });
+		put16(output, static_cast<uint32_t>(8 + 3 * count));
+		output.push_back(8);
+		put16(output, image.height);
+		put16(output, image.width);
+		output.push_back(static_cast<uint8_t>(count));
+
+		for (size_t i = 0; i < count; i++)
+		{
+			auto&& c = image.components[i];
+			output.push_back(c.id);
+			output.push_back(static_cast<uint8_t>(c.h << 4 | c.v));
+			output.push_back(tables[i]);
+		}
+
+		// Huffman 表，第一个分量用亮度表，其余用色度表
+		write_huffman_tables(output);
+
+		const auto scan_length = static_cast<uint32_t>(6 + count * 2);
+		output.insert(output.end(), { 0xff, Jpeg::SOS, static_cast<uint8_t>(scan_length >> 8), static_cast<uint8_t>(scan_length), static_cast<uint8_t>(count) });
+
+		for (size_t i = 0; i < count; i++)
+		{
+			output.push_back(image.components[i].id);
+			output.push_back(i == 0 ? 0x00 : 0x11);
+		}
+
+		output.insert(output.end(), { 0, 63, 0x00 });
+
+		{
+			PE_TRACE_SCOPE("EncodeJpegCoefficients.entropy");
+
+			const huffman_code dc_codes[]{ build_huffman_code(Jpeg::StandardLuminanceDc), build_huffman_code(Jpeg::StandardChrominanceDc) };
+			const huffman_code ac_codes[]{ build_huffman_code(Jpeg::StandardLuminanceAc), build_huffman_code(Jpeg::StandardChrominanceAc) };
+
+			bit_writer writer(output);
+			int predictions[3]{};
+
+			const auto encode_block = [&](size_t i, uint32_t bx, uint32_t by)
+			{
+				const auto table = i == 0 ? 0 : 1;
+				const auto coefficients = image.components[i].Block(bx, by);
+				encode_dc(writer, dc_codes[table], coefficients[0] - predictions[i]);
+				predictions[i] = coefficients[0];
+				encode_ac(writer, ac_codes[table], coefficients, 1, 63);
+			};
+
+			if (count == 1)
+			{
+				for (uint32_t by = 0; by < used_blocks_h; by++)
+				{
+					for (uint32_t bx = 0; bx < used_blocks_w; bx++)
+					{
+						encode_block(0, bx, by);
+					}
+				}
+			}
+			else
+			{
+				for (uint32_t my = 0; my < mcus_y; my++)
+				{
+					for (uint32_t mx = 0; mx < mcus_x; mx++)
+					{
+						for (size_t i = 0; i < count; i++)
+						{
+							auto&& c = image.components[i];
+
+							for (uint32_t y = 0; y < c.v; y++)
+							{
+								for (uint32_t x = 0; x < c.h; x++)
+								{
+									encode_block(i, mx * c.h + x, my * c.v + y);
+								}
+							}
+						}
+					}
+				}
+			}
+
+			writer.Flush();
+		}
+
+		output.push_back(0xff);
+		output.push_back(Jpeg::EOI);
+		return output;
+	}
+}
@@ -0,0 +1,72 @@
+﻿/*
+ * JPEG 编码（与平台无关）
+ *
+ * 输出使用标准 Huffman 表的基线或者渐进式 YCbCr JPEG。
+ * 渐进式默认只使用频谱选择（先直流、再低频、最后高频）；也可以按 libjpeg 默认的脚本加上逐次逼近，
+ * 与 Pillow、cjpeg 等输出的渐进式图片的扫描结构相同。
+ * 也可以直接熵编码已经量化的 DCT 系数，用于无损变换。
+ *
+ * 并行编码基线图片时每行 MCU 是一个重启间隔，各行在线程池上独立编码，再用 RST 标记按顺序拼接；
+ * 系数与单线程编码完全相同，解码结果也完全相同，文件只多出 DRI 段和每行两个字节的 RST 标记。
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "JpegCoefficients.h"
+#include "PixelBuffer.h"
+#include "ThreadPool.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 色度采样方式
+	/// </summary>
+	enum class JpegSubsampling : uint8_t
+	{
+		Yuv444,
+		Yuv422,
+		Yuv420
+	};
+
+	/// <summary>
+	/// 编码参数
+	/// </summary>
+	struct JpegEncodeOptions
+	{
+		// 1 - 100，与 IJG 的质量含义相同
+		int quality{ 90 };
+		JpegSubsampling subsampling{ JpegSubsampling::Yuv420 };
+		bool progressive{ false };
+		// 渐进式图片是否使用逐次逼近
+		bool successive_approximation{ false };
+	};
+
+	/// <summary>
+	/// 把 BGRA8 图片编码为 JPEG，忽略 alpha
+	/// </summary>
+	/// <param name="image">图片</param>
+	/// <param name="options">编码参数</param>
+	/// <returns>JPEG 文件内容</returns>
+	std::vector<uint8_t> EncodeJpeg(ImageView const& image, JpegEncodeOptions const& options = {});
+
+	/// <summary>
+	/// 同上，颜色转换和变换在线程池上并行执行。基线图片按重启间隔并行熵编码，渐进式图片的扫描仍在当前线程上编码
+	/// </summary>
+	/// <param name="image">图片</param>
+	/// <param name="options">编码参数</param>
+	/// <param name="pool">线程池</param>
+	/// <returns>JPEG 文件内容</returns>
+	std::vector<uint8_t> EncodeJpeg(ImageView const& image, JpegEncodeOptions const& options, ThreadPool& pool);
+
+	/// <summary>
+	/// 把量化 DCT 系数熵编码为使用标准 Huffman 表的顺序 JPEG，不做 IDCT 和重新量化。
+	/// 量化表按原样写出（超过 255 时使用扩展顺序格式），metadata 中的标记段原样复制到 SOI 之后。
+	/// 系数不覆盖图片或者分量数不支持时抛出 std::invalid_argument
+	/// </summary>
+	/// <param name="image">系数</param>
+	/// <returns>JPEG 文件内容</returns>
+	std::vector<uint8_t> EncodeJpegCoefficients(JpegCoefficients const& image);
+}
@@ -0,0 +1,153 @@
+﻿/*
+ * JPEG 略缩图代码
+ */
+
+#include "JpegThumbnail.h"
+#include "JpegDecoder.h"
+#include "Trace.h"
+
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		/// <summary>
+		/// 读取文件的一段，读不全时抛出异常
+		/// </summary>
+		std::vector<uint8_t> read_range(ReadAtFunction const& read, uint64_t offset, size_t size, uint64_t& bytes_read)
+		{
+			std::vector<uint8_t> bytes(size);
+			const auto count = read(offset, bytes.data(), size);
+			bytes_read += count;
+
+			if (count != size)
+			{
+				throw std::runtime_error("JPEG: unexpected end of file");
+			}
+
+			return bytes;
+		}
+
+		/// <summary>
+		/// 按需要的尺寸缩小解码，并转正
+		/// </summary>
+		PixelBuffer decode_oriented(std::vector<uint8_t> const& data, JpegInfo const& info, uint16_t orientation, uint32_t width, uint32_t height)
+		{
+			// 显示尺寸是转正之后的，解码尺寸是存储方向的
+			const auto swap = SwapsDimensions(orientation);
+			const auto scale = ChooseJpegScale(info.width, info.height, swap ? height : width, swap ? width : height);
+			auto pixels = DecodeJpeg(data.data(), data.size(), scale);
+
+			return orientation == 1 ? std::move(pixels) : ApplyExifOrientation(pixels.View(), orientation);
+		}
+	}
+
+	PixelBuffer LoadJpegThumbnail(ReadAtFunction const& read, uint64_t file_size, uint32_t width, uint32_t height, JpegThumbnailStats* stats)
+	{
+		PE_TRACE_SCOPE("LoadJpegThumbnail");
+
+		JpegThumbnailStats local_stats;
+		auto&& result_stats = stats ? *stats : local_stats;
+		result_stats = {};
+
+		ExifInfo exif;
+		ReadJpegExif(read, exif, &result_stats.bytes_read);
+		result_stats.orientation = exif.orientation;
+
+		if (exif.thumbnail_size != 0)
+		{
+			// 内嵌略缩图在 APP1 段内，通常已经读过，这里重新读取这一小段
+			const auto embedded = read_range(read, exif.thumbnail_offset, exif.thumbnail_size, result_stats.bytes_read);
+			JpegInfo info;
+
+			if (ReadJpegInfo(embedded.data(), embedded.size(), info))
+			{
+				const auto swap = SwapsDimensions(exif.orientation);
+				const auto shown_width = swap ? info.height : info.width;
+				const auto shown_height = swap ? info.width : info.height;
+
+				if (shown_width * 2 >= width && shown_height * 2 >= height)
+				{
+					try
+					{
+						auto pixels = decode_oriented(embedded, info, exif.orientation, width, height);
+						result_stats.source = JpegThumbnailSource::Embedded;
+						return pixels;
+					}
+					catch (std::runtime_error const&)
+					{
+						// 内嵌略缩图损坏，继续解码原图
+					}
+				}
+			}
+		}
+
+		PE_TRACE_SCOPE("LoadJpegThumbnail.scaled");
+
+		const auto data = read_range(read, 0, static_cast<size_t>(file_size), result_stats.bytes_read);
+		JpegInfo info;
+
+		if (!ReadJpegInfo(data.data(), data.size(), info))
+		{
+			throw std::runtime_error("JPEG: unsupported file");
+		}
+
+		result_stats.source = JpegThumbnailSource::Scaled;
+		return decode_oriented(data, info, exif.orientation, width, height);
+	}
+
+	std::optional<Placeholder> LoadEmbeddedPlaceholder(ReadAtFunction const& read, SniffResult const& sniffed, uint64_t* bytes_read)
+	{
+		PE_TRACE_SCOPE("LoadEmbeddedPlaceholder");
+
+		if (!sniffed.valid || sniffed.header.format != ImageFormat::Jpeg || sniffed.exif_size == 0)
+		{
+			return std::nullopt;
+		}
+
+		std::vector<uint8_t> tiff(sniffed.exif_size);
+		const auto count = read(sniffed.exif_offset, tiff.data(), tiff.size());
+
+		if (bytes_read)
+		{
+			*bytes_read += count;
+		}
+
+		// 略缩图的位置是文件中的位置，解析时给出 TIFF 数据的位置
+		ExifInfo exif;
+
+		if (!ParseExifTiff(tiff.data(), count, sniffed.exif_offset, exif) || exif.thumbnail_size == 0)
+		{
+			return std::nullopt;
+		}
+
+		const auto thumbnail = tiff.data() + (exif.thumbnail_offset - sniffed.exif_offset);
+		JpegInfo info;
+
+		if (!ReadJpegInfo(thumbnail, exif.thumbnail_size, info))
+		{
+			return std::nullopt;
+		}
+
+		try
+		{
+			// 占位预览只有 Columns×Rows 格，缩小到不小于格数的最小尺寸就够了
+			auto pixels = DecodeJpeg(thumbnail, exif.thumbnail_size, ChooseJpegScale(info.width, info.height, Placeholder::Columns, Placeholder::Rows));
+
+			if (exif.orientation != 1)
+			{
+				pixels = ApplyExifOrientation(pixels.View(), exif.orientation);
+			}
+
+			return ComputePlaceholder(pixels.View());
+		}
+		catch (std::runtime_error const&)
+		{
+			// 内嵌略缩图损坏
+			return std::nullopt;
+		}
+	}
+}
@@ -0,0 +1,64 @@
+﻿/*
+ * JPEG 略缩图（与平台无关）
+ *
+ * 优先使用 EXIF 中内嵌的略缩图，只需要读取文件开头的 APP1 段；
+ * 没有内嵌略缩图或者太小时，读取整个文件在 DCT 域缩小解码。结果都按 EXIF 方向转正。
+ * 扫描图库时也从内嵌略缩图计算占位预览，只读取识别文件头时找到的 EXIF 段。
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+#include "Exif.h"
+#include "HeaderSniffer.h"
+#include "PixelBuffer.h"
+#include "Placeholder.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 略缩图的来源
+	/// </summary>
+	enum class JpegThumbnailSource : uint8_t
+	{
+		// EXIF 中内嵌的略缩图
+		Embedded,
+		// 缩小解码原图
+		Scaled
+	};
+
+	/// <summary>
+	/// 一次加载的统计
+	/// </summary>
+	struct JpegThumbnailStats
+	{
+		JpegThumbnailSource source{ JpegThumbnailSource::Embedded };
+		// 从文件读取的字节数
+		uint64_t bytes_read{ 0 };
+		uint16_t orientation{ 1 };
+	};
+
+	/// <summary>
+	/// 加载不小于指定尺寸的略缩图。内嵌略缩图放大不超过 2 倍就能填满时直接使用，
+	/// 否则缩小解码原图。文件不是有效的 JPEG 时抛出 std::runtime_error
+	/// </summary>
+	/// <param name="read">读取函数</param>
+	/// <param name="file_size">文件字节数</param>
+	/// <param name="width">显示宽度</param>
+	/// <param name="height">显示高度</param>
+	/// <param name="stats">可选的统计输出</param>
+	/// <returns>正向的 BGRA8 预乘图片</returns>
+	PixelBuffer LoadJpegThumbnail(ReadAtFunction const& read, uint64_t file_size, uint32_t width, uint32_t height, JpegThumbnailStats* stats = nullptr);
+
+	/// <summary>
+	/// 从 EXIF 中内嵌的略缩图计算占位预览。只读取识别文件头时找到的 EXIF 段，略缩图在 DCT 域缩小解码。
+	/// 不是 JPEG、没有内嵌略缩图或者略缩图损坏时为空，读取失败时抛出读取函数的异常
+	/// </summary>
+	/// <param name="read">读取函数</param>
+	/// <param name="sniffed">同一文件的识别结果</param>
+	/// <param name="bytes_read">可选的输出：加上读取的字节数</param>
+	/// <returns>占位预览</returns>
+	std::optional<Placeholder> LoadEmbeddedPlaceholder(ReadAtFunction const& read, SniffResult const& sniffed, uint64_t* bytes_read = nullptr);
+}
@@ -0,0 +1,258 @@
+﻿/*
+ * JPEG 无损变换代码
+ */
+
+#include "JpegTransform.h"
+#include "Exif.h"
+#include "JpegCommon.h"
+#include "JpegDecoder.h"
+#include "JpegEncoder.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		/// <summary>
+		/// 每种变换分解为：先转置，再翻转输出的横向、纵向
+		/// </summary>
+		struct transform_steps
+		{
+			bool transpose;
+			bool flip_x;
+			bool flip_y;
+		};
+
+		constexpr transform_steps steps_of(JpegTransform transform) noexcept
+		{
+			switch (transform)
+			{
+			case JpegTransform::FlipHorizontal:
+				return { false, true, false };
+			case JpegTransform::FlipVertical:
+				return { false, false, true };
+			case JpegTransform::Transpose:
+				return { true, false, false };
+			case JpegTransform::Transverse:
+				return { true, true, true };
+			case JpegTransform::Rotate90:
+				return { true, true, false };
+			case JpegTransform::Rotate180:
+				return { false, true, true };
+			case JpegTransform::Rotate270:
+				return { true, false, true };
+			case JpegTransform::None:
+				break;
+			}
+
+			return { false, false, false };
+		}
+
+		/// <summary>
+		/// 块内每个输出系数（Z 字形序号）取自的源系数和符号。
+		/// 转置交换水平和垂直频率；翻转使奇数频率的余弦基函数变号
+		/// </summary>
+		struct block_mapping
+		{
+			uint8_t source[64];
+			int8_t sign[64];
+
+			explicit block_mapping(transform_steps steps) noexcept
+			{
+				uint8_t zigzag[64];
+
+				for (uint8_t k = 0; k < 64; k++)
+				{
+					zigzag[Jpeg::NaturalOrder[k]] = k;
+				}
+
+				for (uint8_t k = 0; k < 64; k++)
+				{
+					const auto u = Jpeg::NaturalOrder[k] % 8;
+					const auto v = Jpeg::NaturalOrder[k] / 8;
+					const auto negate = (steps.flip_x && (u & 1) != 0) != (steps.flip_y && (v & 1) != 0);
+
+					source[k] = steps.transpose ? zigzag[u * 8 + v] : k;
+					sign[k] = static_cast<int8_t>(negate ? -1 : 1);
+				}
+			}
+		};
+
+		/// <summary>
+		/// 复制 APPn 和 COM 段，EXIF 段改为与变换后的像素一致：方向为 1，尺寸为新的尺寸，
+		/// 略缩图做同样的旋转或翻转。裁剪后略缩图的内容不再对应，去掉
+		/// </summary>
+		std::vector<uint8_t> transform_metadata(std::vector<uint8_t> const& metadata, JpegTransformOptions const& options, uint32_t width, uint32_t height)
+		{
+			// 标记、长度和 "Exif\0\0"
+			constexpr size_t exif_overhead = 2 + 2 + 6;
+
+			const auto crops = options.crop_x != 0 || options.crop_y != 0 || options.crop_width != 0 || options.crop_height != 0;
+			std::vector<uint8_t> result;
+			result.reserve(metadata.size());
+
+			size_t position = 0;
+
+			while (position + 4 <= metadata.size())
+			{
+				const auto segment = metadata.data() + position;
+				const auto size = std::min<size_t>(2 + (segment[2] << 8 | segment[3]), metadata.size() - position);
+				position += size;
+
+				if (segment[1] != Jpeg::APP1 || size < exif_overhead || std::memcmp(segment + 4, "Exif\0\0", 6) != 0)
+				{
+					result.insert(result.end(), segment, segment + size);
+					continue;
+				}
+
+				ExifInfo info;
+				std::vector<uint8_t> thumbnail;
+
+				if (!crops && ParseExifTiff(segment + exif_overhead, size - exif_overhead, 0, info) && info.thumbnail_size != 0)
+				{
+					try
+					{
+						thumbnail = TransformJpeg(segment + exif_overhead + info.thumbnail_offset, info.thumbnail_size, { options.transform });
+					}
+					catch (std::exception const&)
+					{
+						// 略缩图无法变换时去掉，不影响主图片
+						thumbnail.clear();
+					}
+				}
+
+				const auto rewritten = RewriteExifSegment(segment, size, width, height, thumbnail);
+				result.insert(result.end(), rewritten.begin(), rewritten.end());
+			}
+
+			return result;
+		}
+	}
+
+	JpegCoefficients TransformJpegCoefficients(JpegCoefficients const& source, JpegTransformOptions const& options)
+	{
+		PE_TRACE_SCOPE("TransformJpegCoefficients");
+
+		const auto mcu_width = source.McuWidth();
+		const auto mcu_height = source.McuHeight();
+
+		if (options.crop_x % mcu_width != 0 || options.crop_y % mcu_height != 0)
+		{
+			throw std::invalid_argument("JPEG: crop origin must be aligned to MCU");
+		}
+
+		if (options.crop_x >= source.width || options.crop_y >= source.height)
+		{
+			throw std::invalid_argument("JPEG: crop origin is outside the image");
+		}
+
+		const auto steps = steps_of(options.transform);
+
+		// 裁剪区域，按原图的方向
+		auto width = source.width - options.crop_x;
+		auto height = source.height - options.crop_y;
+
+		if (options.crop_width != 0)
+		{
+			width = std::min(width, options.crop_width);
+		}
+
+		if (options.crop_height != 0)
+		{
+			height = std::min(height, options.crop_height);
+		}
+
+		// 输出翻转的方向上，不完整的 MCU 会移到起点一侧，裁掉。转置时输出的横向对应原图的纵向
+		if (steps.transpose ? steps.flip_y : steps.flip_x)
+		{
+			width -= width % mcu_width;
+		}
+
+		if (steps.transpose ? steps.flip_x : steps.flip_y)
+		{
+			height -= height % mcu_height;
+		}
+
+		if (width == 0 || height == 0)
+		{
+			throw std::invalid_argument("JPEG: nothing is left after trimming partial MCUs");
+		}
+
+		JpegCoefficients result;
+		result.width = steps.transpose ? height : width;
+		result.height = steps.transpose ? width : height;
+		result.metadata = transform_metadata(source.metadata, options, result.width, result.height);
+
+		const auto output_mcu_width = steps.transpose ? mcu_height : mcu_width;
+		const auto output_mcu_height = steps.transpose ? mcu_width : mcu_height;
+		const auto mcus_x = (result.width + output_mcu_width - 1) / output_mcu_width;
+		const auto mcus_y = (result.height + output_mcu_height - 1) / output_mcu_height;
+
+		const block_mapping mapping(steps);
+
+		for (auto&& c : source.components)
+		{
+			auto&& out = result.components.emplace_back();
+			out.id = c.id;
+			out.h = steps.transpose ? c.v : c.h;
+			out.v = steps.transpose ? c.h : c.v;
+			out.blocks_w = mcus_x * out.h;
+			out.blocks_h = mcus_y * out.v;
+			out.coefficients.assign(static_cast<size_t>(out.blocks_w) * out.blocks_h * 64, 0);
+
+			// 转置后量化表也要转置，每个系数仍然用原来的量化值
+			for (auto k = 0; k < 64; k++)
+			{
+				out.quantization[k] = c.quantization[mapping.source[k]];
+			}
+
+			// 裁剪区域在这个分量中的起点（块）
+			const auto origin_x = options.crop_x / mcu_width * c.h;
+			const auto origin_y = options.crop_y / mcu_height * c.v;
+
+			for (uint32_t oy = 0; oy < out.blocks_h; oy++)
+			{
+				for (uint32_t ox = 0; ox < out.blocks_w; ox++)
+				{
+					// 翻转的方向上输出正好是整数个 MCU，块数与区域相同
+					const auto tx = steps.flip_x ? out.blocks_w - 1 - ox : ox;
+					const auto ty = steps.flip_y ? out.blocks_h - 1 - oy : oy;
+					const auto sx = origin_x + (steps.transpose ? ty : tx);
+					const auto sy = origin_y + (steps.transpose ? tx : ty);
+
+					// 超出原图的补齐块保持为 0
+					if (sx >= c.blocks_w || sy >= c.blocks_h)
+					{
+						continue;
+					}
+
+					const auto input = c.Block(sx, sy);
+					const auto output = out.Block(ox, oy);
+
+					for (auto k = 0; k < 64; k++)
+					{
+						output[k] = static_cast<int16_t>(mapping.sign[k] * input[mapping.source[k]]);
+					}
+				}
+			}
+		}
+
+		return result;
+	}
+
+	std::vector<uint8_t> TransformJpeg(uint8_t const* data, size_t size, JpegTransformOptions const& options)
+	{
+		PE_TRACE_SCOPE("TransformJpeg");
+
+		if (options.IsIdentity())
+		{
+			return { data, data + size };
+		}
+
+		return EncodeJpegCoefficients(TransformJpegCoefficients(ReadJpegCoefficients(data, size), options));
+	}
+}
@@ -0,0 +1,81 @@
+﻿/*
+ * JPEG 无损变换（与平台无关）
+ *
+ * 旋转、翻转和裁剪都只重新排列 8x8 的 DCT 块：块内的系数转置，或者奇数频率的系数变号，量化值不变。
+ * 只需要熵解码和重新熵编码，不做 IDCT、颜色转换和重新量化，像素与原图完全相同，没有代际损失。
+ * APPn（XMP、ICC 等）和 COM 段原样复制。EXIF 段改为与新的像素一致：方向改为 1，PixelXDimension 和 PixelYDimension
+ * 改为新的尺寸，内嵌略缩图做同样的旋转或翻转；裁剪时去掉略缩图。所以变换应当包含方向的校正，否则查看器不再按原来的方向显示。
+ *
+ * 目前界面没有旋转和裁剪，保存只在没有效果时复制原文件，还没有调用这里的变换。
+ *
+ * 块只能整块移动，所以裁剪的起点必须对齐到 MCU；翻转会把右边或下边不完整的 MCU 移到左边或上边，
+ * 这部分无法无损处理，与 jpegtran -trim 一样裁掉（最多 MCU 的尺寸减一个像素）。
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "JpegCoefficients.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 无损变换，旋转都是顺时针
+	/// </summary>
+	enum class JpegTransform : uint8_t
+	{
+		None,
+		FlipHorizontal,
+		FlipVertical,
+		// 沿主对角线翻转
+		Transpose,
+		// 沿副对角线翻转
+		Transverse,
+		Rotate90,
+		Rotate180,
+		Rotate270
+	};
+
+	/// <summary>
+	/// 变换参数。先按原图的坐标裁剪，再变换
+	/// </summary>
+	struct JpegTransformOptions
+	{
+		JpegTransform transform{ JpegTransform::None };
+		// 裁剪的起点，必须是 MCU 尺寸的整数倍
+		uint32_t crop_x{ 0 };
+		uint32_t crop_y{ 0 };
+		// 裁剪的尺寸，0 表示到图片边缘
+		uint32_t crop_width{ 0 };
+		uint32_t crop_height{ 0 };
+
+		/// <summary>
+		/// 不旋转、不翻转也不裁剪，输出与原文件相同，可以直接复制文件
+		/// </summary>
+		[[nodiscard]] bool IsIdentity() const noexcept
+		{
+			return transform == JpegTransform::None && crop_x == 0 && crop_y == 0 && crop_width == 0 && crop_height == 0;
+		}
+	};
+
+	/// <summary>
+	/// 变换系数。裁剪的起点没有对齐到 MCU、超出图片，或者裁掉不完整的 MCU 后没有剩下像素时抛出 std::invalid_argument
+	/// </summary>
+	/// <param name="source">原图的系数</param>
+	/// <param name="options">变换参数</param>
+	/// <returns>变换后的系数，metadata 中的 EXIF 已经改为新的方向、尺寸和略缩图</returns>
+	JpegCoefficients TransformJpegCoefficients(JpegCoefficients const& source, JpegTransformOptions const& options);
+
+	/// <summary>
+	/// 无损变换 JPEG 文件：读取系数、变换、重新熵编码。渐进式图片输出为顺序格式。
+	/// 参数是恒等变换时直接返回原文件的内容
+	/// </summary>
+	/// <param name="data">文件内容</param>
+	/// <param name="size">字节数</param>
+	/// <param name="options">变换参数</param>
+	/// <returns>变换后的 JPEG 文件内容</returns>
+	std::vector<uint8_t> TransformJpeg(uint8_t const* data, size_t size, JpegTransformOptions const& options);
+}
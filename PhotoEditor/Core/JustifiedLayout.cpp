@@ -0,0 +1,300 @@
+﻿/*
+ * 按宽高比排列的图库布局代码
+ */
+
+#include "JustifiedLayout.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		// 宽高比的上下限，全景照片和竖长的截图不会占满整行或者变成一条细线
+		constexpr float min_aspect = 0.25f;
+		constexpr float max_aspect = 5.0f;
+		constexpr float default_aspect = 1.5f;
+	}
+
+	JustifiedLayout::JustifiedLayout(JustifiedLayoutOptions options) noexcept :
+		options_(options)
+	{
+	}
+
+	float JustifiedLayout::AspectRatio(uint32_t width, uint32_t height) noexcept
+	{
+		if (width == 0 || height == 0)
+		{
+			return default_aspect;
+		}
+
+		return std::clamp(static_cast<float>(width) / static_cast<float>(height), min_aspect, max_aspect);
+	}
+
+	void JustifiedLayout::SetWidth(float width)
+	{
+		if (width == width_)
+		{
+			return;
+		}
+
+		PE_TRACE_SCOPE("JustifiedLayout::SetWidth");
+
+		width_ = width;
+		row_starts_.assign(1, 0);
+		row_heights_.clear();
+		relayout_from(0);
+	}
+
+	void JustifiedLayout::Assign(std::vector<float> aspects)
+	{
+		PE_TRACE_SCOPE("JustifiedLayout::Assign");
+
+		if (aspects.size() > std::numeric_limits<uint32_t>::max())
+		{
+			throw std::length_error("照片太多，无法布局");
+		}
+
+		aspects_ = std::move(aspects);
+		row_starts_.assign(1, 0);
+		row_heights_.clear();
+		relayout_from(0);
+	}
+
+	void JustifiedLayout::Splice(size_t index, size_t erase_count, float const* aspects, size_t insert_count)
+	{
+		PE_TRACE_SCOPE("JustifiedLayout::Splice");
+
+		index = std::min(index, aspects_.size());
+		erase_count = std::min(erase_count, aspects_.size() - index);
+
+		if (aspects_.size() - erase_count + insert_count > std::numeric_limits<uint32_t>::max())
+		{
+			throw std::length_error("照片太多，无法布局");
+		}
+
+		// 断行时会看下一行的第一张照片，所以从包含前一张照片的行开始
+		const auto first_row = index == 0 || RowCount() == 0 ? 0 : RowOf(index - 1);
+
+		aspects_.erase(aspects_.begin() + index, aspects_.begin() + index + erase_count);
+		aspects_.insert(aspects_.begin() + index, aspects, aspects + insert_count);
+
+		if (width_ <= 0)
+		{
+			return;
+		}
+
+		// 保留原来的断点，新的断点和它重合之后后面的行不变
+		const std::vector<uint32_t> old_starts(row_starts_.begin() + first_row, row_starts_.end());
+		const std::vector<float> old_heights(row_heights_.begin() + first_row, row_heights_.end());
+		const auto delta = static_cast<ptrdiff_t>(insert_count) - static_cast<ptrdiff_t>(erase_count);
+		const auto edit_end = index + insert_count;
+		const auto count = aspects_.size();
+
+		row_starts_.resize(first_row + 1);
+		row_heights_.resize(first_row);
+
+		size_t start = row_starts_.back();
+		size_t old_row = 0;
+		last_relayout_rows_ = 0;
+
+		while (start < count)
+		{
+			float height = 0;
+			const auto end = break_row(start, height);
+
+			row_heights_.push_back(height);
+			row_starts_.push_back(static_cast<uint32_t>(end));
+			last_relayout_rows_++;
+
+			if (end >= edit_end && end < count)
+			{
+				const auto old_end = static_cast<size_t>(static_cast<ptrdiff_t>(end) - delta);
+
+				while (old_row < old_heights.size() && old_starts[old_row] < old_end)
+				{
+					old_row++;
+				}
+
+				// 从这里开始照片和原来相同，断行也相同
+				if (old_row < old_heights.size() && old_starts[old_row] == old_end)
+				{
+					for (auto row = old_row; row < old_heights.size(); row++)
+					{
+						row_heights_.push_back(old_heights[row]);
+						row_starts_.push_back(static_cast<uint32_t>(static_cast<ptrdiff_t>(old_starts[row + 1]) + delta));
+					}
+
+					break;
+				}
+			}
+
+			start = end;
+		}
+
+		update_tops(first_row);
+		PE_TRACE_COUNTER("JustifiedLayout.RelayoutRows", last_relayout_rows_);
+	}
+
+	double JustifiedLayout::Height() const noexcept
+	{
+		return row_tops_.empty() ? 0 : row_tops_.back() + row_heights_.back();
+	}
+
+	size_t JustifiedLayout::RowOf(size_t index) const noexcept
+	{
+		if (RowCount() == 0)
+		{
+			return 0;
+		}
+
+		// 最后一项是照片数，不参与查找
+		const auto found = std::upper_bound(row_starts_.begin(), row_starts_.end() - 1, index);
+		return static_cast<size_t>(found - row_starts_.begin()) - 1;
+	}
+
+	std::pair<size_t, size_t> JustifiedLayout::ItemsInRange(double top, double bottom) const noexcept
+	{
+		if (RowCount() == 0 || bottom <= top)
+		{
+			return { 0, 0 };
+		}
+
+		const auto first = std::upper_bound(row_tops_.begin(), row_tops_.end(), top);
+		const auto last = std::lower_bound(row_tops_.begin(), row_tops_.end(), bottom);
+		const auto first_row = first == row_tops_.begin() ? 0 : static_cast<size_t>(first - row_tops_.begin()) - 1;
+		const auto last_row = static_cast<size_t>(last - row_tops_.begin());
+
+		return { row_starts_[first_row], row_starts_[std::max(first_row, last_row)] };
+	}
+
+	LayoutRect JustifiedLayout::ItemRect(size_t index) const noexcept
+	{
+		if (RowCount() == 0 || index >= row_starts_.back())
+		{
+			return {};
+		}
+
+		const auto row = RowOf(index);
+		const auto height = row_heights_[row];
+		auto x = 0.0f;
+
+		for (size_t i = row_starts_[row]; i < index; i++)
+		{
+			x += aspects_[i] * height + options_.spacing;
+		}
+
+		return { x, static_cast<float>(row_tops_[row]), aspects_[index] * height, height };
+	}
+
+	size_t JustifiedLayout::VerticalNeighbor(size_t index, ptrdiff_t rows) const noexcept
+	{
+		if (RowCount() == 0 || index >= row_starts_.back())
+		{
+			return index;
+		}
+
+		const auto rect = ItemRect(index);
+		const auto center = rect.x + rect.width / 2;
+		const auto row = static_cast<size_t>(std::clamp<ptrdiff_t>(static_cast<ptrdiff_t>(RowOf(index)) + rows, 0, static_cast<ptrdiff_t>(RowCount()) - 1));
+		const auto height = row_heights_[row];
+		const auto end = row_starts_[row + 1];
+		auto x = 0.0f;
+
+		// 照片右侧一半的间距也算这张照片，行尾的空白算最后一张
+		for (size_t i = row_starts_[row]; i + 1 < end; i++)
+		{
+			x += aspects_[i] * height;
+
+			if (center < x + options_.spacing / 2)
+			{
+				return i;
+			}
+
+			x += options_.spacing;
+		}
+
+		return end - 1;
+	}
+
+	size_t JustifiedLayout::break_row(size_t start, float& height) const noexcept
+	{
+		const auto count = aspects_.size();
+		const auto target = options_.row_height;
+		auto sum = 0.0f;
+
+		for (auto i = start; i < count; i++)
+		{
+			sum += aspects_[i];
+
+			const auto items = static_cast<float>(i - start + 1);
+			const auto available = std::max(width_ - options_.spacing * (items - 1), 1.0f);
+
+			if (sum * target < available)
+			{
+				continue;
+			}
+
+			// 放入这张照片后行高不超过目标；不放入时行高超过目标，取更接近目标的一种
+			const auto with = available / sum;
+
+			if (i > start)
+			{
+				const auto without = (available + options_.spacing) / (sum - aspects_[i]);
+
+				if (without - target < target - with && without <= target * options_.max_row_height_ratio)
+				{
+					height = without;
+					return i;
+				}
+			}
+
+			height = with;
+			return i + 1;
+		}
+
+		// 最后一行不满，不拉伸
+		height = target;
+		return count;
+	}
+
+	void JustifiedLayout::relayout_from(size_t row)
+	{
+		row_starts_.resize(row + 1);
+		row_heights_.resize(row);
+		last_relayout_rows_ = 0;
+
+		if (width_ > 0)
+		{
+			size_t start = row_starts_.back();
+
+			while (start < aspects_.size())
+			{
+				float height = 0;
+				start = break_row(start, height);
+
+				row_heights_.push_back(height);
+				row_starts_.push_back(static_cast<uint32_t>(start));
+				last_relayout_rows_++;
+			}
+		}
+
+		update_tops(row);
+		PE_TRACE_COUNTER("JustifiedLayout.RelayoutRows", last_relayout_rows_);
+	}
+
+	void JustifiedLayout::update_tops(size_t row)
+	{
+		row_tops_.resize(row_heights_.size());
+
+		for (auto r = row; r < row_tops_.size(); r++)
+		{
+			row_tops_[r] = r == 0 ? 0 : row_tops_[r - 1] + row_heights_[r - 1] + options_.spacing;
+		}
+	}
+}
@@ -0,0 +1,160 @@
+﻿/*
+ * 按宽高比排列的图库布局（与平台无关）
+ *
+ * 每一行的照片保持原来的宽高比、高度相同，并且正好占满一行：
+ * 按显示顺序累加宽高比，行宽达到可用宽度时断行，行高取接近目标高度的一种断法。
+ * 每张照片只保存一个 float 宽高比，断行是一次线性的扫描。
+ * 插入、删除或者替换一段照片时从受影响的那一行开始重新断行，
+ * 新的断点和原来的断点重合之后，后面的行直接沿用（只平移序号和纵坐标）。
+ * 查询按纵坐标二分查找行，调用方只为可见范围内的照片创建元素。
+ * 方向键上下移动时取相邻行中横向位置最接近的照片。
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 布局参数，单位是像素（与设备无关的像素）
+	/// </summary>
+	struct JustifiedLayoutOptions
+	{
+		// 目标行高
+		float row_height{ 200 };
+		// 照片之间和行之间的间距
+		float spacing{ 8 };
+		// 行高最多是目标行高的倍数，超过时宁可多放一张照片让行矮一些
+		float max_row_height_ratio{ 1.5f };
+	};
+
+	/// <summary>
+	/// 照片的位置和大小
+	/// </summary>
+	struct LayoutRect
+	{
+		float x{ 0 };
+		float y{ 0 };
+		float width{ 0 };
+		float height{ 0 };
+	};
+
+	/// <summary>
+	/// 按宽高比断行的布局。不保存照片本身，只保存显示顺序上每张照片的宽高比
+	/// </summary>
+	class JustifiedLayout
+	{
+	public:
+		explicit JustifiedLayout(JustifiedLayoutOptions options = {}) noexcept;
+
+		/// <summary>
+		/// 由像素尺寸得到宽高比，尺寸未知时取 3:2，过宽或者过窄的照片按上下限处理
+		/// </summary>
+		static float AspectRatio(uint32_t width, uint32_t height) noexcept;
+
+		/// <summary>
+		/// 设置可用宽度，改变时全部重新断行
+		/// </summary>
+		void SetWidth(float width);
+
+		[[nodiscard]] float Width() const noexcept
+		{
+			return width_;
+		}
+
+		/// <summary>
+		/// 把从 index 开始的 erase_count 张照片替换为新的照片，只重新断行受影响的行
+		/// </summary>
+		/// <param name="index">起始位置</param>
+		/// <param name="erase_count">删除的照片数</param>
+		/// <param name="aspects">新照片的宽高比</param>
+		/// <param name="insert_count">新照片数</param>
+		void Splice(size_t index, size_t erase_count, float const* aspects, size_t insert_count);
+
+		/// <summary>
+		/// 替换全部照片
+		/// </summary>
+		void Assign(std::vector<float> aspects);
+
+		[[nodiscard]] size_t Size() const noexcept
+		{
+			return aspects_.size();
+		}
+
+		[[nodiscard]] size_t RowCount() const noexcept
+		{
+			return row_heights_.size();
+		}
+
+		/// <summary>
+		/// 总高度，不包括最后一行之后的间距
+		/// </summary>
+		[[nodiscard]] double Height() const noexcept;
+
+		/// <summary>
+		/// 照片所在的行
+		/// </summary>
+		[[nodiscard]] size_t RowOf(size_t index) const noexcept;
+
+		/// <summary>
+		/// 纵坐标范围 [top, bottom) 内的行包含的照片，返回 [first, last)
+		/// </summary>
+		[[nodiscard]] std::pair<size_t, size_t> ItemsInRange(double top, double bottom) const noexcept;
+
+		/// <summary>
+		/// 照片的位置和大小
+		/// </summary>
+		[[nodiscard]] LayoutRect ItemRect(size_t index) const noexcept;
+
+		/// <summary>
+		/// 向上（rows 为负）或者向下移动 rows 行后，横向覆盖当前照片中心的照片，用于方向键导航。
+		/// 超出范围时停在第一行或者最后一行
+		/// </summary>
+		/// <param name="index">当前照片</param>
+		/// <param name="rows">移动的行数</param>
+		/// <returns>照片的位置，还没有断行时返回 index</returns>
+		[[nodiscard]] size_t VerticalNeighbor(size_t index, ptrdiff_t rows) const noexcept;
+
+		/// <summary>
+		/// 最近一次修改重新断行的行数，用于追踪和基准测试
+		/// </summary>
+		[[nodiscard]] size_t LastRelayoutRows() const noexcept
+		{
+			return last_relayout_rows_;
+		}
+
+	private:
+		/// <summary>
+		/// 从 start 开始断出一行
+		/// </summary>
+		/// <param name="start">行的第一张照片</param>
+		/// <param name="height">输出的行高</param>
+		/// <returns>下一行的第一张照片</returns>
+		size_t break_row(size_t start, float& height) const noexcept;
+
+		/// <summary>
+		/// 从第 row 行开始重新断行直到末尾
+		/// </summary>
+		void relayout_from(size_t row);
+
+		/// <summary>
+		/// 从第 row 行开始重新计算纵坐标
+		/// </summary>
+		void update_tops(size_t row);
+
+		const JustifiedLayoutOptions options_;
+		float width_{ 0 };
+
+		std::vector<float> aspects_;
+		// 第 r 行是 [row_starts_[r], row_starts_[r + 1])，最后一项是照片数
+		std::vector<uint32_t> row_starts_{ 0 };
+		std::vector<float> row_heights_;
+		std::vector<double> row_tops_;
+
+		size_t last_relayout_rows_{ 0 };
+	};
+}
@@ -0,0 +1,81 @@
+﻿/*
+ * 图库提供者公共代码
+ */
+
+#include "LibraryProvider.h"
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+namespace PhotoCore
+{
+	ImageInfo LibraryProvider::ReadImageInfo(std::string const& path) const
+	{
+		// 大部分文件在前 4KB 内就能找到尺寸，带大 EXIF 块的 JPEG 需要再往后读
+		constexpr size_t read_sizes[]{ 4 * 1024, 64 * 1024, 256 * 1024 };
+
+		std::vector<uint8_t> buffer;
+
+		for (auto read_size : read_sizes)
+		{
+			buffer.resize(read_size);
+			const auto bytes = ReadBytes(path, 0, buffer.data(), buffer.size());
+
+			ImageHeader header;
+
+			if (ParseImageHeader(buffer.data(), bytes, header))
+			{
+				return { header.format, header.width, header.height, {} };
+			}
+
+			// 文件已经读完了
+			if (bytes < read_size)
+			{
+				break;
+			}
+		}
+
+		throw std::runtime_error("not a supported image: " + path);
+	}
+
+	std::string JoinPath(std::string const& folder, std::string const& name)
+	{
+		return folder.empty() ? name : folder + '/' + name;
+	}
+
+	std::string FileExtension(std::string const& name)
+	{
+		const auto dot = name.rfind('.');
+		const auto slash = name.rfind('/');
+
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		{
+			return {};
+		}
+
+		auto extension = name.substr(dot);
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c)
+		{
+			return static_cast<char>(std::tolower(c));
+		});
+
+		return extension;
+	}
+
+	std::string FileDisplayName(std::string const& path)
+	{
+		const auto slash = path.rfind('/');
+		const auto begin = slash == std::string::npos ? 0 : slash + 1;
+		const auto dot = path.rfind('.');
+		const auto end = dot == std::string::npos || dot < begin ? path.size() : dot;
+
+		return path.substr(begin, end - begin);
+	}
+
+	bool IsImageFileName(std::string const& name)
+	{
+		const auto extension = FileExtension(name);
+		return extension == ".jpg" || extension == ".png" || extension == ".gif";
+	}
+}
@@ -0,0 +1,104 @@
+﻿/*
+ * 图库文件系统和元数据接口（与平台无关）
+ *
+ * MainPage 通过 StorageFile 查询和 GetImagePropertiesAsync 读取图库，
+ * 这里把同样的操作抽象出来，使扫描流程可以在磁盘、合成图库等不同的实现上运行和测量。
+ * 路径统一使用 '/' 分隔，相对于图库根目录，根目录是空字符串。
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ImageHeader.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 目录中的一项
+	/// </summary>
+	struct FileEntry
+	{
+		std::string name;
+		bool is_folder{ false };
+		uint64_t size_bytes{ 0 };
+		// Unix 时间，秒
+		int64_t modified_time{ 0 };
+	};
+
+	/// <summary>
+	/// 图片属性，对应 MainPage 使用的 ImageProperties 中的字段
+	/// </summary>
+	struct ImageInfo
+	{
+		ImageFormat format{ ImageFormat::Unknown };
+		uint32_t width{ 0 };
+		uint32_t height{ 0 };
+		std::string title;
+	};
+
+	/// <summary>
+	/// 图库的文件系统和元数据提供者。实现必须允许多个线程同时调用
+	/// </summary>
+	class LibraryProvider
+	{
+	public:
+		virtual ~LibraryProvider() = default;
+
+		/// <summary>
+		/// 列出目录中的文件和子目录
+		/// </summary>
+		/// <param name="folder">目录路径</param>
+		/// <returns>目录项，顺序不确定</returns>
+		virtual std::vector<FileEntry> ListFolder(std::string const& folder) const = 0;
+
+		/// <summary>
+		/// 读取文件的一段字节，文件不存在时抛出 std::runtime_error
+		/// </summary>
+		/// <param name="path">文件路径</param>
+		/// <param name="offset">起始位置</param>
+		/// <param name="buffer">输出缓冲区</param>
+		/// <param name="size">最多读取的字节数</param>
+		/// <returns>实际读取的字节数，到文件末尾时小于 size</returns>
+		virtual size_t ReadBytes(std::string const& path, uint64_t offset, uint8_t* buffer, size_t size) const = 0;
+
+		/// <summary>
+		/// 读取图片属性，相当于 GetImagePropertiesAsync。文件不是有效图片时抛出 std::runtime_error。
+		/// 默认实现读取文件头解析尺寸
+		/// </summary>
+		/// <param name="path">文件路径</param>
+		/// <returns>图片属性</returns>
+		virtual ImageInfo ReadImageInfo(std::string const& path) const;
+
+		/// <summary>
+		/// 文件是否在本机，相当于 Provider().Id() == L"computer"
+		/// </summary>
+		virtual bool IsLocal(std::string const&) const
+		{
+			return true;
+		}
+	};
+
+	/// <summary>
+	/// 拼接目录和名称
+	/// </summary>
+	std::string JoinPath(std::string const& folder, std::string const& name);
+
+	/// <summary>
+	/// 小写的后缀名（包括点），没有后缀名时为空
+	/// </summary>
+	std::string FileExtension(std::string const& name);
+
+	/// <summary>
+	/// 不含目录和后缀名的文件名，相当于 StorageFile::DisplayName
+	/// </summary>
+	std::string FileDisplayName(std::string const& path);
+
+	/// <summary>
+	/// 是否是 MainPage 扫描的图片类型（.jpg、.png、.gif）
+	/// </summary>
+	bool IsImageFileName(std::string const& name);
+}
@@ -0,0 +1,292 @@
+﻿/*
+ * 图库扫描代码
+ */
+
+#include "LibraryScanner.h"
+#include "JpegThumbnail.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <exception>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		PhotoInfo invalid_photo(ScannedFile const& file)
+		{
+			PhotoInfo photo;
+			photo.path = file.path;
+			photo.name = FileDisplayName(file.path);
+			photo.type = FileDisplayType(file.path);
+			photo.size_bytes = file.size_bytes;
+			photo.modified_time = file.modified_time;
+			photo.valid = false;
+			return photo;
+		}
+
+		/// <summary>
+		/// 一个文件的识别状态
+		/// </summary>
+		enum class sniff_state : uint8_t
+		{
+			Remote,
+			CachedInvalid,
+			Invalid,
+			Valid
+		};
+
+		struct sniffed_file
+		{
+			sniff_state state{ sniff_state::Remote };
+			SniffResult result;
+			std::optional<Placeholder> placeholder;
+		};
+	}
+
+	std::vector<ScannedFile> EnumerateImageFiles(LibraryProvider const& provider, std::string const& folder)
+	{
+		PE_TRACE_SCOPE("EnumerateImageFiles");
+
+		std::vector<ScannedFile> files;
+		std::vector<std::string> pending{ folder };
+
+		while (!pending.empty())
+		{
+			const auto current = std::move(pending.back());
+			pending.pop_back();
+
+			for (auto&& entry : provider.ListFolder(current))
+			{
+				if (entry.is_folder)
+				{
+					pending.push_back(JoinPath(current, entry.name));
+				}
+				else if (IsImageFileName(entry.name))
+				{
+					files.push_back({ JoinPath(current, entry.name), entry.size_bytes, entry.modified_time });
+				}
+			}
+		}
+
+		PE_TRACE_COUNTER("EnumerateImageFiles.Files", files.size());
+		return files;
+	}
+
+	PhotoInfo LoadPhotoInfo(LibraryProvider const& provider, ScannedFile const& file)
+	{
+		auto info = provider.ReadImageInfo(file.path);
+
+		PhotoInfo photo;
+		photo.path = file.path;
+		photo.name = FileDisplayName(file.path);
+		photo.type = FileDisplayType(file.path);
+		photo.title = std::move(info.title);
+		photo.format = info.format;
+		photo.width = info.width;
+		photo.height = info.height;
+		photo.size_bytes = file.size_bytes;
+		photo.modified_time = file.modified_time;
+		return photo;
+	}
+
+	std::string FileDisplayType(std::string const& path)
+	{
+		auto type = FileExtension(path);
+
+		if (type.empty())
+		{
+			return "文件";
+		}
+
+		std::transform(type.begin() + 1, type.end(), type.begin() + 1, [](unsigned char c)
+		{
+			return static_cast<char>(std::toupper(c));
+		});
+
+		return type.substr(1) + " 文件";
+	}
+
+	ScanResult ScanLibrary(LibraryProvider const& provider, std::function<bool(PhotoInfo const&)> const& on_photo)
+	{
+		PE_TRACE_SCOPE("ScanLibrary");
+
+		ScanResult result;
+
+		// 与 GetFilesAsync 一样，拿到完整的文件列表之后才开始创建照片
+		const auto files = EnumerateImageFiles(provider);
+		result.photos.reserve(files.size());
+
+		for (auto&& file : files)
+		{
+			if (!provider.IsLocal(file.path))
+			{
+				result.unsupported_files++;
+				continue;
+			}
+
+			try
+			{
+				result.photos.push_back(LoadPhotoInfo(provider, file));
+			}
+			catch (std::exception const&)
+			{
+				// 属性读不出来的文件仍然会出现在网格中，显示时才发现无法解码
+				result.photos.push_back(invalid_photo(file));
+				result.failed_files++;
+			}
+
+			if (on_photo && !on_photo(result.photos.back()))
+			{
+				break;
+			}
+		}
+
+		PE_TRACE_COUNTER("ScanLibrary.Photos", result.photos.size());
+		return result;
+	}
+
+	ScanResult ScanLibraryHeaders(LibraryProvider const& provider, HeaderScanOptions const& options, std::function<bool(PhotoInfo const&)> const& on_photo)
+	{
+		PE_TRACE_SCOPE("ScanLibraryHeaders");
+
+		ScanResult result;
+
+		const auto files = EnumerateImageFiles(provider);
+		result.photos.reserve(files.size());
+
+		const auto batch_size = std::max<size_t>(options.batch_size, 1);
+		std::vector<sniffed_file> batch;
+
+		for (size_t start = 0; start < files.size(); start += batch_size)
+		{
+			const auto count = std::min(batch_size, files.size() - start);
+			batch.assign(count, {});
+
+			// 每个文件只有几次小读取，按文件并行
+			const auto sniff_range = [&](size_t begin, size_t end)
+			{
+				for (auto i = begin; i < end; i++)
+				{
+					auto&& file = files[start + i];
+					auto&& entry = batch[i];
+
+					if (!provider.IsLocal(file.path))
+					{
+						entry.state = sniff_state::Remote;
+						continue;
+					}
+
+					if (options.negative_cache && options.negative_cache->Contains(file.path, file.size_bytes, file.modified_time))
+					{
+						entry.state = sniff_state::CachedInvalid;
+						continue;
+					}
+
+					const auto read = [&](uint64_t offset, uint8_t* buffer, size_t size)
+					{
+						return provider.ReadBytes(file.path, offset, buffer, size);
+					};
+
+					try
+					{
+						entry.result = SniffImage(read);
+					}
+					catch (std::exception const&)
+					{
+						entry.result = {};
+					}
+
+					if (entry.result.valid && options.placeholders)
+					{
+						entry.placeholder = options.placeholders->Find(file.path, file.size_bytes, file.modified_time);
+
+						if (!entry.placeholder)
+						{
+							try
+							{
+								entry.placeholder = LoadEmbeddedPlaceholder(read, entry.result, &entry.result.bytes_read);
+							}
+							catch (std::exception const&)
+							{
+								// 读取失败时没有占位预览，照片仍然有效
+							}
+
+							if (entry.placeholder)
+							{
+								options.placeholders->Add(file.path, file.size_bytes, file.modified_time, *entry.placeholder);
+							}
+						}
+					}
+
+					entry.state = entry.result.valid ? sniff_state::Valid : sniff_state::Invalid;
+
+					// 读取失败或者无法确定的文件可能只是暂时的，不记入负缓存
+					if (!entry.result.valid && entry.result.definitive && options.negative_cache)
+					{
+						options.negative_cache->Add(file.path, file.size_bytes, file.modified_time);
+					}
+				}
+			};
+
+			if (options.pool)
+			{
+				options.pool->ParallelFor(count, sniff_range);
+			}
+			else
+			{
+				sniff_range(0, count);
+			}
+
+			// 按查询顺序加入
+			for (size_t i = 0; i < count; i++)
+			{
+				auto&& file = files[start + i];
+				auto&& entry = batch[i];
+				result.bytes_read += entry.result.bytes_read;
+
+				if (entry.state == sniff_state::Remote)
+				{
+					result.unsupported_files++;
+					continue;
+				}
+
+				if (entry.state == sniff_state::Valid)
+				{
+					PhotoInfo photo;
+					photo.path = file.path;
+					photo.name = FileDisplayName(file.path);
+					photo.type = FileDisplayType(file.path);
+					photo.format = entry.result.header.format;
+					photo.width = entry.result.DisplayWidth();
+					photo.height = entry.result.DisplayHeight();
+					photo.size_bytes = file.size_bytes;
+					photo.modified_time = file.modified_time;
+					photo.placeholder = entry.placeholder;
+
+					result.photos.push_back(std::move(photo));
+				}
+				else
+				{
+					result.photos.push_back(invalid_photo(file));
+					result.failed_files++;
+
+					if (entry.state == sniff_state::CachedInvalid)
+					{
+						result.cached_invalid_files++;
+					}
+				}
+
+				if (on_photo && !on_photo(result.photos.back()))
+				{
+					PE_TRACE_COUNTER("ScanLibraryHeaders.Photos", result.photos.size());
+					return result;
+				}
+			}
+		}
+
+		PE_TRACE_COUNTER("ScanLibraryHeaders.Photos", result.photos.size());
+		return result;
+	}
+}
@@ -0,0 +1,124 @@
+﻿/*
+ * 图库扫描（与平台无关）
+ *
+ * 与 MainPage::get_items_async 的流程相同：先深度查询出所有 .jpg/.png/.gif 文件，
+ * 再逐个读取图片属性创建照片，跳过不在本机的文件。
+ * ScanLibraryHeaders 用文件头识别代替读取属性，按批并行读取，并跳过负缓存中已知无效的文件；
+ * 同时可以从 JPEG 的内嵌略缩图计算占位预览。
+ */
+
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "HeaderSniffer.h"
+#include "LibraryProvider.h"
+#include "Placeholder.h"
+#include "ThreadPool.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 查询得到的文件
+	/// </summary>
+	struct ScannedFile
+	{
+		std::string path;
+		uint64_t size_bytes{ 0 };
+		int64_t modified_time{ 0 };
+	};
+
+	/// <summary>
+	/// 照片信息，对应 MainPage::load_image_info_async 创建的 Photo
+	/// </summary>
+	struct PhotoInfo
+	{
+		std::string path;
+		// 相当于 StorageFile::DisplayName
+		std::string name;
+		// 相当于 StorageFile::DisplayType
+		std::string type;
+		std::string title;
+		ImageFormat format{ ImageFormat::Unknown };
+		uint32_t width{ 0 };
+		uint32_t height{ 0 };
+		uint64_t size_bytes{ 0 };
+		int64_t modified_time{ 0 };
+		// 属性读取或者文件头识别失败时为 false，显示时不需要再尝试解码
+		bool valid{ true };
+		// 缓存中已有的占位预览
+		std::optional<Placeholder> placeholder;
+	};
+
+	/// <summary>
+	/// 扫描结果
+	/// </summary>
+	struct ScanResult
+	{
+		std::vector<PhotoInfo> photos;
+		// 不在本机、没有加入的文件数
+		size_t unsupported_files{ 0 };
+		// 读取属性失败的文件数，这些照片的尺寸为 0
+		size_t failed_files{ 0 };
+		// 其中在负缓存中、没有读取的文件数
+		size_t cached_invalid_files{ 0 };
+		// 识别文件头读取的字节数
+		uint64_t bytes_read{ 0 };
+	};
+
+	/// <summary>
+	/// 文件头扫描的参数
+	/// </summary>
+	struct HeaderScanOptions
+	{
+		// 无效文件的负缓存，可以为空。新发现的无效文件会加入缓存
+		NegativeCache* negative_cache{ nullptr };
+		// 占位预览的缓存，可以为空。不为空时为照片加上占位预览：缓存中有同一版本的直接使用，
+		// 否则从内嵌略缩图计算并加入缓存
+		PlaceholderCache* placeholders{ nullptr };
+		// 并行读取用的线程池，为空时在调用线程上逐个读取
+		ThreadPool* pool{ nullptr };
+		// 每批识别的文件数，每批完成后按顺序回调
+		size_t batch_size{ 64 };
+	};
+
+	/// <summary>
+	/// 递归查询目录下的所有图片文件，相当于 FolderDepth::Deep 的 GetFilesAsync
+	/// </summary>
+	/// <param name="provider">图库</param>
+	/// <param name="folder">起始目录</param>
+	/// <returns>图片文件</returns>
+	std::vector<ScannedFile> EnumerateImageFiles(LibraryProvider const& provider, std::string const& folder = {});
+
+	/// <summary>
+	/// 读取一个文件的属性创建照片信息，相当于 MainPage::load_image_info_async。
+	/// 属性读取失败时抛出异常
+	/// </summary>
+	PhotoInfo LoadPhotoInfo(LibraryProvider const& provider, ScannedFile const& file);
+
+	/// <summary>
+	/// 相当于 StorageFile::DisplayType，例如“JPG 文件”
+	/// </summary>
+	std::string FileDisplayType(std::string const& path);
+
+	/// <summary>
+	/// 完整扫描。每加入一张照片调用一次 on_photo，返回 false 时停止扫描
+	/// </summary>
+	/// <param name="provider">图库</param>
+	/// <param name="on_photo">加入照片的回调，可以为空</param>
+	/// <returns>扫描结果</returns>
+	ScanResult ScanLibrary(LibraryProvider const& provider, std::function<bool(PhotoInfo const&)> const& on_photo = {});
+
+	/// <summary>
+	/// 用文件头识别代替读取属性的完整扫描。照片的尺寸是转正后的尺寸，没有标题。
+	/// 每加入一张照片调用一次 on_photo，返回 false 时停止扫描
+	/// </summary>
+	/// <param name="provider">图库</param>
+	/// <param name="options">扫描参数</param>
+	/// <param name="on_photo">加入照片的回调，可以为空</param>
+	/// <returns>扫描结果</returns>
+	ScanResult ScanLibraryHeaders(LibraryProvider const& provider, HeaderScanOptions const& options = {}, std::function<bool(PhotoInfo const&)> const& on_photo = {});
+}
@@ -0,0 +1,356 @@
+﻿/*
+ * 图片加载调度器（与平台无关）
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Trace.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 加载优先级，数值越小越先执行
+	/// </summary>
+	enum class LoadPriority : uint8_t
+	{
+		// 屏幕上可见的元素
+		Visible = 0,
+		// 即将可见的预取
+		Prefetch = 1,
+		// 后台索引
+		Indexing = 2
+	};
+
+	constexpr size_t LoadPriorityCount = 3;
+
+	/// <summary>
+	/// 调度器计数器快照
+	/// </summary>
+	struct LoadSchedulerCounters
+	{
+		// 每个优先级当前排队的请求数
+		std::array<size_t, LoadPriorityCount> queue_depth{};
+		// 每个优先级出现过的最大排队数
+		std::array<size_t, LoadPriorityCount> max_queue_depth{};
+		// 每个优先级的平均、最大等待时间（毫秒）
+		std::array<double, LoadPriorityCount> average_wait_ms{};
+		std::array<double, LoadPriorityCount> max_wait_ms{};
+
+		// 正在工作线程上执行的请求数
+		size_t in_flight{ 0 };
+
+		uint64_t submitted{ 0 };
+		// 被合并到已有请求中的重复请求数
+		uint64_t merged{ 0 };
+		uint64_t completed{ 0 };
+		uint64_t failed{ 0 };
+	};
+
+	/// <summary>
+	/// 调度器析构时还没有开始执行的请求以这个异常完成
+	/// </summary>
+	class LoadCancelled : public std::runtime_error
+	{
+	public:
+		LoadCancelled() :
+			std::runtime_error("load request was cancelled")
+		{
+		}
+	};
+
+	/// <summary>
+	/// 按优先级调度、按键合并的异步加载器。
+	/// 同一个键的并发请求只执行一次加载，结果共享给所有等待者。
+	/// 加载函数在工作线程上执行，回调同样在工作线程上调用，由调用方切换回界面线程。
+	/// </summary>
+	template <class Key, class Result, class Hash = std::hash<Key>>
+	class LoadScheduler
+	{
+	public:
+		using Job = std::function<Result()>;
+		// 加载失败时结果为空，异常通过第二个参数传递
+		using Callback = std::function<void(std::shared_ptr<Result const> const&, std::exception_ptr)>;
+
+		explicit LoadScheduler(size_t worker_count = DefaultWorkerCount())
+		{
+			worker_count = std::max<size_t>(worker_count, 1);
+			workers_.reserve(worker_count);
+
+			for (size_t i = 0; i < worker_count; i++)
+			{
+				workers_.emplace_back([this] { worker_loop(); });
+			}
+		}
+
+		LoadScheduler(LoadScheduler const&) = delete;
+		LoadScheduler& operator=(LoadScheduler const&) = delete;
+
+		~LoadScheduler()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stopping_ = true;
+			}
+
+			wake_.notify_all();
+
+			for (auto&& worker : workers_)
+			{
+				worker.join();
+			}
+
+			// 没有开始执行的请求以取消完成，等待的协程不会永远挂起
+			const auto cancelled = std::make_exception_ptr(LoadCancelled{});
+
+			for (auto&& entry : pending_)
+			{
+				for (auto&& waiter : entry.second->waiters)
+				{
+					waiter(nullptr, cancelled);
+				}
+			}
+		}
+
+		/// <summary>
+		/// 提交加载请求
+		/// </summary>
+		/// <param name="key">合并用的键</param>
+		/// <param name="priority">优先级</param>
+		/// <param name="job">在工作线程上执行的加载函数</param>
+		/// <param name="callback">完成回调</param>
+		void Submit(Key const& key, LoadPriority priority, Job job, Callback callback)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				submitted_++;
+
+				if (const auto found = pending_.find(key); found != pending_.end())
+				{
+					// 已有相同的请求，合并等待者
+					const auto& request = found->second;
+					request->waiters.push_back(std::move(callback));
+					merged_++;
+
+					// 提升尚未开始执行的请求的优先级
+					if (!request->running && priority < request->priority)
+					{
+						depth_[index_of(request->priority)]--;
+						enqueue(request, priority);
+					}
+
+					return;
+				}
+
+				auto request = std::make_shared<Request>();
+				request->key = key;
+				request->job = std::move(job);
+				request->waiters.push_back(std::move(callback));
+				request->queued_at = clock::now();
+
+				pending_.emplace(key, request);
+				enqueue(request, priority);
+			}
+
+			wake_.notify_one();
+		}
+
+		/// <summary>
+		/// 获取计数器快照
+		/// </summary>
+		/// <returns>计数器</returns>
+		[[nodiscard]] LoadSchedulerCounters Counters() const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			LoadSchedulerCounters counters{};
+			counters.queue_depth = depth_;
+			counters.max_queue_depth = max_depth_;
+			counters.in_flight = in_flight_;
+			counters.submitted = submitted_;
+			counters.merged = merged_;
+			counters.completed = completed_;
+			counters.failed = failed_;
+
+			for (size_t i = 0; i < LoadPriorityCount; i++)
+			{
+				counters.average_wait_ms[i] = started_[i] == 0 ? 0.0 : to_ms(total_wait_[i]) / static_cast<double>(started_[i]);
+				counters.max_wait_ms[i] = to_ms(max_wait_[i]);
+			}
+
+			return counters;
+		}
+
+		/// <summary>
+		/// 默认工作线程数，保留一半核心给界面和合成
+		/// </summary>
+		/// <returns>线程数</returns>
+		static size_t DefaultWorkerCount()
+		{
+			const size_t cores = std::thread::hardware_concurrency();
+			return std::clamp<size_t>(cores / 2, 1, 4);
+		}
+
+	private:
+		using clock = std::chrono::steady_clock;
+
+		struct Request
+		{
+			Key key{};
+			Job job;
+			std::vector<Callback> waiters;
+			clock::time_point queued_at;
+			LoadPriority priority{ LoadPriority::Indexing };
+			bool running{ false };
+		};
+
+		static size_t index_of(LoadPriority priority)
+		{
+			return static_cast<size_t>(priority);
+		}
+
+		static void trace_depth(size_t index, size_t depth)
+		{
+			static constexpr char const* names[LoadPriorityCount]{ "LoadScheduler.Visible", "LoadScheduler.Prefetch", "LoadScheduler.Indexing" };
+			PE_TRACE_COUNTER(names[index], depth);
+		}
+
+		static double to_ms(clock::duration duration)
+		{
+			return std::chrono::duration<double, std::milli>(duration).count();
+		}
+
+		// 调用时必须持有锁
+		void enqueue(std::shared_ptr<Request> const& request, LoadPriority priority)
+		{
+			const auto index = index_of(priority);
+			request->priority = priority;
+			queues_[index].push_back(request);
+
+			depth_[index]++;
+			max_depth_[index] = std::max(max_depth_[index], depth_[index]);
+			trace_depth(index, depth_[index]);
+		}
+
+		// 调用时必须持有锁。提升优先级后旧队列中会残留条目，出队时跳过
+		std::shared_ptr<Request> dequeue()
+		{
+			for (size_t index = 0; index < LoadPriorityCount; index++)
+			{
+				auto& queue = queues_[index];
+
+				while (!queue.empty())
+				{
+					auto request = std::move(queue.front());
+					queue.pop_front();
+
+					if (!request->running && index_of(request->priority) == index)
+					{
+						depth_[index]--;
+						trace_depth(index, depth_[index]);
+						return request;
+					}
+				}
+			}
+
+			return nullptr;
+		}
+
+		void worker_loop()
+		{
+			PE_TRACE_THREAD_NAME("LoadScheduler worker");
+
+			for (;;)
+			{
+				std::shared_ptr<Request> request;
+
+				{
+					std::unique_lock<std::mutex> lock(mutex_);
+					wake_.wait(lock, [this, &request] { return stopping_ || (request = dequeue()) != nullptr; });
+
+					if (!request)
+					{
+						return;
+					}
+
+					// 记录等待时间
+					const auto index = index_of(request->priority);
+					const auto waited = clock::now() - request->queued_at;
+					total_wait_[index] += waited;
+					max_wait_[index] = std::max(max_wait_[index], waited);
+					started_[index]++;
+					PE_TRACE_COUNTER("LoadScheduler.WaitMs", to_ms(waited));
+
+					request->running = true;
+					in_flight_++;
+				}
+
+				std::shared_ptr<Result const> result;
+				std::exception_ptr error{};
+
+				try
+				{
+					PE_TRACE_SCOPE("LoadScheduler::job");
+					result = std::make_shared<Result const>(request->job());
+				}
+				catch (...)
+				{
+					error = std::current_exception();
+				}
+
+				std::vector<Callback> waiters;
+
+				{
+					// 先移出等待列表，之后到达的同键请求会重新加载
+					std::lock_guard<std::mutex> lock(mutex_);
+					pending_.erase(request->key);
+					waiters = std::move(request->waiters);
+
+					in_flight_--;
+					error ? failed_++ : completed_++;
+				}
+
+				for (auto&& waiter : waiters)
+				{
+					waiter(result, error);
+				}
+			}
+		}
+
+		mutable std::mutex mutex_;
+		std::condition_variable wake_;
+		bool stopping_{ false };
+
+		std::unordered_map<Key, std::shared_ptr<Request>, Hash> pending_;
+		std::array<std::deque<std::shared_ptr<Request>>, LoadPriorityCount> queues_;
+
+		// 计数器
+		std::array<size_t, LoadPriorityCount> depth_{};
+		std::array<size_t, LoadPriorityCount> max_depth_{};
+		std::array<clock::duration, LoadPriorityCount> total_wait_{};
+		std::array<clock::duration, LoadPriorityCount> max_wait_{};
+		std::array<uint64_t, LoadPriorityCount> started_{};
+		size_t in_flight_{ 0 };
+		uint64_t submitted_{ 0 };
+		uint64_t merged_{ 0 };
+		uint64_t completed_{ 0 };
+		uint64_t failed_{ 0 };
+
+		// 必须最后声明，保证工作线程启动时其它成员已构造
+		std::vector<std::thread> workers_;
+	};
+}
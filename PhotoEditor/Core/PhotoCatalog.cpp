@@ -0,0 +1,207 @@
+﻿/*
+ * 照片目录代码
+ */
+
+#include "PhotoCatalog.h"
+
+#include <limits>
+#include <stdexcept>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		// 哈希表每个节点的额外开销（估计值）
+		constexpr size_t node_overhead = 32;
+	}
+
+	StringPool::Id StringPool::Add(std::string_view value)
+	{
+		if (chars_.size() + value.size() > std::numeric_limits<uint32_t>::max())
+		{
+			throw std::runtime_error("字符串池超过 4 GB");
+		}
+
+		chars_.insert(chars_.end(), value.begin(), value.end());
+		offsets_.push_back(static_cast<uint32_t>(chars_.size()));
+		return static_cast<Id>(offsets_.size() - 2);
+	}
+
+	StringPool::Id StringPool::Intern(std::string_view value)
+	{
+		if (const auto found = interned_.find(std::string(value)); found != interned_.end())
+		{
+			return found->second;
+		}
+
+		const auto id = Add(value);
+		interned_.emplace(value, id);
+		return id;
+	}
+
+	size_t StringPool::MemoryBytes() const noexcept
+	{
+		auto bytes = chars_.capacity() + offsets_.capacity() * sizeof(uint32_t);
+
+		for (auto&& [value, id] : interned_)
+		{
+			bytes += node_overhead + sizeof(id) + sizeof(value) + (value.capacity() > 15 ? value.capacity() : 0);
+		}
+
+		return bytes;
+	}
+
+	void StringPool::Reserve(size_t strings, size_t chars)
+	{
+		offsets_.reserve(strings + 1);
+		chars_.reserve(chars);
+	}
+
+	PhotoId PhotoCatalog::Add(PhotoInfo const& info)
+	{
+		if (files_.size() >= std::numeric_limits<PhotoId>::max())
+		{
+			throw std::runtime_error("照片目录已满");
+		}
+
+		const std::string_view path = info.path;
+		const auto separator = path.find_last_of("/\\");
+		const auto file_start = separator == std::string_view::npos ? 0 : separator + 1;
+
+		folders_.push_back(strings_.Intern(path.substr(0, file_start)));
+		files_.push_back(strings_.Add(path.substr(file_start)));
+		types_.push_back(strings_.Intern(info.type));
+		widths_.push_back(info.width);
+		heights_.push_back(info.height);
+		sizes_.push_back(info.size_bytes);
+		modified_times_.push_back(info.modified_time);
+		formats_.push_back(info.format);
+		flags_.push_back(info.valid ? flag_valid : 0);
+
+		if (!placeholders_.empty())
+		{
+			placeholders_.emplace_back();
+		}
+
+		const auto id = static_cast<PhotoId>(files_.size() - 1);
+
+		if (!info.title.empty())
+		{
+			SetTitle(id, info.title);
+		}
+
+		if (info.placeholder)
+		{
+			SetPlaceholder(id, *info.placeholder);
+		}
+
+		return id;
+	}
+
+	void PhotoCatalog::Reserve(size_t count)
+	{
+		// 文件名平均按 16 个字符估计
+		strings_.Reserve(count, count * 16);
+		folders_.reserve(count);
+		files_.reserve(count);
+		types_.reserve(count);
+		widths_.reserve(count);
+		heights_.reserve(count);
+		sizes_.reserve(count);
+		modified_times_.reserve(count);
+		formats_.reserve(count);
+		flags_.reserve(count);
+
+		if (!placeholders_.empty())
+		{
+			placeholders_.reserve(count);
+		}
+	}
+
+	std::string PhotoCatalog::Path(PhotoId id) const
+	{
+		std::string path(strings_.Get(folders_[id]));
+		path += strings_.Get(files_[id]);
+		return path;
+	}
+
+	std::string_view PhotoCatalog::Name(PhotoId id) const noexcept
+	{
+		const auto file = FileName(id);
+		const auto dot = file.rfind('.');
+		return dot == std::string_view::npos || dot == 0 ? file : file.substr(0, dot);
+	}
+
+	std::string_view PhotoCatalog::Title(PhotoId id) const noexcept
+	{
+		if (titles_.empty())
+		{
+			return {};
+		}
+
+		const auto found = titles_.find(id);
+		return found == titles_.end() ? std::string_view{} : strings_.Get(found->second);
+	}
+
+	void PhotoCatalog::SetTitle(PhotoId id, std::string_view title)
+	{
+		if (title.empty())
+		{
+			titles_.erase(id);
+			return;
+		}
+
+		// 旧的标题留在字符串池中，标题很少修改
+		titles_[id] = strings_.Add(title);
+	}
+
+	PhotoInfo PhotoCatalog::Get(PhotoId id) const
+	{
+		PhotoInfo info;
+		info.path = Path(id);
+		info.name = Name(id);
+		info.type = Type(id);
+		info.title = Title(id);
+		info.format = formats_[id];
+		info.width = widths_[id];
+		info.height = heights_[id];
+		info.size_bytes = sizes_[id];
+		info.modified_time = modified_times_[id];
+		info.valid = IsValid(id);
+
+		if (const auto placeholder = FindPlaceholder(id))
+		{
+			info.placeholder = *placeholder;
+		}
+
+		return info;
+	}
+
+	void PhotoCatalog::SetPlaceholder(PhotoId id, Placeholder const& placeholder)
+	{
+		if (placeholders_.empty())
+		{
+			placeholders_.reserve(files_.capacity());
+			placeholders_.resize(files_.size());
+		}
+
+		placeholders_[id] = placeholder;
+		flags_[id] |= flag_placeholder;
+	}
+
+	size_t PhotoCatalog::MemoryBytes() const noexcept
+	{
+		const auto ids = folders_.capacity() + files_.capacity() + types_.capacity();
+		const auto dimensions = widths_.capacity() + heights_.capacity();
+
+		return strings_.MemoryBytes()
+			+ ids * sizeof(StringPool::Id)
+			+ dimensions * sizeof(uint32_t)
+			+ sizes_.capacity() * sizeof(uint64_t)
+			+ modified_times_.capacity() * sizeof(int64_t)
+			+ formats_.capacity() * sizeof(ImageFormat)
+			+ flags_.capacity() * sizeof(uint8_t)
+			+ placeholders_.capacity() * sizeof(Placeholder)
+			+ titles_.size() * (node_overhead + sizeof(PhotoId) + sizeof(StringPool::Id));
+	}
+}
@@ -0,0 +1,253 @@
+﻿/*
+ * 照片目录（与平台无关）
+ *
+ * 每张照片只保存几列紧凑的数据，以 32 位 ID 访问：目录和类型字符串在字符串池中去重，
+ * 文件名连续存放在一块内存中，很少出现的标题单独保存。界面只为正在显示的照片创建完整的 Photo 对象。
+ * 只能在一个线程上使用。
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "ImageHeader.h"
+#include "LibraryScanner.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 照片在目录中的编号，按加入顺序从 0 开始
+	/// </summary>
+	using PhotoId = uint32_t;
+
+	/// <summary>
+	/// 字符串池。所有字符串连续存放，以 32 位 ID 访问
+	/// </summary>
+	class StringPool
+	{
+	public:
+		using Id = uint32_t;
+
+		/// <summary>
+		/// 加入字符串，不去重，适合几乎不重复的文件名
+		/// </summary>
+		Id Add(std::string_view value);
+
+		/// <summary>
+		/// 加入字符串，相同的字符串返回同一个 ID，适合目录和类型这样重复很多的值
+		/// </summary>
+		Id Intern(std::string_view value);
+
+		/// <summary>
+		/// 读取字符串，下一次加入之前有效
+		/// </summary>
+		[[nodiscard]] std::string_view Get(Id id) const noexcept
+		{
+			return { chars_.data() + offsets_[id], static_cast<size_t>(offsets_[id + 1] - offsets_[id]) };
+		}
+
+		[[nodiscard]] size_t Size() const noexcept
+		{
+			return offsets_.size() - 1;
+		}
+
+		/// <summary>
+		/// 占用的内存字节数（估计值）
+		/// </summary>
+		[[nodiscard]] size_t MemoryBytes() const noexcept;
+
+		void Reserve(size_t strings, size_t chars);
+
+	private:
+		std::vector<char> chars_;
+		// 第 i 个字符串是 [offsets_[i], offsets_[i + 1])
+		std::vector<uint32_t> offsets_{ 0 };
+		std::unordered_map<std::string, Id> interned_;
+	};
+
+	/// <summary>
+	/// 列式存储的照片目录
+	/// </summary>
+	class PhotoCatalog
+	{
+	public:
+		/// <summary>
+		/// 加入一张照片。路径按最后一个 '/' 或者 '\' 拆分为目录和文件名
+		/// </summary>
+		/// <param name="info">照片信息，名称取文件名去掉后缀名的部分</param>
+		/// <returns>照片 ID</returns>
+		PhotoId Add(PhotoInfo const& info);
+
+		void Reserve(size_t count);
+
+		[[nodiscard]] size_t Size() const noexcept
+		{
+			return files_.size();
+		}
+
+		/// <summary>
+		/// 完整路径
+		/// </summary>
+		[[nodiscard]] std::string Path(PhotoId id) const;
+
+		/// <summary>
+		/// 包括后缀名的文件名
+		/// </summary>
+		[[nodiscard]] std::string_view FileName(PhotoId id) const noexcept
+		{
+			return strings_.Get(files_[id]);
+		}
+
+		/// <summary>
+		/// 去掉后缀名的文件名，相当于 StorageFile::DisplayName
+		/// </summary>
+		[[nodiscard]] std::string_view Name(PhotoId id) const noexcept;
+
+		/// <summary>
+		/// 相当于 StorageFile::DisplayType
+		/// </summary>
+		[[nodiscard]] std::string_view Type(PhotoId id) const noexcept
+		{
+			return strings_.Get(types_[id]);
+		}
+
+		/// <summary>
+		/// 类型字符串的 ID，类型相同的照片 ID 相同
+		/// </summary>
+		[[nodiscard]] StringPool::Id TypeId(PhotoId id) const noexcept
+		{
+			return types_[id];
+		}
+
+		/// <summary>
+		/// 标题，没有标题时为空
+		/// </summary>
+		[[nodiscard]] std::string_view Title(PhotoId id) const noexcept;
+
+		void SetTitle(PhotoId id, std::string_view title);
+
+		[[nodiscard]] ImageFormat Format(PhotoId id) const noexcept
+		{
+			return formats_[id];
+		}
+
+		[[nodiscard]] uint32_t Width(PhotoId id) const noexcept
+		{
+			return widths_[id];
+		}
+
+		[[nodiscard]] uint32_t Height(PhotoId id) const noexcept
+		{
+			return heights_[id];
+		}
+
+		[[nodiscard]] uint64_t SizeBytes(PhotoId id) const noexcept
+		{
+			return sizes_[id];
+		}
+
+		[[nodiscard]] int64_t ModifiedTime(PhotoId id) const noexcept
+		{
+			return modified_times_[id];
+		}
+
+		[[nodiscard]] bool IsValid(PhotoId id) const noexcept
+		{
+			return (flags_[id] & flag_valid) != 0;
+		}
+
+		/// <summary>
+		/// 解码失败后标记为无效
+		/// </summary>
+		void MarkInvalid(PhotoId id) noexcept
+		{
+			flags_[id] &= static_cast<uint8_t>(~flag_valid);
+		}
+
+		/// <summary>
+		/// 占位预览，还没有计算时为空
+		/// </summary>
+		[[nodiscard]] Placeholder const* FindPlaceholder(PhotoId id) const noexcept
+		{
+			return (flags_[id] & flag_placeholder) != 0 ? &placeholders_[id] : nullptr;
+		}
+
+		void SetPlaceholder(PhotoId id, Placeholder const& placeholder);
+
+		/// <summary>
+		/// 标题，没有标题时为名称，与 Photo::ImageTitle 一致
+		/// </summary>
+		[[nodiscard]] std::string_view DisplayTitle(PhotoId id) const noexcept
+		{
+			const auto title = Title(id);
+			return title.empty() ? Name(id) : title;
+		}
+
+		// 整列数据，用于索引和按列筛选
+		[[nodiscard]] std::vector<uint32_t> const& Widths() const noexcept
+		{
+			return widths_;
+		}
+
+		[[nodiscard]] std::vector<uint32_t> const& Heights() const noexcept
+		{
+			return heights_;
+		}
+
+		[[nodiscard]] std::vector<int64_t> const& ModifiedTimes() const noexcept
+		{
+			return modified_times_;
+		}
+
+		[[nodiscard]] std::vector<ImageFormat> const& Formats() const noexcept
+		{
+			return formats_;
+		}
+
+		[[nodiscard]] std::vector<uint8_t> const& Flags() const noexcept
+		{
+			return flags_;
+		}
+
+		/// <summary>
+		/// 还原为 PhotoInfo
+		/// </summary>
+		[[nodiscard]] PhotoInfo Get(PhotoId id) const;
+
+		/// <summary>
+		/// 占用的内存字节数（估计值），包括字符串池
+		/// </summary>
+		[[nodiscard]] size_t MemoryBytes() const noexcept;
+
+		// Flags 中表示有效的位
+		static constexpr uint8_t flag_valid = 1;
+		// Flags 中表示已有占位预览的位
+		static constexpr uint8_t flag_placeholder = 2;
+
+	private:
+
+		StringPool strings_;
+
+		// 每张照片一项的列
+		std::vector<StringPool::Id> folders_;
+		std::vector<StringPool::Id> files_;
+		std::vector<StringPool::Id> types_;
+		std::vector<uint32_t> widths_;
+		std::vector<uint32_t> heights_;
+		std::vector<uint64_t> sizes_;
+		std::vector<int64_t> modified_times_;
+		std::vector<ImageFormat> formats_;
+		std::vector<uint8_t> flags_;
+
+		// 占位预览，设置第一个时才分配，之后和其它列一样长
+		std::vector<Placeholder> placeholders_;
+
+		// 大多数照片没有标题，单独保存
+		std::unordered_map<PhotoId, StringPool::Id> titles_;
+	};
+}
@@ -0,0 +1,182 @@
+﻿/*
+ * 像素缓冲区（与平台无关）
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+
+#include "BufferPool.h"
+
+namespace PhotoCore
+{
+	// 像素格式固定为 BGRA8 预乘，与 SoftwareBitmap 的 Bgra8 / Premultiplied 一致
+	constexpr size_t BytesPerPixel = 4;
+
+	// 行首对齐到缓存行
+	constexpr size_t RowAlignment = BufferAlignment;
+
+	/// <summary>
+	/// 像素视图，不拥有内存
+	/// </summary>
+	struct ImageView
+	{
+		uint8_t* pixels{ nullptr };
+		uint32_t width{ 0 };
+		uint32_t height{ 0 };
+		// 每行字节数
+		size_t stride{ 0 };
+
+		[[nodiscard]] uint8_t* Row(size_t y) const noexcept
+		{
+			return pixels + y * stride;
+		}
+
+		[[nodiscard]] size_t PixelCount() const noexcept
+		{
+			return static_cast<size_t>(width) * height;
+		}
+
+		[[nodiscard]] bool Empty() const noexcept
+		{
+			return pixels == nullptr || width == 0 || height == 0;
+		}
+
+		/// <summary>
+		/// 截取矩形区域，共享同一块内存
+		/// </summary>
+		[[nodiscard]] ImageView Crop(uint32_t x, uint32_t y, uint32_t crop_width, uint32_t crop_height) const noexcept
+		{
+			return { Row(y) + x * BytesPerPixel, crop_width, crop_height, stride };
+		}
+	};
+
+	/// <summary>
+	/// 按行复制像素，尺寸必须相同
+	/// </summary>
+	inline void CopyPixels(ImageView const& source, ImageView const& destination) noexcept
+	{
+		if (source.pixels == destination.pixels)
+		{
+			return;
+		}
+
+		const auto row_bytes = source.width * BytesPerPixel;
+
+		for (size_t y = 0; y < source.height; y++)
+		{
+			std::memcpy(destination.Row(y), source.Row(y), row_bytes);
+		}
+	}
+
+	/// <summary>
+	/// 是否所有像素的 alpha 都是 255
+	/// </summary>
+	inline bool IsOpaque(ImageView const& image) noexcept
+	{
+		for (size_t y = 0; y < image.height; y++)
+		{
+			const auto row = image.Row(y);
+
+			for (size_t x = 0; x < image.width; x++)
+			{
+				if (row[x * BytesPerPixel + 3] != 255)
+				{
+					return false;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	/// <summary>
+	/// 拥有内存的像素缓冲区，每行都对齐到缓存行。
+	/// 效果的中间结果等用完即弃的缓冲区从缓冲池借出，解码结果等长期保存的缓冲区直接申请
+	/// </summary>
+	class PixelBuffer
+	{
+	public:
+		PixelBuffer() = default;
+
+		PixelBuffer(uint32_t width, uint32_t height) :
+			width_(width),
+			height_(height),
+			stride_(AlignedStride(width))
+		{
+			if (stride_ * height_ != 0)
+			{
+				pixels_.reset(static_cast<uint8_t*>(::operator new(stride_ * height_, std::align_val_t{ RowAlignment })));
+			}
+		}
+
+		/// <summary>
+		/// 从缓冲池借出内存，析构时归还
+		/// </summary>
+		PixelBuffer(uint32_t width, uint32_t height, BufferPool& pool) :
+			pixels_(nullptr, pixels_delete{ &pool, AlignedStride(width) * height }),
+			width_(width),
+			height_(height),
+			stride_(AlignedStride(width))
+		{
+			pixels_.reset(static_cast<uint8_t*>(pool.Allocate(stride_ * height_)));
+		}
+
+		[[nodiscard]] ImageView View() const noexcept
+		{
+			return { pixels_.get(), width_, height_, stride_ };
+		}
+
+		[[nodiscard]] uint32_t Width() const noexcept
+		{
+			return width_;
+		}
+
+		[[nodiscard]] uint32_t Height() const noexcept
+		{
+			return height_;
+		}
+
+		[[nodiscard]] size_t SizeInBytes() const noexcept
+		{
+			return stride_ * height_;
+		}
+
+		/// <summary>
+		/// 对齐后的行字节数
+		/// </summary>
+		static size_t AlignedStride(uint32_t width) noexcept
+		{
+			return (width * BytesPerPixel + RowAlignment - 1) / RowAlignment * RowAlignment;
+		}
+
+	private:
+		struct pixels_delete
+		{
+			// 借出内存的缓冲池，为空（值初始化）时内存直接申请
+			BufferPool* pool;
+			size_t bytes;
+
+			void operator()(uint8_t* pixels) const noexcept
+			{
+				if (pool)
+				{
+					pool->Release(pixels, bytes);
+				}
+				else
+				{
+					::operator delete(pixels, std::align_val_t{ RowAlignment });
+				}
+			}
+		};
+
+		std::unique_ptr<uint8_t, pixels_delete> pixels_;
+		uint32_t width_{ 0 };
+		uint32_t height_{ 0 };
+		size_t stride_{ 0 };
+	};
+}
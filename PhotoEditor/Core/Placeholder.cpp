@@ -0,0 +1,276 @@
+﻿/*
+ * 照片的占位预览代码
+ */
+
+#include "Placeholder.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		uint16_t pack_rgb565(uint32_t r, uint32_t g, uint32_t b) noexcept
+		{
+			return static_cast<uint16_t>((r >> 3) << 11 | (g >> 2) << 5 | b >> 3);
+		}
+
+		/// <summary>
+		/// 展开为 8 位的 R、G、B，低位用高位填充，白色仍然是 255
+		/// </summary>
+		std::array<uint32_t, 3> unpack_rgb565(uint16_t color) noexcept
+		{
+			const uint32_t r = color >> 11 & 0x1f;
+			const uint32_t g = color >> 5 & 0x3f;
+			const uint32_t b = color & 0x1f;
+			return { r << 3 | r >> 2, g << 2 | g >> 4, b << 3 | b >> 2 };
+		}
+
+		constexpr char hex_digits[] = "0123456789abcdef";
+
+		int hex_value(char digit) noexcept
+		{
+			if (digit >= '0' && digit <= '9')
+			{
+				return digit - '0';
+			}
+			else if (digit >= 'a' && digit <= 'f')
+			{
+				return digit - 'a' + 10;
+			}
+
+			return -1;
+		}
+	}
+
+	uint32_t Placeholder::AverageColor() const noexcept
+	{
+		std::array<uint32_t, 3> sum{};
+
+		for (auto cell : cells)
+		{
+			const auto rgb = unpack_rgb565(cell);
+
+			for (size_t c = 0; c < 3; c++)
+			{
+				sum[c] += rgb[c];
+			}
+		}
+
+		const auto count = static_cast<uint32_t>(cells.size());
+		return (sum[0] + count / 2) / count << 16 | (sum[1] + count / 2) / count << 8 | (sum[2] + count / 2) / count;
+	}
+
+	Placeholder ComputePlaceholder(ImageView const& image) noexcept
+	{
+		Placeholder placeholder;
+
+		if (image.Empty())
+		{
+			return placeholder;
+		}
+
+		for (uint32_t row = 0; row < Placeholder::Rows; row++)
+		{
+			// 图片比格子还小时每格至少取一个像素
+			const auto top = std::min(row * image.height / Placeholder::Rows, image.height - 1);
+			const auto bottom = std::max((row + 1) * image.height / Placeholder::Rows, top + 1);
+
+			for (uint32_t column = 0; column < Placeholder::Columns; column++)
+			{
+				const auto left = std::min(column * image.width / Placeholder::Columns, image.width - 1);
+				const auto right = std::max((column + 1) * image.width / Placeholder::Columns, left + 1);
+
+				uint64_t b = 0;
+				uint64_t g = 0;
+				uint64_t r = 0;
+
+				for (auto y = top; y < bottom; y++)
+				{
+					auto const* pixel = image.Row(y) + left * BytesPerPixel;
+
+					for (auto x = left; x < right; x++, pixel += BytesPerPixel)
+					{
+						b += pixel[0];
+						g += pixel[1];
+						r += pixel[2];
+					}
+				}
+
+				const auto count = static_cast<uint64_t>(right - left) * (bottom - top);
+				placeholder.cells[row * Placeholder::Columns + column] = pack_rgb565(
+					static_cast<uint32_t>(r / count), static_cast<uint32_t>(g / count), static_cast<uint32_t>(b / count));
+			}
+		}
+
+		return placeholder;
+	}
+
+	void RenderPlaceholder(Placeholder const& placeholder, ImageView const& destination) noexcept
+	{
+		if (destination.Empty())
+		{
+			return;
+		}
+
+		std::array<std::array<uint32_t, 3>, Placeholder::Columns * Placeholder::Rows> colors;
+
+		for (size_t i = 0; i < colors.size(); i++)
+		{
+			colors[i] = unpack_rgb565(placeholder.cells[i]);
+		}
+
+		// 以格子中心为采样点，定点数插值（8 位小数）
+		const auto sample = [](uint32_t position, uint32_t size, uint32_t cells, uint32_t& index, uint32_t& weight)
+		{
+			const auto center = static_cast<int64_t>((2 * position + 1) * cells * 128 / size) - 128;
+			const auto clamped = std::clamp<int64_t>(center, 0, (cells - 1) * 256);
+			index = static_cast<uint32_t>(clamped >> 8);
+			weight = static_cast<uint32_t>(clamped & 0xff);
+
+			if (index == cells - 1)
+			{
+				index = cells - 2;
+				weight = 256;
+			}
+		};
+
+		for (uint32_t y = 0; y < destination.height; y++)
+		{
+			uint32_t row = 0;
+			uint32_t wy = 0;
+			sample(y, destination.height, Placeholder::Rows, row, wy);
+
+			auto* pixel = destination.Row(y);
+
+			for (uint32_t x = 0; x < destination.width; x++, pixel += BytesPerPixel)
+			{
+				uint32_t column = 0;
+				uint32_t wx = 0;
+				sample(x, destination.width, Placeholder::Columns, column, wx);
+
+				auto&& top_left = colors[row * Placeholder::Columns + column];
+				auto&& top_right = colors[row * Placeholder::Columns + column + 1];
+				auto&& bottom_left = colors[(row + 1) * Placeholder::Columns + column];
+				auto&& bottom_right = colors[(row + 1) * Placeholder::Columns + column + 1];
+
+				// 像素是 BGRA，颜色是 RGB
+				for (size_t c = 0; c < 3; c++)
+				{
+					const auto top = top_left[c] * (256 - wx) + top_right[c] * wx;
+					const auto bottom = bottom_left[c] * (256 - wx) + bottom_right[c] * wx;
+					pixel[2 - c] = static_cast<uint8_t>((top * (256 - wy) + bottom * wy + 32768) >> 16);
+				}
+
+				pixel[3] = 255;
+			}
+		}
+	}
+
+	std::optional<Placeholder> PlaceholderCache::Find(std::string const& path, uint64_t size_bytes, int64_t modified_time) const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		const auto found = entries_.find(path);
+
+		if (found == entries_.end() || found->second.size_bytes != size_bytes || found->second.modified_time != modified_time)
+		{
+			return std::nullopt;
+		}
+
+		return found->second.placeholder;
+	}
+
+	void PlaceholderCache::Add(std::string const& path, uint64_t size_bytes, int64_t modified_time, Placeholder const& placeholder)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		entries_[path] = { size_bytes, modified_time, placeholder };
+	}
+
+	size_t PlaceholderCache::Size() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return entries_.size();
+	}
+
+	void PlaceholderCache::Save(std::ostream& output) const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::string cells(Placeholder::Columns * Placeholder::Rows * 4, '0');
+
+		for (auto&& [path, cached] : entries_)
+		{
+			for (size_t i = 0; i < cached.placeholder.cells.size(); i++)
+			{
+				for (size_t digit = 0; digit < 4; digit++)
+				{
+					cells[i * 4 + digit] = hex_digits[cached.placeholder.cells[i] >> (12 - digit * 4) & 0xf];
+				}
+			}
+
+			output << cached.size_bytes << '\t' << cached.modified_time << '\t' << cells << '\t' << path << '\n';
+		}
+	}
+
+	void PlaceholderCache::Load(std::istream& input)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::string line;
+		constexpr size_t cells_length = Placeholder::Columns * Placeholder::Rows * 4;
+
+		while (std::getline(input, line))
+		{
+			const auto first = line.find('\t');
+			const auto second = first == std::string::npos ? std::string::npos : line.find('\t', first + 1);
+			const auto third = second == std::string::npos ? std::string::npos : second + 1 + cells_length;
+
+			if (third == std::string::npos || third + 1 >= line.size() || line[third] != '\t')
+			{
+				continue;
+			}
+
+			char* end = nullptr;
+			const auto size_bytes = std::strtoull(line.c_str(), &end, 10);
+
+			if (end != line.c_str() + first)
+			{
+				continue;
+			}
+
+			const auto modified_time = std::strtoll(line.c_str() + first + 1, &end, 10);
+
+			if (end != line.c_str() + second)
+			{
+				continue;
+			}
+
+			Placeholder placeholder;
+			auto parsed = true;
+
+			for (size_t i = 0; i < placeholder.cells.size() && parsed; i++)
+			{
+				uint32_t cell = 0;
+
+				for (size_t digit = 0; digit < 4; digit++)
+				{
+					const auto value = hex_value(line[second + 1 + i * 4 + digit]);
+
+					if (value < 0)
+					{
+						parsed = false;
+						break;
+					}
+
+					cell = cell << 4 | static_cast<uint32_t>(value);
+				}
+
+				placeholder.cells[i] = static_cast<uint16_t>(cell);
+			}
+
+			if (parsed)
+			{
+				entries_[line.substr(third + 1)] = { size_bytes, modified_time, placeholder };
+			}
+		}
+	}
+}
@@ -0,0 +1,95 @@
+﻿/*
+ * 照片的占位预览（与平台无关）
+ *
+ * 网格项出现时略缩图往往还没有解码，快速滚动时只能看到一片空白。
+ * 每张照片保存一个 4×3 的颜色网格（每格 RGB565，共 24 字节），放在照片目录中；
+ * 网格项出现的同一帧就能不经过任何 I/O 画出模糊的预览，略缩图解码完成之后再替换。
+ * 预览在扫描图库时从 JPEG 的 EXIF 内嵌略缩图计算（LoadEmbeddedPlaceholder），不另外解码略缩图；
+ * 没有内嵌略缩图的照片没有占位预览。按路径、文件大小和修改时间保存在缓存文件中，之后的启动直接使用。
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+#include "PixelBuffer.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 占位预览：按行排列的 Columns×Rows 个格子，每格是该区域的平均颜色（RGB565）
+	/// </summary>
+	struct Placeholder
+	{
+		static constexpr uint32_t Columns = 4;
+		static constexpr uint32_t Rows = 3;
+
+		std::array<uint16_t, Columns * Rows> cells{};
+
+		/// <summary>
+		/// 整张图片的平均颜色，0xRRGGBB
+		/// </summary>
+		[[nodiscard]] uint32_t AverageColor() const noexcept;
+
+		friend bool operator==(Placeholder const& left, Placeholder const& right) noexcept
+		{
+			return left.cells == right.cells;
+		}
+	};
+
+	/// <summary>
+	/// 从解码好的图片（通常是略缩图）计算占位预览
+	/// </summary>
+	/// <param name="image">BGRA8 像素</param>
+	/// <returns>占位预览，图片为空时全黑</returns>
+	Placeholder ComputePlaceholder(ImageView const& image) noexcept;
+
+	/// <summary>
+	/// 把占位预览双线性放大到目标图片，格子之间平滑过渡
+	/// </summary>
+	/// <param name="placeholder">占位预览</param>
+	/// <param name="destination">BGRA8 不透明像素</param>
+	void RenderPlaceholder(Placeholder const& placeholder, ImageView const& destination) noexcept;
+
+	/// <summary>
+	/// 按路径保存占位预览，与负缓存相同，文件的大小或者修改时间改变时作废。线程安全
+	/// </summary>
+	class PlaceholderCache
+	{
+	public:
+		[[nodiscard]] std::optional<Placeholder> Find(std::string const& path, uint64_t size_bytes, int64_t modified_time) const;
+
+		void Add(std::string const& path, uint64_t size_bytes, int64_t modified_time, Placeholder const& placeholder);
+
+		[[nodiscard]] size_t Size() const;
+
+		/// <summary>
+		/// 每行一项：大小、修改时间、十六进制的格子、路径，以制表符分隔
+		/// </summary>
+		void Save(std::ostream& output) const;
+
+		/// <summary>
+		/// 读取 Save 写出的内容，忽略无法解析的行
+		/// </summary>
+		void Load(std::istream& input);
+
+	private:
+		struct entry
+		{
+			uint64_t size_bytes;
+			int64_t modified_time;
+			Placeholder placeholder;
+		};
+
+		mutable std::mutex mutex_;
+		std::unordered_map<std::string, entry> entries_;
+	};
+}
@@ -0,0 +1,1263 @@
+﻿/*
+ * PNG 编码代码
+ */
+
+#include "PngEncoder.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		// deflate 的窗口
+		constexpr size_t window_size = 32768;
+		constexpr size_t window_mask = window_size - 1;
+		constexpr size_t min_match = 3;
+		constexpr size_t max_match = 258;
+		// 长度为 3 的匹配距离太远时不比三个字面量更短
+		constexpr size_t too_far = 4096;
+
+		constexpr int hash_bits = 15;
+
+		// 每个块最多的符号数，块越大 Huffman 表的开销越小，但越难适应数据的变化
+		constexpr size_t block_symbols = 1 << 15;
+
+		// 存储块最多的字节数
+		constexpr size_t max_stored = 65535;
+
+		// 并行编码时每段最少的字节数，太小时同步刷新和字典的开销变大
+		constexpr size_t min_segment = 256 * 1024;
+
+		/// <summary>
+		/// 每个压缩级别的匹配参数，与 zlib 的配置表相同
+		/// </summary>
+		struct level_params
+		{
+			// 前一个匹配达到这个长度时，延迟匹配只查找四分之一的候选位置
+			uint16_t good;
+			// 延迟匹配：匹配短于这个长度时检查下一个位置是否有更长的匹配。
+			// 不做延迟匹配的级别（1 - 3）中是匹配内的位置插入哈希表的最大匹配长度
+			uint16_t lazy;
+			// 达到这个长度就停止查找
+			uint16_t nice;
+			// 最多检查的候选位置
+			uint16_t chain;
+			bool lazy_match;
+		};
+
+		constexpr level_params level_table[10]{
+			{ 0, 0, 0, 0, false },
+			{ 4, 4, 8, 4, false },
+			{ 4, 5, 16, 8, false },
+			{ 4, 6, 32, 32, false },
+			{ 4, 4, 16, 16, true },
+			{ 8, 16, 32, 32, true },
+			{ 8, 16, 128, 128, true },
+			{ 8, 32, 128, 256, true },
+			{ 32, 128, 258, 1024, true },
+			{ 32, 258, 258, 4096, true },
+		};
+
+		constexpr uint16_t length_base[29]{ 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		constexpr uint8_t length_extra[29]{ 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		constexpr uint16_t distance_base[30]{ 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+		constexpr uint8_t distance_extra[30]{ 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+		// 码长码的写出顺序
+		constexpr uint8_t code_length_order[19]{ 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+		constexpr size_t literal_codes = 286;
+		constexpr size_t distance_codes = 30;
+		constexpr uint16_t end_of_block = 256;
+
+		/// <summary>
+		/// 长度、距离到码的查找表和 CRC 表
+		/// </summary>
+		struct deflate_tables
+		{
+			uint8_t length_code[max_match + 1]{};
+			// 距离 1 - 256 直接查表，更远的按 (距离 - 1) >> 7 查表
+			uint8_t distance_code_near[256]{};
+			uint8_t distance_code_far[256]{};
+			uint32_t crc[256]{};
+
+			deflate_tables() noexcept
+			{
+				for (uint8_t code = 0; code < 29; code++)
+				{
+					const auto end = code == 28 ? max_match + 1 : length_base[code + 1];
+
+					for (size_t length = length_base[code]; length < end; length++)
+					{
+						length_code[length] = code;
+					}
+				}
+
+				for (uint8_t code = 0; code < 30; code++)
+				{
+					const size_t end = distance_base[code] + (size_t{ 1 } << distance_extra[code]);
+
+					for (size_t distance = distance_base[code]; distance < end; distance++)
+					{
+						if (distance <= 256)
+						{
+							distance_code_near[distance - 1] = code;
+						}
+						else
+						{
+							distance_code_far[(distance - 1) >> 7] = code;
+						}
+					}
+				}
+
+				for (uint32_t n = 0; n < 256; n++)
+				{
+					auto c = n;
+
+					for (auto k = 0; k < 8; k++)
+					{
+						c = (c & 1) != 0 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+					}
+
+					crc[n] = c;
+				}
+			}
+
+			[[nodiscard]] uint8_t DistanceCode(size_t distance) const noexcept
+			{
+				return distance <= 256 ? distance_code_near[distance - 1] : distance_code_far[(distance - 1) >> 7];
+			}
+		};
+
+		const deflate_tables tables;
+
+		uint32_t crc32(uint32_t crc, uint8_t const* data, size_t size) noexcept
+		{
+			auto c = crc ^ 0xffffffffu;
+
+			for (size_t i = 0; i < size; i++)
+			{
+				c = tables.crc[(c ^ data[i]) & 0xff] ^ (c >> 8);
+			}
+
+			return c ^ 0xffffffffu;
+		}
+
+		constexpr uint32_t adler_base = 65521;
+
+		uint32_t adler32(uint32_t adler, uint8_t const* data, size_t size) noexcept
+		{
+			uint32_t a = adler & 0xffff;
+			uint32_t b = adler >> 16;
+
+			while (size > 0)
+			{
+				// 5552 字节之内 b 不会溢出 32 位
+				const auto count = std::min<size_t>(size, 5552);
+
+				for (size_t i = 0; i < count; i++)
+				{
+					a += data[i];
+					b += a;
+				}
+
+				a %= adler_base;
+				b %= adler_base;
+				data += count;
+				size -= count;
+			}
+
+			return b << 16 | a;
+		}
+
+		/// <summary>
+		/// 两段数据各自的 Adler-32 合并为整体的 Adler-32，与 zlib 的 adler32_combine 相同
+		/// </summary>
+		uint32_t adler32_combine(uint32_t first, uint32_t second, size_t second_size) noexcept
+		{
+			const auto remainder = static_cast<uint32_t>(second_size % adler_base);
+			auto a = first & 0xffff;
+			auto b = static_cast<uint32_t>(static_cast<uint64_t>(remainder) * a % adler_base);
+			a += (second & 0xffff) + adler_base - 1;
+			b += (first >> 16) + (second >> 16) + adler_base - remainder;
+
+			if (a >= adler_base)
+			{
+				a -= adler_base;
+			}
+
+			if (a >= adler_base)
+			{
+				a -= adler_base;
+			}
+
+			if (b >= adler_base << 1)
+			{
+				b -= adler_base << 1;
+			}
+
+			if (b >= adler_base)
+			{
+				b -= adler_base;
+			}
+
+			return b << 16 | a;
+		}
+
+		void put32(std::vector<uint8_t>& output, uint32_t value)
+		{
+			output.push_back(static_cast<uint8_t>(value >> 24));
+			output.push_back(static_cast<uint8_t>(value >> 16));
+			output.push_back(static_cast<uint8_t>(value >> 8));
+			output.push_back(static_cast<uint8_t>(value));
+		}
+
+		/// <summary>
+		/// 写 deflate 数据，低位在前
+		/// </summary>
+		class bit_writer
+		{
+		public:
+			explicit bit_writer(std::vector<uint8_t>& output) noexcept :
+				output_(output)
+			{
+			}
+
+			void Write(uint32_t bits, int count)
+			{
+				buffer_ |= static_cast<uint64_t>(bits) << count_;
+				count_ += count;
+
+				while (count_ >= 8)
+				{
+					output_.push_back(static_cast<uint8_t>(buffer_));
+					buffer_ >>= 8;
+					count_ -= 8;
+				}
+			}
+
+			/// <summary>
+			/// 剩余的位补 0 到字节边界
+			/// </summary>
+			void Align()
+			{
+				if (count_ > 0)
+				{
+					output_.push_back(static_cast<uint8_t>(buffer_));
+				}
+
+				buffer_ = 0;
+				count_ = 0;
+			}
+
+			/// <summary>
+			/// 在字节边界上直接写字节
+			/// </summary>
+			void Bytes(uint8_t const* data, size_t size)
+			{
+				output_.insert(output_.end(), data, data + size);
+			}
+
+		private:
+			std::vector<uint8_t>& output_;
+			uint64_t buffer_{ 0 };
+			int count_{ 0 };
+		};
+
+		/// <summary>
+		/// 由频率计算码长不超过 limit 的 Huffman 码长。超过时把频率减半再试，
+		/// 得到的码长略差于最优，但实现简单，对压缩率的影响可以忽略
+		/// </summary>
+		void build_lengths(uint32_t const* frequencies, size_t count, int limit, uint8_t* lengths)
+		{
+			std::vector<uint32_t> weights(frequencies, frequencies + count);
+			std::vector<uint16_t> leaves;
+			std::vector<uint64_t> node_weights;
+			std::vector<int32_t> parents;
+			std::vector<uint16_t> depths;
+
+			std::fill(lengths, lengths + count, uint8_t{ 0 });
+
+			for (;;)
+			{
+				leaves.clear();
+
+				for (size_t i = 0; i < count; i++)
+				{
+					if (weights[i] != 0)
+					{
+						leaves.push_back(static_cast<uint16_t>(i));
+					}
+				}
+
+				if (leaves.size() < 2)
+				{
+					for (auto leaf : leaves)
+					{
+						lengths[leaf] = 1;
+					}
+
+					return;
+				}
+
+				std::stable_sort(leaves.begin(), leaves.end(), [&](uint16_t a, uint16_t b)
+				{
+					return weights[a] < weights[b];
+				});
+
+				// 叶子按权重排好序，合并出的内部节点权重也是递增的，两个队列的队首就是最小的两个
+				const auto leaf_count = leaves.size();
+				node_weights.assign(leaf_count, 0);
+				parents.assign(leaf_count * 2 - 1, -1);
+
+				for (size_t i = 0; i < leaf_count; i++)
+				{
+					node_weights[i] = weights[leaves[i]];
+				}
+
+				size_t next_leaf = 0;
+				auto next_internal = leaf_count;
+
+				const auto pick = [&]
+				{
+					if (next_leaf < leaf_count && (next_internal == node_weights.size() || node_weights[next_leaf] <= node_weights[next_internal]))
+					{
+						return next_leaf++;
+					}
+
+					return next_internal++;
+				};
+
+				while (node_weights.size() < leaf_count * 2 - 1)
+				{
+					const auto a = pick();
+					const auto b = pick();
+					const auto node = static_cast<int32_t>(node_weights.size());
+					node_weights.push_back(node_weights[a] + node_weights[b]);
+					parents[a] = node;
+					parents[b] = node;
+				}
+
+				// 父节点总在子节点之后，从根倒着求深度
+				depths.assign(node_weights.size(), 0);
+				auto max_depth = 0;
+
+				for (auto i = node_weights.size() - 1; i-- > 0;)
+				{
+					depths[i] = static_cast<uint16_t>(depths[parents[i]] + 1);
+					max_depth = std::max<int>(max_depth, depths[i]);
+				}
+
+				if (max_depth <= limit)
+				{
+					for (size_t i = 0; i < leaf_count; i++)
+					{
+						lengths[leaves[i]] = static_cast<uint8_t>(depths[i]);
+					}
+
+					return;
+				}
+
+				for (auto&& weight : weights)
+				{
+					weight = weight == 0 ? 0 : (weight + 1) / 2;
+				}
+			}
+		}
+
+		/// <summary>
+		/// 由码长得到范式 Huffman 码，码字按位反转以便低位在前写出
+		/// </summary>
+		void build_codes(uint8_t const* lengths, size_t count, uint16_t* codes) noexcept
+		{
+			uint16_t length_counts[16]{};
+			uint16_t next_code[16]{};
+
+			for (size_t i = 0; i < count; i++)
+			{
+				length_counts[lengths[i]]++;
+			}
+
+			length_counts[0] = 0;
+			uint32_t code = 0;
+
+			for (auto length = 1; length < 16; length++)
+			{
+				code = (code + length_counts[length - 1]) << 1;
+				next_code[length] = static_cast<uint16_t>(code);
+			}
+
+			for (size_t i = 0; i < count; i++)
+			{
+				const auto length = lengths[i];
+
+				if (length == 0)
+				{
+					codes[i] = 0;
+					continue;
+				}
+
+				auto value = next_code[length]++;
+				uint16_t reversed = 0;
+
+				for (auto k = 0; k < length; k++, value >>= 1)
+				{
+					reversed = static_cast<uint16_t>(reversed << 1 | (value & 1));
+				}
+
+				codes[i] = reversed;
+			}
+		}
+
+		/// <summary>
+		/// 保证至少有两个码，单个码的码长码无法被解码器接受
+		/// </summary>
+		void ensure_two_codes(uint32_t* frequencies, size_t count) noexcept
+		{
+			auto used = std::count_if(frequencies, frequencies + count, [](uint32_t f) { return f != 0; });
+
+			for (size_t i = 0; i < count && used < 2; i++)
+			{
+				if (frequencies[i] == 0)
+				{
+					frequencies[i] = 1;
+					used++;
+				}
+			}
+		}
+
+		/// <summary>
+		/// LZ77 的输出：距离为 0 时 length 是字面量
+		/// </summary>
+		struct lz_symbol
+		{
+			uint16_t length;
+			uint16_t distance;
+		};
+
+		/// <summary>
+		/// 把一段数据压缩为若干 deflate 块。data 之前的 dictionary 个字节作为字典，可以被引用但不输出
+		/// </summary>
+		class deflater
+		{
+		public:
+			deflater(int level, bit_writer& writer) :
+				params_(level_table[level]),
+				writer_(writer)
+			{
+				if (params_.chain != 0)
+				{
+					head_.assign(size_t{ 1 } << hash_bits, -1);
+					prev_.assign(window_size, -1);
+					symbols_.reserve(block_symbols);
+				}
+			}
+
+			/// <summary>
+			/// 压缩 data[dictionary, dictionary + size)。final 为 false 时以同步刷新结束
+			/// </summary>
+			void Compress(uint8_t const* data, size_t dictionary, size_t size, bool final)
+			{
+				data_ = data;
+				end_ = dictionary + size;
+
+				if (params_.chain == 0)
+				{
+					write_stored(dictionary, size, final);
+				}
+				else
+				{
+					compress(dictionary, final);
+				}
+
+				if (!final)
+				{
+					// 空的存储块，对齐到字节边界，之后可以直接拼接下一段
+					writer_.Write(0, 3);
+					writer_.Align();
+					constexpr uint8_t empty[]{ 0x00, 0x00, 0xff, 0xff };
+					writer_.Bytes(empty, sizeof(empty));
+				}
+			}
+
+		private:
+			[[nodiscard]] uint32_t hash(size_t position) const noexcept
+			{
+				const auto value = static_cast<uint32_t>(data_[position]) | static_cast<uint32_t>(data_[position + 1]) << 8 | static_cast<uint32_t>(data_[position + 2]) << 16;
+				return value * 2654435761u >> (32 - hash_bits);
+			}
+
+			void insert(size_t position) noexcept
+			{
+				if (position + min_match > end_)
+				{
+					return;
+				}
+
+				auto&& slot = head_[hash(position)];
+				prev_[position & window_mask] = slot;
+				slot = static_cast<int32_t>(position);
+			}
+
+			[[nodiscard]] static size_t match_length(uint8_t const* a, uint8_t const* b, size_t limit) noexcept
+			{
+				size_t n = 0;
+
+				while (n + 8 <= limit)
+				{
+					uint64_t x;
+					uint64_t y;
+					std::memcpy(&x, a + n, 8);
+					std::memcpy(&y, b + n, 8);
+
+					if (x != y)
+					{
+						while (a[n] == b[n])
+						{
+							n++;
+						}
+
+						return n;
+					}
+
+					n += 8;
+				}
+
+				while (n < limit && a[n] == b[n])
+				{
+					n++;
+				}
+
+				return n;
+			}
+
+			/// <summary>
+			/// 在 position 之前的窗口中找比 previous 更长的最长匹配，不插入 position
+			/// </summary>
+			size_t find_match(size_t position, size_t previous, size_t& distance) const noexcept
+			{
+				const auto limit = std::min(max_match, end_ - position);
+
+				if (limit < min_match)
+				{
+					return 0;
+				}
+
+				const auto current = data_ + position;
+				auto best = std::max(previous, min_match - 1);
+				auto candidate = head_[hash(position)];
+				auto chain = previous >= params_.good ? params_.chain >> 2 : params_.chain;
+
+				if (best >= limit)
+				{
+					return 0;
+				}
+
+				while (candidate >= 0 && position - static_cast<size_t>(candidate) <= window_size && chain-- > 0)
+				{
+					const auto match = data_ + candidate;
+
+					if (match[best] == current[best] && match[best - 1] == current[best - 1] && match[0] == current[0] && match[1] == current[1])
+					{
+						const auto length = match_length(match, current, limit);
+
+						if (length > best)
+						{
+							best = length;
+							distance = position - static_cast<size_t>(candidate);
+
+							if (length >= params_.nice || length == limit)
+							{
+								break;
+							}
+						}
+					}
+
+					// 槽位被更新的位置覆盖时链就断了
+					const auto next = prev_[static_cast<size_t>(candidate) & window_mask];
+
+					if (next >= candidate)
+					{
+						break;
+					}
+
+					candidate = next;
+				}
+
+				if (best <= std::max(previous, min_match - 1) || (best == min_match && distance > too_far))
+				{
+					return 0;
+				}
+
+				return best;
+			}
+
+			void literal(uint8_t value)
+			{
+				symbols_.push_back({ value, 0 });
+				literal_frequencies_[value]++;
+			}
+
+			void match(size_t length, size_t distance)
+			{
+				symbols_.push_back({ static_cast<uint16_t>(length), static_cast<uint16_t>(distance) });
+
+				const auto length_code = tables.length_code[length];
+				const auto distance_code = tables.DistanceCode(distance);
+				literal_frequencies_[257 + length_code]++;
+				distance_frequencies_[distance_code]++;
+				extra_bits_ += length_extra[length_code] + distance_extra[distance_code];
+			}
+
+			void compress(size_t dictionary, bool final)
+			{
+				// 字典只需要最后一个窗口
+				for (auto position = dictionary - std::min(dictionary, window_size); position < dictionary; position++)
+				{
+					insert(position);
+				}
+
+				auto position = dictionary;
+				block_start_ = dictionary;
+
+				// 延迟匹配时已经找过的下一个位置的匹配
+				auto pending = false;
+				size_t pending_length = 0;
+				size_t pending_distance = 0;
+
+				while (position < end_)
+				{
+					size_t distance = 0;
+					size_t length;
+
+					if (pending)
+					{
+						length = pending_length;
+						distance = pending_distance;
+						pending = false;
+					}
+					else
+					{
+						length = find_match(position, 0, distance);
+					}
+
+					insert(position);
+
+					if (params_.lazy_match && length != 0 && length < params_.lazy && position + 1 < end_)
+					{
+						size_t next_distance = 0;
+						const auto next_length = find_match(position + 1, length, next_distance);
+
+						if (next_length != 0)
+						{
+							literal(data_[position]);
+							position++;
+							pending = true;
+							pending_length = next_length;
+							pending_distance = next_distance;
+							continue;
+						}
+					}
+
+					if (length != 0)
+					{
+						match(length, distance);
+
+						// 快速的级别中长匹配内的位置不插入，重复的数据上哈希链不会太长
+						if (params_.lazy_match || length <= params_.lazy)
+						{
+							for (size_t i = 1; i < length; i++)
+							{
+								insert(position + i);
+							}
+						}
+
+						position += length;
+					}
+					else
+					{
+						literal(data_[position]);
+						position++;
+					}
+
+					if (symbols_.size() >= block_symbols && !pending)
+					{
+						flush_block(position, false);
+					}
+				}
+
+				flush_block(position, final);
+			}
+
+			void write_stored(size_t begin, size_t size, bool final)
+			{
+				do
+				{
+					const auto count = std::min(size, max_stored);
+					const auto last = count == size;
+
+					writer_.Write(final && last ? 1 : 0, 1);
+					writer_.Write(0, 2);
+					writer_.Align();
+
+					const uint8_t header[]{
+						static_cast<uint8_t>(count),
+						static_cast<uint8_t>(count >> 8),
+						static_cast<uint8_t>(~count),
+						static_cast<uint8_t>(~count >> 8),
+					};
+					writer_.Bytes(header, sizeof(header));
+					writer_.Bytes(data_ + begin, count);
+
+					begin += count;
+					size -= count;
+				} while (size > 0);
+			}
+
+			/// <summary>
+			/// 把积累的符号写为一个动态 Huffman 块，比存储块更大时改写为存储块
+			/// </summary>
+			void flush_block(size_t position, bool final)
+			{
+				literal_frequencies_[end_of_block] = 1;
+				ensure_two_codes(literal_frequencies_, literal_codes);
+				ensure_two_codes(distance_frequencies_, distance_codes);
+
+				uint8_t literal_lengths[literal_codes];
+				uint8_t distance_lengths[distance_codes];
+				build_lengths(literal_frequencies_, literal_codes, 15, literal_lengths);
+				build_lengths(distance_frequencies_, distance_codes, 15, distance_lengths);
+
+				// 码长序列，两个表连续编码，重复的码长用 16、17、18 游程编码
+				size_t literal_count = literal_codes;
+				size_t distance_count = distance_codes;
+
+				while (literal_count > 257 && literal_lengths[literal_count - 1] == 0)
+				{
+					literal_count--;
+				}
+
+				while (distance_count > 1 && distance_lengths[distance_count - 1] == 0)
+				{
+					distance_count--;
+				}
+
+				uint8_t all_lengths[literal_codes + distance_codes];
+				std::copy(literal_lengths, literal_lengths + literal_count, all_lengths);
+				std::copy(distance_lengths, distance_lengths + distance_count, all_lengths + literal_count);
+				const auto length_count = literal_count + distance_count;
+
+				struct run_symbol
+				{
+					uint8_t symbol;
+					uint8_t extra;
+				};
+
+				std::vector<run_symbol> runs;
+				uint32_t run_frequencies[19]{};
+
+				for (size_t i = 0; i < length_count;)
+				{
+					const auto value = all_lengths[i];
+					size_t run = 1;
+
+					while (i + run < length_count && all_lengths[i + run] == value)
+					{
+						run++;
+					}
+
+					i += run;
+
+					if (value == 0)
+					{
+						while (run >= 11)
+						{
+							const auto count = std::min<size_t>(run, 138);
+							runs.push_back({ 18, static_cast<uint8_t>(count - 11) });
+							run -= count;
+						}
+
+						if (run >= 3)
+						{
+							runs.push_back({ 17, static_cast<uint8_t>(run - 3) });
+							run = 0;
+						}
+					}
+					else
+					{
+						runs.push_back({ value, 0 });
+						run--;
+
+						while (run >= 3)
+						{
+							const auto count = std::min<size_t>(run, 6);
+							runs.push_back({ 16, static_cast<uint8_t>(count - 3) });
+							run -= count;
+						}
+					}
+
+					for (; run > 0; run--)
+					{
+						runs.push_back({ value, 0 });
+					}
+				}
+
+				for (auto&& run : runs)
+				{
+					run_frequencies[run.symbol]++;
+				}
+
+				ensure_two_codes(run_frequencies, 19);
+
+				uint8_t run_lengths[19];
+				build_lengths(run_frequencies, 19, 7, run_lengths);
+
+				size_t order_count = 19;
+
+				while (order_count > 4 && run_lengths[code_length_order[order_count - 1]] == 0)
+				{
+					order_count--;
+				}
+
+				// 比较动态块与存储块的位数
+				uint64_t dynamic_bits = 3 + 5 + 5 + 4 + 3 * order_count + extra_bits_;
+
+				for (auto&& run : runs)
+				{
+					dynamic_bits += run_lengths[run.symbol] + (run.symbol == 16 ? 2 : run.symbol == 17 ? 3 : run.symbol == 18 ? 7 : 0);
+				}
+
+				for (size_t i = 0; i < literal_codes; i++)
+				{
+					dynamic_bits += static_cast<uint64_t>(literal_frequencies_[i]) * literal_lengths[i];
+				}
+
+				for (size_t i = 0; i < distance_codes; i++)
+				{
+					dynamic_bits += static_cast<uint64_t>(distance_frequencies_[i]) * distance_lengths[i];
+				}
+
+				const auto raw_size = position - block_start_;
+				const auto stored_bits = (raw_size + 5 * ((raw_size + max_stored - 1) / max_stored)) * 8 + 7;
+
+				if (raw_size > 0 && stored_bits < dynamic_bits)
+				{
+					write_stored(block_start_, raw_size, final);
+				}
+				else
+				{
+					uint16_t literal_table[literal_codes];
+					uint16_t distance_table[distance_codes];
+					uint16_t run_table[19];
+					build_codes(literal_lengths, literal_codes, literal_table);
+					build_codes(distance_lengths, distance_codes, distance_table);
+					build_codes(run_lengths, 19, run_table);
+
+					writer_.Write(final ? 1 : 0, 1);
+					writer_.Write(2, 2);
+					writer_.Write(static_cast<uint32_t>(literal_count - 257), 5);
+					writer_.Write(static_cast<uint32_t>(distance_count - 1), 5);
+					writer_.Write(static_cast<uint32_t>(order_count - 4), 4);
+
+					for (size_t i = 0; i < order_count; i++)
+					{
+						writer_.Write(run_lengths[code_length_order[i]], 3);
+					}
+
+					for (auto&& run : runs)
+					{
+						writer_.Write(run_table[run.symbol], run_lengths[run.symbol]);
+
+						if (run.symbol == 16)
+						{
+							writer_.Write(run.extra, 2);
+						}
+						else if (run.symbol == 17)
+						{
+							writer_.Write(run.extra, 3);
+						}
+						else if (run.symbol == 18)
+						{
+							writer_.Write(run.extra, 7);
+						}
+					}
+
+					for (auto&& symbol : symbols_)
+					{
+						if (symbol.distance == 0)
+						{
+							writer_.Write(literal_table[symbol.length], literal_lengths[symbol.length]);
+							continue;
+						}
+
+						const auto length_code = tables.length_code[symbol.length];
+						const auto distance_code = tables.DistanceCode(symbol.distance);
+
+						writer_.Write(literal_table[257 + length_code], literal_lengths[257 + length_code]);
+						writer_.Write(symbol.length - length_base[length_code], length_extra[length_code]);
+						writer_.Write(distance_table[distance_code], distance_lengths[distance_code]);
+						writer_.Write(symbol.distance - distance_base[distance_code], distance_extra[distance_code]);
+					}
+
+					writer_.Write(literal_table[end_of_block], literal_lengths[end_of_block]);
+				}
+
+				symbols_.clear();
+				std::fill(std::begin(literal_frequencies_), std::end(literal_frequencies_), 0u);
+				std::fill(std::begin(distance_frequencies_), std::end(distance_frequencies_), 0u);
+				extra_bits_ = 0;
+				block_start_ = position;
+			}
+
+			level_params params_;
+			bit_writer& writer_;
+
+			uint8_t const* data_{ nullptr };
+			size_t end_{ 0 };
+			size_t block_start_{ 0 };
+
+			std::vector<int32_t> head_;
+			std::vector<int32_t> prev_;
+
+			std::vector<lz_symbol> symbols_;
+			uint32_t literal_frequencies_[literal_codes]{};
+			uint32_t distance_frequencies_[distance_codes]{};
+			uint64_t extra_bits_{ 0 };
+		};
+
+		/// <summary>
+		/// 每行的字节数和滤波时左边像素的字节数
+		/// </summary>
+		struct row_layout
+		{
+			size_t channels;
+			size_t row_bytes;
+			// 滤波后每行前面有一个字节的滤波类型
+			size_t line_bytes;
+		};
+
+		row_layout layout_of(ImageView const& image, PngEncodeOptions const& options) noexcept
+		{
+			const size_t channels = options.alpha ? 4 : 3;
+			return { channels, image.width * channels, image.width * channels + 1 };
+		}
+
+		/// <summary>
+		/// BGRA8 预乘转换为 RGB 或者非预乘的 RGBA
+		/// </summary>
+		void convert_row(uint8_t const* source, uint32_t width, bool alpha, uint8_t* output) noexcept
+		{
+			if (!alpha)
+			{
+				for (uint32_t x = 0; x < width; x++, source += BytesPerPixel, output += 3)
+				{
+					output[0] = source[2];
+					output[1] = source[1];
+					output[2] = source[0];
+				}
+
+				return;
+			}
+
+			for (uint32_t x = 0; x < width; x++, source += BytesPerPixel, output += 4)
+			{
+				const uint32_t a = source[3];
+
+				if (a == 255 || a == 0)
+				{
+					output[0] = a == 0 ? 0 : source[2];
+					output[1] = a == 0 ? 0 : source[1];
+					output[2] = a == 0 ? 0 : source[0];
+				}
+				else
+				{
+					output[0] = static_cast<uint8_t>(std::min(255u, (source[2] * 255u + a / 2) / a));
+					output[1] = static_cast<uint8_t>(std::min(255u, (source[1] * 255u + a / 2) / a));
+					output[2] = static_cast<uint8_t>(std::min(255u, (source[0] * 255u + a / 2) / a));
+				}
+
+				output[3] = static_cast<uint8_t>(a);
+			}
+		}
+
+		/// <summary>
+		/// 残差按有符号字节的绝对值之和，越小通常压缩得越好
+		/// </summary>
+		uint32_t residual_cost(uint8_t const* residual, size_t size) noexcept
+		{
+			uint32_t sum = 0;
+
+			for (size_t i = 0; i < size; i++)
+			{
+				sum += static_cast<uint32_t>(std::abs(static_cast<int>(static_cast<int8_t>(residual[i]))));
+			}
+
+			return sum;
+		}
+
+		/// <summary>
+		/// 对 [begin, end) 行做滤波，写到 output（第 begin 行的起点）。
+		/// 每种滤波都是没有分支的独立循环，编译器可以向量化；每行选择残差代价最小的滤波
+		/// </summary>
+		void filter_rows(ImageView const& image, PngEncodeOptions const& options, uint32_t begin, uint32_t end, uint8_t* output)
+		{
+			const auto layout = layout_of(image, options);
+			const auto bpp = layout.channels;
+			const auto size = layout.row_bytes;
+
+			// 行前面补 bpp 个 0，左边和左上的像素不需要判断边界；第 0 行的上一行全是 0
+			std::vector<uint8_t> rows((bpp + size) * 2, 0);
+			auto previous = rows.data() + bpp;
+			auto current = rows.data() + bpp * 2 + size;
+
+			if (begin > 0)
+			{
+				convert_row(image.Row(begin - 1), image.width, options.alpha, previous);
+			}
+
+			std::vector<uint8_t> candidates(size * 4);
+			const auto sub = candidates.data();
+			const auto up = sub + size;
+			const auto average = up + size;
+			const auto paeth = average + size;
+
+			for (auto y = begin; y < end; y++, output += layout.line_bytes)
+			{
+				convert_row(image.Row(y), image.width, options.alpha, current);
+
+				if (options.level == 0)
+				{
+					output[0] = 0;
+					std::memcpy(output + 1, current, size);
+					std::swap(previous, current);
+					continue;
+				}
+
+				for (size_t i = 0; i < size; i++)
+				{
+					sub[i] = static_cast<uint8_t>(current[i] - current[i - bpp]);
+				}
+
+				for (size_t i = 0; i < size; i++)
+				{
+					up[i] = static_cast<uint8_t>(current[i] - previous[i]);
+				}
+
+				for (size_t i = 0; i < size; i++)
+				{
+					average[i] = static_cast<uint8_t>(current[i] - ((current[i - bpp] + previous[i]) >> 1));
+				}
+
+				for (size_t i = 0; i < size; i++)
+				{
+					const int a = current[i - bpp];
+					const int b = previous[i];
+					const int c = previous[i - bpp];
+					const auto pa = std::abs(b - c);
+					const auto pb = std::abs(a - c);
+					const auto pc = std::abs(a + b - c - c);
+					const auto predictor = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+					paeth[i] = static_cast<uint8_t>(current[i] - predictor);
+				}
+
+				uint8_t const* filtered[5]{ current, sub, up, average, paeth };
+				uint8_t best = 0;
+				auto best_cost = residual_cost(current, size);
+
+				for (uint8_t type = 1; type < 5; type++)
+				{
+					const auto cost = residual_cost(filtered[type], size);
+
+					if (cost < best_cost)
+					{
+						best = type;
+						best_cost = cost;
+					}
+				}
+
+				output[0] = best;
+				std::memcpy(output + 1, filtered[best], size);
+				std::swap(previous, current);
+			}
+		}
+
+		void write_chunk(std::vector<uint8_t>& output, char const* type, uint8_t const* data, size_t size)
+		{
+			put32(output, static_cast<uint32_t>(size));
+			const auto start = output.size();
+			output.insert(output.end(), type, type + 4);
+			output.insert(output.end(), data, data + size);
+			put32(output, crc32(0, output.data() + start, output.size() - start));
+		}
+
+		/// <summary>
+		/// 签名和 IHDR
+		/// </summary>
+		std::vector<uint8_t> begin_png(ImageView const& image, PngEncodeOptions const& options)
+		{
+			if (image.width == 0 || image.height == 0)
+			{
+				throw std::invalid_argument("PNG: image is empty");
+			}
+
+			if (options.level < 0 || options.level > 9)
+			{
+				throw std::invalid_argument("PNG: level must be between 0 and 9");
+			}
+
+			std::vector<uint8_t> output{ 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+			std::vector<uint8_t> header;
+			put32(header, image.width);
+			put32(header, image.height);
+			// 8 位，RGB 或者 RGBA，deflate，自适应滤波，不隔行
+			header.insert(header.end(), { 8, static_cast<uint8_t>(options.alpha ? 6 : 2), 0, 0, 0 });
+			write_chunk(output, "IHDR", header.data(), header.size());
+			return output;
+		}
+
+		/// <summary>
+		/// zlib 头，FLEVEL 与压缩级别对应
+		/// </summary>
+		void zlib_header(std::vector<uint8_t>& output, int level)
+		{
+			constexpr uint8_t flags[]{ 0x01, 0x01, 0x5e, 0x5e, 0x5e, 0x5e, 0x9c, 0xda, 0xda, 0xda };
+			output.push_back(0x78);
+			output.push_back(flags[level]);
+		}
+
+		void end_png(std::vector<uint8_t>& output)
+		{
+			write_chunk(output, "IEND", nullptr, 0);
+		}
+	}
+
+	std::vector<uint8_t> EncodePng(ImageView const& image, PngEncodeOptions const& options)
+	{
+		PE_TRACE_SCOPE("EncodePng");
+
+		auto output = begin_png(image, options);
+		const auto layout = layout_of(image, options);
+
+		std::vector<uint8_t> filtered(layout.line_bytes * image.height);
+		filter_rows(image, options, 0, image.height, filtered.data());
+
+		std::vector<uint8_t> stream;
+		stream.reserve(filtered.size() / 2);
+		zlib_header(stream, options.level);
+
+		bit_writer writer(stream);
+		deflater(options.level, writer).Compress(filtered.data(), 0, filtered.size(), true);
+		writer.Align();
+		put32(stream, adler32(1, filtered.data(), filtered.size()));
+
+		write_chunk(output, "IDAT", stream.data(), stream.size());
+		end_png(output);
+		return output;
+	}
+
+	std::vector<uint8_t> EncodePng(ImageView const& image, PngEncodeOptions const& options, ThreadPool& pool)
+	{
+		PE_TRACE_SCOPE("EncodePng.parallel");
+
+		auto output = begin_png(image, options);
+		const auto layout = layout_of(image, options);
+		std::vector<uint8_t> filtered(layout.line_bytes * image.height);
+
+		{
+			PE_TRACE_SCOPE("EncodePng.filter");
+
+			// 每块约 64 KB
+			const auto grain = std::max<size_t>(1, 65536 / layout.line_bytes);
+			pool.ParallelFor(image.height, [&](size_t begin, size_t end)
+			{
+				filter_rows(image, options, static_cast<uint32_t>(begin), static_cast<uint32_t>(end), filtered.data() + begin * layout.line_bytes);
+			}, grain);
+		}
+
+		// 每个线程约四段，线程之间的负载比较均衡
+		const auto total = filtered.size();
+		const auto segment_size = std::max(min_segment, (total + pool.ThreadCount() * 4 - 1) / (pool.ThreadCount() * 4));
+		const auto segment_count = (total + segment_size - 1) / segment_size;
+
+		// 每段一个 IDAT 块：长度和类型、压缩数据、CRC
+		std::vector<std::vector<uint8_t>> chunks(segment_count);
+		std::vector<uint32_t> adlers(segment_count);
+
+		{
+			PE_TRACE_SCOPE("EncodePng.deflate");
+
+			pool.ParallelFor(segment_count, [&](size_t begin, size_t end)
+			{
+				for (auto i = begin; i < end; i++)
+				{
+					const auto start = i * segment_size;
+					const auto size = std::min(segment_size, total - start);
+					const auto dictionary = std::min(start, window_size);
+					const auto last = i == segment_count - 1;
+
+					auto&& chunk = chunks[i];
+					chunk.reserve(size / 2 + 16);
+					chunk.resize(8);
+
+					if (i == 0)
+					{
+						zlib_header(chunk, options.level);
+					}
+
+					bit_writer writer(chunk);
+					deflater(options.level, writer).Compress(filtered.data() + start - dictionary, dictionary, size, last);
+					writer.Align();
+
+					adlers[i] = adler32(1, filtered.data() + start, size);
+				}
+			});
+		}
+
+		// 合并校验和写到最后一段之后，再按段计算 CRC
+		auto adler = adlers[0];
+
+		for (size_t i = 1; i < segment_count; i++)
+		{
+			adler = adler32_combine(adler, adlers[i], std::min(segment_size, total - i * segment_size));
+		}
+
+		put32(chunks.back(), adler);
+
+		pool.ParallelFor(segment_count, [&](size_t begin, size_t end)
+		{
+			for (auto i = begin; i < end; i++)
+			{
+				auto&& chunk = chunks[i];
+				const auto size = static_cast<uint32_t>(chunk.size() - 8);
+				const uint8_t header[]{
+					static_cast<uint8_t>(size >> 24), static_cast<uint8_t>(size >> 16), static_cast<uint8_t>(size >> 8), static_cast<uint8_t>(size),
+					'I', 'D', 'A', 'T',
+				};
+				std::copy(std::begin(header), std::end(header), chunk.begin());
+				put32(chunk, crc32(0, chunk.data() + 4, chunk.size() - 4));
+			}
+		});
+
+		size_t bytes = output.size() + 12;
+
+		for (auto&& chunk : chunks)
+		{
+			bytes += chunk.size();
+		}
+
+		output.reserve(bytes);
+
+		for (auto&& chunk : chunks)
+		{
+			output.insert(output.end(), chunk.begin(), chunk.end());
+		}
+
+		end_png(output);
+		return output;
+	}
+}
@@ -0,0 +1,49 @@
+﻿/*
+ * PNG 编码（与平台无关）
+ *
+ * 输出 8 位 RGB 或者 RGBA、不隔行的 PNG，压缩使用内置的 deflate（LZ77 加动态 Huffman），不依赖 zlib。
+ * 每行在五种滤波中选择残差绝对值之和最小的一种，与 libpng 的启发式相同。
+ *
+ * 并行编码时把滤波后的数据按行切成若干段，每段独立压缩为一个 IDAT 块：
+ * 段的末尾做一次同步刷新（空的存储块）对齐到字节，各段直接拼接就是一个完整的 zlib 流。
+ * 每段以前一段最后 32 KB 为字典（与 pigz 相同），可以引用段之前的数据，压缩率接近单线程。
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "PixelBuffer.h"
+#include "ThreadPool.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 编码参数
+	/// </summary>
+	struct PngEncodeOptions
+	{
+		// 0 - 9，与 zlib 的压缩级别含义相同：0 不压缩，1 最快，9 最小
+		int level{ 6 };
+		// 是否写出 alpha 通道，否则输出 RGB
+		bool alpha{ false };
+	};
+
+	/// <summary>
+	/// 在当前线程上把 BGRA8 预乘图片编码为 PNG，整个图片压缩为一个连续的流
+	/// </summary>
+	/// <param name="image">图片</param>
+	/// <param name="options">编码参数</param>
+	/// <returns>PNG 文件内容</returns>
+	std::vector<uint8_t> EncodePng(ImageView const& image, PngEncodeOptions const& options = {});
+
+	/// <summary>
+	/// 同上，滤波和压缩按段在线程池上并行执行
+	/// </summary>
+	/// <param name="image">图片</param>
+	/// <param name="options">编码参数</param>
+	/// <param name="pool">线程池</param>
+	/// <returns>PNG 文件内容</returns>
+	std::vector<uint8_t> EncodePng(ImageView const& image, PngEncodeOptions const& options, ThreadPool& pool);
+}
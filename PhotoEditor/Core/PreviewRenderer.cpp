@@ -0,0 +1,243 @@
+﻿/*
+ * 效果预览的批量渲染代码
+ */
+
+#include "PreviewRenderer.h"
+#include "EffectKernels.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		/// <summary>
+		/// 目标的一个像素在源中覆盖的范围 [begin, end)
+		/// </summary>
+		struct source_span
+		{
+			uint32_t begin;
+			uint32_t end;
+		};
+
+		/// <summary>
+		/// 一个方向上每个目标像素覆盖的源像素，裁掉的部分两侧相等
+		/// </summary>
+		std::vector<source_span> spans_of(uint32_t source_size, uint32_t destination_size, double scale)
+		{
+			const auto covered = destination_size / scale;
+			const auto offset = (source_size - covered) / 2;
+			const auto step = covered / destination_size;
+
+			std::vector<source_span> spans(destination_size);
+
+			for (uint32_t i = 0; i < destination_size; i++)
+			{
+				const auto begin = std::min(static_cast<uint32_t>(offset + i * step), source_size - 1);
+				const auto end = static_cast<uint32_t>(offset + (i + 1) * step);
+
+				// 放大时每个目标像素至少取一个源像素
+				spans[i] = { begin, std::clamp(end, begin + 1, source_size) };
+			}
+
+			return spans;
+		}
+
+		/// <summary>
+		/// 计算目标的 [begin, end) 行，每个目标像素取覆盖区域的平均值
+		/// </summary>
+		void resample_rows(ImageView const& source, ImageView const& destination, std::vector<source_span> const& columns, std::vector<source_span> const& rows, uint32_t begin, uint32_t end) noexcept
+		{
+			for (auto y = begin; y < end; y++)
+			{
+				auto output = destination.Row(y);
+
+				for (uint32_t x = 0; x < destination.width; x++, output += BytesPerPixel)
+				{
+					uint32_t sum[BytesPerPixel]{};
+
+					for (auto sy = rows[y].begin; sy < rows[y].end; sy++)
+					{
+						auto input = source.Row(sy) + columns[x].begin * BytesPerPixel;
+
+						for (auto sx = columns[x].begin; sx < columns[x].end; sx++, input += BytesPerPixel)
+						{
+							for (size_t channel = 0; channel < BytesPerPixel; channel++)
+							{
+								sum[channel] += input[channel];
+							}
+						}
+					}
+
+					const auto count = (rows[y].end - rows[y].begin) * (columns[x].end - columns[x].begin);
+
+					for (size_t channel = 0; channel < BytesPerPixel; channel++)
+					{
+						output[channel] = static_cast<uint8_t>((sum[channel] + count / 2) / count);
+					}
+				}
+			}
+		}
+
+		bool is_point_effect(Effect const& effect) noexcept
+		{
+			return std::visit([](auto&& e)
+			{
+				return IsPointEffect<std::decay_t<decltype(e)>>;
+			}, effect);
+		}
+
+		template <class Kernel>
+		void render_row(Kernel const& kernel, uint8_t const* input, uint8_t* output, uint32_t width) noexcept
+		{
+			for (uint32_t x = 0; x < width; x++, input += BytesPerPixel, output += BytesPerPixel)
+			{
+				auto p = LoadPixel(input);
+				kernel(p);
+				StorePixel(p, output);
+			}
+		}
+	}
+
+	void ResampleToFill(ImageView const& source, ImageView const& destination)
+	{
+		if (source.Empty() || destination.Empty())
+		{
+			return;
+		}
+
+		const auto scale = std::max(static_cast<double>(destination.width) / source.width, static_cast<double>(destination.height) / source.height);
+		resample_rows(source, destination, spans_of(source.width, destination.width, scale), spans_of(source.height, destination.height, scale), 0, destination.height);
+	}
+
+	void ResampleToFill(ImageView const& source, ImageView const& destination, ThreadPool& pool)
+	{
+		if (source.Empty() || destination.Empty())
+		{
+			return;
+		}
+
+		const auto scale = std::max(static_cast<double>(destination.width) / source.width, static_cast<double>(destination.height) / source.height);
+		const auto columns = spans_of(source.width, destination.width, scale);
+		const auto rows = spans_of(source.height, destination.height, scale);
+
+		pool.ParallelFor(destination.height, [&](size_t begin, size_t end)
+		{
+			resample_rows(source, destination, columns, rows, static_cast<uint32_t>(begin), static_cast<uint32_t>(end));
+		}, RowsPerChunk(destination.width));
+	}
+
+	Effect PreviewTileEffect(EffectTag tag) noexcept
+	{
+		switch (tag)
+		{
+		case EffectTag::Sepia:
+			return SepiaEffect{ .5f };
+		case EffectTag::Invert:
+			return InvertEffect{};
+		case EffectTag::Grayscale:
+			return GrayscaleEffect{};
+		case EffectTag::Blur:
+			return GaussianBlurEffect{ 3 };
+		case EffectTag::Color:
+			return SaturationEffect{ .5f };
+		case EffectTag::Light:
+			return ExposureEffect{ 1 };
+		}
+
+		return CompositeEffect{};
+	}
+
+	PreviewRenderer::PreviewRenderer(ImageView const& thumbnail) :
+		thumbnail_(thumbnail.width, thumbnail.height)
+	{
+		CopyPixels(thumbnail, thumbnail_.View());
+	}
+
+	PreviewRenderer::PreviewRenderer(PixelBuffer thumbnail) noexcept :
+		thumbnail_(std::move(thumbnail))
+	{
+	}
+
+	ImageView PreviewRenderer::Base(uint32_t width, uint32_t height)
+	{
+		for (auto&& base : bases_)
+		{
+			if (base.Width() == width && base.Height() == height)
+			{
+				return base.View();
+			}
+		}
+
+		PE_TRACE_SCOPE("PreviewRenderer::resample");
+
+		auto&& base = bases_.emplace_back(width, height);
+		ResampleToFill(thumbnail_.View(), base.View());
+		return base.View();
+	}
+
+	void PreviewRenderer::RenderTiles(Effect const* effects, ImageView const* tiles, size_t count, ThreadPool& pool)
+	{
+		PE_TRACE_SCOPE("PreviewRenderer::RenderTiles");
+
+		if (count == 0)
+		{
+			return;
+		}
+
+		const auto width = tiles[0].width;
+		const auto height = tiles[0].height;
+
+		for (size_t i = 1; i < count; i++)
+		{
+			if (tiles[i].width != width || tiles[i].height != height)
+			{
+				throw std::invalid_argument("预览的尺寸必须相同");
+			}
+		}
+
+		const auto base = Base(width, height);
+
+		// 底图的每一行读入缓存一次，依次写出所有逐像素效果的预览
+		pool.ParallelFor(height, [&](size_t begin, size_t end)
+		{
+			for (auto y = begin; y < end; y++)
+			{
+				const auto input = base.Row(y);
+
+				for (size_t i = 0; i < count; i++)
+				{
+					std::visit([&](auto&& e)
+					{
+						using T = std::decay_t<decltype(e)>;
+
+						if constexpr (IsPointEffect<T>)
+						{
+							render_row(typename PointKernelFor<T>::type{ e }, input, tiles[i].Row(y), width);
+						}
+					}, effects[i]);
+				}
+			}
+		}, RowsPerChunk(width));
+
+		// 模糊需要相邻的行，在底图上单独处理
+		for (size_t i = 0; i < count; i++)
+		{
+			if (!is_point_effect(effects[i]))
+			{
+				ApplyEffect(effects[i], base, tiles[i], pool);
+			}
+		}
+	}
+
+	void PreviewRenderer::RenderChain(CompiledEffectChain const& compiled, EffectChain const& chain, ImageView const& destination, ThreadPool& pool)
+	{
+		PE_TRACE_SCOPE("PreviewRenderer::RenderChain");
+
+		// 第一遍从底图读取，底图保持不变
+		RenderEffectChain(compiled, chain, Base(destination.width, destination.height), destination, pool);
+	}
+}
@@ -0,0 +1,94 @@
+﻿/*
+ * 效果预览的批量渲染（与平台无关）
+ *
+ * 效果预览网格中的六个预览和应用按钮上的预览都来自同一张略缩图。
+ * 渲染器只保存一份略缩图，每种预览尺寸只缩小一次；六个预览在一次遍历中完成：
+ * 底图的每一行读入一次，依次写出每个逐像素效果的预览，模糊在底图上单独处理。
+ * 188x88 的底图只有 64 KB，整个过程都在缓存中。
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "EffectChain.h"
+#include "PixelBuffer.h"
+
+namespace PhotoCore
+{
+	// 效果预览网格中每个预览的尺寸，与原来 InitializeEffectPreview 中精灵的大小相同
+	constexpr uint32_t PreviewTileWidth = 188;
+	constexpr uint32_t PreviewTileHeight = 88;
+
+	// 应用按钮上预览的尺寸
+	constexpr uint32_t ButtonPreviewWidth = 232;
+	constexpr uint32_t ButtonPreviewHeight = 64;
+
+	/// <summary>
+	/// 把 source 缩放并居中裁剪到 destination 的尺寸（与 Stretch="UniformToFill" 相同），
+	/// 每个目标像素取覆盖区域的平均值
+	/// </summary>
+	void ResampleToFill(ImageView const& source, ImageView const& destination);
+
+	/// <summary>
+	/// 同上，按行在线程池上并行，用于缩小整幅图片
+	/// </summary>
+	void ResampleToFill(ImageView const& source, ImageView const& destination, ThreadPool& pool);
+
+	/// <summary>
+	/// 效果预览网格中每个标签的预览效果，参数与原来 InitializeEffectPreviews 使用的相同
+	/// </summary>
+	Effect PreviewTileEffect(EffectTag tag) noexcept;
+
+	/// <summary>
+	/// 同一张略缩图的所有效果预览。不是线程安全的
+	/// </summary>
+	class PreviewRenderer
+	{
+	public:
+		/// <summary>
+		/// 复制略缩图
+		/// </summary>
+		/// <param name="thumbnail">BGRA8 预乘略缩图</param>
+		explicit PreviewRenderer(ImageView const& thumbnail);
+
+		/// <summary>
+		/// 接管已经复制出来的略缩图
+		/// </summary>
+		explicit PreviewRenderer(PixelBuffer thumbnail) noexcept;
+
+		/// <summary>
+		/// 缩小到指定尺寸的底图，每个尺寸只缩小一次
+		/// </summary>
+		ImageView Base(uint32_t width, uint32_t height);
+
+		/// <summary>
+		/// 渲染若干个单效果预览，所有预览的尺寸必须相同，否则抛出 std::invalid_argument
+		/// </summary>
+		/// <param name="effects">每个预览的效果</param>
+		/// <param name="tiles">每个预览的输出</param>
+		/// <param name="count">预览数</param>
+		/// <param name="pool">线程池</param>
+		void RenderTiles(Effect const* effects, ImageView const* tiles, size_t count, ThreadPool& pool);
+
+		/// <summary>
+		/// 按效果链渲染一个预览，用于应用按钮
+		/// </summary>
+		void RenderChain(CompiledEffectChain const& compiled, EffectChain const& chain, ImageView const& destination, ThreadPool& pool);
+
+		/// <summary>
+		/// 缩小略缩图的次数，用于检查每个尺寸只缩小一次
+		/// </summary>
+		[[nodiscard]] size_t ResampleCount() const noexcept
+		{
+			return bases_.size();
+		}
+
+	private:
+		PixelBuffer thumbnail_;
+
+		// 各个尺寸的底图，通常只有预览网格和按钮两种
+		std::vector<PixelBuffer> bases_;
+	};
+}
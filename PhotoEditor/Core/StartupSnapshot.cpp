@@ -0,0 +1,271 @@
+﻿/*
+ * 启动快照代码
+ */
+
+#include "StartupSnapshot.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		constexpr char snapshot_magic[4]{ 'P', 'E', 'S', 'S' };
+		constexpr uint32_t snapshot_version = 2;
+
+		struct snapshot_header
+		{
+			char magic[4];
+			uint32_t version;
+			uint32_t count;
+			uint32_t strings_bytes;
+		};
+
+		/// <summary>
+		/// 一张照片的定长记录，字符串依次保存在字符串区
+		/// </summary>
+		struct snapshot_record
+		{
+			// 略缩图像素在文件中的位置
+			uint64_t pixels_offset;
+			uint64_t size_bytes;
+			int64_t modified_time;
+			// 路径、名称、类型、标题在字符串区中的位置和各自的长度
+			uint32_t strings_offset;
+			uint16_t path_length;
+			uint16_t name_length;
+			uint16_t type_length;
+			uint16_t title_length;
+			uint32_t width;
+			uint32_t height;
+			uint32_t thumbnail_width;
+			uint32_t thumbnail_height;
+			uint8_t format;
+			uint8_t valid;
+			uint8_t has_placeholder;
+			uint8_t reserved[5];
+			uint16_t placeholder[Placeholder::Columns * Placeholder::Rows];
+		};
+
+		/// <summary>
+		/// 映射的内存不保证对齐，复制出来使用
+		/// </summary>
+		snapshot_record record_at(uint8_t const* data, size_t index) noexcept
+		{
+			snapshot_record entry;
+			std::memcpy(&entry, data + sizeof(snapshot_header) + index * sizeof(snapshot_record), sizeof(snapshot_record));
+			return entry;
+		}
+
+		size_t align_up(size_t value) noexcept
+		{
+			return (value + RowAlignment - 1) / RowAlignment * RowAlignment;
+		}
+
+		uint16_t string_length(std::string const& value)
+		{
+			if (value.size() > std::numeric_limits<uint16_t>::max())
+			{
+				throw std::invalid_argument("快照中的字符串太长");
+			}
+
+			return static_cast<uint16_t>(value.size());
+		}
+	}
+
+	void WriteStartupSnapshot(std::ostream& output, std::vector<SnapshotPhoto> const& photos)
+	{
+		PE_TRACE_SCOPE("WriteStartupSnapshot");
+
+		std::vector<snapshot_record> records(photos.size());
+		std::string strings;
+
+		for (size_t i = 0; i < photos.size(); i++)
+		{
+			auto&& info = photos[i].info;
+			auto& entry = records[i];
+
+			entry.size_bytes = info.size_bytes;
+			entry.modified_time = info.modified_time;
+			entry.strings_offset = static_cast<uint32_t>(strings.size());
+			entry.path_length = string_length(info.path);
+			entry.name_length = string_length(info.name);
+			entry.type_length = string_length(info.type);
+			entry.title_length = string_length(info.title);
+			entry.width = info.width;
+			entry.height = info.height;
+			entry.format = static_cast<uint8_t>(info.format);
+			entry.valid = info.valid ? 1 : 0;
+
+			if (info.placeholder)
+			{
+				entry.has_placeholder = 1;
+				std::copy(info.placeholder->cells.begin(), info.placeholder->cells.end(), entry.placeholder);
+			}
+
+			strings += info.path;
+			strings += info.name;
+			strings += info.type;
+			strings += info.title;
+		}
+
+		// 像素从字符串区之后的第一个对齐位置开始
+		auto offset = align_up(sizeof(snapshot_header) + records.size() * sizeof(snapshot_record) + strings.size());
+
+		for (size_t i = 0; i < photos.size(); i++)
+		{
+			auto&& thumbnail = photos[i].thumbnail;
+			auto& entry = records[i];
+
+			if (!thumbnail.pixels)
+			{
+				continue;
+			}
+
+			entry.pixels_offset = offset;
+			entry.thumbnail_width = thumbnail.width;
+			entry.thumbnail_height = thumbnail.height;
+			offset = align_up(offset + thumbnail.PixelCount() * BytesPerPixel);
+		}
+
+		snapshot_header header{};
+		std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+		header.version = snapshot_version;
+		header.count = static_cast<uint32_t>(records.size());
+		header.strings_bytes = static_cast<uint32_t>(strings.size());
+
+		output.write(reinterpret_cast<char const*>(&header), sizeof(header));
+		output.write(reinterpret_cast<char const*>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(snapshot_record)));
+		output.write(strings.data(), static_cast<std::streamsize>(strings.size()));
+
+		size_t written = sizeof(header) + records.size() * sizeof(snapshot_record) + strings.size();
+		const std::vector<char> padding(RowAlignment, 0);
+
+		for (size_t i = 0; i < photos.size(); i++)
+		{
+			auto&& thumbnail = photos[i].thumbnail;
+
+			if (!thumbnail.pixels)
+			{
+				continue;
+			}
+
+			output.write(padding.data(), static_cast<std::streamsize>(records[i].pixels_offset - written));
+			written = records[i].pixels_offset;
+
+			// 各行紧密排列
+			const auto row_bytes = thumbnail.width * BytesPerPixel;
+
+			for (size_t y = 0; y < thumbnail.height; y++)
+			{
+				output.write(reinterpret_cast<char const*>(thumbnail.Row(y)), static_cast<std::streamsize>(row_bytes));
+			}
+
+			written += row_bytes * thumbnail.height;
+		}
+
+		if (!output)
+		{
+			throw std::runtime_error("无法写入启动快照");
+		}
+	}
+
+	StartupSnapshot::StartupSnapshot(uint8_t const* data, size_t size) :
+		data_(data)
+	{
+		PE_TRACE_SCOPE("StartupSnapshot::StartupSnapshot");
+
+		snapshot_header header{};
+
+		if (size < sizeof(header))
+		{
+			throw std::runtime_error("启动快照不完整");
+		}
+
+		std::memcpy(&header, data, sizeof(header));
+
+		if (std::memcmp(header.magic, snapshot_magic, sizeof(header.magic)) != 0 || header.version != snapshot_version)
+		{
+			throw std::runtime_error("启动快照的格式或者版本不对");
+		}
+
+		count_ = header.count;
+		strings_offset_ = sizeof(header) + count_ * sizeof(snapshot_record);
+
+		if (count_ > (size - sizeof(header)) / sizeof(snapshot_record) || header.strings_bytes > size - strings_offset_)
+		{
+			throw std::runtime_error("启动快照不完整");
+		}
+
+		// 先检查所有记录，之后访问时不再检查
+		for (size_t i = 0; i < count_; i++)
+		{
+			const auto entry = record_at(data_, i);
+			const auto strings_end = static_cast<uint64_t>(entry.strings_offset) + entry.path_length + entry.name_length + entry.type_length + entry.title_length;
+
+			if (strings_end > header.strings_bytes)
+			{
+				throw std::runtime_error("启动快照的字符串越界");
+			}
+
+			if (entry.pixels_offset != 0)
+			{
+				const auto pixel_bytes = static_cast<uint64_t>(entry.thumbnail_width) * entry.thumbnail_height * BytesPerPixel;
+
+				if (entry.pixels_offset > size || pixel_bytes > size - entry.pixels_offset)
+				{
+					throw std::runtime_error("启动快照的略缩图越界");
+				}
+			}
+		}
+	}
+
+	PhotoInfo StartupSnapshot::Info(size_t index) const
+	{
+		const auto entry = record_at(data_, index);
+		auto const* strings = reinterpret_cast<char const*>(data_ + strings_offset_ + entry.strings_offset);
+
+		PhotoInfo info;
+		info.path.assign(strings, entry.path_length);
+		strings += entry.path_length;
+		info.name.assign(strings, entry.name_length);
+		strings += entry.name_length;
+		info.type.assign(strings, entry.type_length);
+		strings += entry.type_length;
+		info.title.assign(strings, entry.title_length);
+
+		info.format = static_cast<ImageFormat>(entry.format);
+		info.width = entry.width;
+		info.height = entry.height;
+		info.size_bytes = entry.size_bytes;
+		info.modified_time = entry.modified_time;
+		info.valid = entry.valid != 0;
+
+		if (entry.has_placeholder)
+		{
+			info.placeholder.emplace();
+			std::copy(std::begin(entry.placeholder), std::end(entry.placeholder), info.placeholder->cells.begin());
+		}
+
+		return info;
+	}
+
+	ImageView StartupSnapshot::Thumbnail(size_t index) const noexcept
+	{
+		const auto entry = record_at(data_, index);
+
+		if (entry.pixels_offset == 0)
+		{
+			return {};
+		}
+
+		// ImageView 没有只读版本，调用方不能写入
+		return { const_cast<uint8_t*>(data_ + entry.pixels_offset), entry.thumbnail_width, entry.thumbnail_height, entry.thumbnail_width * BytesPerPixel };
+	}
+}
@@ -0,0 +1,77 @@
+﻿/*
+ * 启动快照（与平台无关）
+ *
+ * 退出或者挂起时把网格当前位置开始的一屏照片写成一个文件：照片信息和已经解码的略缩图像素。
+ * 下次启动时映射这个文件，在扫描图库和读取任何图片之前就能显示第一屏。
+ * 文件按本机字节序保存，只在同一台机器上使用；格式或者版本不对时整个文件作废。
+ *
+ * 布局：文件头、每张照片一条定长记录（包括占位预览）、字符串区，之后是每张略缩图的像素（BGRA8 预乘，
+ * 各行紧密排列），每张略缩图的起始位置对齐到 RowAlignment。
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "LibraryScanner.h"
+#include "PixelBuffer.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 写入快照的一张照片
+	/// </summary>
+	struct SnapshotPhoto
+	{
+		PhotoInfo info;
+		// 解码好的略缩图，可以为空
+		ImageView thumbnail;
+	};
+
+	/// <summary>
+	/// 写出快照
+	/// </summary>
+	/// <param name="output">二进制输出流</param>
+	/// <param name="photos">照片，按显示顺序</param>
+	void WriteStartupSnapshot(std::ostream& output, std::vector<SnapshotPhoto> const& photos);
+
+	/// <summary>
+	/// 内存中（通常是映射的文件）的快照。不复制数据，使用期间内存必须保持有效
+	/// </summary>
+	class StartupSnapshot
+	{
+	public:
+		/// <summary>
+		/// 检查并解析快照，格式不对时抛出 std::runtime_error
+		/// </summary>
+		/// <param name="data">快照内容</param>
+		/// <param name="size">字节数</param>
+		StartupSnapshot(uint8_t const* data, size_t size);
+
+		/// <summary>
+		/// 照片数
+		/// </summary>
+		[[nodiscard]] size_t Size() const noexcept
+		{
+			return count_;
+		}
+
+		/// <summary>
+		/// 照片信息
+		/// </summary>
+		[[nodiscard]] PhotoInfo Info(size_t index) const;
+
+		/// <summary>
+		/// 略缩图像素，指向快照内存，只读。没有略缩图时为空
+		/// </summary>
+		[[nodiscard]] ImageView Thumbnail(size_t index) const noexcept;
+
+	private:
+		uint8_t const* data_;
+		size_t count_{ 0 };
+		size_t strings_offset_{ 0 };
+	};
+}
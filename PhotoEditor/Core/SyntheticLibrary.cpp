@@ -0,0 +1,555 @@
+﻿/*
+ * 合成图库代码
+ */
+
+#include "SyntheticLibrary.h"
+#include "Exif.h"
+#include "JpegEncoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		/// <summary>
+		/// 随机数。std 的分布在不同标准库上结果不同，这里只用引擎的原始输出，保证各平台生成的图库一致
+		/// </summary>
+		class random
+		{
+		public:
+			explicit random(uint64_t seed) :
+				engine_(seed)
+			{
+			}
+
+			// [0, 1)
+			double uniform()
+			{
+				return static_cast<double>(engine_() >> 11) * (1.0 / 9007199254740992.0);
+			}
+
+			// [0, count)
+			size_t below(size_t count)
+			{
+				return static_cast<size_t>(uniform() * count);
+			}
+
+			bool chance(double probability)
+			{
+				return uniform() < probability;
+			}
+
+			// 对数正态分布，median 为中位数
+			double log_normal(double median, double sigma)
+			{
+				const auto u1 = std::max(uniform(), 1e-12);
+				const auto u2 = uniform();
+				const auto normal = std::sqrt(-2 * std::log(u1)) * std::cos(2 * 3.14159265358979323846 * u2);
+				return median * std::exp(sigma * normal);
+			}
+
+		private:
+			std::mt19937_64 engine_;
+		};
+
+		struct dimension
+		{
+			uint32_t width;
+			uint32_t height;
+			double weight;
+		};
+
+		// 手机、相机、全景和旧设备的照片
+		constexpr dimension jpeg_dimensions[]{
+			{ 4032, 3024, 30 }, { 3024, 4032, 20 }, { 6000, 4000, 12 }, { 4000, 6000, 4 },
+			{ 4608, 3456, 8 }, { 2048, 1536, 6 }, { 1600, 1200, 6 }, { 1024, 768, 5 },
+			{ 640, 480, 4 }, { 8192, 2048, 3 }, { 12000, 3000, 1 }, { 8000, 6000, 1 },
+		};
+
+		// 截图和图标
+		constexpr dimension png_dimensions[]{
+			{ 1920, 1080, 35 }, { 2560, 1440, 15 }, { 1170, 2532, 25 }, { 800, 600, 15 }, { 256, 256, 10 },
+		};
+
+		// 动图
+		constexpr dimension gif_dimensions[]{
+			{ 480, 270, 50 }, { 320, 240, 30 }, { 800, 450, 20 },
+		};
+
+		template <size_t N>
+		dimension const& pick(dimension const (&table)[N], random& rng)
+		{
+			double total = 0;
+
+			for (auto&& entry : table)
+			{
+				total += entry.weight;
+			}
+
+			auto value = rng.uniform() * total;
+
+			for (auto&& entry : table)
+			{
+				if (value < entry.weight)
+				{
+					return entry;
+				}
+
+				value -= entry.weight;
+			}
+
+			return table[N - 1];
+		}
+
+		uint32_t crc32(uint8_t const* data, size_t size) noexcept
+		{
+			uint32_t crc = 0xffffffff;
+
+			for (size_t i = 0; i < size; i++)
+			{
+				crc ^= data[i];
+
+				for (auto bit = 0; bit < 8; bit++)
+				{
+					crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+				}
+			}
+
+			return ~crc;
+		}
+
+		uint64_t hash(std::string const& text) noexcept
+		{
+			// FNV-1a
+			uint64_t value = 14695981039346656037ull;
+
+			for (auto c : text)
+			{
+				value = (value ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+			}
+
+			return value;
+		}
+
+		void put_be16(std::vector<uint8_t>& bytes, uint32_t value)
+		{
+			bytes.push_back(static_cast<uint8_t>(value >> 8));
+			bytes.push_back(static_cast<uint8_t>(value));
+		}
+
+		void put_be32(std::vector<uint8_t>& bytes, uint32_t value)
+		{
+			put_be16(bytes, value >> 16);
+			put_be16(bytes, value & 0xffff);
+		}
+
+		void put_le16(std::vector<uint8_t>& bytes, uint32_t value)
+		{
+			bytes.push_back(static_cast<uint8_t>(value));
+			bytes.push_back(static_cast<uint8_t>(value >> 8));
+		}
+
+		/// <summary>
+		/// 内嵌在 EXIF 中的 160x120 略缩图，所有文件共用
+		/// </summary>
+		std::vector<uint8_t> const& exif_thumbnail()
+		{
+			static const auto thumbnail = []
+			{
+				PixelBuffer pixels(160, 120);
+				const auto view = pixels.View();
+
+				for (uint32_t y = 0; y < view.height; y++)
+				{
+					auto row = view.Row(y);
+
+					for (uint32_t x = 0; x < view.width; x++, row += BytesPerPixel)
+					{
+						row[0] = static_cast<uint8_t>(x * 255 / view.width);
+						row[1] = static_cast<uint8_t>(y * 255 / view.height);
+						row[2] = static_cast<uint8_t>(128 + (x ^ y) % 64);
+						row[3] = 255;
+					}
+				}
+
+				JpegEncodeOptions options;
+				options.quality = 75;
+				return EncodeJpeg(view, options);
+			}();
+
+			return thumbnail;
+		}
+
+		/// <summary>
+		/// SOI、JFIF、大小不一的 EXIF 段（相机的 EXIF 通常有几 KB 到几十 KB）和 SOF0
+		/// </summary>
+		std::vector<uint8_t> jpeg_header(SyntheticFile const& file)
+		{
+			std::vector<uint8_t> bytes{ 0xff, 0xd8 };
+
+			// APP0 JFIF
+			const uint8_t jfif[]{ 0xff, 0xe0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+			bytes.insert(bytes.end(), std::begin(jfif), std::end(jfif));
+
+			// APP1 EXIF：IFD0 中的方向和 IFD1 中的略缩图，其余是填充
+			const auto exif_size = static_cast<size_t>(2 * 1024 + hash(file.path) % (40 * 1024));
+			const auto exif = BuildExifSegment(file.orientation, file.exif_thumbnail ? exif_thumbnail() : std::vector<uint8_t>{}, 2 + exif_size);
+			bytes.insert(bytes.end(), exif.begin(), exif.end());
+
+			// SOF0：8 位、YCbCr 4:2:0
+			const uint8_t sof[]{ 0xff, 0xc0, 0x00, 0x11, 0x08 };
+			bytes.insert(bytes.end(), std::begin(sof), std::end(sof));
+			put_be16(bytes, file.height);
+			put_be16(bytes, file.width);
+			const uint8_t components[]{ 0x03, 0x01, 0x22, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01 };
+			bytes.insert(bytes.end(), std::begin(components), std::end(components));
+
+			return bytes;
+		}
+
+		std::vector<uint8_t> png_header(SyntheticFile const& file)
+		{
+			std::vector<uint8_t> bytes{ 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+			put_be32(bytes, 13);
+			const auto chunk_start = bytes.size();
+			bytes.insert(bytes.end(), { 'I', 'H', 'D', 'R' });
+			put_be32(bytes, file.width);
+			put_be32(bytes, file.height);
+			// 8 位 RGBA、deflate、自适应过滤、不交错
+			bytes.insert(bytes.end(), { 8, 6, 0, 0, 0 });
+			put_be32(bytes, crc32(bytes.data() + chunk_start, bytes.size() - chunk_start));
+
+			return bytes;
+		}
+
+		std::vector<uint8_t> gif_header(SyntheticFile const& file)
+		{
+			std::vector<uint8_t> bytes{ 'G', 'I', 'F', '8', '9', 'a' };
+			put_le16(bytes, file.width);
+			put_le16(bytes, file.height);
+			// 没有全局调色板
+			bytes.insert(bytes.end(), { 0x00, 0x00, 0x00 });
+			return bytes;
+		}
+	}
+
+	SyntheticLibrary::SyntheticLibrary(SyntheticLibraryOptions const& options) :
+		property_latency_(options.property_latency),
+		list_latency_(options.list_latency)
+	{
+		random rng(options.seed);
+
+		// 随机递归树：每个新目录挂在之前的某个目录下，深度大约是目录数的对数
+		const auto folder_count = options.max_depth == 0 ? 1 : std::max<size_t>(1, static_cast<size_t>(options.file_count / std::max(options.files_per_folder, 1.0)));
+		folders_.reserve(folder_count);
+		folders_.push_back({});
+
+		for (size_t i = 1; i < folder_count; i++)
+		{
+			auto parent = static_cast<uint32_t>(rng.below(i));
+
+			while (folders_[parent].depth >= options.max_depth)
+			{
+				parent = static_cast<uint32_t>(rng.below(parent));
+			}
+
+			Folder folder;
+			folder.path = JoinPath(folders_[parent].path, "Album " + std::to_string(i));
+			folder.depth = folders_[parent].depth + 1;
+
+			folders_[parent].folders.push_back(static_cast<uint32_t>(i));
+			folders_.push_back(std::move(folder));
+		}
+
+		// 十年之内
+		constexpr int64_t first_time = 1420070400;
+		constexpr int64_t time_span = 10 * 365 * 24 * 3600ll;
+
+		files_.reserve(options.file_count);
+
+		for (size_t i = 0; i < options.file_count; i++)
+		{
+			SyntheticFile file;
+			std::string name;
+			char number[24];
+			std::snprintf(number, sizeof number, "%06zu", i);
+
+			if (rng.chance(options.other_fraction))
+			{
+				// 视频和其他文件
+				if (rng.chance(.7))
+				{
+					name = std::string("VID_") + number + ".mp4";
+					file.size_bytes = static_cast<uint64_t>(rng.log_normal(50e6, 1));
+				}
+				else
+				{
+					name = std::string("notes_") + number + ".txt";
+					file.size_bytes = static_cast<uint64_t>(rng.log_normal(2e3, 1));
+				}
+			}
+			else
+			{
+				const auto kind = rng.uniform();
+				dimension const* size;
+				double bytes_per_pixel;
+
+				if (kind < .85)
+				{
+					file.format = ImageFormat::Jpeg;
+					size = &pick(jpeg_dimensions, rng);
+					bytes_per_pixel = .25;
+					// 相机默认的大写后缀名
+					name = rng.chance(.2) ? std::string("DSC_") + number + ".JPG" : std::string("IMG_") + number + ".jpg";
+				}
+				else if (kind < .97)
+				{
+					file.format = ImageFormat::Png;
+					size = &pick(png_dimensions, rng);
+					bytes_per_pixel = 1;
+					name = std::string("Screenshot_") + number + ".png";
+				}
+				else
+				{
+					file.format = ImageFormat::Gif;
+					size = &pick(gif_dimensions, rng);
+					// 多帧
+					bytes_per_pixel = 4;
+					name = std::string("GIF_") + number + ".gif";
+				}
+
+				file.width = size->width;
+				file.height = size->height;
+				file.size_bytes = static_cast<uint64_t>(rng.log_normal(file.width * static_cast<double>(file.height) * bytes_per_pixel, .35));
+				file.corrupt = rng.chance(options.corrupt_fraction);
+				file.remote = rng.chance(options.remote_fraction);
+
+				if (rng.chance(options.titled_fraction))
+				{
+					file.title = "Photo " + std::to_string(rng.below(options.file_count));
+				}
+			}
+
+			if (file.format == ImageFormat::Jpeg)
+			{
+				// 由文件名决定，不改变随机数序列，同样的种子仍然生成同样的图库
+				const auto exif_hash = hash(name);
+				const auto exif_value = static_cast<double>(exif_hash % 10000) / 10000;
+				const auto rotation = (exif_hash >> 32) % 100;
+
+				file.exif_thumbnail = exif_value < options.exif_thumbnail_fraction;
+				// 手机竖拍的照片多数按横向存储，由方向标签转正
+				file.orientation = rotation < 15 ? 6 : rotation < 17 ? 8 : rotation < 18 ? 3 : 1;
+			}
+
+			file.size_bytes = std::max<uint64_t>(file.size_bytes, 128);
+			file.modified_time = first_time + static_cast<int64_t>(rng.uniform() * time_span);
+
+			// 较早创建的目录（通常更浅）文件更多
+			const auto folder = static_cast<uint32_t>(std::pow(rng.uniform(), 1.5) * folders_.size());
+			file.path = JoinPath(folders_[folder].path, name);
+
+			folders_[folder].files.push_back(static_cast<uint32_t>(i));
+			files_.push_back(std::move(file));
+		}
+
+		folder_index_.reserve(folders_.size());
+
+		for (size_t i = 0; i < folders_.size(); i++)
+		{
+			folder_index_.emplace(folders_[i].path, static_cast<uint32_t>(i));
+		}
+
+		file_index_.reserve(files_.size());
+
+		for (size_t i = 0; i < files_.size(); i++)
+		{
+			file_index_.emplace(files_[i].path, static_cast<uint32_t>(i));
+		}
+	}
+
+	std::vector<FileEntry> SyntheticLibrary::ListFolder(std::string const& folder) const
+	{
+		if (list_latency_.count() > 0)
+		{
+			std::this_thread::sleep_for(list_latency_);
+		}
+
+		const auto found = folder_index_.find(folder);
+
+		if (found == folder_index_.end())
+		{
+			return {};
+		}
+
+		auto&& entry = folders_[found->second];
+		std::vector<FileEntry> entries;
+		entries.reserve(entry.folders.size() + entry.files.size());
+
+		for (auto index : entry.folders)
+		{
+			auto&& child = folders_[index];
+			entries.push_back({ child.path.substr(child.path.rfind('/') + 1), true, 0, 0 });
+		}
+
+		for (auto index : entry.files)
+		{
+			auto&& file = files_[index];
+			const auto slash = file.path.rfind('/');
+			entries.push_back({ slash == std::string::npos ? file.path : file.path.substr(slash + 1), false, file.size_bytes, file.modified_time });
+		}
+
+		return entries;
+	}
+
+	size_t SyntheticLibrary::ReadBytes(std::string const& path, uint64_t offset, uint8_t* buffer, size_t size) const
+	{
+		auto&& file = find_file(path);
+
+		if (offset >= file.size_bytes)
+		{
+			return 0;
+		}
+
+		const auto count = static_cast<size_t>(std::min<uint64_t>(size, file.size_bytes - offset));
+		std::memset(buffer, 0, count);
+
+		const auto header = FileHeader(file);
+
+		if (offset < header.size())
+		{
+			const auto header_bytes = std::min(count, static_cast<size_t>(header.size() - offset));
+			std::memcpy(buffer, header.data() + offset, header_bytes);
+		}
+
+		return count;
+	}
+
+	ImageInfo SyntheticLibrary::ReadImageInfo(std::string const& path) const
+	{
+		if (property_latency_.count() > 0)
+		{
+			// 忙等待，sleep 的精度不够
+			const auto deadline = std::chrono::steady_clock::now() + property_latency_;
+
+			while (std::chrono::steady_clock::now() < deadline)
+			{
+				std::this_thread::yield();
+			}
+		}
+
+		auto info = LibraryProvider::ReadImageInfo(path);
+		info.title = find_file(path).title;
+		return info;
+	}
+
+	bool SyntheticLibrary::IsLocal(std::string const& path) const
+	{
+		return !find_file(path).remote;
+	}
+
+	uint32_t SyntheticLibrary::Depth() const noexcept
+	{
+		uint32_t depth = 0;
+
+		for (auto&& folder : folders_)
+		{
+			depth = std::max(depth, folder.depth);
+		}
+
+		return depth;
+	}
+
+	size_t SyntheticLibrary::LocalImageCount() const noexcept
+	{
+		return static_cast<size_t>(std::count_if(files_.begin(), files_.end(), [](SyntheticFile const& file)
+		{
+			return file.format != ImageFormat::Unknown && !file.remote;
+		}));
+	}
+
+	void SyntheticLibrary::WriteTo(std::filesystem::path const& root) const
+	{
+		for (auto&& folder : folders_)
+		{
+			std::filesystem::create_directories(root / std::filesystem::u8path(folder.path));
+		}
+
+		for (auto&& file : files_)
+		{
+			const auto path = root / std::filesystem::u8path(file.path);
+			const auto header = FileHeader(file);
+
+			{
+				std::ofstream output(path, std::ios::binary | std::ios::trunc);
+
+				if (!output)
+				{
+					throw std::runtime_error("cannot create " + path.u8string());
+				}
+
+				output.write(reinterpret_cast<char const*>(header.data()), static_cast<std::streamsize>(std::min<uint64_t>(header.size(), file.size_bytes)));
+			}
+
+			std::filesystem::resize_file(path, file.size_bytes);
+		}
+	}
+
+	std::vector<uint8_t> SyntheticLibrary::FileHeader(SyntheticFile const& file)
+	{
+		std::vector<uint8_t> bytes;
+
+		switch (file.format)
+		{
+		case ImageFormat::Jpeg:
+			bytes = jpeg_header(file);
+			break;
+		case ImageFormat::Png:
+			bytes = png_header(file);
+			break;
+		case ImageFormat::Gif:
+			bytes = gif_header(file);
+			break;
+		default:
+			// 非图片文件
+			bytes.assign({ 0x00, 0x00, 0x00, 0x18, 'f', 't', 'y', 'p' });
+			break;
+		}
+
+		if (file.corrupt)
+		{
+			// 下载中断或者磁盘损坏：保留签名，后面的字节被破坏
+			random rng(hash(file.path));
+
+			for (size_t i = 4; i < bytes.size(); i++)
+			{
+				bytes[i] = static_cast<uint8_t>(rng.below(256));
+			}
+
+			bytes.resize(std::min<size_t>(bytes.size(), 24));
+		}
+
+		return bytes;
+	}
+
+	SyntheticFile const& SyntheticLibrary::find_file(std::string const& path) const
+	{
+		const auto found = file_index_.find(path);
+
+		if (found == file_index_.end())
+		{
+			throw std::runtime_error("no such file: " + path);
+		}
+
+		return files_[found->second];
+	}
+}
@@ -0,0 +1,131 @@
+﻿/*
+ * 合成图库（与平台无关）
+ *
+ * 按真实图库的分布生成任意数量的虚拟图片：目录深度、每个目录的文件数、格式、尺寸和文件大小，
+ * 以及少量非图片文件、损坏的文件和不在本机的文件。同样的参数总是生成同样的图库。
+ * 可以直接在内存中作为提供者使用，也可以写到磁盘上再用 DiskLibrary 读取。
+ */
+
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "LibraryProvider.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 合成图库的参数
+	/// </summary>
+	struct SyntheticLibraryOptions
+	{
+		// 文件总数，包括非图片文件
+		size_t file_count{ 10000 };
+		uint64_t seed{ 1 };
+		// 每个目录平均的文件数
+		double files_per_folder{ 60 };
+		// 最大目录深度，根目录为 0
+		uint32_t max_depth{ 8 };
+		// 非图片文件（视频、文本等）的比例，扫描时会被过滤掉
+		double other_fraction{ .03 };
+		// 文件头损坏的图片比例
+		double corrupt_fraction{ .005 };
+		// 不在本机（OneDrive 等）的图片比例
+		double remote_fraction{ 0 };
+		// 带标题的图片比例
+		double titled_fraction{ .1 };
+		// EXIF 中带内嵌略缩图的 JPEG 比例
+		double exif_thumbnail_fraction{ .9 };
+		// 每次读取图片属性的额外延迟，模拟属性系统的开销
+		std::chrono::microseconds property_latency{ 0 };
+		// 每次列出目录的额外延迟，模拟 GetItemsAsync 等待 I/O 的时间，等待时不占用 CPU
+		std::chrono::microseconds list_latency{ 0 };
+	};
+
+	/// <summary>
+	/// 合成图库中的一个文件
+	/// </summary>
+	struct SyntheticFile
+	{
+		std::string path;
+		// 非图片文件为 Unknown
+		ImageFormat format{ ImageFormat::Unknown };
+		uint32_t width{ 0 };
+		uint32_t height{ 0 };
+		uint64_t size_bytes{ 0 };
+		int64_t modified_time{ 0 };
+		std::string title;
+		bool corrupt{ false };
+		bool remote{ false };
+		// JPEG 的 EXIF 方向和是否带内嵌略缩图
+		uint16_t orientation{ 1 };
+		bool exif_thumbnail{ false };
+	};
+
+	/// <summary>
+	/// 内存中的合成图库。构造之后只读，可以被多个线程同时访问
+	/// </summary>
+	class SyntheticLibrary final : public LibraryProvider
+	{
+	public:
+		explicit SyntheticLibrary(SyntheticLibraryOptions const& options);
+
+		std::vector<FileEntry> ListFolder(std::string const& folder) const override;
+		size_t ReadBytes(std::string const& path, uint64_t offset, uint8_t* buffer, size_t size) const override;
+		ImageInfo ReadImageInfo(std::string const& path) const override;
+		bool IsLocal(std::string const& path) const override;
+
+		[[nodiscard]] std::vector<SyntheticFile> const& Files() const noexcept
+		{
+			return files_;
+		}
+
+		[[nodiscard]] size_t FolderCount() const noexcept
+		{
+			return folders_.size();
+		}
+
+		/// <summary>
+		/// 实际生成的最大目录深度
+		/// </summary>
+		[[nodiscard]] uint32_t Depth() const noexcept;
+
+		/// <summary>
+		/// 扫描后应当得到的图片数：本机的 .jpg、.png、.gif 文件，包括损坏的文件
+		/// </summary>
+		[[nodiscard]] size_t LocalImageCount() const noexcept;
+
+		/// <summary>
+		/// 把图库写到磁盘目录中。文件只写入文件头，其余部分是稀疏的空洞，大小与合成的大小一致
+		/// </summary>
+		/// <param name="root">目标目录，不存在时创建</param>
+		void WriteTo(std::filesystem::path const& root) const;
+
+		/// <summary>
+		/// 文件开头的字节，之后的内容都是 0
+		/// </summary>
+		static std::vector<uint8_t> FileHeader(SyntheticFile const& file);
+
+	private:
+		struct Folder
+		{
+			std::string path;
+			uint32_t depth{ 0 };
+			std::vector<uint32_t> folders;
+			std::vector<uint32_t> files;
+		};
+
+		SyntheticFile const& find_file(std::string const& path) const;
+
+		std::chrono::microseconds property_latency_;
+		std::chrono::microseconds list_latency_;
+		std::vector<Folder> folders_;
+		std::vector<SyntheticFile> files_;
+		std::unordered_map<std::string, uint32_t> folder_index_;
+		std::unordered_map<std::string, uint32_t> file_index_;
+	};
+}
@@ -0,0 +1,192 @@
+﻿/*
+ * 数据并行线程池代码
+ */
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <exception>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		// 当前线程是否正在执行池内任务，用于避免嵌套调用死锁
+		thread_local bool inside_pool = false;
+	}
+
+	ThreadPool::ThreadPool(size_t thread_count)
+	{
+		thread_count = std::max<size_t>(thread_count, 1);
+		workers_.reserve(thread_count - 1);
+
+		for (size_t i = 1; i < thread_count; i++)
+		{
+			workers_.emplace_back([this] { worker_loop(); });
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+
+		wake_.notify_all();
+
+		for (auto&& worker : workers_)
+		{
+			worker.join();
+		}
+	}
+
+	void ThreadPool::ParallelFor(size_t count, Body const& body, size_t grain)
+	{
+		if (count == 0)
+		{
+			return;
+		}
+
+		grain = std::max<size_t>(grain, 1);
+		const auto chunk_count = (count + grain - 1) / grain;
+
+		// 只有一块、没有工作线程或者嵌套调用时直接执行
+		if (workers_.empty() || chunk_count == 1 || inside_pool)
+		{
+			body(0, count);
+			return;
+		}
+
+		std::lock_guard<std::mutex> run_lock(run_mutex_);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			body_ = &body;
+			count_ = count;
+			grain_ = grain;
+			chunk_count_ = chunk_count;
+			next_chunk_.store(0, std::memory_order_relaxed);
+			finished_chunks_.store(0, std::memory_order_relaxed);
+			error_ = nullptr;
+			generation_++;
+		}
+
+		wake_.notify_all();
+
+		// 调用线程也参与计算
+		inside_pool = true;
+		run_chunks(&body, count, grain, chunk_count);
+		inside_pool = false;
+
+		std::exception_ptr error;
+
+		{
+			// 等待所有块完成，并且所有工作线程都离开本次任务
+			std::unique_lock<std::mutex> lock(mutex_);
+			done_.wait(lock, [this] { return finished_chunks_.load() == chunk_count_ && active_workers_ == 0; });
+
+			body_ = nullptr;
+			error = error_;
+		}
+
+		if (error)
+		{
+			std::rethrow_exception(error);
+		}
+	}
+
+	ThreadPool& ThreadPool::Shared()
+	{
+		// 有意不释放，避免退出时等待工作线程
+		static auto* pool = new ThreadPool();
+		return *pool;
+	}
+
+	ThreadPool& ThreadPool::Inline()
+	{
+		static ThreadPool pool(1);
+		return pool;
+	}
+
+	void ThreadPool::worker_loop()
+	{
+		inside_pool = true;
+		uint64_t seen = 0;
+
+		for (;;)
+		{
+			Body const* body;
+			size_t count;
+			size_t grain;
+			size_t chunk_count;
+
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				wake_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+
+				if (stopping_)
+				{
+					return;
+				}
+
+				// 在锁内复制任务参数，任务已经结束时 body 为空
+				seen = generation_;
+				body = body_;
+				count = count_;
+				grain = grain_;
+				chunk_count = chunk_count_;
+				active_workers_++;
+			}
+
+			if (body)
+			{
+				run_chunks(body, count, grain, chunk_count);
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				active_workers_--;
+			}
+
+			done_.notify_all();
+		}
+	}
+
+	void ThreadPool::run_chunks(Body const* body, size_t count, size_t grain, size_t chunk_count)
+	{
+		for (;;)
+		{
+			const auto chunk = next_chunk_.fetch_add(1, std::memory_order_relaxed);
+
+			if (chunk >= chunk_count)
+			{
+				return;
+			}
+
+			const auto begin = chunk * grain;
+			const auto end = std::min(begin + grain, count);
+
+			try
+			{
+				(*body)(begin, end);
+			}
+			catch (...)
+			{
+				// 只保留第一个异常，其余块照常执行
+				std::lock_guard<std::mutex> lock(mutex_);
+
+				if (!error_)
+				{
+					error_ = std::current_exception();
+				}
+			}
+
+			if (finished_chunks_.fetch_add(1, std::memory_order_acq_rel) + 1 == chunk_count)
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				done_.notify_all();
+			}
+		}
+	}
+}
@@ -0,0 +1,101 @@
+﻿/*
+ * 数据并行线程池（与平台无关）
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 固定线程数的线程池，只提供 ParallelFor。
+	/// 调用线程也参与计算，所以 ThreadCount() 个线程中有一个是调用者。
+	/// </summary>
+	class ThreadPool
+	{
+	public:
+		using Body = std::function<void(size_t begin, size_t end)>;
+
+		explicit ThreadPool(size_t thread_count = std::thread::hardware_concurrency());
+
+		ThreadPool(ThreadPool const&) = delete;
+		ThreadPool& operator=(ThreadPool const&) = delete;
+
+		~ThreadPool();
+
+		/// <summary>
+		/// 参与计算的线程数（包括调用线程）
+		/// </summary>
+		/// <returns>线程数</returns>
+		[[nodiscard]] size_t ThreadCount() const noexcept
+		{
+			return workers_.size() + 1;
+		}
+
+		/// <summary>
+		/// 把 [0, count) 按 grain 切块并行执行，返回时所有块都已完成。
+		/// 在池内线程上嵌套调用时直接在当前线程执行。
+		/// </summary>
+		/// <param name="count">元素个数</param>
+		/// <param name="body">处理 [begin, end) 的函数</param>
+		/// <param name="grain">每块的元素个数</param>
+		void ParallelFor(size_t count, Body const& body, size_t grain = 1);
+
+		/// <summary>
+		/// 同上，函数以引用包装为 Body，捕获较多变量的 lambda 也不会申请堆内存
+		/// </summary>
+		template <class Function, class = std::enable_if_t<!std::is_same_v<std::decay_t<Function>, Body>>>
+		void ParallelFor(size_t count, Function const& body, size_t grain = 1)
+		{
+			ParallelFor(count, Body(std::cref(body)), grain);
+		}
+
+		/// <summary>
+		/// 进程共享的线程池，线程数等于核心数
+		/// </summary>
+		/// <returns>线程池</returns>
+		static ThreadPool& Shared();
+
+		/// <summary>
+		/// 没有工作线程的线程池，ParallelFor 直接在调用线程上执行，不会等待其他调用者。
+		/// 用于界面线程上的小任务
+		/// </summary>
+		/// <returns>线程池</returns>
+		static ThreadPool& Inline();
+
+	private:
+		void worker_loop();
+		void run_chunks(Body const* body, size_t count, size_t grain, size_t chunk_count);
+
+		std::vector<std::thread> workers_;
+
+		// 同一时间只执行一个 ParallelFor
+		std::mutex run_mutex_;
+
+		std::mutex mutex_;
+		std::condition_variable wake_;
+		std::condition_variable done_;
+		uint64_t generation_{ 0 };
+		bool stopping_{ false };
+
+		// 当前任务
+		Body const* body_{ nullptr };
+		size_t count_{ 0 };
+		size_t grain_{ 1 };
+		std::atomic<size_t> next_chunk_{ 0 };
+		size_t chunk_count_{ 0 };
+		std::atomic<size_t> finished_chunks_{ 0 };
+		size_t active_workers_{ 0 };
+		std::exception_ptr error_{};
+	};
+}
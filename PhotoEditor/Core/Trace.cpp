@@ -0,0 +1,293 @@
+﻿/*
+ * 性能追踪代码
+ */
+
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace PhotoCore::Trace
+{
+	namespace detail
+	{
+		std::atomic<bool> enabled{ false };
+	}
+
+	namespace
+	{
+		// 每个线程最多保留的事件数，写满后覆盖最旧的事件
+		constexpr size_t ring_capacity = 1 << 15;
+
+		/// <summary>
+		/// 单个线程的环形缓冲区。只有所属线程写入，导出时加锁读取
+		/// </summary>
+		struct ThreadBuffer
+		{
+			std::mutex mutex;
+			std::vector<Event> events;
+			size_t next{ 0 };
+			bool wrapped{ false };
+			uint32_t thread_id{ 0 };
+			std::string thread_name;
+			// 所属线程已经退出，导出或清空之后从登记表中删除
+			bool exited{ false };
+		};
+
+		/// <summary>
+		/// 所有线程缓冲区的登记表。线程退出后缓冲区保留到下一次导出或清空，之后释放，
+		/// 系统线程池中用过又退出的线程不会一直占着缓冲区
+		/// </summary>
+		struct Registry
+		{
+			std::mutex mutex;
+			std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+			uint32_t next_thread_id{ 1 };
+		};
+
+		Registry& registry()
+		{
+			// 有意不释放，其它线程退出时仍可能访问
+			static auto* instance = new Registry();
+			return *instance;
+		}
+
+		/// <summary>
+		/// 线程持有的缓冲区，线程退出时标记为已退出
+		/// </summary>
+		struct BufferOwner
+		{
+			std::shared_ptr<ThreadBuffer> buffer;
+
+			BufferOwner()
+			{
+				buffer = std::make_shared<ThreadBuffer>();
+				buffer->events.resize(ring_capacity);
+
+				auto& reg = registry();
+				std::lock_guard<std::mutex> lock(reg.mutex);
+				buffer->thread_id = reg.next_thread_id++;
+				reg.buffers.push_back(buffer);
+			}
+
+			BufferOwner(BufferOwner const&) = delete;
+			BufferOwner& operator=(BufferOwner const&) = delete;
+
+			~BufferOwner()
+			{
+				std::lock_guard<std::mutex> lock(buffer->mutex);
+				buffer->exited = true;
+			}
+		};
+
+		ThreadBuffer& current_buffer()
+		{
+			thread_local BufferOwner owner;
+			return *owner.buffer;
+		}
+
+		/// <summary>
+		/// 删除满足条件的缓冲区，调用时必须持有登记表的锁
+		/// </summary>
+		template <class Predicate>
+		void release_buffers(Registry& reg, Predicate const& predicate)
+		{
+			reg.buffers.erase(std::remove_if(reg.buffers.begin(), reg.buffers.end(), predicate), reg.buffers.end());
+		}
+
+		std::atomic<uint64_t> next_id{ 1 };
+
+		void write_string(std::ostream& output, char const* text)
+		{
+			output << '"';
+
+			for (auto c = text; c && *c; ++c)
+			{
+				switch (*c)
+				{
+				case '"':
+					output << "\\\"";
+					break;
+				case '\\':
+					output << "\\\\";
+					break;
+				default:
+					if (static_cast<unsigned char>(*c) >= 0x20)
+					{
+						output << *c;
+					}
+					break;
+				}
+			}
+
+			output << '"';
+		}
+
+		void write_event(std::ostream& output, Event const& event, uint32_t thread_id)
+		{
+			output << "{\"name\":";
+			write_string(output, event.name);
+			output << ",\"ph\":\"" << static_cast<char>(event.phase) << "\""
+				<< ",\"ts\":" << static_cast<double>(event.timestamp_ns) / 1000.0
+				<< ",\"pid\":1,\"tid\":" << thread_id;
+
+			switch (event.phase)
+			{
+			case Phase::Complete:
+				output << ",\"dur\":" << static_cast<double>(event.duration_ns) / 1000.0;
+				if (event.flow_id != 0)
+				{
+					// 流 v2：同一个 bind_id 的切片之间用箭头连接
+					output << ",\"bind_id\":\"0x" << std::hex << event.flow_id << std::dec << "\",\"flow_in\":true,\"flow_out\":true";
+				}
+				break;
+			case Phase::AsyncBegin:
+			case Phase::AsyncEnd:
+				output << ",\"cat\":\"async\",\"id\":\"0x" << std::hex << event.id << std::dec << "\"";
+				break;
+			case Phase::Counter:
+				output << ",\"args\":{\"value\":" << event.value << "}";
+				break;
+			}
+
+			output << "}";
+		}
+	}
+
+	void Enable(bool value) noexcept
+	{
+		detail::enabled.store(value, std::memory_order_relaxed);
+	}
+
+	uint64_t Now() noexcept
+	{
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+	uint64_t NewId() noexcept
+	{
+		return next_id.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void Record(Event const& event) noexcept
+	{
+		auto& buffer = current_buffer();
+		std::lock_guard<std::mutex> lock(buffer.mutex);
+
+		buffer.events[buffer.next] = event;
+
+		if (++buffer.next == buffer.events.size())
+		{
+			buffer.next = 0;
+			buffer.wrapped = true;
+		}
+	}
+
+	void SetThreadName(char const* name) noexcept
+	{
+		auto& buffer = current_buffer();
+		std::lock_guard<std::mutex> lock(buffer.mutex);
+		buffer.thread_name = name;
+	}
+
+	void Clear() noexcept
+	{
+		auto& reg = registry();
+		std::lock_guard<std::mutex> registry_lock(reg.mutex);
+
+		for (auto&& buffer : reg.buffers)
+		{
+			std::lock_guard<std::mutex> lock(buffer->mutex);
+			buffer->next = 0;
+			buffer->wrapped = false;
+		}
+
+		// 已退出线程的缓冲区不会再写入，直接释放
+		release_buffers(reg, [](std::shared_ptr<ThreadBuffer> const& buffer)
+		{
+			std::lock_guard<std::mutex> lock(buffer->mutex);
+			return buffer->exited;
+		});
+	}
+
+	void WriteChromeJson(std::ostream& output)
+	{
+		// 先复制缓冲区列表，导出时不阻塞新线程的登记
+		std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+		{
+			auto& reg = registry();
+			std::lock_guard<std::mutex> lock(reg.mutex);
+			buffers = reg.buffers;
+		}
+
+		// 时间戳以微秒输出，保留到纳秒
+		const auto flags = output.flags();
+		const auto precision = output.precision();
+		output << std::fixed << std::setprecision(3);
+
+		output << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		auto first = true;
+
+		const auto separator = [&]
+		{
+			if (!first)
+			{
+				output << ",\n";
+			}
+			first = false;
+		};
+
+		// 导出时已经退出的线程，事件已经全部写出
+		std::vector<ThreadBuffer const*> exported;
+
+		for (auto&& buffer : buffers)
+		{
+			std::lock_guard<std::mutex> lock(buffer->mutex);
+
+			if (buffer->exited)
+			{
+				exported.push_back(buffer.get());
+			}
+
+			if (!buffer->thread_name.empty())
+			{
+				separator();
+				output << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->thread_id << ",\"args\":{\"name\":";
+				write_string(output, buffer->thread_name.c_str());
+				output << "}}";
+			}
+
+			// 按时间顺序输出：写满过时从最旧的位置开始
+			const auto count = buffer->wrapped ? buffer->events.size() : buffer->next;
+			const auto begin = buffer->wrapped ? buffer->next : 0;
+
+			for (size_t i = 0; i < count; i++)
+			{
+				separator();
+				write_event(output, buffer->events[(begin + i) % buffer->events.size()], buffer->thread_id);
+			}
+		}
+
+		output << "]}\n";
+
+		output.flags(flags);
+		output.precision(precision);
+
+		// 释放已经导出的、已退出线程的缓冲区
+		if (!exported.empty())
+		{
+			auto& reg = registry();
+			std::lock_guard<std::mutex> lock(reg.mutex);
+			release_buffers(reg, [&](std::shared_ptr<ThreadBuffer> const& buffer)
+			{
+				return std::find(exported.begin(), exported.end(), buffer.get()) != exported.end();
+			});
+		}
+	}
+}
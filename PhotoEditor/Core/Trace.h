@@ -0,0 +1,225 @@
+﻿/*
+ * 性能追踪（与平台无关）
+ *
+ * 定义 PHOTOEDITOR_TRACE 时启用，未定义时所有 PE_TRACE_* 宏展开为空，没有任何开销。
+ * 启用后事件记录到每个线程自己的环形缓冲区，可随时导出为 Chrome / Perfetto 的 JSON 格式。
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+namespace PhotoCore::Trace
+{
+	/// <summary>
+	/// 事件类型，取值与 Chrome trace 的 ph 字段一致
+	/// </summary>
+	enum class Phase : char
+	{
+		Complete = 'X',
+		AsyncBegin = 'b',
+		AsyncEnd = 'e',
+		Counter = 'C'
+	};
+
+	/// <summary>
+	/// 单个追踪事件。名称必须是静态字符串
+	/// </summary>
+	struct Event
+	{
+		char const* name{ nullptr };
+		uint64_t timestamp_ns{ 0 };
+		uint64_t duration_ns{ 0 };
+		// 异步事件的 id
+		uint64_t id{ 0 };
+		// 跨线程流的 id，0 表示不属于任何流
+		uint64_t flow_id{ 0 };
+		double value{ 0 };
+		Phase phase{ Phase::Complete };
+	};
+
+	namespace detail
+	{
+		extern std::atomic<bool> enabled;
+	}
+
+	/// <summary>
+	/// 运行时开关
+	/// </summary>
+	/// <returns>是否正在记录</returns>
+	inline bool IsEnabled() noexcept
+	{
+		return detail::enabled.load(std::memory_order_relaxed);
+	}
+
+	void Enable(bool value) noexcept;
+
+	/// <summary>
+	/// 单调时钟，纳秒
+	/// </summary>
+	uint64_t Now() noexcept;
+
+	/// <summary>
+	/// 分配新的异步或者流 id
+	/// </summary>
+	uint64_t NewId() noexcept;
+
+	/// <summary>
+	/// 记录事件到当前线程的环形缓冲区
+	/// </summary>
+	void Record(Event const& event) noexcept;
+
+	/// <summary>
+	/// 设置当前线程在追踪文件中显示的名称
+	/// </summary>
+	void SetThreadName(char const* name) noexcept;
+
+	/// <summary>
+	/// 丢弃所有线程已记录的事件
+	/// </summary>
+	void Clear() noexcept;
+
+	/// <summary>
+	/// 导出所有线程的事件为 Chrome trace JSON
+	/// </summary>
+	/// <param name="output">输出流</param>
+	void WriteChromeJson(std::ostream& output);
+
+	/// <summary>
+	/// 同步代码块的耗时，析构时记录
+	/// </summary>
+	class ScopedSpan
+	{
+	public:
+		explicit ScopedSpan(char const* name, uint64_t flow_id = 0) noexcept :
+			name_(name),
+			flow_id_(flow_id),
+			start_(IsEnabled() ? Now() : 0)
+		{
+		}
+
+		ScopedSpan(ScopedSpan const&) = delete;
+		ScopedSpan& operator=(ScopedSpan const&) = delete;
+
+		~ScopedSpan()
+		{
+			if (start_ != 0 && IsEnabled())
+			{
+				Event event{};
+				event.name = name_;
+				event.timestamp_ns = start_;
+				event.duration_ns = Now() - start_;
+				event.flow_id = flow_id_;
+				event.phase = Phase::Complete;
+				Record(event);
+			}
+		}
+
+	private:
+		char const* name_;
+		uint64_t flow_id_;
+		uint64_t start_;
+	};
+
+	/// <summary>
+	/// 协程的耗时。开始和结束可能在不同线程上，用异步事件对记录，可以跨越 co_await
+	/// </summary>
+	class AsyncSpan
+	{
+	public:
+		explicit AsyncSpan(char const* name) noexcept :
+			name_(name),
+			id_(IsEnabled() ? NewId() : 0)
+		{
+			emit(Phase::AsyncBegin);
+		}
+
+		AsyncSpan(AsyncSpan const&) = delete;
+		AsyncSpan& operator=(AsyncSpan const&) = delete;
+
+		~AsyncSpan()
+		{
+			emit(Phase::AsyncEnd);
+		}
+
+	private:
+		void emit(Phase phase) const noexcept
+		{
+			if (id_ != 0 && IsEnabled())
+			{
+				Event event{};
+				event.name = name_;
+				event.timestamp_ns = Now();
+				event.id = id_;
+				event.phase = phase;
+				Record(event);
+			}
+		}
+
+		char const* name_;
+		uint64_t id_;
+	};
+
+	/// <summary>
+	/// 记录计数器的当前值
+	/// </summary>
+	inline void Counter(char const* name, double value) noexcept
+	{
+		if (IsEnabled())
+		{
+			Event event{};
+			event.name = name;
+			event.timestamp_ns = Now();
+			event.value = value;
+			event.phase = Phase::Counter;
+			Record(event);
+		}
+	}
+
+	/// <summary>
+	/// 在当前线程上标记流经过的点，导出后用箭头连接同一 id 的所有点
+	/// </summary>
+	inline void FlowStep(char const* name, uint64_t flow_id) noexcept
+	{
+		if (flow_id != 0 && IsEnabled())
+		{
+			Event event{};
+			event.name = name;
+			event.timestamp_ns = Now();
+			event.flow_id = flow_id;
+			event.phase = Phase::Complete;
+			Record(event);
+		}
+	}
+}
+
+#define PE_TRACE_CONCAT_INNER(a, b) a##b
+#define PE_TRACE_CONCAT(a, b) PE_TRACE_CONCAT_INNER(a, b)
+
+#ifdef PHOTOEDITOR_TRACE
+
+// 同步代码块
+#define PE_TRACE_SCOPE(name) ::PhotoCore::Trace::ScopedSpan PE_TRACE_CONCAT(pe_trace_scope_, __LINE__){ name }
+// 同步代码块，同时作为流的一个节点
+#define PE_TRACE_SCOPE_FLOW(name, flow_id) ::PhotoCore::Trace::ScopedSpan PE_TRACE_CONCAT(pe_trace_scope_, __LINE__){ name, flow_id }
+// 协程，跨越挂起点
+#define PE_TRACE_ASYNC_SCOPE(name) ::PhotoCore::Trace::AsyncSpan PE_TRACE_CONCAT(pe_trace_async_, __LINE__){ name }
+#define PE_TRACE_COUNTER(name, value) ::PhotoCore::Trace::Counter(name, static_cast<double>(value))
+#define PE_TRACE_NEW_FLOW_ID() (::PhotoCore::Trace::IsEnabled() ? ::PhotoCore::Trace::NewId() : uint64_t{ 0 })
+#define PE_TRACE_FLOW_STEP(name, flow_id) ::PhotoCore::Trace::FlowStep(name, flow_id)
+#define PE_TRACE_THREAD_NAME(name) ::PhotoCore::Trace::SetThreadName(name)
+
+#else
+
+// sizeof 不求值参数，只是避免未使用变量的警告
+#define PE_TRACE_SCOPE(name) ((void)0)
+#define PE_TRACE_SCOPE_FLOW(name, flow_id) ((void)sizeof(flow_id))
+#define PE_TRACE_ASYNC_SCOPE(name) ((void)0)
+#define PE_TRACE_COUNTER(name, value) ((void)sizeof(name), (void)sizeof(value))
+#define PE_TRACE_NEW_FLOW_ID() (uint64_t{ 0 })
+#define PE_TRACE_FLOW_STEP(name, flow_id) ((void)sizeof(flow_id))
+#define PE_TRACE_THREAD_NAME(name) ((void)0)
+
+#endif
@@ -0,0 +1,330 @@
+﻿/*
+ * 标题和文件名的子串搜索代码
+ */
+
+#include "TrigramIndex.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <string>
+
+namespace PhotoCore
+{
+	namespace
+	{
+		// 哈希表每个节点的额外开销（估计值）
+		constexpr size_t node_overhead = 48;
+
+		unsigned char fold_case(char c) noexcept
+		{
+			const auto byte = static_cast<unsigned char>(c);
+			return byte >= 'A' && byte <= 'Z' ? static_cast<unsigned char>(byte - 'A' + 'a') : byte;
+		}
+
+		std::string fold(std::string_view value)
+		{
+			std::string folded(value.size(), '\0');
+
+			for (size_t i = 0; i < value.size(); i++)
+			{
+				folded[i] = static_cast<char>(fold_case(value[i]));
+			}
+
+			return folded;
+		}
+
+		/// <summary>
+		/// 收集忽略大小写之后的所有三元组，不去重
+		/// </summary>
+		void collect_trigrams(std::string_view text, std::vector<uint32_t>& trigrams)
+		{
+			if (text.size() < 3)
+			{
+				return;
+			}
+
+			for (size_t i = 0; i + 3 <= text.size(); i++)
+			{
+				trigrams.push_back(static_cast<uint32_t>(fold_case(text[i])) << 16
+					| static_cast<uint32_t>(fold_case(text[i + 1])) << 8
+					| fold_case(text[i + 2]));
+			}
+		}
+
+		/// <summary>
+		/// text 忽略大小写之后是否包含已经转为小写的 folded_query
+		/// </summary>
+		bool contains_folded(std::string_view text, std::string_view folded_query) noexcept
+		{
+			if (folded_query.size() > text.size())
+			{
+				return false;
+			}
+
+			const auto first = static_cast<unsigned char>(folded_query[0]);
+
+			for (size_t i = 0; i + folded_query.size() <= text.size(); i++)
+			{
+				if (fold_case(text[i]) != first)
+				{
+					continue;
+				}
+
+				size_t j = 1;
+
+				while (j < folded_query.size() && fold_case(text[i + j]) == static_cast<unsigned char>(folded_query[j]))
+				{
+					j++;
+				}
+
+				if (j == folded_query.size())
+				{
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		void write_varint(std::vector<uint8_t>& bytes, uint32_t value)
+		{
+			while (value >= 0x80)
+			{
+				bytes.push_back(static_cast<uint8_t>(value | 0x80));
+				value >>= 7;
+			}
+
+			bytes.push_back(static_cast<uint8_t>(value));
+		}
+
+		uint32_t read_varint(uint8_t const*& p) noexcept
+		{
+			uint32_t value = 0;
+			int shift = 0;
+
+			while (*p & 0x80)
+			{
+				value |= static_cast<uint32_t>(*p++ & 0x7f) << shift;
+				shift += 7;
+			}
+
+			return value | static_cast<uint32_t>(*p++) << shift;
+		}
+	}
+
+	void TrigramIndex::Update()
+	{
+		const auto end = catalog_.Size();
+
+		if (end == indexed_)
+		{
+			return;
+		}
+
+		PE_TRACE_SCOPE("TrigramIndex::Update");
+
+		std::vector<uint32_t> trigrams;
+
+		for (auto id = indexed_; id < end; id++)
+		{
+			add_document(static_cast<PhotoId>(id), trigrams);
+		}
+
+		indexed_ = end;
+	}
+
+	void TrigramIndex::TitleChanged(PhotoId id)
+	{
+		if (id >= indexed_)
+		{
+			return;
+		}
+
+		// 新标题的三元组插入到列表中间；旧的留在原处，由核对排除
+		std::vector<uint32_t> trigrams;
+		add_document(id, trigrams);
+		has_stale_ = true;
+	}
+
+	std::vector<PhotoId> TrigramIndex::Search(std::string_view query) const
+	{
+		PE_TRACE_SCOPE("TrigramIndex::Search");
+
+		std::vector<PhotoId> result;
+
+		if (query.empty())
+		{
+			return result;
+		}
+
+		const auto folded = fold(query);
+
+		// 不到三个字节时没有三元组可用，直接逐个核对
+		if (folded.size() < 3)
+		{
+			for (size_t id = 0; id < indexed_; id++)
+			{
+				if (contains(static_cast<PhotoId>(id), folded))
+				{
+					result.push_back(static_cast<PhotoId>(id));
+				}
+			}
+
+			return result;
+		}
+
+		std::vector<uint32_t> trigrams;
+		collect_trigrams(folded, trigrams);
+		std::sort(trigrams.begin(), trigrams.end());
+		trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+
+		std::vector<posting_list const*> lists;
+
+		for (auto trigram : trigrams)
+		{
+			const auto found = postings_.find(trigram);
+
+			if (found == postings_.end())
+			{
+				return result;
+			}
+
+			lists.push_back(&found->second);
+		}
+
+		// 从最短的列表开始求交集，候选越来越少
+		std::sort(lists.begin(), lists.end(), [](auto left, auto right)
+		{
+			return left->count < right->count;
+		});
+
+		decode(*lists.front(), result);
+
+		for (size_t i = 1; i < lists.size() && !result.empty(); i++)
+		{
+			// 边解码边和候选比较，不展开整个列表
+			auto const& list = *lists[i];
+			auto const* p = list.bytes.data();
+			auto const* const end = p + list.bytes.size();
+			PhotoId current = 0;
+			size_t kept = 0;
+			size_t candidate = 0;
+
+			while (p < end && candidate < result.size())
+			{
+				current += read_varint(p);
+
+				while (candidate < result.size() && result[candidate] < current)
+				{
+					candidate++;
+				}
+
+				if (candidate < result.size() && result[candidate] == current)
+				{
+					result[kept++] = current;
+					candidate++;
+				}
+			}
+
+			result.resize(kept);
+		}
+
+		// 正好三个字节、又没有过期项时，列表就是准确的结果
+		if (folded.size() > 3 || has_stale_)
+		{
+			result.erase(std::remove_if(result.begin(), result.end(), [&](PhotoId id)
+			{
+				return !contains(id, folded);
+			}), result.end());
+		}
+
+		return result;
+	}
+
+	size_t TrigramIndex::MemoryBytes() const noexcept
+	{
+		auto bytes = postings_.bucket_count() * sizeof(void*);
+
+		for (auto&& [trigram, list] : postings_)
+		{
+			bytes += node_overhead + list.bytes.capacity();
+		}
+
+		return bytes;
+	}
+
+	void TrigramIndex::add_document(PhotoId id, std::vector<uint32_t>& trigrams)
+	{
+		trigrams.clear();
+		collect_trigrams(catalog_.FileName(id), trigrams);
+		collect_trigrams(catalog_.Title(id), trigrams);
+
+		std::sort(trigrams.begin(), trigrams.end());
+		trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+
+		for (auto trigram : trigrams)
+		{
+			auto& list = postings_[trigram];
+
+			if (list.count == 0 || id > list.last)
+			{
+				append(list, id);
+			}
+			else
+			{
+				insert(list, id);
+			}
+		}
+	}
+
+	bool TrigramIndex::contains(PhotoId id, std::string_view folded_query) const
+	{
+		return contains_folded(catalog_.FileName(id), folded_query) || contains_folded(catalog_.Title(id), folded_query);
+	}
+
+	void TrigramIndex::append(posting_list& list, PhotoId id)
+	{
+		write_varint(list.bytes, list.count == 0 ? id : id - list.last);
+		list.last = id;
+		list.count++;
+	}
+
+	void TrigramIndex::decode(posting_list const& list, std::vector<PhotoId>& ids)
+	{
+		ids.clear();
+		ids.reserve(list.count);
+
+		auto const* p = list.bytes.data();
+		auto const* const end = p + list.bytes.size();
+		PhotoId current = 0;
+
+		while (p < end)
+		{
+			current += read_varint(p);
+			ids.push_back(current);
+		}
+	}
+
+	void TrigramIndex::insert(posting_list& list, PhotoId id)
+	{
+		std::vector<PhotoId> ids;
+		decode(list, ids);
+
+		const auto position = std::lower_bound(ids.begin(), ids.end(), id);
+
+		if (position != ids.end() && *position == id)
+		{
+			return;
+		}
+
+		ids.insert(position, id);
+
+		// 插入在中间，整个列表重新编码
+		list = {};
+
+		for (auto value : ids)
+		{
+			append(list, value);
+		}
+	}
+}
@@ -0,0 +1,97 @@
+﻿/*
+ * 标题和文件名的子串搜索（与平台无关）
+ *
+ * 对每张照片的文件名和标题（忽略 ASCII 大小写）取所有连续 3 个字节作为三元组，
+ * 每个三元组记录包含它的照片 ID，按 ID 递增以差值变长编码压缩保存。
+ * 搜索时取查询中各个三元组的列表求交集，再逐个核对候选照片确实包含查询字符串。
+ * 按字节处理，UTF-8 的中文标题同样适用。
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "PhotoCatalog.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 三元组倒排索引。只能和目录在同一个线程上使用
+	/// </summary>
+	class TrigramIndex
+	{
+	public:
+		explicit TrigramIndex(PhotoCatalog const& catalog) noexcept :
+			catalog_(catalog)
+		{
+		}
+
+		/// <summary>
+		/// 把目录中新加入的照片加入索引
+		/// </summary>
+		void Update();
+
+		/// <summary>
+		/// 照片的标题改变之后调用。旧标题的三元组不删除，搜索时核对会排除
+		/// </summary>
+		/// <param name="id">照片 ID</param>
+		void TitleChanged(PhotoId id);
+
+		/// <summary>
+		/// 搜索文件名或者标题包含 query 的照片，忽略 ASCII 大小写
+		/// </summary>
+		/// <param name="query">查询字符串，为空时返回空</param>
+		/// <returns>按 ID 递增的照片 ID</returns>
+		[[nodiscard]] std::vector<PhotoId> Search(std::string_view query) const;
+
+		/// <summary>
+		/// 已经加入索引的照片数
+		/// </summary>
+		[[nodiscard]] size_t Size() const noexcept
+		{
+			return indexed_;
+		}
+
+		/// <summary>
+		/// 不同的三元组个数
+		/// </summary>
+		[[nodiscard]] size_t TrigramCount() const noexcept
+		{
+			return postings_.size();
+		}
+
+		/// <summary>
+		/// 占用的内存字节数（估计值）
+		/// </summary>
+		[[nodiscard]] size_t MemoryBytes() const noexcept;
+
+	private:
+		/// <summary>
+		/// 一个三元组的 ID 列表：每项是与上一项的差值，以 7 位一组的变长整数保存
+		/// </summary>
+		struct posting_list
+		{
+			std::vector<uint8_t> bytes;
+			PhotoId last{ 0 };
+			uint32_t count{ 0 };
+		};
+
+		PhotoCatalog const& catalog_;
+		size_t indexed_{ 0 };
+		std::unordered_map<uint32_t, posting_list> postings_;
+
+		// 标题改变过以后，列表中可能有已经不包含该三元组的照片，这时三个字节的查询也需要核对
+		bool has_stale_{ false };
+
+		void add_document(PhotoId id, std::vector<uint32_t>& trigrams);
+		[[nodiscard]] bool contains(PhotoId id, std::string_view folded_query) const;
+
+		static void append(posting_list& list, PhotoId id);
+		static void decode(posting_list const& list, std::vector<PhotoId>& ids);
+		static void insert(posting_list& list, PhotoId id);
+	};
+}
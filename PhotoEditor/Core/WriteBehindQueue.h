@@ -0,0 +1,289 @@
+﻿/*
+ * 延迟合并写入队列（与平台无关）
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Trace.h"
+
+namespace PhotoCore
+{
+	/// <summary>
+	/// 写入队列计数器快照
+	/// </summary>
+	struct WriteBehindCounters
+	{
+		// 等待写入的键数
+		size_t pending{ 0 };
+		// 出现过的最大批次
+		size_t max_batch{ 0 };
+
+		uint64_t submitted{ 0 };
+		// 被同一个键后来的值覆盖、没有写入的值
+		uint64_t coalesced{ 0 };
+		uint64_t written{ 0 };
+		uint64_t failed{ 0 };
+		uint64_t batches{ 0 };
+	};
+
+	/// <summary>
+	/// 延迟写入队列。同一个键在写入之前多次提交只写最后一次的值；
+	/// 最后一次提交之后安静 debounce 时间（最长不超过第一次提交之后 max_delay）才开始一批写入，
+	/// 每批最多 max_batch 个键，按第一次提交的顺序在一个后台线程上依次写入。
+	/// 同一个键的写入不会并发，顺序和提交顺序一致。写入失败通过错误回调报告，每批写完之后调用批次回调，回调都在后台线程上调用。
+	/// </summary>
+	template <class Key, class Value, class Hash = std::hash<Key>>
+	class WriteBehindQueue
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+		using Writer = std::function<void(Key const&, Value const&)>;
+		using ErrorHandler = std::function<void(Key const&, std::exception_ptr)>;
+		using BatchHandler = std::function<void(size_t written, size_t failed)>;
+
+		WriteBehindQueue(Writer writer, ErrorHandler on_error,
+			clock::duration debounce = std::chrono::milliseconds(500),
+			clock::duration max_delay = std::chrono::seconds(2),
+			size_t max_batch = 64) :
+			writer_(std::move(writer)),
+			on_error_(std::move(on_error)),
+			debounce_(debounce),
+			max_delay_(std::max(max_delay, debounce)),
+			max_batch_(std::max<size_t>(max_batch, 1))
+		{
+			thread_ = std::thread([this] { writer_loop(); });
+		}
+
+		WriteBehindQueue(WriteBehindQueue const&) = delete;
+		WriteBehindQueue& operator=(WriteBehindQueue const&) = delete;
+
+		/// <summary>
+		/// 写完所有排队的值之后才返回
+		/// </summary>
+		~WriteBehindQueue()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stopping_ = true;
+			}
+
+			wake_.notify_all();
+			thread_.join();
+		}
+
+		/// <summary>
+		/// 提交写入，已经排队的同一个键直接替换值
+		/// </summary>
+		/// <param name="key">键，例如文件路径</param>
+		/// <param name="value">要写入的值</param>
+		void Submit(Key const& key, Value value)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				submitted_++;
+				last_submit_ = clock::now();
+
+				if (const auto found = pending_.find(key); found != pending_.end())
+				{
+					found->second = std::move(value);
+					coalesced_++;
+					return;
+				}
+
+				if (order_.empty())
+				{
+					first_submit_ = last_submit_;
+				}
+
+				pending_.emplace(key, std::move(value));
+				order_.push_back(key);
+				PE_TRACE_COUNTER("WriteBehindQueue.Pending", order_.size());
+			}
+
+			wake_.notify_one();
+		}
+
+		/// <summary>
+		/// 不再等待，立即写入所有排队的值，全部写完（包括正在写的一批）之后返回。
+		/// 不能在写入函数或者错误回调中调用
+		/// </summary>
+		void Flush()
+		{
+			PE_TRACE_SCOPE("WriteBehindQueue::Flush");
+
+			std::unique_lock<std::mutex> lock(mutex_);
+			flushing_++;
+			wake_.notify_all();
+
+			done_.wait(lock, [this] { return order_.empty() && in_flight_ == 0; });
+			flushing_--;
+		}
+
+		/// <summary>
+		/// 设置每批写完之后的回调，例如在有失败时通知界面
+		/// </summary>
+		/// <param name="handler">回调，参数是这一批成功和失败的个数</param>
+		void OnBatchWritten(BatchHandler handler)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			on_batch_ = std::move(handler);
+		}
+
+		/// <summary>
+		/// 获取计数器快照
+		/// </summary>
+		/// <returns>计数器</returns>
+		[[nodiscard]] WriteBehindCounters Counters() const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			WriteBehindCounters counters{};
+			counters.pending = order_.size();
+			counters.max_batch = max_batch_seen_;
+			counters.submitted = submitted_;
+			counters.coalesced = coalesced_;
+			counters.written = written_;
+			counters.failed = failed_;
+			counters.batches = batches_;
+			return counters;
+		}
+
+	private:
+		// 调用时必须持有锁
+		clock::time_point deadline() const
+		{
+			return std::min(last_submit_ + debounce_, first_submit_ + max_delay_);
+		}
+
+		void writer_loop()
+		{
+			PE_TRACE_THREAD_NAME("WriteBehindQueue writer");
+
+			std::vector<std::pair<Key, Value>> batch;
+			std::unique_lock<std::mutex> lock(mutex_);
+
+			for (;;)
+			{
+				wake_.wait(lock, [this] { return stopping_ || !order_.empty(); });
+
+				if (order_.empty())
+				{
+					return;
+				}
+
+				// 等到安静下来再写，期间的提交都会合并到这一批
+				while (!stopping_ && flushing_ == 0 && clock::now() < deadline())
+				{
+					wake_.wait_until(lock, deadline());
+				}
+
+				batch.clear();
+
+				while (!order_.empty() && batch.size() < max_batch_)
+				{
+					auto found = pending_.find(order_.front());
+					batch.emplace_back(found->first, std::move(found->second));
+					pending_.erase(found);
+					order_.pop_front();
+				}
+
+				in_flight_ = batch.size();
+				batches_++;
+				max_batch_seen_ = std::max(max_batch_seen_, batch.size());
+				PE_TRACE_COUNTER("WriteBehindQueue.Pending", order_.size());
+
+				lock.unlock();
+				write_batch(batch);
+				lock.lock();
+
+				in_flight_ = 0;
+				done_.notify_all();
+			}
+		}
+
+		void write_batch(std::vector<std::pair<Key, Value>> const& batch)
+		{
+			PE_TRACE_SCOPE("WriteBehindQueue::write_batch");
+
+			uint64_t written = 0;
+			uint64_t failed = 0;
+
+			for (auto&& [key, value] : batch)
+			{
+				try
+				{
+					writer_(key, value);
+					written++;
+				}
+				catch (...)
+				{
+					failed++;
+
+					if (on_error_)
+					{
+						on_error_(key, std::current_exception());
+					}
+				}
+			}
+
+			BatchHandler on_batch;
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				written_ += written;
+				failed_ += failed;
+				on_batch = on_batch_;
+			}
+
+			if (on_batch)
+			{
+				on_batch(static_cast<size_t>(written), static_cast<size_t>(failed));
+			}
+		}
+
+		Writer writer_;
+		ErrorHandler on_error_;
+		BatchHandler on_batch_;
+		const clock::duration debounce_;
+		const clock::duration max_delay_;
+		const size_t max_batch_;
+
+		mutable std::mutex mutex_;
+		std::condition_variable wake_;
+		std::condition_variable done_;
+		bool stopping_{ false };
+		size_t flushing_{ 0 };
+
+		// 等待写入的值，以及键第一次提交的顺序
+		std::unordered_map<Key, Value, Hash> pending_;
+		std::deque<Key> order_;
+		clock::time_point first_submit_;
+		clock::time_point last_submit_;
+		size_t in_flight_{ 0 };
+
+		// 计数器
+		size_t max_batch_seen_{ 0 };
+		uint64_t submitted_{ 0 };
+		uint64_t coalesced_{ 0 };
+		uint64_t written_{ 0 };
+		uint64_t failed_{ 0 };
+		uint64_t batches_{ 0 };
+
+		// 必须最后声明，保证后台线程启动时其它成员已构造
+		std::thread thread_;
+	};
+}
@@ -5,7 +5,15 @@
 // ReSharper disable CppExpressionWithoutSideEffects
 #include "pch.h"
 #include "DetailPage.h"
+#include "ImageLoader.h"
 #include "Photo.h"
+#include "Core/ExportJob.h"
+#include "Core/PngEncoder.h"
+#include "Core/ThreadPool.h"
+#include "Core/Trace.h"
+
+#include <algorithm>
+#include <optional>
 
 using namespace winrt;
 using namespace Microsoft::Graphics::Canvas;
@@ -33,6 +41,227 @@ using namespace Windows::UI::Xaml::Navigation;
 
 namespace winrt::PhotoEditor::implementation
 {
+	namespace
+	{
+		/// <summary>
+		/// 预览网格中 Tag 对应的效果标签
+		/// </summary>
+		/// <param name="tag">Tag 的取值</param>
+		/// <returns>效果标签，未知的取值为空</returns>
+		std::optional<PhotoCore::EffectTag> effect_tag_of(hstring const& tag)
+		{
+			if (tag == L"sepia")
+			{
+				return PhotoCore::EffectTag::Sepia;
+			}
+			else if (tag == L"invert")
+			{
+				return PhotoCore::EffectTag::Invert;
+			}
+			else if (tag == L"grayscale")
+			{
+				return PhotoCore::EffectTag::Grayscale;
+			}
+			else if (tag == L"blur")
+			{
+				return PhotoCore::EffectTag::Blur;
+			}
+			else if (tag == L"color")
+			{
+				return PhotoCore::EffectTag::Color;
+			}
+			else if (tag == L"light")
+			{
+				return PhotoCore::EffectTag::Light;
+			}
+
+			return std::nullopt;
+		}
+
+		/// <summary>
+		/// 照片当前的效果参数
+		/// </summary>
+		PhotoCore::EffectParameters parameters_of(PhotoEditor::Photo const& item)
+		{
+			PhotoCore::EffectParameters parameters;
+			parameters.exposure = item.Exposure();
+			parameters.temperature = item.Temperature();
+			parameters.tint = item.Tint();
+			parameters.contrast = item.Contrast();
+			parameters.saturation = item.Saturation();
+			parameters.blur_amount = item.BlurAmount();
+			parameters.intensity = item.Intensity();
+			return parameters;
+		}
+
+		/// <summary>
+		/// 与 Win2D 效果对应的 CPU 效果，参数取照片当前的值
+		/// </summary>
+		template <class Win2DEffect>
+		PhotoCore::Effect core_effect_of(Win2DEffect const&, PhotoCore::EffectParameters const& parameters)
+		{
+			if constexpr (std::is_same_v<Win2DEffect, ContrastEffect>) return PhotoCore::ContrastEffect{ parameters.contrast };
+			else if constexpr (std::is_same_v<Win2DEffect, ExposureEffect>) return PhotoCore::ExposureEffect{ parameters.exposure };
+			else if constexpr (std::is_same_v<Win2DEffect, TemperatureAndTintEffect>) return PhotoCore::TemperatureAndTintEffect{ parameters.temperature, parameters.tint };
+			else if constexpr (std::is_same_v<Win2DEffect, GaussianBlurEffect>) return PhotoCore::GaussianBlurEffect{ parameters.blur_amount };
+			else if constexpr (std::is_same_v<Win2DEffect, SaturationEffect>) return PhotoCore::SaturationEffect{ parameters.saturation };
+			else if constexpr (std::is_same_v<Win2DEffect, SepiaEffect>) return PhotoCore::SepiaEffect{ parameters.intensity };
+			else if constexpr (std::is_same_v<Win2DEffect, GrayscaleEffect>) return PhotoCore::GrayscaleEffect{};
+			else if constexpr (std::is_same_v<Win2DEffect, InvertEffect>) return PhotoCore::InvertEffect{};
+			else return PhotoCore::CompositeEffect{};
+		}
+
+		/// <summary>
+		/// 与 CPU 效果对应的 Win2D 效果，连接到 source 之后
+		/// </summary>
+		template <class CoreEffect>
+		ICanvasImage win2d_effect_of(CoreEffect const& e, ICanvasImage const& source)
+		{
+			if constexpr (std::is_same_v<CoreEffect, PhotoCore::ContrastEffect>)
+			{
+				ContrastEffect effect;
+				effect.Contrast(e.contrast);
+				effect.Source(source);
+				return effect;
+			}
+			else if constexpr (std::is_same_v<CoreEffect, PhotoCore::ExposureEffect>)
+			{
+				ExposureEffect effect;
+				effect.Exposure(e.exposure);
+				effect.Source(source);
+				return effect;
+			}
+			else if constexpr (std::is_same_v<CoreEffect, PhotoCore::TemperatureAndTintEffect>)
+			{
+				TemperatureAndTintEffect effect;
+				effect.Temperature(e.temperature);
+				effect.Tint(e.tint);
+				effect.Source(source);
+				return effect;
+			}
+			else if constexpr (std::is_same_v<CoreEffect, PhotoCore::GaussianBlurEffect>)
+			{
+				GaussianBlurEffect effect;
+				effect.BlurAmount(e.blur_amount);
+				effect.BorderMode(EffectBorderMode::Hard);
+				effect.Source(source);
+				return effect;
+			}
+			else if constexpr (std::is_same_v<CoreEffect, PhotoCore::SaturationEffect>)
+			{
+				SaturationEffect effect;
+				effect.Saturation(e.saturation);
+				effect.Source(source);
+				return effect;
+			}
+			else if constexpr (std::is_same_v<CoreEffect, PhotoCore::SepiaEffect>)
+			{
+				SepiaEffect effect;
+				effect.Intensity(e.intensity);
+				effect.Source(source);
+				return effect;
+			}
+			else if constexpr (std::is_same_v<CoreEffect, PhotoCore::GrayscaleEffect>)
+			{
+				GrayscaleEffect effect;
+				effect.Source(source);
+				return effect;
+			}
+			else if constexpr (std::is_same_v<CoreEffect, PhotoCore::InvertEffect>)
+			{
+				InvertEffect effect;
+				effect.Source(source);
+				return effect;
+			}
+			else
+			{
+				// 只有一个输入的合成效果就是上一个效果的输出
+				return source;
+			}
+		}
+
+		/// <summary>
+		/// 用 Win2D 在原图尺寸上渲染效果链。与界面上的效果笔刷一样由 Direct2D 计算，保存的结果与显示的相同
+		/// </summary>
+		/// <param name="chain">效果链</param>
+		/// <param name="bitmap">原图</param>
+		/// <returns>BGRA8 预乘的渲染结果</returns>
+		PhotoCore::PixelBuffer render_with_win2d(PhotoCore::EffectChain const& chain, SoftwareBitmap const& bitmap)
+		{
+			const auto device = CanvasDevice::GetSharedDevice();
+			ICanvasImage image = CanvasBitmap::CreateFromSoftwareBitmap(device, bitmap);
+
+			for (auto&& effect : chain)
+			{
+				image = std::visit([&](auto&& e) { return win2d_effect_of(e, image); }, effect);
+			}
+
+			const auto width = static_cast<uint32_t>(bitmap.PixelWidth());
+			const auto height = static_cast<uint32_t>(bitmap.PixelHeight());
+			const CanvasRenderTarget target{ device, static_cast<float>(width), static_cast<float>(height), 96 };
+
+			{
+				const auto session = target.CreateDrawingSession();
+				session.Clear(Color{ 0, 0, 0, 0 });
+				session.DrawImage(image);
+				session.Close();
+			}
+
+			// 渲染目标是 B8G8R8A8 预乘，各行紧密排列
+			auto bytes = target.GetPixelBytes();
+			PhotoCore::PixelBuffer rendered(width, height, PhotoCore::BufferPool::Shared());
+			PhotoCore::CopyPixels({ bytes.data(), width, height, width * PhotoCore::BytesPerPixel }, rendered.View());
+			return rendered;
+		}
+
+		/// <summary>
+		/// 导出的文件：文件名后缀、长边和 JPEG 质量
+		/// </summary>
+		struct export_preset
+		{
+			wchar_t const* suffix;
+			uint32_t max_long_edge;
+			int quality;
+		};
+
+		// 原尺寸、网页版和略缩图
+		constexpr export_preset export_presets[]{
+			{ L"", 0, 92 },
+			{ L"-2048", 2048, 85 },
+			{ L"-400", 400, 80 },
+		};
+
+		/// <summary>
+		/// 写出一个导出的文件。与保存一样在写入前后通知 CachedFileManager，文件由其他应用（例如云存储）提供时也能完成更新
+		/// </summary>
+		/// <param name="folder">保存的文件夹</param>
+		/// <param name="name">文件名，已存在时自动改名</param>
+		/// <param name="bytes">文件内容，调用者在写完之前保持有效</param>
+		/// <returns>失败的原因，成功时为空</returns>
+		IAsyncOperation<hstring> write_export_async(StorageFolder folder, hstring name, std::vector<uint8_t> const& bytes)
+		{
+			try
+			{
+				const auto file = co_await folder.CreateFileAsync(name, CreationCollisionOption::GenerateUniqueName);
+				Windows::Storage::CachedFileManager::DeferUpdates(file);
+				co_await FileIO::WriteBytesAsync(file, bytes);
+
+				const auto status = co_await Windows::Storage::CachedFileManager::CompleteUpdatesAsync(file);
+
+				if (status != Provider::FileUpdateStatus::Complete && status != Provider::FileUpdateStatus::CompleteAndRenamed)
+				{
+					co_return L"文件没有完成更新";
+				}
+			}
+			catch (hresult_error const& e)
+			{
+				co_return e.message();
+			}
+
+			co_return hstring{};
+		}
+	}
+
 	DetailPage::DetailPage() : compositor_(Window::Current().Compositor())
 	{
 		// 初始化组件
@@ -44,8 +273,8 @@ namespace winrt::PhotoEditor::implementation
 	void DetailPage::FitToScreen()
 	{
 		// 计算缩放比例
-		const auto width = MainImageScroller().ActualWidth() / Item().ImageProperties().Width();
-		const auto height = MainImageScroller().ActualHeight() / Item().ImageProperties().Height();
+		const auto width = MainImageScroller().ActualWidth() / Item().ImageWidth();
+		const auto height = MainImageScroller().ActualHeight() / Item().ImageHeight();
 		const auto zoom_factor = static_cast<float>(std::min(width, height));
 
 		// 更改视图
@@ -196,10 +425,15 @@ namespace winrt::PhotoEditor::implementation
 		// 准备选中的效果
 		PrepareSelectedEffects();
 		// 更新
+		RefreshMainImageBrush();
+	}
+
+	void DetailPage::RefreshMainImageBrush()
+	{
 		UpdateMainImageBrush();
 
-		// 遍历效果列表，添加效果
-		for (auto&& item : animatable_properties_list_)
+		// 遍历实际连接的效果的属性，写入新的笔刷
+		for (auto&& item : active_properties_)
 		{
 			// 将列表中的元素转化为字符串
 			std::wstring effect_name = static_cast<std::wstring>(item);
@@ -241,34 +475,88 @@ namespace winrt::PhotoEditor::implementation
 
 	void DetailPage::UpdateButtonImageBrush()
 	{
-		// 设置图片预览背景
-		ButtonPreviewImage().Source(image_source_);
-		ButtonPreviewImage().InvalidateArrange();
+		PE_TRACE_SCOPE("DetailPage::UpdateButtonImageBrush");
 
-		// 创建效果图形
-		CreateEffectsGraph();
+		// 移除原来用 Composition 绘制的预览
+		ElementCompositionPreview::SetElementChildVisual(ButtonPreviewImage(), nullptr);
 
-		// 创建目标笔刷
-		auto destination_brush = compositor_.CreateBackdropBrush();
-		// 创建笔刷工厂
-		auto graphics_effect_factory = compositor_.CreateEffectFactory(graphics_effect_);
+		if (!preview_renderer_)
+		{
+			// 略缩图还没有加载，先显示原图，加载完成后再次更新
+			ButtonPreviewImage().Source(image_source_);
+			ButtonPreviewImage().InvalidateArrange();
+			return;
+		}
 
-		// 从笔刷工厂创建笔刷
-		auto preview_brush = graphics_effect_factory.CreateBrush();
+		// 与 PrepareSelectedEffects 中按钮预览使用的参数相同
+		PhotoCore::EffectParameters parameters;
+		parameters.intensity = 1.0f;
+		parameters.blur_amount = 2.5f;
+		parameters.temperature = 0.25f;
+		parameters.tint = -0.25f;
+		parameters.saturation = saturation_effect_.Saturation();
+		parameters.contrast = .25f;
+		parameters.exposure = -0.25f;
+
+		size_t removed = 0;
+		const auto chain = PhotoCore::OptimizeEffectChain(PhotoCore::BuildEffectChain(SelectedEffectTags(), parameters), removed);
+		PE_TRACE_COUNTER("DetailPage.PreviewEffectsRemoved", removed);
+
+		auto const& compiled = preview_chains_.GetOrCompile(PhotoCore::SignatureOf(chain), [&chain]
+		{
+			return PhotoCore::CompileEffectChain(chain);
+		});
 
-		preview_brush.SetSourceParameter(L"Backdrop", destination_brush);
+		// 按钮预览只有 232x64，直接在界面线程上渲染。不使用共享线程池：它可能正忙于扫描等任务，界面线程不能排队等待
+		PhotoCore::PixelBuffer pixels(PhotoCore::ButtonPreviewWidth, PhotoCore::ButtonPreviewHeight, PhotoCore::BufferPool::Shared());
+		preview_renderer_->RenderChain(compiled, chain, pixels.View(), PhotoCore::ThreadPool::Inline());
 
-		auto effect_sprite = compositor_.CreateSpriteVisual();
-		effect_sprite.Size(float2{ 232, 64 });
-		effect_sprite.Brush(preview_brush);
+		ShowButtonPreview(ToSoftwareBitmap(pixels.View()), ++button_preview_generation_);
+	}
 
-		ElementCompositionPreview::SetElementChildVisual(ButtonPreviewImage(), effect_sprite);
+	fire_and_forget DetailPage::ShowButtonPreview(SoftwareBitmap bitmap, uint64_t generation)
+	{
+		const auto strong = get_strong();
+
+		SoftwareBitmapSource source{};
+		co_await source.SetBitmapAsync(bitmap);
+
+		if (generation == button_preview_generation_)
+		{
+			ButtonPreviewImage().Source(source);
+		}
+	}
+
+	std::vector<PhotoCore::EffectTag> DetailPage::SelectedEffectTags() const
+	{
+		std::vector<PhotoCore::EffectTag> tags;
+
+		for (auto&& item : EffectPreviewGrid().SelectedItems())
+		{
+			if (const auto tag = effect_tag_of(unbox_value<hstring>(item.as<FrameworkElement>().Tag())))
+			{
+				tags.push_back(*tag);
+			}
+		}
+
+		return tags;
 	}
 
 	void DetailPage::UpdateEffectBrush(hstring const& propertyName)
 	{
 		if (combined_brush_)
 		{
+			// 参数离开或回到不起作用的值时，化简的结果会改变，需要换一个效果图
+			std::vector<effect_variant> effects;
+			std::vector<hstring> properties;
+			OptimizeEffects(effects, properties);
+
+			if (EffectsSignature(effects, properties).Key() != main_graph_key_)
+			{
+				RefreshMainImageBrush();
+				return;
+			}
+
 			// "switch-case"
 			if (propertyName == L"Exposure")
 			{
@@ -321,13 +609,33 @@ namespace winrt::PhotoEditor::implementation
 
 	IAsyncAction DetailPage::OnNavigatedTo(NavigationEventArgs e)
 	{
+		PE_TRACE_ASYNC_SCOPE("DetailPage::OnNavigatedTo");
+
+		// 从点击略缩图到显示编辑后的图片
+		const auto flow = PE_TRACE_NEW_FLOW_ID();
+		PE_TRACE_FLOW_STEP("DetailPage::OnNavigatedTo", flow);
 
 		Item(e.Parameter().as<PhotoEditor::Photo>());
 
 		if (auto item = Item())
 		{
 			Photo* impleType = from_abi<Photo>(item);
-			image_source_ = co_await impleType->GetImageSourceAsync();
+
+			try
+			{
+				// 在工作线程上解码，界面线程只负责显示
+				const auto bitmap = co_await impleType->GetImageSourceAsync();
+				image_pixel_size_ = float2{ static_cast<float>(bitmap.PixelWidth()), static_cast<float>(bitmap.PixelHeight()) };
+
+				image_source_ = SoftwareBitmapSource{};
+				co_await image_source_.SetBitmapAsync(bitmap);
+				PE_TRACE_FLOW_STEP("DetailPage::image_loaded", flow);
+			}
+			catch (hresult_error const&)
+			{
+				// 文件无法解码，保持未加载状态
+				image_pixel_size_ = float2{ 0, 0 };
+			}
 
 			// 监听属性更改
 			property_changed_token_ = item.PropertyChanged(auto_revoke, [weak{ get_weak() }](auto&&, auto&& args)
@@ -345,8 +653,10 @@ namespace winrt::PhotoEditor::implementation
 			auto image_animation = ConnectedAnimationService::GetForCurrentView().GetAnimation(L"itemAnimation");
 			if (image_animation)
 			{
-				image_animation.Completed([weak{ get_weak() }](auto&&, auto&&)
+				image_animation.Completed([weak{ get_weak() }, flow](auto&&, auto&&)
 				{
+					PE_TRACE_SCOPE_FLOW("DetailPage::animation_completed", flow);
+
 					if (auto strong = weak.get())
 					{
 						strong->MainImage().Source(strong->image_source_);
@@ -362,7 +672,7 @@ namespace winrt::PhotoEditor::implementation
 
 				image_animation.TryStart(targetImage());
 			}
-			if (image_source_.PixelHeight() == 0 && image_source_.PixelWidth() == 0)
+			if (image_pixel_size_.x == 0 && image_pixel_size_.y == 0)
 			{
 				// 没有加载的图片，禁用编辑和缩放功能
 				EditButton().IsEnabled(false);
@@ -414,124 +724,222 @@ namespace winrt::PhotoEditor::implementation
 		effects_list_.push_back(graphics_effect_);
 	}
 
-	void DetailPage::InitializeEffectPreviews()
+	IAsyncAction DetailPage::InitializeEffectPreviews()
+	{
+		PE_TRACE_ASYNC_SCOPE("DetailPage::InitializeEffectPreviews");
+
+		const auto strong = get_strong();
+		Photo* implType = from_abi<Photo>(Item());
+
+		// 与预览网格中的顺序相同
+		const PhotoCore::EffectTag tags[]{
+			PhotoCore::EffectTag::Color,
+			PhotoCore::EffectTag::Light,
+			PhotoCore::EffectTag::Blur,
+			PhotoCore::EffectTag::Sepia,
+			PhotoCore::EffectTag::Grayscale,
+			PhotoCore::EffectTag::Invert,
+		};
+		const Image images[]{ colorImage(), lightImage(), blurImage(), sepiaImage(), grayscaleImage(), invertImage() };
+		constexpr auto count = std::size(tags);
+
+		SoftwareBitmap thumbnail{ nullptr };
+
+		try
+		{
+			// 所有预览只加载一次略缩图
+			thumbnail = co_await implType->GetThumbnailBitmapAsync(PhotoCore::LoadPriority::Prefetch);
+		}
+		catch (hresult_error const&)
+		{
+			// 略缩图无法解码，预览保持空白
+			co_return;
+		}
+
+		apartment_context ui_thread;
+		co_await resume_background();
+
+		// 在工作线程上缩小一次，六个预览一次遍历
+		auto renderer = std::make_shared<PhotoCore::PreviewRenderer>(ToPixelBuffer(thumbnail));
+		std::vector<PhotoCore::PixelBuffer> tiles;
+		std::vector<PhotoCore::ImageView> views;
+		std::vector<PhotoCore::Effect> effects;
+
+		for (auto tag : tags)
+		{
+			views.push_back(tiles.emplace_back(PhotoCore::PreviewTileWidth, PhotoCore::PreviewTileHeight).View());
+			effects.push_back(PhotoCore::PreviewTileEffect(tag));
+		}
+
+		renderer->RenderTiles(effects.data(), views.data(), count, PhotoCore::ThreadPool::Shared());
+
+		std::vector<SoftwareBitmap> bitmaps;
+
+		for (auto&& view : views)
+		{
+			bitmaps.push_back(ToSoftwareBitmap(view));
+		}
+
+		co_await ui_thread;
+
+		preview_renderer_ = std::move(renderer);
+		UpdateButtonImageBrush();
+
+		for (size_t i = 0; i < count; i++)
+		{
+			SoftwareBitmapSource source{};
+			co_await source.SetBitmapAsync(bitmaps[i]);
+
+			images[i].Source(source);
+			images[i].InvalidateArrange();
+		}
+	}
+
+	IGraphicsEffect DetailPage::CreateEffectsGraph()
 	{
-		SepiaEffect sepiaEffect{};
-		sepiaEffect.Intensity(0.5f);
-		sepiaEffect.Source(CompositionEffectSourceParameter{ L"source" });
-		InitializeEffectPreview(sepiaEffect, sepiaImage());
+		PE_TRACE_SCOPE("DetailPage::CreateEffectsGraph");
+		PE_TRACE_COUNTER("DetailPage.Effects", active_effects_.size());
 
-		GrayscaleEffect grayscaleEffect{};
-		grayscaleEffect.Source(CompositionEffectSourceParameter{ L"source" });
-		InitializeEffectPreview(grayscaleEffect, grayscaleImage());
+		// 第一个效果连接背景，之后每个效果连接上一个效果
+		IGraphicsEffectSource source = CompositionEffectSourceParameter{ L"Backdrop" };
+		IGraphicsEffect root{ nullptr };
 
-		GaussianBlurEffect blurEffect{};
-		blurEffect.BlurAmount(3.0f);
-		blurEffect.Source(CompositionEffectSourceParameter{ L"source" });
-		InitializeEffectPreview(blurEffect, blurImage());
+		for (auto&& effect : active_effects_)
+		{
+			std::visit([&](auto&& e)
+			{
+				if constexpr (std::is_same_v<CompositeEffect, std::decay_t<decltype(e)>>)
+				{
+					auto const& sources = e.Sources();
+					sources.Clear();
+					sources.Append(source);
+				}
+				else
+				{
+					e.Source(source);
+				}
 
-		InvertEffect invertEffect{};
-		invertEffect.Source(CompositionEffectSourceParameter{ L"source" });
-		InitializeEffectPreview(invertEffect, invertImage());
+				source = e;
+				root = e;
+			}, effect);
+		}
 
-		ExposureEffect lightEffect{};
-		lightEffect.Exposure(1.0f);
-		lightEffect.Source(CompositionEffectSourceParameter{ L"source" });
-		InitializeEffectPreview(lightEffect, lightImage());
+		if (!root)
+		{
+			// 全部化简掉了，只输出背景
+			auto const& sources = graphics_effect_.Sources();
+			sources.Clear();
+			sources.Append(source);
+			root = graphics_effect_;
+		}
 
-		SaturationEffect colorEffect{};
-		colorEffect.Saturation(0.5f);
-		colorEffect.Source(CompositionEffectSourceParameter{ L"source" });
-		InitializeEffectPreview(colorEffect, colorImage());
+		return root;
 	}
 
-	IAsyncAction DetailPage::InitializeEffectPreview(IInspectable compEffect, Image image)
+	PhotoCore::EffectChain DetailPage::CurrentEffectChain() const
 	{
-		Photo* implType = from_abi<Photo>(Item());
-		image.Source(co_await implType->GetImageThumbnailAsync());
-		image.InvalidateArrange();
+		const auto parameters = parameters_of(Item());
+		PhotoCore::EffectChain chain;
 
-		auto destinationBrush = compositor_.CreateBackdropBrush();
-		auto graphicsEffectFactory = compositor_.CreateEffectFactory(compEffect.as<IGraphicsEffect>());
-		auto combinedBrush = graphicsEffectFactory.CreateBrush();
-		auto effectSprite = compositor_.CreateSpriteVisual();
+		for (auto&& effect : effects_list_)
+		{
+			chain.push_back(std::visit([&](auto&& e) { return core_effect_of(e, parameters); }, effect));
+		}
 
-		combinedBrush.SetSourceParameter(L"source", destinationBrush);
-		effectSprite.Size(float2{ 188,88 });
-		effectSprite.Brush(combinedBrush);
-		ElementCompositionPreview::SetElementChildVisual(image, effectSprite);
+		return chain;
 	}
 
-	void DetailPage::CreateEffectsGraph()
+	size_t DetailPage::OptimizeEffects(std::vector<effect_variant>& effects, std::vector<hstring>& properties) const
 	{
-		auto as_source = [](auto&& arg) -> IGraphicsEffectSource
+		const auto chain = CurrentEffectChain();
+		size_t removed = 0;
+		const auto optimized = PhotoCore::OptimizeEffectChain(chain, removed);
+
+		// 化简只删除效果、不调换顺序，按类型依次对应回 Win2D 效果。
+		// 选中的标签各不相同，同一类型的效果不会相邻，合并不会发生
+		effects.clear();
+		size_t next = 0;
+
+		for (size_t i = 0; i < chain.size() && next < optimized.size(); i++)
 		{
-			return arg;
-		};
+			if (chain[i].index() == optimized[next].index())
+			{
+				effects.push_back(effects_list_[i]);
+				next++;
+			}
+		}
+
+		// 只保留仍然连接的效果的属性，属性名以效果名开头
+		properties.clear();
 
-		// 创建效果列表
-		for (size_t i = 0; i < effects_list_.size(); i++)
+		for (auto&& property : animatable_properties_list_)
 		{
-			const auto& effect = effects_list_[i];
+			const std::wstring_view name = property;
+			const auto effect_name = name.substr(0, name.find(L'.'));
 
-			if (i == 0)
+			const auto connected = std::any_of(effects.begin(), effects.end(), [&](auto&& effect)
 			{
-				// 第一个效果
-				std::visit([&graphicsEffect = graphics_effect_](auto&& effect)
-					{
-						CompositionEffectSourceParameter source{ L"Backdrop" };
-						if constexpr (std::is_same_v<CompositeEffect, std::decay_t<decltype(effect)>>)
-						{
-							auto const& sources = graphicsEffect.Sources();
-							sources.Clear();
-							sources.Append(source);
-						}
-						else
-						{
-							effect.Source(source);
-						}
-					}, effect);
-			}
-			else if (i < effects_list_.size() - 1)
-			{
-				// 不是最后一个效果
-				std::visit([source = std::visit(as_source, effects_list_[i - 1])](auto&& effect)
-				{
-					if constexpr (!std::is_same_v<CompositeEffect, std::decay_t<decltype(effect)>>)
-					{
-						effect.Source(source);
-					}
-				}, effect);
-			}
-			else
+				const auto connected_name = std::visit([](auto&& e) { return e.Name(); }, effect);
+				return std::wstring_view{ connected_name } == effect_name;
+			});
+
+			if (connected)
 			{
-				// 符合效果是列表的最后一项
-				auto const& sources = graphics_effect_.Sources();
-				sources.Clear();
-				sources.Append(std::visit(as_source, effects_list_[i - 1]));
+				properties.push_back(property);
 			}
 		}
+
+		return removed;
+	}
+
+	PhotoCore::EffectGraphSignature DetailPage::EffectsSignature(std::vector<effect_variant> const& effects, std::vector<hstring> const& properties)
+	{
+		PhotoCore::EffectGraphSignature signature;
+
+		for (auto&& effect : effects)
+		{
+			// 运行时类名，例如 Microsoft.Graphics.Canvas.Effects.ContrastEffect，与 CPU 效果链的签名相同
+			signature.AddEffect(to_string(std::visit([](auto&& e) { return get_class_name(e); }, effect)));
+		}
+
+		for (auto&& property : properties)
+		{
+			signature.AddAnimatableProperty(to_string(property));
+		}
+
+		return signature;
 	}
 
 	void DetailPage::UpdateMainImageBrush()
 	{
+		PE_TRACE_SCOPE("DetailPage::UpdateMainImageBrush");
+
 		MainImage().Source(image_source_);
 		MainImage().InvalidateArrange();
 
-		// 创建效果图像
-		CreateEffectsGraph();
+		// 去掉当前参数下不起作用的效果，全部去掉时只复制背景
+		const auto removed = OptimizeEffects(active_effects_, active_properties_);
+		main_graph_key_ = EffectsSignature(active_effects_, active_properties_).Key();
+		PE_TRACE_COUNTER("DetailPage.EffectsRemoved", removed);
 
 		// 目标笔刷
 		auto destination_brush = compositor_.CreateBackdropBrush();
-		// 效果工厂
-		auto graphics_effect_factory = compositor_.CreateEffectFactory(graphics_effect_, animatable_properties_list_);
+		// 效果工厂，用过的效果组合直接复用，参数由 UpdateEffectBrush 写入新的笔刷
+		auto const& graphics_effect_factory = main_factories_.GetOrCompile(main_graph_key_, [this]
+		{
+			PE_TRACE_SCOPE("DetailPage::CreateEffectFactory");
+			return compositor_.CreateEffectFactory(CreateEffectsGraph(), active_properties_);
+		});
+
+		PE_TRACE_COUNTER("DetailPage.MainGraphHitRate", main_factories_.Stats().HitRate());
+		PE_TRACE_COUNTER("DetailPage.MainGraphCompileMs", main_factories_.Stats().last_compile_ms);
 
 		// 创建复合笔刷
 		combined_brush_ = graphics_effect_factory.CreateBrush();
 		combined_brush_.SetSourceParameter(L"Backdrop", destination_brush);
 
 		const auto effect_sprite = compositor_.CreateSpriteVisual();
-		effect_sprite.Size(float2{ static_cast<float>(image_source_.PixelWidth()), static_cast<float>(image_source_.PixelHeight()) });
+		effect_sprite.Size(image_pixel_size_);
 		effect_sprite.Brush(combined_brush_);
 
 		// 设置显示效果
@@ -646,6 +1054,9 @@ namespace winrt::PhotoEditor::implementation
 
 	IAsyncAction DetailPage::SaveButton_Click(IInspectable const&, RoutedEventArgs const&)
 	{
+		PE_TRACE_ASYNC_SCOPE("DetailPage::SaveButton_Click");
+		const auto flow = PE_TRACE_NEW_FLOW_ID();
+
 		// 创建一个选择器
 		const auto picker = FileSavePicker{};
 		// 设置默认路径
@@ -671,25 +1082,77 @@ namespace winrt::PhotoEditor::implementation
 		// 文件类型 JPEG、PNG、TIF、BMP
 		picker.FileTypeChoices().Insert(file_type, winrt::single_threaded_vector<hstring>({ file_ext_h }));
 
+		std::vector<effect_variant> effects;
+		std::vector<hstring> properties;
+		OptimizeEffects(effects, properties);
+
+		// 重新编码为 JPEG 时先询问质量和色度采样，取消时还没有创建文件
+		PhotoCore::JpegEncodeOptions jpeg_options;
+
+		if (!effects.empty() && file_ext == L".jpg")
+		{
+			if (!co_await ChooseJpegOptionsAsync(jpeg_options))
+			{
+				co_return;
+			}
+		}
+
 		if (const auto& file = co_await picker.PickSaveFileAsync())
 		{
-			// 创建文件读写流
-			if (const auto& stream = co_await file.OpenAsync(Windows::Storage::FileAccessMode::ReadWrite))
+			// 没有起作用的效果时结果就是原图：直接复制文件，不解码也不重新编码，EXIF 等元数据原样保留
+			if (effects.empty())
 			{
-				const BitmapEncoder* encoder_ptr = nullptr;
+				PE_TRACE_FLOW_STEP("SaveButton_Click::copy", flow);
+				const auto source = co_await Item().GetImageFileAsync();
+				co_await source.CopyAndReplaceAsync(file);
+
+				co_await Windows::Storage::CachedFileManager::CompleteUpdatesAsync(file);
+				PE_TRACE_FLOW_STEP("SaveButton_Click::saved", flow);
+				co_return;
+			}
+
+			// JPEG 和 PNG 用 Win2D 渲染原图，在核心中并行编码，不经过单线程的 BitmapEncoder
+			if (file_ext == L".jpg" || file_ext == L".png")
+			{
+				size_t removed = 0;
+				const auto chain = PhotoCore::OptimizeEffectChain(CurrentEffectChain(), removed);
+
+				PE_TRACE_FLOW_STEP("SaveButton_Click::render", flow);
+				const auto bitmap = co_await Item().GetImageSourceAsync();
+
+				co_await resume_background();
+
+				const auto rendered = render_with_win2d(chain, bitmap);
+
+				PE_TRACE_FLOW_STEP("SaveButton_Click::encode", flow);
+				std::vector<uint8_t> bytes;
 
-				// 从流创建编码器
 				if (file_ext == L".jpg")
 				{
-					const auto& encoder = co_await BitmapEncoder::CreateAsync(BitmapEncoder::JpegEncoderId(), stream);
-					encoder_ptr = &encoder;
+					bytes = PhotoCore::EncodeJpeg(rendered.View(), jpeg_options, PhotoCore::ThreadPool::Shared());
 				}
-				else if (file_ext == L".png")
+				else
 				{
-					const auto& encoder = co_await BitmapEncoder::CreateAsync(BitmapEncoder::PngEncoderId(), stream);
-					encoder_ptr = &encoder;
+					// 原图带 alpha 并且结果中确实有透明像素时才写出 alpha 通道，不透明的照片仍然保存为 RGB
+					PhotoCore::PngEncodeOptions png_options;
+					png_options.alpha = bitmap.BitmapAlphaMode() != BitmapAlphaMode::Ignore && !PhotoCore::IsOpaque(rendered.View());
+					bytes = PhotoCore::EncodePng(rendered.View(), png_options, PhotoCore::ThreadPool::Shared());
 				}
-				else if (file_ext == L".gif")
+
+				co_await FileIO::WriteBytesAsync(file, bytes);
+
+				co_await Windows::Storage::CachedFileManager::CompleteUpdatesAsync(file);
+				PE_TRACE_FLOW_STEP("SaveButton_Click::saved", flow);
+				co_return;
+			}
+
+			// 创建文件读写流
+			if (const auto& stream = co_await file.OpenAsync(Windows::Storage::FileAccessMode::ReadWrite))
+			{
+				const BitmapEncoder* encoder_ptr = nullptr;
+
+				// 从流创建编码器
+				if (file_ext == L".gif")
 				{
 					const auto& encoder = co_await BitmapEncoder::CreateAsync(BitmapEncoder::GifEncoderId(), stream);
 					encoder_ptr = &encoder;
@@ -709,6 +1172,7 @@ namespace winrt::PhotoEditor::implementation
 				}
 
 				// 渲染图片
+				PE_TRACE_FLOW_STEP("SaveButton_Click::render", flow);
 				const RenderTargetBitmap render_target_bitmap{};
 				co_await render_target_bitmap.RenderAsync(MainImage());
 
@@ -717,14 +1181,160 @@ namespace winrt::PhotoEditor::implementation
 				const auto new_buffer = SoftwareBitmap::CreateCopyFromBuffer(
 					pixels,
 					BitmapPixelFormat::Bgra8,
-					Item().ImageProperties().Width(),
-					Item().ImageProperties().Height()
+					Item().ImageWidth(),
+					Item().ImageHeight()
 				);
 
+				PE_TRACE_FLOW_STEP("SaveButton_Click::encode", flow);
 				co_await(*encoder_ptr).FlushAsync();
 
 				co_await Windows::Storage::CachedFileManager::CompleteUpdatesAsync(file);
+				PE_TRACE_FLOW_STEP("SaveButton_Click::saved", flow);
 			}
 		}
 	}
+
+	IAsyncOperation<bool> DetailPage::ChooseJpegOptionsAsync(PhotoCore::JpegEncodeOptions& options)
+	{
+		const auto strong = get_strong();
+
+		// 默认是上一次的选择
+		const auto settings = ApplicationData::Current().LocalSettings().Values();
+		options.quality = std::clamp(unbox_value_or<int32_t>(settings.TryLookup(L"JpegQuality"), options.quality), 1, 100);
+		const auto subsampling = std::clamp(unbox_value_or<int32_t>(settings.TryLookup(L"JpegSubsampling"), static_cast<int32_t>(options.subsampling)), 0, 2);
+
+		const Slider quality_slider{};
+		quality_slider.Header(box_value(L"质量"));
+		quality_slider.Minimum(1);
+		quality_slider.Maximum(100);
+		quality_slider.Value(options.quality);
+
+		// 顺序与 JpegSubsampling 相同
+		const ComboBox subsampling_box{};
+		subsampling_box.Header(box_value(L"色度采样"));
+		subsampling_box.Items().Append(box_value(L"4:4:4（颜色最清晰）"));
+		subsampling_box.Items().Append(box_value(L"4:2:2"));
+		subsampling_box.Items().Append(box_value(L"4:2:0（文件最小）"));
+		subsampling_box.SelectedIndex(subsampling);
+
+		const StackPanel panel{};
+		panel.Spacing(12);
+		panel.Children().Append(quality_slider);
+		panel.Children().Append(subsampling_box);
+
+		const ContentDialog options_dialog{};
+		options_dialog.Title(box_value(L"JPEG 选项"));
+		options_dialog.Content(panel);
+		options_dialog.PrimaryButtonText(L"保存");
+		options_dialog.CloseButtonText(L"取消");
+		options_dialog.DefaultButton(ContentDialogButton::Primary);
+
+		if (co_await options_dialog.ShowAsync() != ContentDialogResult::Primary)
+		{
+			co_return false;
+		}
+
+		options.quality = static_cast<int>(quality_slider.Value());
+		options.subsampling = static_cast<PhotoCore::JpegSubsampling>(subsampling_box.SelectedIndex());
+		settings.Insert(L"JpegQuality", box_value(static_cast<int32_t>(options.quality)));
+		settings.Insert(L"JpegSubsampling", box_value(static_cast<int32_t>(options.subsampling)));
+		co_return true;
+	}
+
+	IAsyncAction DetailPage::ExportButton_Click(IInspectable const&, RoutedEventArgs const&)
+	{
+		PE_TRACE_ASYNC_SCOPE("DetailPage::ExportButton_Click");
+		const auto flow = PE_TRACE_NEW_FLOW_ID();
+		const auto strong = get_strong();
+
+		// 选择保存的文件夹，所有尺寸写到同一个文件夹
+		const auto picker = FolderPicker{};
+		picker.SuggestedStartLocation(PickerLocationId::PicturesLibrary);
+		picker.FileTypeFilter().Append(L".jpg");
+
+		const auto folder = co_await picker.PickSingleFolderAsync();
+
+		if (!folder)
+		{
+			co_return;
+		}
+
+		// 在界面线程上取得效果链和文件名
+		size_t removed = 0;
+		const auto chain = PhotoCore::OptimizeEffectChain(CurrentEffectChain(), removed);
+
+		std::wstring name{ Item().ImageName() };
+
+		if (const auto dot = name.find_last_of(L'.'); dot != std::wstring::npos)
+		{
+			name.resize(dot);
+		}
+
+		// 原图只解码一次
+		PE_TRACE_FLOW_STEP("ExportButton_Click::decode", flow);
+		const auto bitmap = co_await Item().GetImageSourceAsync();
+
+		apartment_context ui_thread;
+		co_await resume_background();
+
+		// 与保存一样用 Win2D 渲染一次效果链，导出的结果与显示的相同；再缩小到各个尺寸后同时编码
+		PE_TRACE_FLOW_STEP("ExportButton_Click::render", flow);
+		const auto rendered = render_with_win2d(chain, bitmap);
+		std::vector<PhotoCore::ExportTarget> targets;
+
+		for (auto&& preset : export_presets)
+		{
+			auto&& target = targets.emplace_back();
+			target.max_long_edge = preset.max_long_edge;
+			target.options.quality = preset.quality;
+		}
+
+		PhotoCore::ExportStats stats;
+		const auto outputs = PhotoCore::RenderExports(rendered.View(), {}, targets, PhotoCore::ThreadPool::Shared(), PhotoCore::BufferPool::Shared(), &stats);
+		PE_TRACE_COUNTER("DetailPage.ExportEncodeMs", stats.encode_ms);
+
+		// 所有文件同时写出，一个文件失败时其余的文件照常写完
+		PE_TRACE_FLOW_STEP("ExportButton_Click::write", flow);
+		std::vector<std::wstring> names;
+		std::vector<IAsyncOperation<hstring>> writes;
+
+		for (size_t i = 0; i < outputs.size(); i++)
+		{
+			names.push_back(name + export_presets[i].suffix + L".jpg");
+			writes.push_back(write_export_async(folder, hstring(names.back()), outputs[i].bytes));
+		}
+
+		std::wstring failures;
+
+		for (size_t i = 0; i < writes.size(); i++)
+		{
+			if (const auto message = co_await writes[i]; !message.empty())
+			{
+				failures += L"\n" + names[i] + L"：" + std::wstring(message);
+			}
+		}
+
+		PE_TRACE_FLOW_STEP("ExportButton_Click::saved", flow);
+
+		if (failures.empty())
+		{
+			co_return;
+		}
+
+		co_await ui_thread;
+
+		const ContentDialog failures_dialog{};
+		failures_dialog.Title(box_value(L"部分文件没有导出"));
+		failures_dialog.Content(box_value(L"以下文件没有写出：" + failures));
+		failures_dialog.CloseButtonText(L"确定");
+
+		try
+		{
+			co_await failures_dialog.ShowAsync();
+		}
+		catch (hresult_error const&)
+		{
+			// 同一时间只能显示一个对话框，其他对话框正在显示时放弃
+		}
+	}
 }
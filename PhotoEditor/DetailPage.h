@@ -1,5 +1,9 @@
 ﻿#pragma once
 #include "DetailPage.g.h"
+#include "Core/EffectGraphCache.h"
+#include "Core/JpegEncoder.h"
+#include "Core/PreviewRenderer.h"
+#include <memory>
 #include <variant>
 
 namespace winrt::PhotoEditor::implementation
@@ -164,6 +168,14 @@ namespace winrt::PhotoEditor::implementation
 		/// <returns></returns>
 		Windows::Foundation::IAsyncAction SaveButton_Click(Windows::Foundation::IInspectable const&, Windows::UI::Xaml::RoutedEventArgs const&);
 
+		/// <summary>
+		/// 点击导出按钮的事件：选择文件夹，一次导出原尺寸、网页版和略缩图
+		/// </summary>
+		/// <param name=""></param>
+		/// <param name=""></param>
+		/// <returns></returns>
+		Windows::Foundation::IAsyncAction ExportButton_Click(Windows::Foundation::IInspectable const&, Windows::UI::Xaml::RoutedEventArgs const&);
+
 		/// <summary>
 		/// 选择效果的按钮点击事件
 		/// </summary>
@@ -186,6 +198,15 @@ namespace winrt::PhotoEditor::implementation
 		void CancelEffectsButton_Click(Windows::Foundation::IInspectable const&, Windows::UI::Xaml::RoutedEventArgs const&);
 
 	private:
+		using effect_variant = std::variant<Microsoft::Graphics::Canvas::Effects::ContrastEffect,
+			Microsoft::Graphics::Canvas::Effects::ExposureEffect,
+			Microsoft::Graphics::Canvas::Effects::TemperatureAndTintEffect,
+			Microsoft::Graphics::Canvas::Effects::GaussianBlurEffect,
+			Microsoft::Graphics::Canvas::Effects::SaturationEffect,
+			Microsoft::Graphics::Canvas::Effects::SepiaEffect,
+			Microsoft::Graphics::Canvas::Effects::GrayscaleEffect,
+			Microsoft::Graphics::Canvas::Effects::InvertEffect,
+			Microsoft::Graphics::Canvas::Effects::CompositeEffect>;
 		
 		/// <summary>
 		/// 初始化所有图片效果
@@ -193,22 +214,58 @@ namespace winrt::PhotoEditor::implementation
 		void InitializeEffects();
 
 		/// <summary>
-		/// 初始化图片预览
+		/// 初始化图片预览：加载一次略缩图，在工作线程上渲染六个效果预览
 		/// </summary>
-		void InitializeEffectPreviews();
+		/// <returns></returns>
+		Windows::Foundation::IAsyncAction InitializeEffectPreviews();
 
 		/// <summary>
-		/// 初始化图片预览
+		/// 按选择顺序排列的效果标签
 		/// </summary>
-		/// <param name="">效果</param>
-		/// <param name="">图片</param>
-		/// <returns></returns>
-		Windows::Foundation::IAsyncAction InitializeEffectPreview(Windows::Foundation::IInspectable, Windows::UI::Xaml::Controls::Image);
+		/// <returns>标签</returns>
+		std::vector<PhotoCore::EffectTag> SelectedEffectTags() const;
+
+		/// <summary>
+		/// 显示按钮预览，期间又渲染过新的预览时丢弃
+		/// </summary>
+		/// <param name="">位图</param>
+		/// <param name="">渲染的序号</param>
+		fire_and_forget ShowButtonPreview(Windows::Graphics::Imaging::SoftwareBitmap, uint64_t);
+
+		/// <summary>
+		/// 连接化简后的效果，创建效果图像
+		/// </summary>
+		/// <returns>效果图的终点，没有效果时是只连接背景的合成效果</returns>
+		Windows::Graphics::Effects::IGraphicsEffect CreateEffectsGraph();
+
+		/// <summary>
+		/// 按照片当前的参数化简效果列表，去掉不起作用的效果和它们的可动画属性
+		/// </summary>
+		/// <param name="">输出保留的效果</param>
+		/// <param name="">输出保留的可动画属性</param>
+		/// <returns>去掉的效果数</returns>
+		size_t OptimizeEffects(std::vector<effect_variant>&, std::vector<hstring>&) const;
+
+		/// <summary>
+		/// 与应用的效果列表对应的 CPU 效果链，参数取照片当前的值
+		/// </summary>
+		/// <returns>未化简的效果链</returns>
+		PhotoCore::EffectChain CurrentEffectChain() const;
+
+		/// <summary>
+		/// 保存为 JPEG 前询问质量和色度采样，默认值和选择的结果保存在本地设置中
+		/// </summary>
+		/// <param name="">输出编码参数</param>
+		/// <returns>是否确定保存</returns>
+		Windows::Foundation::IAsyncOperation<bool> ChooseJpegOptionsAsync(PhotoCore::JpegEncodeOptions&);
 
 		/// <summary>
-		/// 从选中的效果创建效果图像
+		/// 效果列表的签名，用于查找编译过的效果工厂
 		/// </summary>
-		void CreateEffectsGraph();
+		/// <param name="">效果</param>
+		/// <param name="">可动画的属性</param>
+		/// <returns>签名</returns>
+		static PhotoCore::EffectGraphSignature EffectsSignature(std::vector<effect_variant> const&, std::vector<hstring> const&);
 
 		/// <summary>
 		/// 配置并且生成用于渲染的资源
@@ -231,7 +288,12 @@ namespace winrt::PhotoEditor::implementation
 		void ApplyEffects();
 
 		/// <summary>
-		/// 更新按钮图片笔刷
+		/// 重新生成主图片的笔刷并写入所有参数
+		/// </summary>
+		void RefreshMainImageBrush();
+
+		/// <summary>
+		/// 更新按钮图片预览，略缩图加载之前显示原图
 		/// </summary>
 		void UpdateButtonImageBrush();
 
@@ -261,18 +323,28 @@ namespace winrt::PhotoEditor::implementation
 		std::vector<Windows::Foundation::IInspectable> selected_effects_temp_{};
 		std::vector<hstring> animatable_properties_list_{};
 
-		std::vector<std::variant<Microsoft::Graphics::Canvas::Effects::ContrastEffect,
-			Microsoft::Graphics::Canvas::Effects::ExposureEffect,
-			Microsoft::Graphics::Canvas::Effects::TemperatureAndTintEffect,
-			Microsoft::Graphics::Canvas::Effects::GaussianBlurEffect,
-			Microsoft::Graphics::Canvas::Effects::SaturationEffect,
-			Microsoft::Graphics::Canvas::Effects::SepiaEffect,
-			Microsoft::Graphics::Canvas::Effects::GrayscaleEffect,
-			Microsoft::Graphics::Canvas::Effects::InvertEffect,
-			Microsoft::Graphics::Canvas::Effects::CompositeEffect>> effects_list_{};
+		std::vector<effect_variant> effects_list_{};
+
+		// 主图片实际连接的效果和可动画属性：化简之后的 effects_list_ 和 animatable_properties_list_
+		std::vector<effect_variant> active_effects_{};
+		std::vector<hstring> active_properties_{};
+
+		// 编译过的效果工厂，按效果类型的顺序和可动画的属性区分
+		PhotoCore::EffectGraphCache<Windows::UI::Composition::CompositionEffectFactory> main_factories_{};
+		// 主图片当前效果图的签名
+		std::string main_graph_key_{};
+
+		// 效果预览和按钮预览共用的略缩图，加载之前为空
+		std::shared_ptr<PhotoCore::PreviewRenderer> preview_renderer_{};
+		// 按钮预览编译过的效果链
+		PhotoCore::EffectGraphCache<PhotoCore::CompiledEffectChain> preview_chains_{};
+		uint64_t button_preview_generation_{ 0 };
 
 		// 照片图像源
-		Windows::UI::Xaml::Media::Imaging::BitmapImage image_source_{ nullptr };
+		Windows::UI::Xaml::Media::Imaging::SoftwareBitmapSource image_source_{ nullptr };
+
+		// 解码后的照片像素尺寸，未加载时为 0
+		Windows::Foundation::Numerics::float2 image_pixel_size_{ 0, 0 };
 
 	};
 }
@@ -0,0 +1,435 @@
+﻿/*
+ * 图片加载服务代码
+ */
+
+#include "pch.h"
+#include "ImageLoader.h"
+#include "Core/JpegThumbnail.h"
+#include "Core/Trace.h"
+
+#include <fstream>
+#include <MemoryBuffer.h>
+
+using namespace winrt;
+using namespace std;
+using namespace Windows::Foundation;
+using namespace Windows::Graphics::Imaging;
+using namespace Windows::Storage;
+using namespace Windows::Storage::Streams;
+using namespace Windows::UI::Xaml::Media::Imaging;
+using namespace PhotoCore;
+
+namespace winrt::PhotoEditor::implementation
+{
+    namespace
+    {
+        // 略缩图的目标尺寸，与主页面网格项的大小相同
+        constexpr uint32_t thumbnail_width = 300;
+        constexpr uint32_t thumbnail_height = 200;
+
+        // 负缓存在应用数据目录中的文件名
+        constexpr wchar_t invalid_images_file[] = L"invalid-images.tsv";
+
+        // 占位预览缓存的文件名
+        constexpr wchar_t placeholders_file[] = L"placeholders.tsv";
+
+        /// <summary>
+        /// 在当前（工作）线程上把流解码为界面可以直接显示的位图
+        /// </summary>
+        /// <param name="stream">图片流</param>
+        /// <returns>BGRA8 预乘位图</returns>
+        SoftwareBitmap decode_bitmap(IRandomAccessStream const& stream)
+        {
+            const auto decoder = BitmapDecoder::CreateAsync(stream).get();
+
+            return decoder.GetSoftwareBitmapAsync(
+                BitmapPixelFormat::Bgra8,
+                BitmapAlphaMode::Premultiplied,
+                BitmapTransform{},
+                ExifOrientationMode::RespectExifOrientation,
+                ColorManagementMode::DoNotColorManage).get();
+        }
+
+        /// <summary>
+        /// 是否是 JPEG 文件
+        /// </summary>
+        /// <param name="file">图片文件</param>
+        /// <returns>是否可以使用缩小解码</returns>
+        bool is_jpeg(StorageFile const& file)
+        {
+            const auto type = file.FileType();
+            return _wcsicmp(type.c_str(), L".jpg") == 0 || _wcsicmp(type.c_str(), L".jpeg") == 0;
+        }
+
+        /// <summary>
+        /// 按位置读取流
+        /// </summary>
+        /// <param name="stream">文件流</param>
+        /// <returns>读取函数</returns>
+        ReadAtFunction read_from(IRandomAccessStream const& stream)
+        {
+            return [stream](uint64_t offset, uint8_t* bytes, size_t size) -> size_t
+            {
+                const auto capacity = static_cast<uint32_t>(size);
+                const auto buffer = stream.GetInputStreamAt(offset).ReadAsync(Buffer{ capacity }, capacity, InputStreamOptions::None).get();
+                const auto count = buffer.Length();
+
+                DataReader::FromBuffer(buffer).ReadBytes(array_view<uint8_t>(bytes, bytes + count));
+                return count;
+            };
+        }
+
+        /// <summary>
+        /// 加载 JPEG 略缩图：优先使用 EXIF 中内嵌的略缩图，只读取文件开头的几 KB；
+        /// 没有或者太小时在 DCT 域缩小解码原图
+        /// </summary>
+        /// <param name="file">JPEG 文件</param>
+        /// <returns>BGRA8 预乘位图</returns>
+        SoftwareBitmap decode_jpeg_thumbnail(StorageFile const& file)
+        {
+            PE_TRACE_SCOPE("ImageLoader::decode_jpeg_thumbnail");
+
+            const auto stream = file.OpenReadAsync().get();
+            const auto pixels = LoadJpegThumbnail(read_from(stream), stream.Size(), thumbnail_width, thumbnail_height);
+            stream.Close();
+
+            return ToSoftwareBitmap(pixels.View());
+        }
+
+        /// <summary>
+        /// 解码略缩图。JPEG 不经过系统的略缩图，失败时再退回系统略缩图
+        /// </summary>
+        /// <param name="file">图片文件</param>
+        /// <param name="flow">追踪用的流 ID</param>
+        /// <returns>BGRA8 预乘位图</returns>
+        SoftwareBitmap decode_thumbnail(StorageFile const& file, uint64_t flow)
+        {
+            PE_TRACE_SCOPE_FLOW("ImageLoader::decode_thumbnail", flow);
+
+            if (is_jpeg(file))
+            {
+                try
+                {
+                    return decode_jpeg_thumbnail(file);
+                }
+                catch (hresult_error const&)
+                {
+                }
+                catch (std::exception const&)
+                {
+                }
+            }
+
+            // 获取略缩图
+            const auto thumbnail = file.GetThumbnailAsync(FileProperties::ThumbnailMode::PicturesView).get();
+
+            if (!thumbnail)
+            {
+                throw hresult_error(E_FAIL, L"无法获取略缩图");
+            }
+
+            auto thumbnail_bitmap = decode_bitmap(thumbnail);
+            thumbnail.Close();
+
+            return thumbnail_bitmap;
+        }
+
+        /// <summary>
+        /// 生成合并请求用的键
+        /// </summary>
+        /// <param name="file">图片文件</param>
+        /// <param name="kind">加载类型</param>
+        /// <returns>键</returns>
+        wstring key_of(StorageFile const& file, wchar_t const* kind)
+        {
+            const auto path = file.Path().empty() ? file.FolderRelativeId() : file.Path();
+            return wstring{ kind } + L"|" + static_cast<wstring>(path);
+        }
+    }
+
+    SoftwareBitmap ToSoftwareBitmap(ImageView const& image)
+    {
+        // CreateCopyFromBuffer 要求各行紧密排列
+        const auto row_bytes = image.width * BytesPerPixel;
+        vector<uint8_t> packed(row_bytes * image.height);
+
+        for (uint32_t y = 0; y < image.height; y++)
+        {
+            memcpy(packed.data() + y * row_bytes, image.Row(y), row_bytes);
+        }
+
+        DataWriter writer;
+        writer.WriteBytes(packed);
+
+        return SoftwareBitmap::CreateCopyFromBuffer(
+            writer.DetachBuffer(),
+            BitmapPixelFormat::Bgra8,
+            image.width,
+            image.height,
+            BitmapAlphaMode::Premultiplied);
+    }
+
+    PixelBuffer ToPixelBuffer(SoftwareBitmap const& bitmap)
+    {
+        const auto buffer = bitmap.LockBuffer(BitmapBufferAccessMode::Read);
+        const auto plane = buffer.GetPlaneDescription(0);
+        const auto reference = buffer.CreateReference();
+
+        uint8_t* data = nullptr;
+        uint32_t capacity = 0;
+        check_hresult(reference.as<::Windows::Foundation::IMemoryBufferByteAccess>()->GetBuffer(&data, &capacity));
+
+        PixelBuffer pixels(static_cast<uint32_t>(plane.Width), static_cast<uint32_t>(plane.Height));
+        CopyPixels({ data + plane.StartIndex, pixels.Width(), pixels.Height(), static_cast<size_t>(plane.Stride) }, pixels.View());
+        return pixels;
+    }
+
+    /// <summary>
+    /// 把调度器的回调转换为 co_await，协程在工作线程上恢复
+    /// </summary>
+    struct ImageLoader::decode_awaiter
+    {
+        scheduler_type& scheduler;
+        wstring key;
+        LoadPriority priority;
+        scheduler_type::Job job;
+
+        shared_ptr<SoftwareBitmap const> result{};
+        exception_ptr error{};
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_suspend(std::experimental::coroutine_handle<> handle)
+        {
+            // 回调可能在 Submit 返回前就在工作线程上执行，之后不能再访问成员
+            scheduler.Submit(key, priority, move(job), [this, handle](shared_ptr<SoftwareBitmap const> const& bitmap, exception_ptr const& e)
+            {
+                result = bitmap;
+                error = e;
+                handle();
+            });
+        }
+
+        SoftwareBitmap await_resume() const
+        {
+            if (error)
+            {
+                rethrow_exception(error);
+            }
+
+            return *result;
+        }
+    };
+
+    ImageLoader& ImageLoader::Current()
+    {
+        // 有意不释放：应用由系统终止，避免退出时等待正在解码的工作线程
+        static auto* loader = new ImageLoader();
+        return *loader;
+    }
+
+    ImageLoader::decode_awaiter ImageLoader::decode_async(wstring key, LoadPriority priority, scheduler_type::Job job)
+    {
+        return { scheduler_, move(key), priority, move(job) };
+    }
+
+    IAsyncOperation<SoftwareBitmapSource> ImageLoader::LoadThumbnailAsync(StorageFile file, LoadPriority priority)
+    {
+        PE_TRACE_ASYNC_SCOPE("ImageLoader::LoadThumbnailAsync");
+
+        // 记住调用线程（界面线程）
+        apartment_context ui_thread;
+
+        // 跨越挂起点追踪：提交、解码、显示
+        const auto flow = PE_TRACE_NEW_FLOW_ID();
+        const auto bitmap = co_await decode_thumbnail_async(file, priority, flow);
+
+        // 回到界面线程，只把解码好的位图交给界面
+        co_await ui_thread;
+        PE_TRACE_FLOW_STEP("ImageLoader::present_thumbnail", flow);
+
+        SoftwareBitmapSource source{};
+        co_await source.SetBitmapAsync(bitmap);
+
+        co_return source;
+    }
+
+    IAsyncOperation<SoftwareBitmap> ImageLoader::LoadThumbnailBitmapAsync(StorageFile file, LoadPriority priority)
+    {
+        PE_TRACE_ASYNC_SCOPE("ImageLoader::LoadThumbnailBitmapAsync");
+
+        apartment_context ui_thread;
+        const auto flow = PE_TRACE_NEW_FLOW_ID();
+
+        auto bitmap = co_await decode_thumbnail_async(file, priority, flow);
+
+        co_await ui_thread;
+        co_return bitmap;
+    }
+
+    void ImageLoader::PrimeThumbnail(hstring const& path, ImageView const& pixels)
+    {
+        primed_thumbnails_.insert_or_assign(wstring(path), ToSoftwareBitmap(pixels));
+    }
+
+    SoftwareBitmap ImageLoader::TakePrimedThumbnail(hstring const& path)
+    {
+        if (primed_thumbnails_.empty())
+        {
+            return nullptr;
+        }
+
+        const auto found = primed_thumbnails_.find(wstring(path));
+
+        if (found == primed_thumbnails_.end())
+        {
+            return nullptr;
+        }
+
+        auto bitmap = move(found->second);
+        primed_thumbnails_.erase(found);
+        return bitmap;
+    }
+
+    ImageLoader::decode_awaiter ImageLoader::decode_thumbnail_async(StorageFile const& file, LoadPriority priority, uint64_t flow)
+    {
+        PE_TRACE_FLOW_STEP("ImageLoader::submit_thumbnail", flow);
+
+        return decode_async(key_of(file, L"thumbnail"), priority, [file, flow]
+        {
+            return decode_thumbnail(file, flow);
+        });
+    }
+
+    void ImageLoader::LoadPlaceholders()
+    {
+        const hstring path = ApplicationData::Current().LocalFolder().Path() + L"\\" + placeholders_file;
+        ifstream input(path.c_str());
+        placeholders_.Load(input);
+    }
+
+    void ImageLoader::SavePlaceholders() const
+    {
+        const hstring path = ApplicationData::Current().LocalFolder().Path() + L"\\" + placeholders_file;
+        ofstream output(path.c_str(), ios::trunc);
+        placeholders_.Save(output);
+    }
+
+    IAsyncOperation<SoftwareBitmap> ImageLoader::LoadImageAsync(StorageFile file, LoadPriority priority)
+    {
+        PE_TRACE_ASYNC_SCOPE("ImageLoader::LoadImageAsync");
+
+        // 记住调用线程（界面线程）
+        apartment_context ui_thread;
+
+        const auto flow = PE_TRACE_NEW_FLOW_ID();
+        PE_TRACE_FLOW_STEP("ImageLoader::submit_image", flow);
+
+        auto bitmap = co_await decode_async(key_of(file, L"image"), priority, [file, flow]
+        {
+            PE_TRACE_SCOPE_FLOW("ImageLoader::decode_image", flow);
+
+            // 创建流
+            const IRandomAccessStream stream{ file.OpenAsync(FileAccessMode::Read).get() };
+            return decode_bitmap(stream);
+        });
+
+        co_await ui_thread;
+        PE_TRACE_FLOW_STEP("ImageLoader::present_image", flow);
+
+        co_return bitmap;
+    }
+
+    SniffResult ImageLoader::ReadHeader(StorageFile const& file, uint64_t size_bytes, int64_t modified_time, optional<Placeholder>* placeholder)
+    {
+        PE_TRACE_SCOPE("ImageLoader::ReadHeader");
+
+        const auto path = to_string(file.Path());
+        SniffResult result;
+
+        // 负缓存中只有确定无效的文件
+        if (invalid_images_.Contains(path, size_bytes, modified_time))
+        {
+            result.definitive = true;
+            return result;
+        }
+
+        try
+        {
+            const auto stream = file.OpenReadAsync().get();
+            const auto read = read_from(stream);
+            result = SniffImage(read);
+
+            // 占位预览在扫描时就计算，只多读一次 EXIF 段，不用等略缩图解码
+            if (placeholder && result.valid)
+            {
+                *placeholder = placeholders_.Find(path, size_bytes, modified_time);
+
+                if (!*placeholder)
+                {
+                    try
+                    {
+                        *placeholder = LoadEmbeddedPlaceholder(read, result, &result.bytes_read);
+                    }
+                    catch (hresult_error const&)
+                    {
+                        // 读取失败时没有占位预览，识别结果仍然有效
+                    }
+
+                    if (*placeholder)
+                    {
+                        placeholders_.Add(path, size_bytes, modified_time, **placeholder);
+                    }
+                }
+            }
+
+            stream.Close();
+        }
+        catch (hresult_error const&)
+        {
+            // 打不开的文件可能只是暂时被占用，不记入负缓存
+            return {};
+        }
+
+        // 只记入确定的格式错误，读到的数据不够或者这里不支持的文件下次重新识别
+        if (!result.valid && result.definitive)
+        {
+            invalid_images_.Add(path, size_bytes, modified_time);
+        }
+
+        return result;
+    }
+
+    bool ImageLoader::IsKnownInvalid(StorageFile const& file, uint64_t size_bytes, int64_t modified_time) const
+    {
+        return invalid_images_.Contains(to_string(file.Path()), size_bytes, modified_time);
+    }
+
+    void ImageLoader::MarkInvalid(StorageFile const& file, uint64_t size_bytes, int64_t modified_time)
+    {
+        invalid_images_.Add(to_string(file.Path()), size_bytes, modified_time);
+    }
+
+    bool ImageLoader::IsFormatError(hresult_error const& error) noexcept
+    {
+        // 只有解码器确认数据有问题才算；打不开、被占用、没有权限等都可能只是暂时的
+        return HRESULT_FACILITY(error.code()) == FACILITY_WINCODEC_ERR;
+    }
+
+    void ImageLoader::LoadInvalidImages()
+    {
+        const hstring path = ApplicationData::Current().LocalFolder().Path() + L"\\" + invalid_images_file;
+        ifstream input(path.c_str());
+        invalid_images_.Load(input);
+    }
+
+    void ImageLoader::SaveInvalidImages() const
+    {
+        const hstring path = ApplicationData::Current().LocalFolder().Path() + L"\\" + invalid_images_file;
+        ofstream output(path.c_str(), ios::trunc);
+        invalid_images_.Save(output);
+    }
+}
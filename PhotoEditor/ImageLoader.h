@@ -0,0 +1,169 @@
+﻿/*
+ * 图片加载服务头文件
+ */
+
+#pragma once
+
+#include "Core/HeaderSniffer.h"
+#include "Core/LoadScheduler.h"
+#include "Core/PixelBuffer.h"
+#include "Core/Placeholder.h"
+
+#include <optional>
+#include <unordered_map>
+
+namespace winrt::PhotoEditor::implementation
+{
+	/// <summary>
+	/// 把 BGRA8 预乘像素复制为位图
+	/// </summary>
+	/// <param name="">像素</param>
+	/// <returns>BGRA8 预乘位图</returns>
+	Windows::Graphics::Imaging::SoftwareBitmap ToSoftwareBitmap(PhotoCore::ImageView const&);
+
+	/// <summary>
+	/// 把 BGRA8 位图的像素复制到缓冲区
+	/// </summary>
+	/// <param name="">位图</param>
+	/// <returns>像素</returns>
+	PhotoCore::PixelBuffer ToPixelBuffer(Windows::Graphics::Imaging::SoftwareBitmap const&);
+
+	/// <summary>
+	/// 全局图片加载服务。所有略缩图和原图都通过这里加载：
+	/// 按优先级排队，合并同一文件的并发请求，在工作线程上解码，只把解码好的位图交给界面线程。
+	/// </summary>
+	class ImageLoader
+	{
+	public:
+		/// <summary>
+		/// 获取全局实例
+		/// </summary>
+		/// <returns>加载服务</returns>
+		static ImageLoader& Current();
+
+		/// <summary>
+		/// 异步加载略缩图，在调用线程上完成
+		/// </summary>
+		/// <param name="">图片文件</param>
+		/// <param name="">优先级</param>
+		/// <returns>可直接显示的图片源</returns>
+		Windows::Foundation::IAsyncOperation<Windows::UI::Xaml::Media::Imaging::SoftwareBitmapSource> LoadThumbnailAsync(Windows::Storage::StorageFile, PhotoCore::LoadPriority);
+
+		/// <summary>
+		/// 异步加载略缩图的位图，在调用线程上完成。用于保存启动快照和渲染效果预览
+		/// </summary>
+		/// <param name="">图片文件</param>
+		/// <param name="">优先级</param>
+		/// <returns>BGRA8 预乘位图</returns>
+		Windows::Foundation::IAsyncOperation<Windows::Graphics::Imaging::SoftwareBitmap> LoadThumbnailBitmapAsync(Windows::Storage::StorageFile, PhotoCore::LoadPriority);
+
+		/// <summary>
+		/// 预先放入一张略缩图（例如来自启动快照），第一次显示这张图片时直接使用，不打开文件。
+		/// 只能在界面线程上调用
+		/// </summary>
+		/// <param name="">图片路径</param>
+		/// <param name="">BGRA8 预乘像素，会被复制</param>
+		void PrimeThumbnail(hstring const&, PhotoCore::ImageView const&);
+
+		/// <summary>
+		/// 取出预先放入的略缩图，没有时为空。只能在界面线程上调用
+		/// </summary>
+		/// <param name="">图片路径</param>
+		/// <returns>位图</returns>
+		Windows::Graphics::Imaging::SoftwareBitmap TakePrimedThumbnail(hstring const&);
+
+		/// <summary>
+		/// 异步解码原图，在调用线程上完成
+		/// </summary>
+		/// <param name="">图片文件</param>
+		/// <param name="">优先级</param>
+		/// <returns>解码后的位图</returns>
+		Windows::Foundation::IAsyncOperation<Windows::Graphics::Imaging::SoftwareBitmap> LoadImageAsync(Windows::Storage::StorageFile, PhotoCore::LoadPriority);
+
+		/// <summary>
+		/// 只读取文件头识别图片，在工作线程上调用。已知无效的文件直接返回无效，不读取；
+		/// 新发现的确定无效的文件记入负缓存。大小和修改时间是负缓存项和占位预览的版本，文件改变后重新识别
+		/// </summary>
+		/// <param name="">图片文件</param>
+		/// <param name="size_bytes">文件大小</param>
+		/// <param name="modified_time">修改时间</param>
+		/// <param name="placeholder">可选的输出：占位预览。缓存中有同一版本的直接使用，
+		/// 否则用同一个流从 JPEG 的内嵌略缩图计算并加入缓存；没有内嵌略缩图时为空</param>
+		/// <returns>识别结果</returns>
+		PhotoCore::SniffResult ReadHeader(Windows::Storage::StorageFile const&, uint64_t size_bytes, int64_t modified_time, std::optional<PhotoCore::Placeholder>* placeholder = nullptr);
+
+		/// <summary>
+		/// 文件是否已知无效
+		/// </summary>
+		/// <param name="">图片文件</param>
+		/// <param name="size_bytes">文件大小</param>
+		/// <param name="modified_time">修改时间</param>
+		/// <returns>是否在负缓存中</returns>
+		bool IsKnownInvalid(Windows::Storage::StorageFile const&, uint64_t size_bytes, int64_t modified_time) const;
+
+		/// <summary>
+		/// 解码失败后把文件记入负缓存，只应在 IsFormatError 的错误之后调用
+		/// </summary>
+		/// <param name="">图片文件</param>
+		/// <param name="size_bytes">文件大小</param>
+		/// <param name="modified_time">修改时间</param>
+		void MarkInvalid(Windows::Storage::StorageFile const&, uint64_t size_bytes, int64_t modified_time);
+
+		/// <summary>
+		/// 错误是否说明文件本身不是有效的图片（解码器报告的格式错误），而不是暂时无法读取
+		/// </summary>
+		/// <param name="">解码时的错误</param>
+		/// <returns>是否可以记入负缓存</returns>
+		static bool IsFormatError(hresult_error const&) noexcept;
+
+		/// <summary>
+		/// 从应用数据目录读取负缓存
+		/// </summary>
+		void LoadInvalidImages();
+
+		/// <summary>
+		/// 把负缓存写到应用数据目录
+		/// </summary>
+		void SaveInvalidImages() const;
+
+		/// <summary>
+		/// 从应用数据目录读取占位预览缓存
+		/// </summary>
+		void LoadPlaceholders();
+
+		/// <summary>
+		/// 把占位预览缓存写到应用数据目录
+		/// </summary>
+		void SavePlaceholders() const;
+
+		/// <summary>
+		/// 队列深度和等待时间计数器
+		/// </summary>
+		/// <returns>计数器快照</returns>
+		PhotoCore::LoadSchedulerCounters [[nodiscard]] Counters() const
+		{
+			return scheduler_.Counters();
+		}
+
+	private:
+		ImageLoader() = default;
+
+		using scheduler_type = PhotoCore::LoadScheduler<std::wstring, Windows::Graphics::Imaging::SoftwareBitmap>;
+
+		// 在工作线程上解码，完成后在工作线程上恢复协程
+		struct decode_awaiter;
+		decode_awaiter decode_async(std::wstring key, PhotoCore::LoadPriority priority, scheduler_type::Job job);
+		decode_awaiter decode_thumbnail_async(Windows::Storage::StorageFile const& file, PhotoCore::LoadPriority priority, uint64_t flow);
+
+		scheduler_type scheduler_;
+
+		// 预先放入的略缩图，按路径，取出后删除
+		std::unordered_map<std::wstring, Windows::Graphics::Imaging::SoftwareBitmap> primed_thumbnails_;
+
+		// 无效图片的负缓存，以文件大小和修改时间作为版本
+		PhotoCore::NegativeCache invalid_images_;
+
+		// 扫描时计算的占位预览，同样以文件大小和修改时间作为版本
+		PhotoCore::PlaceholderCache placeholders_;
+	};
+}
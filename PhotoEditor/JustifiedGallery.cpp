@@ -0,0 +1,370 @@
+﻿/*
+ * 按宽高比排列的图库网格代码
+ */
+
+#include "pch.h"
+#include "JustifiedGallery.h"
+#include "Core/Trace.h"
+
+#include <algorithm>
+#include <cstdint>
+
+using namespace winrt;
+using namespace std;
+using namespace Windows::Foundation;
+using namespace Windows::System;
+using namespace Windows::UI::Xaml;
+using namespace Windows::UI::Xaml::Automation;
+using namespace Windows::UI::Xaml::Controls;
+using namespace Windows::UI::Xaml::Data;
+using namespace Windows::UI::Xaml::Hosting;
+using namespace Windows::UI::Xaml::Input;
+using namespace Windows::UI::Xaml::Media;
+using namespace PhotoCore;
+
+namespace winrt::PhotoEditor::implementation
+{
+    namespace
+    {
+        // 目标行高和照片之间的间距，与原来固定大小的网格项相同
+        constexpr float row_height = 200;
+        constexpr float item_spacing = 8;
+
+        // Canvas 四周的留白
+        constexpr float side_padding = 12;
+
+        JustifiedLayoutOptions layout_options()
+        {
+            JustifiedLayoutOptions options;
+            options.row_height = row_height;
+            options.spacing = item_spacing;
+            return options;
+        }
+    }
+
+    JustifiedGallery::JustifiedGallery(ScrollViewer const& scroller, Canvas const& canvas, com_ptr<PhotoCollection> photos, RealizeHandler realize, ItemHandler click) :
+        scroller_(scroller),
+        canvas_(canvas),
+        photos_(move(photos)),
+        realize_(move(realize)),
+        click_(move(click)),
+        layout_(layout_options())
+    {
+        vector_changed_token_ = photos_->VectorChanged([this](auto&&, auto&&)
+        {
+            photos_changed();
+        });
+
+        view_changed_revoker_ = scroller_.ViewChanged(auto_revoke, [this](IInspectable const&, ScrollViewerViewChangedEventArgs const&)
+        {
+            update(scroller_.VerticalOffset());
+        });
+
+        size_changed_revoker_ = scroller_.SizeChanged(auto_revoke, [this](IInspectable const&, SizeChangedEventArgs const& args)
+        {
+            width_changed(args.NewSize().Width);
+        });
+
+        // 焦点在某张照片上时的按键冒泡到 Canvas。Tab 键只进入网格一次，网格内用方向键移动
+        key_down_revoker_ = canvas_.KeyDown(auto_revoke, [this](IInspectable const&, KeyRoutedEventArgs const& args)
+        {
+            key_down(args);
+        });
+
+        canvas_.TabFocusNavigation(KeyboardNavigationMode::Once);
+
+        layout_.Assign(aspects_of(0, photos_->Order().size()));
+        canvas_.Height(layout_.Height() + side_padding * 2);
+        update(scroller_.VerticalOffset());
+    }
+
+    JustifiedGallery::~JustifiedGallery()
+    {
+        photos_->VectorChanged(vector_changed_token_);
+
+        // 元素的点击事件引用了网格
+        canvas_.Children().Clear();
+    }
+
+    Image JustifiedGallery::ElementOf(PhotoEditor::Photo const& photo) const
+    {
+        if (!photo)
+        {
+            return nullptr;
+        }
+
+        const auto found = realized_.find(from_abi<Photo>(photo)->CatalogId());
+        return found == realized_.end() ? nullptr : found->second.element;
+    }
+
+    void JustifiedGallery::ScrollIntoView(PhotoEditor::Photo const& photo)
+    {
+        uint32_t index = 0;
+
+        if (!photo || !photos_->IndexOf(photo, index))
+        {
+            return;
+        }
+
+        const auto rect = layout_.ItemRect(index);
+        const auto viewport = scroller_.ViewportHeight();
+        auto top = scroller_.VerticalOffset();
+
+        // 已经完整可见时不滚动，否则让照片所在的行居中
+        if (rect.y + side_padding < top || rect.y + rect.height + side_padding > top + viewport)
+        {
+            top = max(0.0, rect.y + side_padding - (viewport - rect.height) / 2);
+            scroller_.ChangeView(nullptr, IReference<double>(top), nullptr, true);
+        }
+
+        // 滚动在下一帧才生效，先按目标位置创建元素，连接动画马上就能使用
+        update(top);
+    }
+
+    void JustifiedGallery::photos_changed()
+    {
+        PE_TRACE_SCOPE("JustifiedGallery::photos_changed");
+
+        // 图片集合给出改变的一段，扫描时追加和删除一段照片都只影响附近的几行
+        auto const& change = photos_->LastChange();
+        const auto count = photos_->Order().size();
+
+        if (change.index + change.removed <= layout_.Size() && layout_.Size() - change.removed + change.inserted == count)
+        {
+            const auto aspects = aspects_of(change.index, change.inserted);
+            layout_.Splice(change.index, change.removed, aspects.data(), aspects.size());
+        }
+        else
+        {
+            // 与布局对不上的通知（不应该出现）按全部替换处理
+            layout_.Assign(aspects_of(0, count));
+        }
+
+        canvas_.Height(layout_.Height() + side_padding * 2);
+        update(scroller_.VerticalOffset());
+    }
+
+    vector<float> JustifiedGallery::aspects_of(size_t first, size_t count) const
+    {
+        auto const& order = photos_->Order();
+        auto const& catalog = photos_->Catalog();
+
+        vector<float> aspects;
+        aspects.reserve(count);
+
+        for (auto i = first; i < first + count; i++)
+        {
+            aspects.push_back(JustifiedLayout::AspectRatio(catalog.Width(order[i]), catalog.Height(order[i])));
+        }
+
+        return aspects;
+    }
+
+    void JustifiedGallery::key_down(KeyRoutedEventArgs const& args)
+    {
+        const auto container = args.OriginalSource().try_as<Button>();
+        const auto photo = container ? container.DataContext().try_as<PhotoEditor::Photo>() : nullptr;
+        uint32_t index = 0;
+
+        if (!photo || !photos_->IndexOf(photo, index))
+        {
+            return;
+        }
+
+        // 翻页键移动大约一屏的行数
+        const auto page_rows = max<ptrdiff_t>(static_cast<ptrdiff_t>(scroller_.ViewportHeight() / (row_height + item_spacing)), 1);
+        const auto last = layout_.Size() - 1;
+        size_t target = index;
+
+        switch (args.Key())
+        {
+        case VirtualKey::Left:
+            target = index == 0 ? 0 : index - 1;
+            break;
+        case VirtualKey::Right:
+            target = min<size_t>(index + 1, last);
+            break;
+        case VirtualKey::Up:
+            target = layout_.VerticalNeighbor(index, -1);
+            break;
+        case VirtualKey::Down:
+            target = layout_.VerticalNeighbor(index, 1);
+            break;
+        case VirtualKey::PageUp:
+            target = layout_.VerticalNeighbor(index, -page_rows);
+            break;
+        case VirtualKey::PageDown:
+            target = layout_.VerticalNeighbor(index, page_rows);
+            break;
+        case VirtualKey::Home:
+            target = 0;
+            break;
+        case VirtualKey::End:
+            target = last;
+            break;
+        default:
+            return;
+        }
+
+        args.Handled(true);
+
+        if (target != index)
+        {
+            focus_item(target);
+        }
+    }
+
+    void JustifiedGallery::focus_item(size_t index)
+    {
+        const auto id = photos_->Order()[index];
+
+        // 目标可能还没有创建元素，先滚动过去
+        ScrollIntoView(photos_->Materialize(id));
+
+        if (const auto found = realized_.find(id); found != realized_.end())
+        {
+            found->second.container.Focus(FocusState::Keyboard);
+        }
+    }
+
+    void JustifiedGallery::width_changed(float width)
+    {
+        const auto available = max(width - side_padding * 2, 0.0f);
+
+        if (available == layout_.Width())
+        {
+            return;
+        }
+
+        layout_.SetWidth(available);
+        canvas_.Width(width);
+        canvas_.Height(layout_.Height() + side_padding * 2);
+        update(scroller_.VerticalOffset());
+    }
+
+    void JustifiedGallery::update(double top)
+    {
+        PE_TRACE_SCOPE("JustifiedGallery::update");
+
+        auto const& order = photos_->Order();
+        const auto viewport = scroller_.ViewportHeight();
+        const auto offset = top - side_padding;
+        const auto [first, last] = layout_.ItemsInRange(offset - viewport, offset + viewport * 2);
+        const auto [visible_first, visible_last] = layout_.ItemsInRange(offset, offset + viewport);
+
+        generation_++;
+
+        for (auto index = first; index < last; index++)
+        {
+            const auto rect = layout_.ItemRect(index);
+            auto found = realized_.find(order[index]);
+            auto created = false;
+
+            if (found == realized_.end())
+            {
+                const auto photo = photos_->Materialize(order[index]);
+                const auto container = take_container();
+                const auto element = container.Content().as<Image>();
+
+                // Image 也直接设置，realize 和点击时用它判断元素是否还在显示这张照片
+                container.DataContext(photo);
+                element.DataContext(photo);
+                AutomationProperties::SetName(container, photo.ImageTitle());
+
+                found = realized_.emplace(order[index], realized_item{ container, element, photo, 0, 0, 0 }).first;
+                created = true;
+            }
+
+            auto&& item = found->second;
+            item.generation = generation_;
+
+            Canvas::SetLeft(item.container, rect.x + side_padding);
+            Canvas::SetTop(item.container, rect.y + side_padding);
+            item.container.Width(rect.width);
+            item.container.Height(rect.height);
+
+            // 读屏软件读出“第几张，共几张”；Tab 键进入网格时按显示顺序
+            if (created || item.index != index || item.count != order.size())
+            {
+                item.index = index;
+                item.count = order.size();
+                item.container.TabIndex(static_cast<int32_t>(min<size_t>(index, INT32_MAX)));
+                AutomationProperties::SetPositionInSet(item.container, static_cast<int32_t>(min<size_t>(index + 1, INT32_MAX)));
+                AutomationProperties::SetSizeOfSet(item.container, static_cast<int32_t>(min<size_t>(order.size(), INT32_MAX)));
+            }
+
+            if (created)
+            {
+                realize_(item.container, item.element, item.photo);
+            }
+        }
+
+        // 离开缓冲范围的元素放回复用池
+        for (auto it = realized_.begin(); it != realized_.end();)
+        {
+            if (it->second.generation != generation_)
+            {
+                recycle(it->second);
+                it = realized_.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        photos_->RangesChanged(
+            ItemIndexRange(static_cast<int32_t>(visible_first), static_cast<uint32_t>(visible_last - visible_first)),
+            single_threaded_vector<ItemIndexRange>({ ItemIndexRange(static_cast<int32_t>(first), static_cast<uint32_t>(last - first)) }).GetView());
+
+        PE_TRACE_COUNTER("JustifiedGallery.Realized", realized_.size());
+    }
+
+    Button JustifiedGallery::take_container()
+    {
+        if (!pool_.empty())
+        {
+            auto container = move(pool_.back());
+            pool_.pop_back();
+            container.Visibility(Visibility::Visible);
+            return container;
+        }
+
+        Image element;
+        element.Stretch(Stretch::UniformToFill);
+
+        // 按钮只提供焦点、点击和自动化，外观就是照片本身
+        Button container;
+        container.Padding({});
+        container.BorderThickness({});
+        container.HorizontalContentAlignment(HorizontalAlignment::Stretch);
+        container.VerticalContentAlignment(VerticalAlignment::Stretch);
+        container.Content(element);
+
+        // 鼠标、触摸、回车、空格和 UI 自动化的 Invoke 都会引发 Click
+        container.Click([this](IInspectable const& sender, RoutedEventArgs const&)
+        {
+            const auto image = sender.as<Button>().Content().as<Image>();
+
+            if (const auto photo = image.DataContext().try_as<PhotoEditor::Photo>())
+            {
+                click_(image, photo);
+            }
+        });
+
+        canvas_.Children().Append(container);
+        return container;
+    }
+
+    void JustifiedGallery::recycle(realized_item const& item)
+    {
+        // 复用时移动到新的位置，不播放偏移动画
+        ElementCompositionPreview::GetElementVisual(item.container).ImplicitAnimations(nullptr);
+
+        item.container.Visibility(Visibility::Collapsed);
+        item.container.DataContext(nullptr);
+        item.element.Source(nullptr);
+        item.element.DataContext(nullptr);
+        pool_.push_back(item.container);
+    }
+}
@@ -0,0 +1,118 @@
+﻿/*
+ * 按宽高比排列的图库网格头文件
+ */
+
+#pragma once
+
+#include "PhotoCollection.h"
+#include "Core/JustifiedLayout.h"
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace winrt::PhotoEditor::implementation
+{
+	/// <summary>
+	/// 图库网格：在 ScrollViewer 内的 Canvas 上按 JustifiedLayout 排列照片，每行照片保持原来的宽高比。
+	/// 只为可见范围和上下各一屏内的照片创建元素，离开范围的元素放回复用池。
+	/// 每张照片是一个 Button，里面是显示略缩图的 Image：可以获得键盘焦点，回车、空格和 UI 自动化的 Invoke 都相当于点击，
+	/// 自动化名称是照片标题；方向键、Home/End 和翻页键按布局移动焦点。
+	/// 图片集合改变时按它给出的改变的一段交给布局重新断行；宽度改变时全部重新断行。
+	/// 可见和缓冲的范围通过 IItemsRangeInfo 告诉图片集合。只能在界面线程上使用
+	/// </summary>
+	class JustifiedGallery
+	{
+	public:
+		// 照片的 Image，元素可能来自复用池，DataContext 是它当前显示的照片
+		using ItemHandler = std::function<void(Windows::UI::Xaml::Controls::Image const&, PhotoEditor::Photo const&)>;
+		// 同上，另外给出放在 Canvas 上、移动位置的容器
+		using RealizeHandler = std::function<void(Windows::UI::Xaml::UIElement const&, Windows::UI::Xaml::Controls::Image const&, PhotoEditor::Photo const&)>;
+
+		/// <summary>
+		/// 构造函数
+		/// </summary>
+		/// <param name="scroller">滚动的容器</param>
+		/// <param name="canvas">放置照片的 Canvas，是 scroller 的内容</param>
+		/// <param name="photos">图片集合</param>
+		/// <param name="realize">元素开始显示一张照片时调用，加载占位预览和略缩图</param>
+		/// <param name="click">点击照片时调用</param>
+		JustifiedGallery(Windows::UI::Xaml::Controls::ScrollViewer const& scroller, Windows::UI::Xaml::Controls::Canvas const& canvas,
+			com_ptr<PhotoCollection> photos, RealizeHandler realize, ItemHandler click);
+		~JustifiedGallery();
+
+		JustifiedGallery(JustifiedGallery const&) = delete;
+		JustifiedGallery& operator=(JustifiedGallery const&) = delete;
+
+		/// <summary>
+		/// 正在显示这张照片的元素，不在缓冲范围内时为空
+		/// </summary>
+		/// <param name="photo">照片</param>
+		/// <returns></returns>
+		[[nodiscard]] Windows::UI::Xaml::Controls::Image ElementOf(PhotoEditor::Photo const& photo) const;
+
+		/// <summary>
+		/// 滚动到照片所在的行并立即创建它的元素
+		/// </summary>
+		/// <param name="photo">照片</param>
+		void ScrollIntoView(PhotoEditor::Photo const& photo);
+
+	private:
+		struct realized_item
+		{
+			Windows::UI::Xaml::Controls::Button container;
+			Windows::UI::Xaml::Controls::Image element;
+			PhotoEditor::Photo photo;
+			uint64_t generation;
+			// 上一次告诉 UI 自动化的位置和总数
+			size_t index;
+			size_t count;
+		};
+
+		void photos_changed();
+		void width_changed(float width);
+
+		/// <summary>
+		/// 显示顺序中 [first, first + count) 的照片的宽高比
+		/// </summary>
+		std::vector<float> aspects_of(size_t first, size_t count) const;
+
+		/// <summary>
+		/// 方向键、Home/End 和翻页键移动焦点
+		/// </summary>
+		void key_down(Windows::UI::Xaml::Input::KeyRoutedEventArgs const& args);
+
+		/// <summary>
+		/// 滚动到照片并让它获得键盘焦点
+		/// </summary>
+		/// <param name="index">照片的位置</param>
+		void focus_item(size_t index);
+
+		/// <summary>
+		/// 为 [top - 一屏, top + 两屏) 内的照片创建或者移动元素，回收其余的元素
+		/// </summary>
+		/// <param name="top">可见范围在 Canvas 中的纵坐标</param>
+		void update(double top);
+
+		Windows::UI::Xaml::Controls::Button take_container();
+		void recycle(realized_item const& item);
+
+		Windows::UI::Xaml::Controls::ScrollViewer scroller_;
+		Windows::UI::Xaml::Controls::Canvas canvas_;
+		com_ptr<PhotoCollection> photos_;
+		RealizeHandler realize_;
+		ItemHandler click_;
+
+		// 与图片集合的显示顺序一一对应
+		PhotoCore::JustifiedLayout layout_;
+
+		std::unordered_map<PhotoCore::PhotoId, realized_item> realized_;
+		std::vector<Windows::UI::Xaml::Controls::Button> pool_;
+		uint64_t generation_{ 0 };
+
+		event_token vector_changed_token_;
+		Windows::UI::Xaml::Controls::ScrollViewer::ViewChanged_revoker view_changed_revoker_;
+		Windows::UI::Xaml::FrameworkElement::SizeChanged_revoker size_changed_revoker_;
+		Windows::UI::Xaml::UIElement::KeyDown_revoker key_down_revoker_;
+	};
+}
@@ -5,8 +5,22 @@
 #include "pch.h"
 #include "MainPage.h"
 #include "Photo.h"
+#include "ImageLoader.h"
+#include "PicturesLibraryProvider.h"
+#include "StartupSnapshotStore.h"
+#include "Core/BufferPool.h"
+#include "Core/DirectoryWalker.h"
+#include "Core/ThreadPool.h"
+#include "Core/Trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <robuffer.h>
 
 using namespace winrt;
+using namespace Windows::ApplicationModel;
 using namespace Windows::Foundation;
 using namespace Windows::Foundation::Collections;
 using namespace Windows::Storage;
@@ -23,18 +37,74 @@ using namespace Windows::UI::Xaml::Media::Imaging;
 
 namespace winrt::PhotoEditor::implementation
 {
+    namespace
+    {
+        // 每批识别的文件数
+        constexpr uint32_t sniff_batch_size = 64;
+
+        // 扫描时合并通知网格的时间间隔
+        constexpr std::chrono::milliseconds flush_interval{ 250 };
+
+        // 启动快照保存的照片数，大约一屏
+        constexpr size_t snapshot_photos = 30;
+
+        // 扫描时跳过的文件中，已经从启动快照加入的
+        constexpr uint8_t already_shown = 2;
+
+        // 占位预览位图的大小，由网格项放大显示
+        constexpr uint32_t placeholder_width = 16;
+        constexpr uint32_t placeholder_height = 12;
+
+        /// <summary>
+        /// 扫描时读取文件头的线程池。读取文件头主要是同步等待 WinRT 的 I/O，
+        /// 不能占用处理像素的共享线程池，否则预览、导出和编码都要排队等待扫描
+        /// </summary>
+        /// <returns>线程池</returns>
+        PhotoCore::ThreadPool &sniff_pool()
+        {
+            // 有意不释放，与共享线程池相同
+            static auto *pool = new PhotoCore::ThreadPool(PhotoCore::DefaultWalkThreadCount());
+            return *pool;
+        }
+
+        /// <summary>
+        /// 把占位预览画成小位图，同步完成，网格项出现的同一帧就能显示
+        /// </summary>
+        /// <param name="placeholder">占位预览</param>
+        /// <returns>位图</returns>
+        WriteableBitmap placeholder_bitmap(PhotoCore::Placeholder const &placeholder)
+        {
+            const WriteableBitmap bitmap(placeholder_width, placeholder_height);
+
+            uint8_t *pixels = nullptr;
+            check_hresult(bitmap.PixelBuffer().as<::Windows::Storage::Streams::IBufferByteAccess>()->Buffer(&pixels));
+
+            PhotoCore::RenderPlaceholder(placeholder, { pixels, placeholder_width, placeholder_height, placeholder_width * PhotoCore::BytesPerPixel });
+            bitmap.Invalidate();
+            return bitmap;
+        }
+    }
+
     /// <summary>
     /// 构造函数
     /// </summary>
-    MainPage::MainPage() : photos_(winrt::single_threaded_observable_vector<IInspectable>()),
+    MainPage::MainPage() : photos_(winrt::make_self<PhotoCollection>()),
                            compositor_(Window::Current().Compositor())
     {
     	// 初始化组件
         InitializeComponent();
 
-        // 加载图片
+        // 网格跟随图片集合和滚动位置创建元素
+        gallery_ = std::make_unique<JustifiedGallery>(ForegroundElement(), ImageCanvas(), photos_,
+            [this](UIElement const &container, Image const &image, PhotoEditor::Photo const &item) { realize_item(container, image, item); },
+            [this](Image const &image, PhotoEditor::Photo const &item) { item_click(image, item); });
+
+        // 先显示上次的第一屏，再扫描图库
+        load_startup_snapshot();
         get_items_async();
 
+        suspending_revoker_ = Application::Current().Suspending(auto_revoke, { this, &MainPage::on_suspending });
+
     	// 设置视图源
         ParaView().Source(ForegroundElement());
     }
@@ -46,85 +116,130 @@ namespace winrt::PhotoEditor::implementation
     /// <returns></returns>
     IAsyncAction MainPage::on_navigated_to(NavigationEventArgs e)
     {
-        // 如果没有预加载则加载图片
-        if (photos().Size() == 0)
+        // 启动快照已经填充了图片集合时也需要动画
+        if (!element_implicit_animation_)
         {
             element_implicit_animation_ = compositor_.CreateImplicitAnimationCollection();
 
             // Define trigger and animation that should play when the trigger is triggered.
             element_implicit_animation_.Insert(L"Offset", create_offset_animation());
+        }
 
+        // 如果没有预加载则加载图片
+        if (photos().Size() == 0)
+        {
         	// 加载图片元素
             co_await get_items_async();
         }
     }
 
     /// <summary>
-    /// 容器内容改变时候的异步事件
+    /// 网格元素开始显示一张照片：先显示占位预览，再加载略缩图和标题。
+    /// 等待期间元素可能已经回收给别的照片，之后只在它仍然显示这张照片时更新
     /// </summary>
-    /// <param name="sender">委托者</param>
-    /// <param name="args">参数</param>
+    /// <param name="container">放在网格上的容器</param>
+    /// <param name="image">显示照片的元素</param>
+    /// <param name="item">照片</param>
     /// <returns></returns>
-    IAsyncAction MainPage::on_container_content_changing(ListViewBase sender, ContainerContentChangingEventArgs args)
+    fire_and_forget MainPage::realize_item(UIElement container, Image image, PhotoEditor::Photo item)
     {
-        // 获取元素视图
-        const auto element_visual = ElementCompositionPreview::GetElementVisual(args.ItemContainer());
-        // 获取图片
-    	const auto image = args.ItemContainer().ContentTemplateRoot().as<Image>();
+        // 等待期间页面可能已经离开，之后还要访问成员
+        const auto strong = get_strong();
+        const auto shows_item = [&] { return image.DataContext().try_as<PhotoEditor::Photo>() == item; };
 
-    	// 在回收队列中
-        if (args.InRecycleQueue())
+        // 将类型转换为图片
+        Photo *converted_photo_type = from_abi<Photo>(item);
+
+        // 先显示占位预览，没有时隐藏到略缩图加载完成
+        if (const auto placeholder = photos_->Catalog().FindPlaceholder(converted_photo_type->CatalogId()))
         {
-        	// 取消引用
-            element_visual.ImplicitAnimations(nullptr);
-            image.Source(nullptr);
+            image.Source(placeholder_bitmap(*placeholder));
+            image.Opacity(1);
         }
+        else
+        {
+            image.Opacity(0);
+        }
+
+        ToolTipService::SetToolTip(image, box_value(item.ImageTitle()));
 
-    	// 阶段0（隐藏图片）
-        if (args.Phase() == 0)
+        try
         {
-            //对每个元素添加隐藏动画
-            element_visual.ImplicitAnimations(element_implicit_animation_);
+            // 扫描时已经识别为无效的文件不再解码
+            if (!converted_photo_type->IsValid())
+            {
+                throw hresult_error(E_FAIL);
+            }
 
-        	// 回调
-            args.RegisterUpdateCallback([&](auto sender, auto args) {
-                on_container_content_changing(sender, args);
-            });
+            // 获取略缩图
+            const auto photo_small = co_await converted_photo_type->GetImageThumbnailAsync(PhotoCore::LoadPriority::Visible);
 
-        	// 设置句柄
-            args.Handled(true);
-        }
+            if (!shows_item())
+            {
+                co_return;
+            }
 
-    	// 阶段1（显示图片）
-        if (args.Phase() == 1)
-        {
+            // 设置显示的图片为略缩图
+            image.Source(photo_small);
+            image.Opacity(1);
 
-        	// 设置透明度为100，显示图片
-            image.Opacity(100);
+            // 元素已经放好，之后重新布局时平滑移动到新的位置；出现和复用时不会从原来的位置移过来
+            ElementCompositionPreview::GetElementVisual(container).ImplicitAnimations(element_implicit_animation_);
 
-            // 对元素拆箱
-            const auto item = unbox_value<PhotoEditor::Photo>(args.Item());
-            // 将类型转换为图片
-            Photo *converted_photo_type = from_abi<Photo>(item);
+            if (!first_paint_recorded_)
+            {
+                first_paint_recorded_ = true;
+                StartupSnapshotStore::RecordFirstPaint(started_from_snapshot_);
+            }
+        }
+        catch (winrt::hresult_error const& e)
+        {
+            // 解码器确认不是有效图片时记入负缓存，之后扫描时不再读取；
+            // 暂时打不开的文件只显示默认图片，下次出现时重试
+            if (converted_photo_type->IsValid() && ImageLoader::IsFormatError(e))
+            {
+                const auto id = converted_photo_type->CatalogId();
+                converted_photo_type->MarkInvalid();
+                photos_->Catalog().MarkInvalid(id);
+
+                // 文件本身打不开时没有 StorageFile，也就无法记入负缓存
+                if (const auto file = item.ImageFile())
+                {
+                    ImageLoader::Current().MarkInvalid(file, photos_->Catalog().SizeBytes(id), photos_->Catalog().ModifiedTime(id));
+                }
+            }
 
+            // 文件无法正常转换为Bitmap略缩图（也就是文件不是正常图片）
+            if (shows_item())
+            {
+                // 设置显示的图片为默认图片
+                const BitmapImage error_image{ Uri{ L"ms-appx:///Assets/StoreLogo.png" } };
+                image.Source(error_image);
+                image.Opacity(1);
+            }
+        }
+        catch (PhotoCore::LoadCancelled const &)
+        {
+            // 加载服务已经停止（应用正在退出），不再更新元素
+            co_return;
+        }
+
+        // 标题在显示时才读取
+        if (converted_photo_type->IsValid())
+        {
             try
             {
-            	// 获取略缩图
-                const auto photo_small = co_await converted_photo_type->GetImageThumbnailAsync();
-                // 设置显示的图片为略缩图
-            	image.Source(photo_small);
+                co_await converted_photo_type->LoadPropertiesAsync();
             }
-            catch (winrt::hresult_error)
+            catch (hresult_error const &)
             {
-            	// 文件无法正常转换为Bitmap略缩图（也就是文件不是正常图片）
-                const BitmapImage error_image{};
-
-            	// 默认图片的URI
-                const Uri error_image_uri{image.BaseUri().AbsoluteUri(), L"Assets/StoreLogo.png"};
+                // 读不到属性时提示保持为文件名
+                co_return;
+            }
 
-            	// 设置显示的图片为默认图片
-            	error_image.UriSource(error_image_uri);
-                image.Source(error_image);
+            if (shows_item())
+            {
+                ToolTipService::SetToolTip(image, box_value(item.ImageTitle()));
             }
         }
     }
@@ -138,13 +253,18 @@ namespace winrt::PhotoEditor::implementation
         // 运行动画
         if (selected_item_)
         {
-            ImageGridView().ScrollIntoView(selected_item_);
-        	// 创建动画并异步执行
+            gallery_->ScrollIntoView(selected_item_);
+        	// 创建动画并执行
             if (const auto animation = ConnectedAnimationService::GetForCurrentView().GetAnimation(L"backAnimation"); animation)
             {
-                co_await ImageGridView().TryStartConnectedAnimationAsync(animation, selected_item_, L"ItemImage");
+                if (const auto element = gallery_->ElementOf(selected_item_))
+                {
+                    animation.TryStart(element);
+                }
             }
         }
+
+        co_return;
     }
 
     // 注册属性改动事件句柄
@@ -162,40 +282,165 @@ namespace winrt::PhotoEditor::implementation
     // 从用户图库中加载图片
     IAsyncAction MainPage::get_items_async()
     {
+        PE_TRACE_ASYNC_SCOPE("MainPage::get_items_async");
+
         // 显示加载进度条
         LoadProgressIndicator().Visibility(Windows::UI::Xaml::Visibility::Visible);
         NoPicsText().Visibility(Windows::UI::Xaml::Visibility::Collapsed);
 
-        // 文件后缀名过滤
-        const QueryOptions options{};
-        // 设置扫描深度
-        options.FolderDepth(FolderDepth::Deep);
-        options.FileTypeFilter().Append(L".jpg");
-        options.FileTypeFilter().Append(L".png");
-        options.FileTypeFilter().Append(L".gif");
+        // 图片库包含的文件夹，由多个线程并行遍历
+        const auto library = co_await StorageLibrary::GetLibraryAsync(KnownLibraryId::Pictures);
+        const PicturesLibraryProvider provider(library.Folders().GetView());
+
+        auto &loader = ImageLoader::Current();
+        const apartment_context ui_thread;
 
-        // 从图库中获取图片
-        const auto result = KnownFolders::PicturesLibrary().CreateFileQueryWithOptions(options);
+        co_await resume_background();
+        loader.LoadInvalidImages();
+        loader.LoadPlaceholders();
 
-    	const auto &image_files = co_await result.GetFilesAsync();
-        auto has_unsupported_files = false;
+        // 遍历时就按后缀名过滤，每找到一批文件就读取文件头，深层的文件夹还在遍历时第一屏就能显示
+        PhotoCore::WalkOptions walk_options;
+        walk_options.batch_size = sniff_batch_size;
+        PhotoCore::DirectoryWalker walker(provider, {}, walk_options);
 
-        // 填充图片集合
-        for (auto &&file : image_files)
+        std::vector<PhotoCore::ScannedFile> found;
+        std::vector<uint8_t> skipped;
+
+        // 启动快照中已经修改过的照片，与扫描得到的新版本一起替换
+        std::vector<PhotoCore::PhotoId> replaced;
+        std::atomic<bool> has_unsupported_files{ false };
+
+        // 还没有交给网格的照片。第一批立即显示，之后按时间间隔合并，每次合并只通知网格一次
+        std::vector<PhotoCore::PhotoInfo> pending;
+        auto last_flush = std::chrono::steady_clock::now();
+        auto flushed = false;
+
+        while (walker.Next(found))
         {
-        	// 仅使用本机（computer）的填充，OneDrive和远程目录的图片不算在内
-            if (file.Provider().Id() == L"computer")
+            const auto offset = pending.size();
+            pending.resize(offset + found.size());
+            skipped.assign(found.size(), 0);
+
+            // 在后台只读取文件头，代替逐个文件读取图片属性
+            sniff_pool().ParallelFor(found.size(), [&](size_t first, size_t last)
             {
-                // 异步读取图片并添加
-                photos().Append(co_await load_image_info_async(file));
+                for (auto i = first; i < last; i++)
+                {
+                    StorageFile file{ nullptr };
+
+                    try
+                    {
+                        file = provider.TakeFile(found[i].path);
+                    }
+                    catch (hresult_error const &)
+                    {
+                        // 遍历之后被删除或者移走的文件
+                        skipped[i] = 1;
+                        continue;
+                    }
+
+                    // 仅使用本机（computer）的填充，OneDrive和远程目录的图片不算在内
+                    if (file.Provider().Id() != L"computer")
+                    {
+                        has_unsupported_files = true;
+                        skipped[i] = 1;
+                        continue;
+                    }
+
+                    auto &info = pending[offset + i];
+                    info.path = to_string(file.Path());
+
+                    // 启动快照中已经显示、之后没有修改过的照片
+                    if (const auto shown = snapshot_photos_.find(info.path); shown != snapshot_photos_.end()
+                        && shown->second.size_bytes == found[i].size_bytes
+                        && shown->second.modified_time == found[i].modified_time)
+                    {
+                        skipped[i] = already_shown;
+                        continue;
+                    }
+
+                    // 同时从内嵌略缩图计算占位预览，网格项出现时直接显示
+                    const auto header = loader.ReadHeader(file, found[i].size_bytes, found[i].modified_time, &info.placeholder);
+
+                    info.type = to_string(file.DisplayType());
+                    info.format = header.header.format;
+                    info.width = header.DisplayWidth();
+                    info.height = header.DisplayHeight();
+                    info.size_bytes = found[i].size_bytes;
+                    info.modified_time = found[i].modified_time;
+                    // 无法确定的文件（例如读取不完整）仍然交给解码器，显示时再判断
+                    info.valid = header.valid || !header.definitive;
+                }
+            });
+
+            // 去掉跳过的文件，保持遍历的顺序
+            size_t kept = offset;
+
+            for (size_t i = 0; i < found.size(); i++)
+            {
+                if (skipped[i] == already_shown)
+                {
+                    snapshot_photos_.erase(pending[offset + i].path);
+                }
+
+                if (!skipped[i])
+                {
+                    if (const auto stale = snapshot_photos_.find(pending[offset + i].path); stale != snapshot_photos_.end())
+                    {
+                        replaced.push_back(stale->second.id);
+                        snapshot_photos_.erase(stale);
+                    }
+
+                    if (kept != offset + i)
+                    {
+                        pending[kept] = std::move(pending[offset + i]);
+                    }
+
+                    kept++;
+                }
             }
-            else
+
+            pending.resize(kept);
+
+            const auto now = std::chrono::steady_clock::now();
+
+            if (!pending.empty() && (!flushed || now - last_flush >= flush_interval))
             {
-            	// 非本机图片，不受支持
-                has_unsupported_files = true;
+                co_await ui_thread;
+
+                // 填充图片集合，无效的文件也显示，以默认图片占位
+                photos_->Retire(replaced);
+                photos_->AddRange(pending);
+                replaced.clear();
+                pending.clear();
+                last_flush = now;
+                flushed = true;
+
+                co_await resume_background();
             }
         }
 
+        PE_TRACE_COUNTER("MainPage.Folders", walker.Stats().folders);
+        loader.SaveInvalidImages();
+        loader.SavePlaceholders();
+        co_await ui_thread;
+
+        photos_->Retire(replaced);
+        photos_->AddRange(pending);
+
+        // 启动快照中没有扫描到的照片已经被删除或者移走
+        std::vector<PhotoCore::PhotoId> missing;
+
+        for (auto &&[path, shown] : snapshot_photos_)
+        {
+            missing.push_back(shown.id);
+        }
+
+        photos_->Retire(missing);
+        snapshot_photos_.clear();
+        PE_TRACE_COUNTER("MainPage.Photos", photos().Size());
+
     	// 没有找到文件
         if (photos().Size() == 0)
         {
@@ -221,14 +466,50 @@ namespace winrt::PhotoEditor::implementation
     }
 
     /// <summary>
-    /// 从StorageFile创建Photo类型
+    /// 把启动快照中的照片加入图片集合，在扫描图库之前就能显示第一屏
+    /// </summary>
+    void MainPage::load_startup_snapshot()
+    {
+        PE_TRACE_SCOPE("MainPage::load_startup_snapshot");
+
+        const auto infos = StartupSnapshotStore::Load();
+
+        if (infos.empty())
+        {
+            return;
+        }
+
+        // 照片 ID 按加入目录的顺序分配
+        const auto first_id = static_cast<PhotoCore::PhotoId>(photos_->Catalog().Size());
+
+        for (size_t i = 0; i < infos.size(); i++)
+        {
+            snapshot_photos_.emplace(infos[i].path, snapshot_photo{ static_cast<PhotoCore::PhotoId>(first_id + i), infos[i].size_bytes, infos[i].modified_time });
+        }
+
+        photos_->AddRange(infos);
+        started_from_snapshot_ = true;
+    }
+
+    /// <summary>
+    /// 挂起时保存启动快照
     /// </summary>
-    /// <param name="file">存储文件</param>
-    /// <returns>Photo</returns>
-    IAsyncOperation<PhotoEditor::Photo> MainPage::load_image_info_async(StorageFile file)
+    /// <param name="">委托者</param>
+    /// <param name="args">参数</param>
+    /// <returns></returns>
+    fire_and_forget MainPage::on_suspending(IInspectable const &, SuspendingEventArgs const &args)
     {
-        auto properties = co_await file.Properties().GetImagePropertiesAsync();
-        co_return winrt::make<Photo>(properties, file, file.DisplayName(), file.DisplayType());
+        const auto strong = get_strong();
+        const auto deferral = args.SuspendingOperation().GetDeferral();
+
+        co_await StartupSnapshotStore::SaveAsync(photos_, snapshot_photos);
+
+        co_await resume_background();
+        ImageLoader::Current().SavePlaceholders();
+
+        // 挂起后空闲的像素缓冲区只会占用内存
+        PhotoCore::BufferPool::Shared().Trim();
+        deferral.Complete();
     }
 
     /// <summary>
@@ -256,16 +537,96 @@ namespace winrt::PhotoEditor::implementation
     }
 
     // 点击图片导航到详情页的事件
-    void MainPage::image_grid_view_item_click(IInspectable const sender, ItemClickEventArgs const e)
+    void MainPage::item_click(Image const &image, PhotoEditor::Photo const &item)
     {
+        PE_TRACE_SCOPE("MainPage::item_click");
+
         // 过渡动画
-        selected_item_ = e.ClickedItem().as<PhotoEditor::Photo>();
+        selected_item_ = item;
 
         // ReSharper disable once CppExpressionWithoutSideEffects
-        ImageGridView().PrepareConnectedAnimation(L"itemAnimation", e.ClickedItem(), L"ItemImage");
+        ConnectedAnimationService::GetForCurrentView().PrepareToAnimate(L"itemAnimation", image);
 
         const auto m_suppress = SuppressNavigationTransitionInfo();
-        Frame().Navigate(xaml_typename<PhotoEditor::DetailPage>(), e.ClickedItem(), m_suppress);
+        Frame().Navigate(xaml_typename<PhotoEditor::DetailPage>(), item, m_suppress);
+    }
+
+    /// <summary>
+    /// 选择排序方式。日期和像素从大到小，其他从小到大
+    /// </summary>
+    /// <param name="sender">菜单项，Tag 是排序键</param>
+    /// <param name="">参数</param>
+    void MainPage::sort_menu_item_click(IInspectable const &sender, RoutedEventArgs const &)
+    {
+        const auto tag = unbox_value<hstring>(sender.as<MenuFlyoutItem>().Tag());
+        auto key = PhotoCore::SortKey::Added;
+
+        if (tag == L"Title")
+        {
+            key = PhotoCore::SortKey::Title;
+        }
+        else if (tag == L"Date")
+        {
+            key = PhotoCore::SortKey::Date;
+        }
+        else if (tag == L"Megapixels")
+        {
+            key = PhotoCore::SortKey::Megapixels;
+        }
+        else if (tag == L"Width")
+        {
+            key = PhotoCore::SortKey::Width;
+        }
+        else if (tag == L"Height")
+        {
+            key = PhotoCore::SortKey::Height;
+        }
+        else if (tag == L"Type")
+        {
+            key = PhotoCore::SortKey::Type;
+        }
+
+        const auto descending = key == PhotoCore::SortKey::Date || key == PhotoCore::SortKey::Megapixels;
+        photos_->Arrange(photos_->Filter(), key, descending);
+    }
+
+    /// <summary>
+    /// 选择筛选条件，保持当前的排序方式
+    /// </summary>
+    /// <param name="sender">菜单项，Tag 是筛选条件</param>
+    /// <param name="">参数</param>
+    void MainPage::filter_menu_item_click(IInspectable const &sender, RoutedEventArgs const &)
+    {
+        const auto tag = unbox_value<hstring>(sender.as<MenuFlyoutItem>().Tag());
+        PhotoCore::PhotoFilter filter;
+
+        if (tag == L"Landscape")
+        {
+            filter.shape = PhotoCore::PhotoShape::Landscape;
+        }
+        else if (tag == L"Portrait")
+        {
+            filter.shape = PhotoCore::PhotoShape::Portrait;
+        }
+        else if (tag == L"Square")
+        {
+            filter.shape = PhotoCore::PhotoShape::Square;
+        }
+        else if (tag == L"Large")
+        {
+            filter.min_pixels = 12'000'000;
+        }
+
+        const auto key = photos_->CurrentSortKey();
+        photos_->Arrange(filter, key, key == PhotoCore::SortKey::Date || key == PhotoCore::SortKey::Megapixels);
+    }
+
+    /// <summary>
+    /// 搜索框的文本改变时按文件名和标题搜索
+    /// </summary>
+    void MainPage::search_box_text_changed(AutoSuggestBox const &sender, AutoSuggestBoxTextChangedEventArgs const &)
+    {
+        photos_->Search(to_string(sender.Text()));
     }
 
     /// <summary>
@@ -4,6 +4,12 @@
 
 #pragma once
 #include "MainPage.g.h"
+#include "JustifiedGallery.h"
+#include "PhotoCollection.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
 
 namespace winrt::PhotoEditor::implementation
 {
@@ -17,12 +23,11 @@ namespace winrt::PhotoEditor::implementation
 		/// <returns></returns>
 		Windows::Foundation::Collections::IVector<Windows::Foundation::IInspectable> [[nodiscard]] photos() const
 		{
-			return photos_;
+			return *photos_;
 		}
 
 		// 加载和渲染图片的事件句柄
 		Windows::Foundation::IAsyncAction on_navigated_to(Windows::UI::Xaml::Navigation::NavigationEventArgs);
-		Windows::Foundation::IAsyncAction on_container_content_changing(Windows::UI::Xaml::Controls::ListViewBase, Windows::UI::Xaml::Controls::ContainerContentChangingEventArgs);
 
 		// 从详情页导航回来的动画
 		Windows::Foundation::IAsyncAction start_connected_animation_for_back_navigation();
@@ -32,16 +37,47 @@ namespace winrt::PhotoEditor::implementation
 		void PropertyChanged(event_token const&);
 
 		// 事件句柄
-		void image_grid_view_item_click(Windows::Foundation::IInspectable const, Windows::UI::Xaml::Controls::ItemClickEventArgs const);
+		void sort_menu_item_click(Windows::Foundation::IInspectable const&, Windows::UI::Xaml::RoutedEventArgs const&);
+		void filter_menu_item_click(Windows::Foundation::IInspectable const&, Windows::UI::Xaml::RoutedEventArgs const&);
+		void search_box_text_changed(Windows::UI::Xaml::Controls::AutoSuggestBox const&, Windows::UI::Xaml::Controls::AutoSuggestBoxTextChangedEventArgs const&);
 
 	private:
 		// 加载图片和动画的函数
 		Windows::Foundation::IAsyncAction get_items_async();
+		void load_startup_snapshot();
+		fire_and_forget on_suspending(Windows::Foundation::IInspectable const&, Windows::ApplicationModel::SuspendingEventArgs const&);
 		Windows::UI::Composition::CompositionAnimationGroup create_offset_animation();
-		Windows::Foundation::IAsyncOperation<PhotoEditor::Photo> load_image_info_async(Windows::Storage::StorageFile);
 
-		// 图片集合字段
-		Windows::Foundation::Collections::IVector<IInspectable> photos_{ nullptr };
+		// 网格元素开始显示一张照片和点击照片
+		fire_and_forget realize_item(Windows::UI::Xaml::UIElement container, Windows::UI::Xaml::Controls::Image image, PhotoEditor::Photo item);
+		void item_click(Windows::UI::Xaml::Controls::Image const&, PhotoEditor::Photo const&);
+
+		// 图片集合字段，Photo 对象只为正在显示的项创建
+		com_ptr<PhotoCollection> photos_;
+
+		// 按宽高比排列照片的网格
+		std::unique_ptr<JustifiedGallery> gallery_;
+
+		/// <summary>
+		/// 启动快照中的照片和保存快照时文件的版本
+		/// </summary>
+		struct snapshot_photo
+		{
+			PhotoCore::PhotoId id;
+			uint64_t size_bytes;
+			int64_t modified_time;
+		};
+
+		// 启动快照中的照片，扫描到同一路径、同一版本时不再重复加入，版本不同时替换为扫描的结果；
+		// 扫描结束时仍在这里的照片已经不存在
+		std::unordered_map<std::string, snapshot_photo> snapshot_photos_;
+
+		// 是否从启动快照开始显示，是否已经记录第一张略缩图显示的时间
+		bool started_from_snapshot_{ false };
+		bool first_paint_recorded_{ false };
+
+		// 挂起时保存启动快照
+		Windows::UI::Xaml::Application::Suspending_revoker suspending_revoker_;
 
 		// 选中图片的字段
 		PhotoEditor::Photo selected_item_{ nullptr };
@@ -52,9 +88,6 @@ namespace winrt::PhotoEditor::implementation
 		// 页面Compositor字段
 		Windows::UI::Composition::Compositor compositor_{ nullptr };
 
-		// 事件
-		event<Windows::Foundation::TypedEventHandler<Windows::UI::Xaml::Controls::ListViewBase, Windows::UI::Xaml::Controls::ContainerContentChangingEventArgs>> handler_;
-
 		// 属性更改通知
 		void raise_property_changed(hstring const&);
 		event<Windows::UI::Xaml::Data::PropertyChangedEventHandler> property_changed_;
@@ -0,0 +1,100 @@
+﻿/*
+ * 图片元数据写入服务代码
+ */
+
+#include "pch.h"
+#include "MetadataWriter.h"
+#include "Core/Trace.h"
+
+using namespace winrt;
+using namespace std;
+using namespace Windows::Foundation;
+using namespace Windows::Storage;
+using namespace PhotoCore;
+
+namespace winrt::PhotoEditor::implementation
+{
+    MetadataWriter::MetadataWriter() :
+        queue_(
+            [this](wstring const& path, metadata const& value) { write(path, value); },
+            [this](wstring const& path, exception_ptr error) { report_failure(path, error); })
+    {
+    }
+
+    MetadataWriter& MetadataWriter::Current()
+    {
+        // 有意不释放：挂起时已经写完，应用由系统终止
+        static auto* writer = new MetadataWriter();
+        return *writer;
+    }
+
+    void MetadataWriter::WriteTitle(hstring const& path, hstring const& title)
+    {
+        queue_.Submit(wstring(path), { wstring(title) });
+    }
+
+    void MetadataWriter::OnFailures(function<void()> handler)
+    {
+        queue_.OnBatchWritten([handler = move(handler)](size_t, size_t failed)
+        {
+            if (failed != 0)
+            {
+                handler();
+            }
+        });
+    }
+
+    IAsyncAction MetadataWriter::FlushAsync()
+    {
+        PE_TRACE_ASYNC_SCOPE("MetadataWriter::FlushAsync");
+
+        co_await resume_background();
+        queue_.Flush();
+    }
+
+    vector<MetadataWriteFailure> MetadataWriter::TakeFailures()
+    {
+        lock_guard<mutex> lock(failures_mutex_);
+        return exchange(failures_, {});
+    }
+
+    void MetadataWriter::write(wstring const& path, metadata const& value)
+    {
+        PE_TRACE_SCOPE("MetadataWriter::write");
+
+        // 在后台线程上同步等待，同一批的文件依次写入
+        const auto file = StorageFile::GetFileFromPathAsync(path).get();
+        const auto properties = file.Properties().GetImagePropertiesAsync().get();
+
+        if (properties.Title() != value.title)
+        {
+            properties.Title(value.title);
+            properties.SavePropertiesAsync().get();
+        }
+    }
+
+    void MetadataWriter::report_failure(wstring const& path, exception_ptr error)
+    {
+        hstring message;
+
+        try
+        {
+            rethrow_exception(error);
+        }
+        catch (hresult_error const& e)
+        {
+            message = e.message();
+        }
+        catch (std::exception const& e)
+        {
+            message = to_hstring(e.what());
+        }
+        catch (...)
+        {
+            message = L"未知错误";
+        }
+
+        lock_guard<mutex> lock(failures_mutex_);
+        failures_.push_back({ hstring(path), message });
+    }
+}
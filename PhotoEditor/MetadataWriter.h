@@ -0,0 +1,91 @@
+﻿/*
+ * 图片元数据写入服务头文件
+ */
+
+#pragma once
+
+#include "Core/WriteBehindQueue.h"
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace winrt::PhotoEditor::implementation
+{
+	/// <summary>
+	/// 写入失败的记录
+	/// </summary>
+	struct MetadataWriteFailure
+	{
+		hstring path;
+		hstring message;
+	};
+
+	/// <summary>
+	/// 全局图片元数据写入服务。标题等属性的修改先在内存中生效，写入文件由这里延迟合并完成：
+	/// 同一个文件连续修改只写最后一次，安静一段时间后在后台线程上成批写入，失败时记录下来，
+	/// 一批写完之后通知界面。应用挂起时调用 FlushAsync 写完所有修改。
+	/// </summary>
+	class MetadataWriter
+	{
+	public:
+		/// <summary>
+		/// 获取全局实例
+		/// </summary>
+		/// <returns>写入服务</returns>
+		static MetadataWriter& Current();
+
+		/// <summary>
+		/// 排队写入图片标题
+		/// </summary>
+		/// <param name="">图片文件路径</param>
+		/// <param name="">标题</param>
+		void WriteTitle(hstring const&, hstring const&);
+
+		/// <summary>
+		/// 在后台线程上立即写入所有排队的修改，全部写完之后完成
+		/// </summary>
+		/// <returns></returns>
+		Windows::Foundation::IAsyncAction FlushAsync();
+
+		/// <summary>
+		/// 设置写入失败的通知：一批写完、其中有写入失败时在后台线程上调用，由界面取出失败记录显示
+		/// </summary>
+		/// <param name="">通知</param>
+		void OnFailures(std::function<void()>);
+
+		/// <summary>
+		/// 取出到目前为止写入失败的记录
+		/// </summary>
+		/// <returns>失败记录</returns>
+		std::vector<MetadataWriteFailure> TakeFailures();
+
+		/// <summary>
+		/// 合并和批次计数器
+		/// </summary>
+		/// <returns>计数器快照</returns>
+		PhotoCore::WriteBehindCounters [[nodiscard]] Counters() const
+		{
+			return queue_.Counters();
+		}
+
+	private:
+		MetadataWriter();
+
+		// 要写入一个文件的属性，目前只有标题
+		struct metadata
+		{
+			std::wstring title;
+		};
+
+		void write(std::wstring const& path, metadata const& value);
+		void report_failure(std::wstring const& path, std::exception_ptr error);
+
+		std::mutex failures_mutex_;
+		std::vector<MetadataWriteFailure> failures_;
+
+		// 最后声明，后台线程可能访问上面的成员
+		PhotoCore::WriteBehindQueue<std::wstring, metadata> queue_;
+	};
+}
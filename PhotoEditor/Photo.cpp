@@ -1,5 +1,8 @@
 ﻿#include "pch.h"
 #include "photo.h"
+#include "ImageLoader.h"
+#include "MetadataWriter.h"
+#include "Core/Trace.h"
 #include <sstream>
 
 using namespace winrt;
@@ -7,34 +10,74 @@ using namespace std;
 using namespace Windows::UI::Xaml;
 using namespace Windows::Storage;
 using namespace Windows::Foundation;
+using namespace Windows::Graphics::Imaging;
 using namespace Windows::UI::Xaml::Media::Imaging;
 using namespace Windows::Storage::Streams;
+using namespace PhotoCore;
 
 namespace winrt::PhotoEditor::implementation
 {
-    IAsyncOperation<BitmapImage> Photo::GetImageThumbnailAsync() const
+    IAsyncOperation<SoftwareBitmapSource> Photo::GetImageThumbnailAsync(LoadPriority priority)
     {
-        // 获取略缩图
-        const auto thumbnail = co_await image_file_.GetThumbnailAsync(FileProperties::ThumbnailMode::PicturesView);
-        
-        BitmapImage bitmap_image{};
-        
-        // 设置源为略缩图
-        bitmap_image.SetSource(thumbnail);
-        thumbnail.Close();
-        
-        co_return bitmap_image;
+        PE_TRACE_ASYNC_SCOPE("Photo::GetImageThumbnailAsync");
+
+        const auto strong = get_strong();
+
+        // 启动快照中已经有解码好的略缩图，不用打开文件
+        if (const auto primed = ImageLoader::Current().TakePrimedThumbnail(image_file_ ? image_file_.Path() : image_path_))
+        {
+            SoftwareBitmapSource source{};
+            co_await source.SetBitmapAsync(primed);
+            co_return source;
+        }
+
+        const auto file = co_await GetImageFileAsync();
+
+        // 由加载服务在工作线程上解码，同一图片的并发请求只解码一次
+        co_return co_await ImageLoader::Current().LoadThumbnailAsync(file, priority);
     }
 
-    IAsyncOperation<BitmapImage> Photo::GetImageSourceAsync() const
+    IAsyncOperation<SoftwareBitmap> Photo::GetThumbnailBitmapAsync(LoadPriority priority)
     {
-        // 创建流
-        const IRandomAccessStream stream{ co_await ImageFile().OpenAsync(FileAccessMode::Read) };
-        
-        const BitmapImage bitmap{};
-        bitmap.SetSource(stream);
-        
-        co_return bitmap;
+        PE_TRACE_ASYNC_SCOPE("Photo::GetThumbnailBitmapAsync");
+
+        const auto strong = get_strong();
+
+        if (const auto primed = ImageLoader::Current().TakePrimedThumbnail(image_file_ ? image_file_.Path() : image_path_))
+        {
+            co_return primed;
+        }
+
+        const auto file = co_await GetImageFileAsync();
+        co_return co_await ImageLoader::Current().LoadThumbnailBitmapAsync(file, priority);
+    }
+
+    IAsyncOperation<SoftwareBitmap> Photo::GetImageSourceAsync()
+    {
+        PE_TRACE_ASYNC_SCOPE("Photo::GetImageSourceAsync");
+
+        const auto strong = get_strong();
+        const auto file = co_await GetImageFileAsync();
+
+        // 原图总是当前要显示的内容
+        co_return co_await ImageLoader::Current().LoadImageAsync(file, LoadPriority::Visible);
+    }
+
+    IAsyncOperation<StorageFile> Photo::GetImageFileAsync()
+    {
+        if (!image_file_)
+        {
+            const auto strong = get_strong();
+            auto file = co_await StorageFile::GetFileFromPathAsync(image_path_);
+
+            // 等待期间可能已经被另一次调用打开了
+            if (!image_file_)
+            {
+                image_file_ = file;
+            }
+        }
+
+        co_return image_file_;
     }
 
     /// <summary>
@@ -46,7 +89,7 @@ namespace winrt::PhotoEditor::implementation
         // 创建字符串流
         wstringstream string_stream;
 
-        string_stream << image_properties_.Width() << " x " << image_properties_.Height();
+        string_stream << image_width_ << " x " << image_height_;
         const wstring str = string_stream.str();
         return static_cast<hstring>(str);
     }
@@ -57,11 +100,65 @@ namespace winrt::PhotoEditor::implementation
     /// <param name="value"></param>
     void Photo::ImageTitle(hstring const& value)
     {
+        // 属性还没有读取时先读取再保存
+        if (!image_properties_)
+        {
+            load_and_set_title_async(value);
+            return;
+        }
+
         if (image_properties_.Title() != value)
         {
+            // 内存中立即生效，写入文件由写入服务合并延迟完成
             image_properties_.Title(value);
-            auto ignore_result = image_properties_.SavePropertiesAsync();
+            MetadataWriter::Current().WriteTitle(image_file_ ? image_file_.Path() : image_path_, value);
             raise_property_changed(L"ImageTitle");
         }
     }
+
+    IAsyncAction Photo::LoadPropertiesAsync()
+    {
+        if (image_properties_)
+        {
+            co_return;
+        }
+
+        PE_TRACE_ASYNC_SCOPE("Photo::LoadPropertiesAsync");
+
+        const auto strong = get_strong();
+        const auto file = co_await GetImageFileAsync();
+        auto properties = co_await file.Properties().GetImagePropertiesAsync();
+
+        // 等待期间可能已经被另一次调用读取了
+        if (!image_properties_)
+        {
+            image_properties_ = properties;
+
+            if (image_properties_.Title() != L"")
+            {
+                raise_property_changed(L"ImageTitle");
+            }
+        }
+    }
+
+    /// <summary>
+    /// 读取属性之后再设置标题
+    /// </summary>
+    /// <param name="value"></param>
+    fire_and_forget Photo::load_and_set_title_async(hstring value)
+    {
+        const auto strong = get_strong();
+
+        try
+        {
+            co_await LoadPropertiesAsync();
+        }
+        catch (hresult_error const&)
+        {
+            // 文件已经不可用，标题无法保存
+            co_return;
+        }
+
+        ImageTitle(value);
+    }
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 ﻿#pragma once
 
 #include "Photo.g.h"
+#include "Core/LoadScheduler.h"
+#include "Core/PhotoCatalog.h"
 
 namespace winrt::PhotoEditor::implementation
 {
@@ -17,24 +19,62 @@ namespace winrt::PhotoEditor::implementation
 			image_properties_(props),
 			image_name_(name),
 			image_file_type_(type),
-			image_file_(image_file)
+			image_file_(image_file),
+			image_width_(props.Width()),
+			image_height_(props.Height())
+		{
+		}
+
+		/// <summary>
+		/// 从照片目录中的记录创建，文件和图片属性在需要时才读取
+		/// </summary>
+		Photo(
+			PhotoCore::PhotoId catalog_id,
+			hstring const& path,
+			hstring const& name,
+			hstring const& type,
+			uint32_t width,
+			uint32_t height,
+			bool valid
+		) :
+			catalog_id_(catalog_id),
+			image_path_(path),
+			image_name_(name),
+			image_file_type_(type),
+			image_width_(width),
+			image_height_(height),
+			valid_(valid)
 		{
 		}
 
 		/// <summary>
 		/// 异步获取图片略缩图
 		/// </summary>
+		/// <param name="priority">加载优先级</param>
 		/// <returns>略缩图</returns>
-		Windows::Foundation::IAsyncOperation<Windows::UI::Xaml::Media::Imaging::BitmapImage> [[nodiscard]] GetImageThumbnailAsync() const;
+		Windows::Foundation::IAsyncOperation<Windows::UI::Xaml::Media::Imaging::SoftwareBitmapSource> [[nodiscard]] GetImageThumbnailAsync(PhotoCore::LoadPriority priority = PhotoCore::LoadPriority::Visible);
+
+		/// <summary>
+		/// 异步获取图片略缩图的位图，用于在 CPU 上渲染效果预览
+		/// </summary>
+		/// <param name="priority">加载优先级</param>
+		/// <returns>BGRA8 预乘位图</returns>
+		Windows::Foundation::IAsyncOperation<Windows::Graphics::Imaging::SoftwareBitmap> [[nodiscard]] GetThumbnailBitmapAsync(PhotoCore::LoadPriority priority = PhotoCore::LoadPriority::Visible);
 
 		/// <summary>
 		/// 异步获取原图片
 		/// </summary>
-		/// <returns>图片源</returns>
-		Windows::Foundation::IAsyncOperation<Windows::UI::Xaml::Media::Imaging::BitmapImage> [[nodiscard]] GetImageSourceAsync() const;
+		/// <returns>解码后的位图</returns>
+		Windows::Foundation::IAsyncOperation<Windows::Graphics::Imaging::SoftwareBitmap> [[nodiscard]] GetImageSourceAsync();
 
 		/// <summary>
-		/// 图片文件属性
+		/// 异步获取图片文件，从照片目录创建时第一次调用才按路径打开
+		/// </summary>
+		/// <returns>图片文件</returns>
+		Windows::Foundation::IAsyncOperation<Windows::Storage::StorageFile> [[nodiscard]] GetImageFileAsync();
+
+		/// <summary>
+		/// 图片文件属性，从照片目录创建时在 GetImageFileAsync 之前为空
 		/// </summary>
 		/// <returns></returns>
 		Windows::Storage::StorageFile [[nodiscard]] ImageFile() const
@@ -43,7 +83,7 @@ namespace winrt::PhotoEditor::implementation
 		}
 
 		/// <summary>
-		/// 图片信息属性
+		/// 图片信息属性，用文件头识别创建时在 LoadPropertiesAsync 之前为空
 		/// </summary>
 		/// <returns></returns>
 		Windows::Storage::FileProperties::ImageProperties [[nodiscard]] ImageProperties() const
@@ -51,6 +91,56 @@ namespace winrt::PhotoEditor::implementation
 			return image_properties_;
 		}
 
+		/// <summary>
+		/// 读取图片属性（标题），只读取一次
+		/// </summary>
+		/// <returns></returns>
+		Windows::Foundation::IAsyncAction LoadPropertiesAsync();
+
+		/// <summary>
+		/// 转正后的图片宽度，与解码得到的位图一致
+		/// </summary>
+		/// <returns></returns>
+		uint32_t [[nodiscard]] ImageWidth() const
+		{
+			return image_width_;
+		}
+
+		/// <summary>
+		/// 转正后的图片高度
+		/// </summary>
+		/// <returns></returns>
+		uint32_t [[nodiscard]] ImageHeight() const
+		{
+			return image_height_;
+		}
+
+		/// <summary>
+		/// 是否是有效的图片，无效的图片不需要再尝试解码
+		/// </summary>
+		/// <returns></returns>
+		bool [[nodiscard]] IsValid() const
+		{
+			return valid_;
+		}
+
+		/// <summary>
+		/// 解码失败后标记为无效
+		/// </summary>
+		void MarkInvalid()
+		{
+			valid_ = false;
+		}
+
+		/// <summary>
+		/// 在照片目录中的 ID
+		/// </summary>
+		/// <returns></returns>
+		PhotoCore::PhotoId [[nodiscard]] CatalogId() const
+		{
+			return catalog_id_;
+		}
+
 		/// <summary>
 		/// 图片名称
 		/// </summary>
@@ -75,7 +165,7 @@ namespace winrt::PhotoEditor::implementation
 		/// <returns></returns>
 		hstring [[nodiscard]] ImageTitle() const
 		{
-			return image_properties_.Title() == L"" ? image_name_ : image_properties_.Title();
+			return !image_properties_ || image_properties_.Title() == L"" ? image_name_ : image_properties_.Title();
 		}
 
 		void ImageTitle(hstring const& value);
@@ -228,9 +318,14 @@ namespace winrt::PhotoEditor::implementation
 		// 文件和信息字段
 		Windows::Storage::FileProperties::ImageProperties image_properties_{ nullptr };
 		Windows::Storage::StorageFile image_file_{ nullptr };
+		PhotoCore::PhotoId catalog_id_{ 0 };
+		hstring image_path_;
 		hstring image_name_;
 		hstring image_file_type_;
 		hstring image_title_;
+		uint32_t image_width_{ 0 };
+		uint32_t image_height_{ 0 };
+		bool valid_{ true };
 
 		// 图片效果字段
 		float exposure_{ 0 };
@@ -258,6 +353,8 @@ namespace winrt::PhotoEditor::implementation
 			}
 		}
 
+		fire_and_forget load_and_set_title_async(hstring value);
+
 		void raise_property_changed(hstring const& property_name)
 		{
 			property_changed_(*this, Windows::UI::Xaml::Data::PropertyChangedEventArgs(property_name));
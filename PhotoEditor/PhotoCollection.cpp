@@ -0,0 +1,562 @@
+﻿/*
+ * 图库照片集合代码
+ */
+
+#include "pch.h"
+#include "PhotoCollection.h"
+#include "Core/Trace.h"
+
+#include <algorithm>
+
+using namespace winrt;
+using namespace std;
+using namespace Windows::Foundation;
+using namespace Windows::Foundation::Collections;
+using namespace Windows::UI::Xaml::Data;
+using namespace PhotoCore;
+
+namespace winrt::PhotoEditor::implementation
+{
+    namespace
+    {
+        // 最多保留的网格缓冲项数
+        constexpr size_t max_pinned = 1024;
+
+        /// <summary>
+        /// 集合变化的参数
+        /// </summary>
+        struct vector_changed_args : implements<vector_changed_args, IVectorChangedEventArgs>
+        {
+            vector_changed_args(Windows::Foundation::Collections::CollectionChange change, uint32_t index) noexcept :
+                change_(change),
+                index_(index)
+            {
+            }
+
+            Windows::Foundation::Collections::CollectionChange CollectionChange() const noexcept
+            {
+                return change_;
+            }
+
+            uint32_t Index() const noexcept
+            {
+                return index_;
+            }
+
+        private:
+            Windows::Foundation::Collections::CollectionChange change_;
+            uint32_t index_;
+        };
+
+        /// <summary>
+        /// 按位置遍历集合，每一项在取到时才创建
+        /// </summary>
+        struct photo_iterator : implements<photo_iterator, IIterator<IInspectable>>
+        {
+            explicit photo_iterator(com_ptr<PhotoCollection> collection) noexcept :
+                collection_(move(collection))
+            {
+            }
+
+            IInspectable Current() const
+            {
+                if (!HasCurrent())
+                {
+                    throw hresult_out_of_bounds();
+                }
+
+                return collection_->GetAt(index_);
+            }
+
+            bool HasCurrent() const noexcept
+            {
+                return index_ < collection_->Size();
+            }
+
+            bool MoveNext() noexcept
+            {
+                if (HasCurrent())
+                {
+                    index_++;
+                }
+
+                return HasCurrent();
+            }
+
+            uint32_t GetMany(array_view<IInspectable> items)
+            {
+                const auto count = collection_->GetMany(index_, items);
+                index_ += count;
+                return count;
+            }
+
+        private:
+            com_ptr<PhotoCollection> collection_;
+            uint32_t index_{ 0 };
+        };
+    }
+
+    PhotoId PhotoCollection::Add(PhotoInfo const& info)
+    {
+        const auto id = catalog_.Add(info);
+        index_.Update();
+        search_.Update();
+
+        // 有筛选、排序或者搜索时重新排列，新照片不一定在末尾
+        if (arranged_)
+        {
+            rearrange();
+            return id;
+        }
+
+        order_.push_back(id);
+
+        const auto index = static_cast<uint32_t>(order_.size() - 1);
+        raise_vector_changed(CollectionChange::ItemInserted, index, { index, 0, 1 });
+        return id;
+    }
+
+    void PhotoCollection::AddRange(vector<PhotoInfo> const& infos)
+    {
+        if (infos.empty())
+        {
+            return;
+        }
+
+        PE_TRACE_SCOPE("PhotoCollection::AddRange");
+
+        for (auto&& info : infos)
+        {
+            order_.push_back(catalog_.Add(info));
+        }
+
+        index_.Update();
+        search_.Update();
+
+        if (arranged_)
+        {
+            rearrange();
+            return;
+        }
+
+        const OrderChange change{ static_cast<uint32_t>(order_.size() - infos.size()), 0, static_cast<uint32_t>(infos.size()) };
+
+        // 只有一项时仍然按插入通知，网格不需要重新布局已有的项
+        if (infos.size() == 1)
+        {
+            raise_vector_changed(CollectionChange::ItemInserted, change.index, change);
+        }
+        else
+        {
+            raise_vector_changed(CollectionChange::Reset, 0, change);
+        }
+    }
+
+    void PhotoCollection::RemoveRange(uint32_t index, uint32_t count)
+    {
+        if (index > order_.size() || count > order_.size() - index)
+        {
+            throw hresult_out_of_bounds();
+        }
+
+        if (count == 0)
+        {
+            return;
+        }
+
+        order_.erase(order_.begin() + index, order_.begin() + index + count);
+
+        if (count == 1)
+        {
+            raise_vector_changed(CollectionChange::ItemRemoved, index, { index, 1, 0 });
+        }
+        else
+        {
+            raise_vector_changed(CollectionChange::Reset, 0, { index, count, 0 });
+        }
+    }
+
+    void PhotoCollection::Retire(vector<PhotoId> const& ids)
+    {
+        if (ids.empty())
+        {
+            return;
+        }
+
+        retired_.insert(ids.begin(), ids.end());
+
+        const auto is_retired = [this](PhotoId id) { return retired_.count(id) != 0; };
+        const auto first = find_if(order_.begin(), order_.end(), is_retired);
+
+        if (first == order_.end())
+        {
+            return;
+        }
+
+        // 改变的一段从第一张到最后一张不再显示的照片，中间仍然显示的照片算作重新插入
+        const auto last = find_if(order_.rbegin(), order_.rend(), is_retired).base();
+        const auto index = static_cast<uint32_t>(first - order_.begin());
+        const auto span = static_cast<uint32_t>(last - first);
+        const auto kept = static_cast<uint32_t>(remove_if(first, last, is_retired) - first);
+
+        order_.erase(order_.begin() + index + kept, last);
+        raise_vector_changed(CollectionChange::Reset, 0, { index, span, kept });
+    }
+
+    void PhotoCollection::ResetOrder(vector<PhotoId> order)
+    {
+        PE_TRACE_SCOPE("PhotoCollection::ResetOrder");
+
+        // 新旧顺序相同的开头和结尾不算改变，扫描时追加一批照片、筛选只去掉一段时网格只重新断行附近的几行
+        const auto common = min(order.size(), order_.size());
+        const auto prefix = static_cast<size_t>(mismatch(order_.begin(), order_.begin() + common, order.begin()).first - order_.begin());
+        size_t suffix = 0;
+
+        while (suffix < common - prefix && order_[order_.size() - 1 - suffix] == order[order.size() - 1 - suffix])
+        {
+            suffix++;
+        }
+
+        const OrderChange change{ static_cast<uint32_t>(prefix), static_cast<uint32_t>(order_.size() - prefix - suffix), static_cast<uint32_t>(order.size() - prefix - suffix) };
+
+        order_ = move(order);
+        raise_vector_changed(CollectionChange::Reset, 0, change);
+    }
+
+    void PhotoCollection::Arrange(PhotoFilter const& filter, PhotoCore::SortKey key, bool descending)
+    {
+        PE_TRACE_SCOPE("PhotoCollection::Arrange");
+
+        filter_ = filter;
+        sort_key_ = key;
+        descending_ = descending;
+        arranged_ = true;
+
+        // 筛选菜单给出的条件不带搜索结果，搜索仍然生效
+        if (!query_.empty())
+        {
+            filter_.ids = &search_ids_;
+        }
+
+        ResetOrder(query());
+    }
+
+    void PhotoCollection::Search(string const& query)
+    {
+        PE_TRACE_SCOPE("PhotoCollection::Search");
+
+        if (query == query_)
+        {
+            return;
+        }
+
+        query_ = query;
+        arranged_ = true;
+        rearrange();
+    }
+
+    PhotoEditor::Photo PhotoCollection::Materialize(PhotoId id)
+    {
+        if (const auto found = materialized_.find(id); found != materialized_.end())
+        {
+            if (auto photo = found->second.get())
+            {
+                return photo;
+            }
+        }
+
+        PE_TRACE_SCOPE("PhotoCollection::Materialize");
+
+        auto photo = make<Photo>(
+            id,
+            to_hstring(catalog_.Path(id)),
+            to_hstring(catalog_.Name(id)),
+            to_hstring(catalog_.Type(id)),
+            catalog_.Width(id),
+            catalog_.Height(id),
+            catalog_.IsValid(id));
+
+        // 网格项回收之后弱引用就过期了，数量翻倍时一起清理
+        if (materialized_.size() >= next_prune_)
+        {
+            for (auto it = materialized_.begin(); it != materialized_.end();)
+            {
+                it = it->second.get() ? next(it) : materialized_.erase(it);
+            }
+
+            next_prune_ = max<size_t>(64, materialized_.size() * 2);
+        }
+
+        // 标题在读取属性或者编辑之后才知道，改变时更新目录和索引
+        photo.PropertyChanged([weak = get_weak(), id](IInspectable const& sender, PropertyChangedEventArgs const& args)
+        {
+            if (args.PropertyName() != L"ImageTitle")
+            {
+                return;
+            }
+
+            if (auto strong = weak.get())
+            {
+                strong->title_changed(id, sender.as<PhotoEditor::Photo>());
+            }
+        });
+
+        materialized_[id] = make_weak(photo);
+        PE_TRACE_COUNTER("PhotoCollection.Materialized", materialized_.size());
+
+        return photo;
+    }
+
+    size_t PhotoCollection::MaterializedCount() const
+    {
+        return static_cast<size_t>(count_if(materialized_.begin(), materialized_.end(), [](auto&& entry)
+        {
+            return entry.second.get() != nullptr;
+        }));
+    }
+
+    uint32_t PhotoCollection::Size() const noexcept
+    {
+        return static_cast<uint32_t>(order_.size());
+    }
+
+    IInspectable PhotoCollection::GetAt(uint32_t index)
+    {
+        if (index >= order_.size())
+        {
+            throw hresult_out_of_bounds();
+        }
+
+        return Materialize(order_[index]);
+    }
+
+    bool PhotoCollection::IndexOf(IInspectable const& value, uint32_t& index) const
+    {
+        const auto photo = value.try_as<PhotoEditor::Photo>();
+
+        if (!photo)
+        {
+            return false;
+        }
+
+        const auto id = from_abi<Photo>(photo)->CatalogId();
+        const auto found = find(order_.begin(), order_.end(), id);
+
+        if (found == order_.end())
+        {
+            return false;
+        }
+
+        index = static_cast<uint32_t>(found - order_.begin());
+        return true;
+    }
+
+    uint32_t PhotoCollection::GetMany(uint32_t start_index, array_view<IInspectable> items)
+    {
+        if (start_index >= order_.size())
+        {
+            return 0;
+        }
+
+        const auto count = min(items.size(), static_cast<uint32_t>(order_.size() - start_index));
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            items[i] = Materialize(order_[start_index + i]);
+        }
+
+        return count;
+    }
+
+    IVectorView<IInspectable> PhotoCollection::GetView()
+    {
+        return *this;
+    }
+
+    void PhotoCollection::SetAt(uint32_t index, IInspectable const& value)
+    {
+        if (index >= order_.size())
+        {
+            throw hresult_out_of_bounds();
+        }
+
+        order_[index] = id_of(value);
+        raise_vector_changed(CollectionChange::ItemChanged, index, { index, 1, 1 });
+    }
+
+    void PhotoCollection::InsertAt(uint32_t index, IInspectable const& value)
+    {
+        if (index > order_.size())
+        {
+            throw hresult_out_of_bounds();
+        }
+
+        order_.insert(order_.begin() + index, id_of(value));
+        raise_vector_changed(CollectionChange::ItemInserted, index, { index, 0, 1 });
+    }
+
+    void PhotoCollection::Append(IInspectable const& value)
+    {
+        InsertAt(Size(), value);
+    }
+
+    void PhotoCollection::ReplaceAll(array_view<IInspectable const> items)
+    {
+        vector<PhotoId> order;
+        order.reserve(items.size());
+
+        for (auto&& item : items)
+        {
+            order.push_back(id_of(item));
+        }
+
+        ResetOrder(move(order));
+    }
+
+    void PhotoCollection::RemoveAt(uint32_t index)
+    {
+        if (index >= order_.size())
+        {
+            throw hresult_out_of_bounds();
+        }
+
+        order_.erase(order_.begin() + index);
+        raise_vector_changed(CollectionChange::ItemRemoved, index, { index, 1, 0 });
+    }
+
+    void PhotoCollection::RemoveAtEnd()
+    {
+        if (order_.empty())
+        {
+            throw hresult_out_of_bounds();
+        }
+
+        RemoveAt(Size() - 1);
+    }
+
+    void PhotoCollection::Clear()
+    {
+        const auto removed = static_cast<uint32_t>(order_.size());
+        order_.clear();
+        raise_vector_changed(CollectionChange::Reset, 0, { 0, removed, 0 });
+    }
+
+    IIterator<IInspectable> PhotoCollection::First()
+    {
+        return make<photo_iterator>(get_strong());
+    }
+
+    event_token PhotoCollection::VectorChanged(VectorChangedEventHandler<IInspectable> const& handler)
+    {
+        return vector_changed_.add(handler);
+    }
+
+    void PhotoCollection::VectorChanged(event_token const& token)
+    {
+        vector_changed_.remove(token);
+    }
+
+    void PhotoCollection::RangesChanged(ItemIndexRange const& visible_range, IVectorView<ItemIndexRange> const& tracked_items)
+    {
+        PE_TRACE_SCOPE("PhotoCollection::RangesChanged");
+
+        first_visible_ = static_cast<uint32_t>(max(visible_range.FirstIndex(), 0));
+
+        // 网格缓冲的项都已经创建过，这里只是换成强引用，保证来回滚动时不会重新创建
+        vector<PhotoEditor::Photo> pinned;
+
+        for (auto&& range : tracked_items)
+        {
+            const auto first = static_cast<uint32_t>(max(range.FirstIndex(), 0));
+            const auto last = min(first + range.Length(), Size());
+
+            for (auto index = first; index < last && pinned.size() < max_pinned; index++)
+            {
+                pinned.push_back(Materialize(order_[index]));
+            }
+        }
+
+        pinned_ = move(pinned);
+        PE_TRACE_COUNTER("PhotoCollection.Pinned", pinned_.size());
+    }
+
+    void PhotoCollection::Close()
+    {
+        pinned_.clear();
+    }
+
+    PhotoId PhotoCollection::id_of(IInspectable const& value) const
+    {
+        const auto photo = value.try_as<PhotoEditor::Photo>();
+
+        if (photo)
+        {
+            const auto id = from_abi<Photo>(photo)->CatalogId();
+
+            // 只接受本集合创建的对象，其他 Photo 的 ID 不属于这个目录
+            if (const auto found = materialized_.find(id); found != materialized_.end() && found->second.get() == photo)
+            {
+                return id;
+            }
+        }
+
+        throw hresult_invalid_argument(L"只能加入从本集合取得的照片");
+    }
+
+    void PhotoCollection::title_changed(PhotoId id, PhotoEditor::Photo const& photo)
+    {
+        const auto properties = from_abi<Photo>(photo)->ImageProperties();
+
+        if (!properties)
+        {
+            return;
+        }
+
+        const auto title = to_string(properties.Title());
+
+        if (title == catalog_.Title(id))
+        {
+            return;
+        }
+
+        catalog_.SetTitle(id, title);
+        index_.TitleChanged(id);
+
+        // 滚动时读取属性也会走到这里，不立即重新排列，下一次排序或者搜索时生效
+        search_.TitleChanged(id);
+    }
+
+    void PhotoCollection::rearrange()
+    {
+        if (query_.empty())
+        {
+            filter_.ids = nullptr;
+        }
+        else
+        {
+            search_ids_ = search_.Search(query_);
+            filter_.ids = &search_ids_;
+        }
+
+        ResetOrder(query());
+    }
+
+    vector<PhotoId> PhotoCollection::query() const
+    {
+        auto order = index_.Query(filter_, sort_key_, descending_);
+
+        if (!retired_.empty())
+        {
+            order.erase(remove_if(order.begin(), order.end(), [this](PhotoId id) { return retired_.count(id) != 0; }), order.end());
+        }
+
+        return order;
+    }
+
+    void PhotoCollection::raise_vector_changed(Windows::Foundation::Collections::CollectionChange change, uint32_t index, OrderChange const& order_change)
+    {
+        PE_TRACE_COUNTER("PhotoCollection.Notifications", ++notifications_);
+        last_change_ = order_change;
+        vector_changed_(*this, make<vector_changed_args>(change, index));
+    }
+}
@@ -0,0 +1,244 @@
+﻿/*
+ * 图库照片集合头文件
+ */
+
+#pragma once
+
+#include "Photo.h"
+#include "Core/CatalogIndex.h"
+#include "Core/PhotoCatalog.h"
+#include "Core/TrigramIndex.h"
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace winrt::PhotoEditor::implementation
+{
+	/// <summary>
+	/// 显示顺序的一次变化：从 index 开始的 removed 张照片换成了 inserted 张照片
+	/// </summary>
+	struct OrderChange
+	{
+		uint32_t index{ 0 };
+		uint32_t removed{ 0 };
+		uint32_t inserted{ 0 };
+	};
+
+	/// <summary>
+	/// 图库网格的数据源。只保存照片目录和显示顺序（每张照片一个 32 位 ID），
+	/// 网格取某一项时才创建 Photo 对象并以弱引用缓存：正在显示的网格项和详情页持有 Photo，
+	/// 它们释放之后对象随之销毁。批量修改只发出一次 Reset 通知；
+	/// 通过 IItemsRangeInfo 得知网格正在显示和缓冲的范围。只能在界面线程上使用。
+	/// </summary>
+	struct PhotoCollection : implements<PhotoCollection,
+		Windows::Foundation::Collections::IObservableVector<Windows::Foundation::IInspectable>,
+		Windows::Foundation::Collections::IVector<Windows::Foundation::IInspectable>,
+		Windows::Foundation::Collections::IVectorView<Windows::Foundation::IInspectable>,
+		Windows::Foundation::Collections::IIterable<Windows::Foundation::IInspectable>,
+		Windows::UI::Xaml::Data::IItemsRangeInfo,
+		Windows::Foundation::IClosable>
+	{
+		/// <summary>
+		/// 照片目录
+		/// </summary>
+		/// <returns></returns>
+		PhotoCore::PhotoCatalog& Catalog() noexcept
+		{
+			return catalog_;
+		}
+
+		PhotoCore::PhotoCatalog const& Catalog() const noexcept
+		{
+			return catalog_;
+		}
+
+		/// <summary>
+		/// 加入照片目录并添加到末尾
+		/// </summary>
+		/// <param name="info">照片信息</param>
+		/// <returns>照片 ID</returns>
+		PhotoCore::PhotoId Add(PhotoCore::PhotoInfo const& info);
+
+		/// <summary>
+		/// 批量加入照片目录并添加到末尾，只通知一次
+		/// </summary>
+		/// <param name="infos">照片信息</param>
+		void AddRange(std::vector<PhotoCore::PhotoInfo> const& infos);
+
+		/// <summary>
+		/// 从显示顺序中移除一段，照片仍然留在目录中。只通知一次
+		/// </summary>
+		/// <param name="index">起始位置</param>
+		/// <param name="count">个数</param>
+		void RemoveRange(uint32_t index, uint32_t count);
+
+		/// <summary>
+		/// 不再显示这些照片，之后排序和筛选也不会出现，例如启动快照中已经被删除的照片。只通知一次
+		/// </summary>
+		/// <param name="ids">照片 ID</param>
+		void Retire(std::vector<PhotoCore::PhotoId> const& ids);
+
+		/// <summary>
+		/// 替换整个显示顺序，用于排序和筛选。只通知一次
+		/// </summary>
+		/// <param name="order">照片 ID</param>
+		void ResetOrder(std::vector<PhotoCore::PhotoId> order);
+
+		/// <summary>
+		/// 按条件筛选并排序，之后加入的照片也按这个条件显示
+		/// </summary>
+		/// <param name="filter">筛选条件</param>
+		/// <param name="key">排序键</param>
+		/// <param name="descending">是否降序</param>
+		void Arrange(PhotoCore::PhotoFilter const& filter, PhotoCore::SortKey key, bool descending);
+
+		/// <summary>
+		/// 只显示文件名或者标题包含 query 的照片，和筛选条件同时生效。为空时取消搜索
+		/// </summary>
+		/// <param name="query">UTF-8 查询字符串</param>
+		void Search(std::string const& query);
+
+		/// <summary>
+		/// 当前的筛选条件
+		/// </summary>
+		/// <returns></returns>
+		PhotoCore::PhotoFilter const& Filter() const noexcept
+		{
+			return filter_;
+		}
+
+		/// <summary>
+		/// 当前的排序键
+		/// </summary>
+		/// <returns></returns>
+		PhotoCore::SortKey CurrentSortKey() const noexcept
+		{
+			return sort_key_;
+		}
+
+		/// <summary>
+		/// 当前的显示顺序
+		/// </summary>
+		/// <returns></returns>
+		std::vector<PhotoCore::PhotoId> const& Order() const noexcept
+		{
+			return order_;
+		}
+
+		/// <summary>
+		/// 最近一次通知对应的显示顺序变化，在 VectorChanged 的处理函数中读取。
+		/// IVectorChangedEventArgs 只有位置，批量修改以 Reset 通知时从这里得到改变的一段
+		/// </summary>
+		/// <returns></returns>
+		OrderChange const& LastChange() const noexcept
+		{
+			return last_change_;
+		}
+
+		/// <summary>
+		/// 网格最近一次报告的可见范围的第一项
+		/// </summary>
+		/// <returns></returns>
+		uint32_t FirstVisibleIndex() const noexcept
+		{
+			return first_visible_;
+		}
+
+		/// <summary>
+		/// 取得照片对象，已经存在时返回同一个对象
+		/// </summary>
+		/// <param name="id">照片 ID</param>
+		/// <returns>照片</returns>
+		PhotoEditor::Photo Materialize(PhotoCore::PhotoId id);
+
+		/// <summary>
+		/// 当前存在的照片对象数
+		/// </summary>
+		/// <returns></returns>
+		size_t MaterializedCount() const;
+
+		// IVectorView 和 IVector
+		uint32_t Size() const noexcept;
+		Windows::Foundation::IInspectable GetAt(uint32_t index);
+		bool IndexOf(Windows::Foundation::IInspectable const& value, uint32_t& index) const;
+		uint32_t GetMany(uint32_t start_index, array_view<Windows::Foundation::IInspectable> items);
+		Windows::Foundation::Collections::IVectorView<Windows::Foundation::IInspectable> GetView();
+
+		// 只能加入从本集合取得的 Photo，其他对象抛出 hresult_invalid_argument
+		void SetAt(uint32_t index, Windows::Foundation::IInspectable const& value);
+		void InsertAt(uint32_t index, Windows::Foundation::IInspectable const& value);
+		void Append(Windows::Foundation::IInspectable const& value);
+		void ReplaceAll(array_view<Windows::Foundation::IInspectable const> items);
+		void RemoveAt(uint32_t index);
+		void RemoveAtEnd();
+		void Clear();
+
+		// IIterable
+		Windows::Foundation::Collections::IIterator<Windows::Foundation::IInspectable> First();
+
+		// IObservableVector
+		event_token VectorChanged(Windows::Foundation::Collections::VectorChangedEventHandler<Windows::Foundation::IInspectable> const& handler);
+		void VectorChanged(event_token const& token);
+
+		// IItemsRangeInfo
+		void RangesChanged(Windows::UI::Xaml::Data::ItemIndexRange const& visible_range, Windows::Foundation::Collections::IVectorView<Windows::UI::Xaml::Data::ItemIndexRange> const& tracked_items);
+		void Close();
+
+	private:
+		// 照片目录和显示顺序
+		PhotoCore::PhotoCatalog catalog_;
+		std::vector<PhotoCore::PhotoId> order_;
+
+		// 排序索引和当前的排列方式，默认按加入顺序显示全部
+		PhotoCore::CatalogIndex index_{ catalog_ };
+		PhotoCore::PhotoFilter filter_;
+		PhotoCore::SortKey sort_key_{ PhotoCore::SortKey::Added };
+		bool descending_{ false };
+		bool arranged_{ false };
+
+		// 子串搜索索引和当前搜索的结果，搜索时 filter_.ids 指向 search_ids_
+		PhotoCore::TrigramIndex search_{ catalog_ };
+		std::string query_;
+		std::vector<PhotoCore::PhotoId> search_ids_;
+
+		// 不再显示的照片
+		std::unordered_set<PhotoCore::PhotoId> retired_;
+
+		// 已经创建的照片对象，过期的项在数量翻倍时清理
+		std::unordered_map<PhotoCore::PhotoId, weak_ref<PhotoEditor::Photo>> materialized_;
+		size_t next_prune_{ 64 };
+
+		// 网格正在显示和缓冲的照片，离开这些范围之后才释放
+		std::vector<PhotoEditor::Photo> pinned_;
+		uint32_t first_visible_{ 0 };
+
+		event<Windows::Foundation::Collections::VectorChangedEventHandler<Windows::Foundation::IInspectable>> vector_changed_;
+		OrderChange last_change_;
+		// 发出的通知次数，用于追踪
+		uint64_t notifications_{ 0 };
+
+		/// <summary>
+		/// 取得从本集合创建的照片的 ID
+		/// </summary>
+		PhotoCore::PhotoId id_of(Windows::Foundation::IInspectable const& value) const;
+
+		/// <summary>
+		/// 照片的标题改变之后更新目录和索引
+		/// </summary>
+		void title_changed(PhotoCore::PhotoId id, PhotoEditor::Photo const& photo);
+
+		/// <summary>
+		/// 重新搜索、筛选并排序
+		/// </summary>
+		void rearrange();
+
+		/// <summary>
+		/// 按当前的排列方式查询，去掉不再显示的照片
+		/// </summary>
+		std::vector<PhotoCore::PhotoId> query() const;
+
+		void raise_vector_changed(Windows::Foundation::Collections::CollectionChange change, uint32_t index, OrderChange const& order_change);
+	};
+}
@@ -0,0 +1,215 @@
+﻿/*
+ * 图片库的图库提供者代码
+ */
+
+#include "pch.h"
+#include "PicturesLibraryProvider.h"
+#include "Core/Trace.h"
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <fileapifromapp.h>
+
+using namespace winrt;
+using namespace std;
+using namespace Windows::Foundation;
+using namespace Windows::Foundation::Collections;
+using namespace Windows::Storage;
+using namespace Windows::Storage::Streams;
+using namespace PhotoCore;
+
+namespace winrt::PhotoEditor::implementation
+{
+    namespace
+    {
+        /// <summary>
+        /// 遍历用的路径转换为系统路径
+        /// </summary>
+        hstring native_path(string const& path)
+        {
+            wstring value(to_hstring(path));
+            replace(value.begin(), value.end(), L'/', L'\\');
+            return hstring(value);
+        }
+
+        /// <summary>
+        /// 系统路径转换为遍历用的路径
+        /// </summary>
+        string walk_path(hstring const& path)
+        {
+            auto value = to_string(path);
+            replace(value.begin(), value.end(), '\\', '/');
+            return value;
+        }
+
+        runtime_error to_runtime_error(hresult_error const& error)
+        {
+            return runtime_error(to_string(error.message()));
+        }
+
+        /// <summary>
+        /// 文件的大小和修改时间
+        /// </summary>
+        struct file_stamp
+        {
+            uint64_t size_bytes;
+            int64_t modified_time;
+        };
+
+        /// <summary>
+        /// 列出一次目录得到所有文件的大小和修改时间。目录项本身就带有这些信息，
+        /// 不经过属性系统，也不逐个访问文件。列不出时为空
+        /// </summary>
+        /// <param name="folder">系统路径</param>
+        /// <returns>按文件名</returns>
+        unordered_map<wstring, file_stamp> file_stamps(hstring const& folder)
+        {
+            unordered_map<wstring, file_stamp> stamps;
+            WIN32_FIND_DATAW data{};
+
+            const auto find = FindFirstFileExFromAppW((folder + L"\\*").c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+
+            if (find == INVALID_HANDLE_VALUE)
+            {
+                return stamps;
+            }
+
+            const unique_ptr<void, decltype(&FindClose)> closer(find, &FindClose);
+
+            do
+            {
+                if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+                {
+                    const auto size_bytes = static_cast<uint64_t>(data.nFileSizeHigh) << 32 | data.nFileSizeLow;
+                    const file_time modified{ static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32 | data.ftLastWriteTime.dwLowDateTime };
+
+                    stamps.emplace(data.cFileName, file_stamp{ size_bytes, winrt::clock::to_time_t(winrt::clock::from_file_time(modified)) });
+                }
+            } while (FindNextFileW(find, &data));
+
+            return stamps;
+        }
+    }
+
+    PicturesLibraryProvider::PicturesLibraryProvider(IVectorView<StorageFolder> const& folders)
+    {
+        for (auto&& folder : folders)
+        {
+            roots_.push_back(walk_path(folder.Path()));
+        }
+    }
+
+    vector<FileEntry> PicturesLibraryProvider::ListFolder(string const& folder) const
+    {
+        vector<FileEntry> entries;
+
+        if (folder.empty())
+        {
+            for (auto&& root : roots_)
+            {
+                entries.push_back({ root, true, 0, 0 });
+            }
+
+            return entries;
+        }
+
+        PE_TRACE_SCOPE("PicturesLibraryProvider::ListFolder");
+
+        try
+        {
+            const auto path = native_path(folder);
+            const auto storage_folder = StorageFolder::GetFolderFromPathAsync(path).get();
+            const auto items = storage_folder.GetItemsAsync().get();
+
+            // 大小和修改时间来自同一个目录的列表，不逐个读取基本属性
+            const auto stamps = file_stamps(path);
+            entries.reserve(items.Size());
+
+            for (auto&& item : items)
+            {
+                auto name = to_string(item.Name());
+
+                if (item.IsOfType(StorageItemTypes::Folder))
+                {
+                    entries.push_back({ move(name), true, 0, 0 });
+                    continue;
+                }
+
+                // 只保存会被扫描的文件
+                if (IsImageFileName(name))
+                {
+                    lock_guard<mutex> lock(files_mutex_);
+                    files_.insert_or_assign(JoinPath(folder, name), item.as<StorageFile>());
+                }
+
+                // 两次列出之间才出现的文件没有记录，大小和修改时间为 0
+                const auto stamp = stamps.find(wstring(item.Name()));
+                entries.push_back({ move(name), false, stamp == stamps.end() ? 0 : stamp->second.size_bytes, stamp == stamps.end() ? 0 : stamp->second.modified_time });
+            }
+        }
+        catch (hresult_error const& e)
+        {
+            throw to_runtime_error(e);
+        }
+
+        return entries;
+    }
+
+    size_t PicturesLibraryProvider::ReadBytes(string const& path, uint64_t offset, uint8_t* buffer, size_t size) const
+    {
+        try
+        {
+            const auto stream = find_file(path, false).OpenReadAsync().get();
+            const auto capacity = static_cast<uint32_t>(size);
+            const auto bytes = stream.GetInputStreamAt(offset).ReadAsync(Buffer{ capacity }, capacity, InputStreamOptions::None).get();
+            const auto count = bytes.Length();
+
+            DataReader::FromBuffer(bytes).ReadBytes(array_view<uint8_t>(buffer, buffer + count));
+            stream.Close();
+            return count;
+        }
+        catch (hresult_error const& e)
+        {
+            throw to_runtime_error(e);
+        }
+    }
+
+    bool PicturesLibraryProvider::IsLocal(string const& path) const
+    {
+        try
+        {
+            return find_file(path, false).Provider().Id() == L"computer";
+        }
+        catch (hresult_error const& e)
+        {
+            throw to_runtime_error(e);
+        }
+    }
+
+    StorageFile PicturesLibraryProvider::TakeFile(string const& path) const
+    {
+        return find_file(path, true);
+    }
+
+    StorageFile PicturesLibraryProvider::find_file(string const& path, bool take) const
+    {
+        {
+            lock_guard<mutex> lock(files_mutex_);
+
+            if (const auto found = files_.find(path); found != files_.end())
+            {
+                auto file = found->second;
+
+                if (take)
+                {
+                    files_.erase(found);
+                }
+
+                return file;
+            }
+        }
+
+        return StorageFile::GetFileFromPathAsync(native_path(path)).get();
+    }
+}
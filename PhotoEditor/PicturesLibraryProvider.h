@@ -0,0 +1,47 @@
+﻿/*
+ * 图片库的图库提供者头文件
+ */
+
+#pragma once
+
+#include "Core/LibraryProvider.h"
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace winrt::PhotoEditor::implementation
+{
+	/// <summary>
+	/// 通过 StorageFolder 访问系统图片库，供 DirectoryWalker 并行遍历。
+	/// 根目录列出图片库包含的各个文件夹，名称是用 '/' 分隔的完整路径，
+	/// 所以遍历得到的路径都是完整路径。WinRT 的错误转换为 std::runtime_error。
+	/// 列出目录时得到的图片文件对象先保存下来，读取文件头时用 TakeFile 取出，不必按路径重新打开。
+	/// 文件的大小和修改时间从 Win32 的目录列表中得到，不经过属性系统
+	/// </summary>
+	class PicturesLibraryProvider final : public PhotoCore::LibraryProvider
+	{
+	public:
+		explicit PicturesLibraryProvider(Windows::Foundation::Collections::IVectorView<Windows::Storage::StorageFolder> const& folders);
+
+		std::vector<PhotoCore::FileEntry> ListFolder(std::string const& folder) const override;
+		size_t ReadBytes(std::string const& path, uint64_t offset, uint8_t* buffer, size_t size) const override;
+		bool IsLocal(std::string const& path) const override;
+
+		/// <summary>
+		/// 取出遍历时得到的文件对象，没有时按路径打开
+		/// </summary>
+		/// <param name="path">遍历得到的路径</param>
+		/// <returns>图片文件</returns>
+		Windows::Storage::StorageFile TakeFile(std::string const& path) const;
+
+	private:
+		Windows::Storage::StorageFile find_file(std::string const& path, bool take) const;
+
+		std::vector<std::string> roots_;
+
+		mutable std::mutex files_mutex_;
+		mutable std::unordered_map<std::string, Windows::Storage::StorageFile> files_;
+	};
+}
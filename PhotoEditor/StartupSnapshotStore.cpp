@@ -0,0 +1,283 @@
+﻿/*
+ * 启动快照的保存和读取代码
+ */
+
+#include "pch.h"
+#include "StartupSnapshotStore.h"
+#include "ImageLoader.h"
+#include "Photo.h"
+#include "Core/StartupSnapshot.h"
+#include "Core/Trace.h"
+
+#include <algorithm>
+#include <fstream>
+
+using namespace winrt;
+using namespace std;
+using namespace Windows::Foundation;
+using namespace Windows::Graphics::Imaging;
+using namespace Windows::Storage;
+using namespace Windows::Storage::Streams;
+using namespace PhotoCore;
+
+namespace winrt::PhotoEditor::implementation
+{
+    namespace
+    {
+        constexpr wchar_t snapshot_file[] = L"startup-snapshot.bin";
+        constexpr wchar_t snapshot_temp_file[] = L"startup-snapshot.tmp";
+        constexpr wchar_t metrics_file[] = L"startup-metrics.tsv";
+
+        /// <summary>
+        /// 只读映射的文件，打不开时为空
+        /// </summary>
+        class mapped_file
+        {
+        public:
+            explicit mapped_file(hstring const& path)
+            {
+                file_ = CreateFile2(path.c_str(), GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, nullptr);
+
+                if (file_ == INVALID_HANDLE_VALUE)
+                {
+                    return;
+                }
+
+                LARGE_INTEGER size{};
+
+                if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0)
+                {
+                    return;
+                }
+
+                mapping_ = CreateFileMappingFromApp(file_, nullptr, PAGE_READONLY, 0, nullptr);
+
+                if (!mapping_)
+                {
+                    return;
+                }
+
+                data_ = static_cast<uint8_t const*>(MapViewOfFileFromApp(mapping_, FILE_MAP_READ, 0, 0));
+                size_ = data_ ? static_cast<size_t>(size.QuadPart) : 0;
+            }
+
+            mapped_file(mapped_file const&) = delete;
+            mapped_file& operator=(mapped_file const&) = delete;
+
+            ~mapped_file()
+            {
+                if (data_)
+                {
+                    UnmapViewOfFile(data_);
+                }
+
+                if (mapping_)
+                {
+                    CloseHandle(mapping_);
+                }
+
+                if (file_ != INVALID_HANDLE_VALUE)
+                {
+                    CloseHandle(file_);
+                }
+            }
+
+            uint8_t const* data() const noexcept
+            {
+                return data_;
+            }
+
+            size_t size() const noexcept
+            {
+                return size_;
+            }
+
+        private:
+            HANDLE file_{ INVALID_HANDLE_VALUE };
+            HANDLE mapping_{ nullptr };
+            uint8_t const* data_{ nullptr };
+            size_t size_{ 0 };
+        };
+
+        /// <summary>
+        /// 解码一张照片的略缩图，失败时为空
+        /// </summary>
+        /// <param name="photo">照片</param>
+        /// <returns>BGRA8 预乘位图</returns>
+        IAsyncOperation<SoftwareBitmap> load_thumbnail_async(PhotoEditor::Photo photo)
+        {
+            try
+            {
+                const auto file = co_await from_abi<Photo>(photo)->GetImageFileAsync();
+                co_return co_await ImageLoader::Current().LoadThumbnailBitmapAsync(file, LoadPriority::Visible);
+            }
+            catch (hresult_error const&)
+            {
+                co_return nullptr;
+            }
+        }
+
+        /// <summary>
+        /// 复制位图的像素，各行紧密排列
+        /// </summary>
+        /// <param name="bitmap">BGRA8 预乘位图</param>
+        /// <returns>像素</returns>
+        vector<uint8_t> copy_pixels(SoftwareBitmap const& bitmap)
+        {
+            const auto size = static_cast<uint32_t>(bitmap.PixelWidth()) * static_cast<uint32_t>(bitmap.PixelHeight()) * BytesPerPixel;
+            Buffer buffer(size);
+            buffer.Length(size);
+            bitmap.CopyToBuffer(buffer);
+
+            vector<uint8_t> pixels(size);
+            DataReader::FromBuffer(buffer).ReadBytes(pixels);
+            return pixels;
+        }
+    }
+
+    vector<PhotoInfo> StartupSnapshotStore::Load()
+    {
+        PE_TRACE_SCOPE("StartupSnapshotStore::Load");
+
+        vector<PhotoInfo> infos;
+        const hstring path = ApplicationData::Current().LocalFolder().Path() + L"\\" + snapshot_file;
+        const mapped_file mapped(path);
+
+        if (!mapped.data())
+        {
+            return infos;
+        }
+
+        try
+        {
+            // 略缩图复制为位图之后就不再需要映射
+            const StartupSnapshot snapshot(mapped.data(), mapped.size());
+            auto& loader = ImageLoader::Current();
+
+            infos.reserve(snapshot.Size());
+
+            for (size_t i = 0; i < snapshot.Size(); i++)
+            {
+                auto info = snapshot.Info(i);
+
+                if (const auto thumbnail = snapshot.Thumbnail(i); thumbnail.pixels)
+                {
+                    loader.PrimeThumbnail(to_hstring(info.path), thumbnail);
+                }
+
+                infos.push_back(move(info));
+            }
+        }
+        catch (std::exception const&)
+        {
+            // 格式不对的快照当作没有，下次挂起时覆盖
+            infos.clear();
+        }
+        catch (hresult_error const&)
+        {
+            infos.clear();
+        }
+
+        PE_TRACE_COUNTER("StartupSnapshot.Photos", infos.size());
+        return infos;
+    }
+
+    IAsyncAction StartupSnapshotStore::SaveAsync(com_ptr<PhotoCollection> photos, size_t count)
+    {
+        PE_TRACE_ASYNC_SCOPE("StartupSnapshotStore::SaveAsync");
+
+        // 先复制要保存的 ID，等待解码期间显示顺序可能改变
+        auto&& order = photos->Order();
+        const auto first = min<size_t>(photos->FirstVisibleIndex(), order.size());
+        const vector<PhotoId> ids(order.begin() + first, order.begin() + min(order.size(), first + count));
+
+        if (ids.empty())
+        {
+            co_return;
+        }
+
+        vector<SnapshotPhoto> snapshot(ids.size());
+        vector<IAsyncOperation<SoftwareBitmap>> loads(ids.size());
+
+        // 同时提交所有略缩图，由加载服务并行解码
+        for (size_t i = 0; i < ids.size(); i++)
+        {
+            snapshot[i].info = photos->Catalog().Get(ids[i]);
+
+            if (snapshot[i].info.valid)
+            {
+                loads[i] = load_thumbnail_async(photos->Materialize(ids[i]));
+            }
+        }
+
+        vector<SoftwareBitmap> bitmaps(ids.size(), nullptr);
+
+        for (size_t i = 0; i < ids.size(); i++)
+        {
+            if (loads[i])
+            {
+                bitmaps[i] = co_await loads[i];
+            }
+        }
+
+        const auto folder = ApplicationData::Current().LocalFolder();
+        const hstring temp_path = folder.Path() + L"\\" + snapshot_temp_file;
+
+        co_await resume_background();
+
+        vector<vector<uint8_t>> pixels(ids.size());
+
+        for (size_t i = 0; i < ids.size(); i++)
+        {
+            if (!bitmaps[i])
+            {
+                continue;
+            }
+
+            const auto width = static_cast<uint32_t>(bitmaps[i].PixelWidth());
+            pixels[i] = copy_pixels(bitmaps[i]);
+            snapshot[i].thumbnail = { pixels[i].data(), width, static_cast<uint32_t>(bitmaps[i].PixelHeight()), width * BytesPerPixel };
+        }
+
+        try
+        {
+            // 先写临时文件再替换，写到一半被终止时原来的快照仍然完整
+            {
+                ofstream output(temp_path.c_str(), ios::binary | ios::trunc);
+                WriteStartupSnapshot(output, snapshot);
+            }
+
+            const auto temp = co_await folder.GetFileAsync(snapshot_temp_file);
+            co_await temp.RenameAsync(snapshot_file, NameCollisionOption::ReplaceExisting);
+        }
+        catch (std::exception const&)
+        {
+        }
+        catch (hresult_error const&)
+        {
+        }
+    }
+
+    void StartupSnapshotStore::RecordFirstPaint(bool from_snapshot)
+    {
+        // 从进程创建开始计时，包括应用激活和创建页面的时间
+        FILETIME created{};
+        FILETIME unused{};
+        FILETIME now{};
+        GetProcessTimes(GetCurrentProcess(), &created, &unused, &unused, &unused);
+        GetSystemTimeAsFileTime(&now);
+
+        const auto ticks = [](FILETIME const& time)
+        {
+            return static_cast<int64_t>(time.dwHighDateTime) << 32 | time.dwLowDateTime;
+        };
+
+        // FILETIME 以 100 纳秒为单位
+        const auto milliseconds = static_cast<double>(ticks(now) - ticks(created)) / 10000.0;
+        PE_TRACE_COUNTER("Startup.FirstPaintMs", milliseconds);
+
+        const hstring path = ApplicationData::Current().LocalFolder().Path() + L"\\" + metrics_file;
+        ofstream output(path.c_str(), ios::app);
+        output << milliseconds << '\t' << (from_snapshot ? "snapshot" : "scan") << '\n';
+    }
+}
@@ -0,0 +1,43 @@
+﻿/*
+ * 启动快照的保存和读取头文件
+ */
+
+#pragma once
+
+#include "PhotoCollection.h"
+#include "Core/LibraryScanner.h"
+
+#include <vector>
+
+namespace winrt::PhotoEditor::implementation
+{
+	/// <summary>
+	/// 启动快照保存在 LocalFolder\startup-snapshot.bin。应用挂起时保存网格当前位置开始的一屏照片，
+	/// 下次启动时映射这个文件，在扫描图库之前显示第一屏：照片信息直接加入集合，
+	/// 略缩图交给 ImageLoader 预先准备，显示时不用打开文件解码。
+	/// 启动到第一张略缩图显示的时间追加到 LocalFolder\startup-metrics.tsv。只能在界面线程上使用
+	/// </summary>
+	class StartupSnapshotStore
+	{
+	public:
+		/// <summary>
+		/// 读取上次保存的快照并预先准备略缩图。没有快照或者快照无效时返回空
+		/// </summary>
+		/// <returns>照片信息，按上次显示的顺序</returns>
+		static std::vector<PhotoCore::PhotoInfo> Load();
+
+		/// <summary>
+		/// 保存网格当前可见的第一项开始的照片，在后台线程上写文件。失败时保留原来的快照
+		/// </summary>
+		/// <param name="photos">图片集合</param>
+		/// <param name="count">最多保存的照片数</param>
+		/// <returns></returns>
+		static Windows::Foundation::IAsyncAction SaveAsync(com_ptr<PhotoCollection> photos, size_t count);
+
+		/// <summary>
+		/// 记录从进程启动到第一张略缩图显示的时间
+		/// </summary>
+		/// <param name="from_snapshot">是否来自启动快照</param>
+		static void RecordFirstPaint(bool from_snapshot);
+	};
+}